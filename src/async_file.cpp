@@ -0,0 +1,173 @@
+#include "async_file.h"
+
+#include <cassert>
+#include <iostream>
+#include <malloc.h>
+
+#include "metrics.h"
+#include "synchronized_ostream.h"
+#include "util.h"
+
+namespace app {
+
+namespace {
+
+// The buffers go round a ring of their number. Chunks, at most one per buffer, never wait, the
+// markers of next() only while the writer is that far behind: dropping one would send every later
+// segment to the wrong file.
+template <typename T, size_t N>
+void push(mpsc_ring<T, N, 0>& ring, T value) {
+  const auto result =
+      ring.push(value, OverflowPolicy::BLOCK, std::chrono::steady_clock::time_point::max());
+  assert(result == SubmitResult::ACCEPTED);
+  (void)result;
+}
+
+HANDLE create(const std::string& path) {
+  const HANDLE file =
+      ::CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                    FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    std::cerr << "Could not create " << path << ": " << winErrorStr(::GetLastError()) << '\n';
+  return file;
+}
+
+}  // namespace
+
+AsyncFile::AsyncFile()
+    : file_(INVALID_HANDLE_VALUE),
+      size_(0),
+      allocated_(0),
+      exit_(false),
+      bytes_(0),
+      writes_(0),
+      errors_(0),
+      waits_(0),
+      waited_(0) {
+  for (uint32_t i = 0; i < buffer_count; ++i) {
+    buffers_[i] = static_cast<unsigned char*>(::_aligned_malloc(buffer_size, alignment));
+    push(free_, i);
+  }
+}
+
+AsyncFile::~AsyncFile() {
+  close();
+  for (auto b : buffers_) ::_aligned_free(b);
+}
+
+bool AsyncFile::open(const std::string& path) {
+  if (is_open()) close();
+  file_ = create(path);
+  if (file_ == INVALID_HANDLE_VALUE) return false;
+  path_ = writing_ = path;
+  size_ = 0;
+  allocated_ = 0;
+  exit_ = false;
+  thread_ = std::thread([this]() { loop(); });
+  return true;
+}
+
+bool AsyncFile::next(const std::string& path) {
+  if (!is_open()) return open(path);
+  const HANDLE file = create(path);
+  if (file == INVALID_HANDLE_VALUE) return false;
+  {
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    files_.emplace_back(file, path);
+  }
+  path_ = path;
+  push(queued_, chunk{next_file, 0, 0});
+  return true;
+}
+
+void AsyncFile::close() {
+  if (!thread_.joinable()) return;
+  exit_ = true;
+  queued_.wake_up();
+  thread_.join();
+  ::CloseHandle(file_);
+  file_ = INVALID_HANDLE_VALUE;
+}
+
+unsigned char* AsyncFile::acquire() {
+  uint32_t index;
+  if (!free_.pop(index)) {
+    const auto start = std::chrono::steady_clock::now();
+    const std::atomic<bool> never{false};
+    while (!free_.pop(index)) free_.wait(never);
+    waits_.fetch_add(1, std::memory_order_relaxed);
+    waited_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count(),
+                      std::memory_order_relaxed);
+  }
+  return buffers_[index];
+}
+
+void AsyncFile::submit(unsigned char* buffer, size_t offset, size_t size) {
+  uint32_t index = 0;
+  while (buffers_[index] != buffer) ++index;
+  if (!size) {
+    push(free_, index);
+    return;
+  }
+  push(queued_, chunk{index, static_cast<uint32_t>(offset), static_cast<uint32_t>(size)});
+}
+
+void AsyncFile::loop() {
+  chunk c;
+  while (true) {
+    while (queued_.pop(c)) {
+      if (c.buffer == next_file) {
+        ::CloseHandle(file_);
+        std::lock_guard<std::mutex> lock(files_mutex_);
+        file_ = files_.front().first;
+        writing_ = std::move(files_.front().second);
+        files_.pop_front();
+        size_ = 0;
+        allocated_ = 0;
+        continue;
+      }
+      write(c);
+      push(free_, c.buffer);
+    }
+    if (exit_) {
+      // Submitted before close() was called, seen empty just before.
+      if (queued_.empty()) return;
+      continue;
+    }
+    queued_.wait(exit_);
+  }
+}
+
+void AsyncFile::write(const chunk& c) {
+  if (size_ + c.size > allocated_) {
+    // Past the end of the data: released by the file system once the file is closed.
+    FILE_ALLOCATION_INFO info;
+    allocated_ = (size_ + c.size + preallocation - 1) / preallocation * preallocation;
+    info.AllocationSize.QuadPart = static_cast<LONGLONG>(allocated_);
+    if (!::SetFileInformationByHandle(file_, FileAllocationInfo, &info, sizeof info))
+      clog.log("AsyncFile: could not preallocate ", writing_, ": ", winErrorStr(::GetLastError()));
+  }
+  const auto start = std::chrono::steady_clock::now();
+  const unsigned char* data = buffers_[c.buffer] + c.offset;
+  DWORD left = c.size;
+  while (left) {
+    DWORD written = 0;
+    if (!::WriteFile(file_, data, left, &written, nullptr)) {
+      if (!errors_.fetch_add(1, std::memory_order_relaxed))
+        std::cerr << "Could not write to " << writing_ << ": " << winErrorStr(::GetLastError())
+                  << '\n';
+      metrics::of(metrics::operation::RECORD_WRITE).record_error();
+      return;
+    }
+    data += written;
+    left -= written;
+  }
+  size_ += c.size;
+  bytes_.fetch_add(c.size, std::memory_order_relaxed);
+  writes_.fetch_add(1, std::memory_order_relaxed);
+  metrics::record(metrics::operation::RECORD_WRITE, std::chrono::steady_clock::now() - start);
+}
+
+}  // namespace app
\ No newline at end of file
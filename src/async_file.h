@@ -0,0 +1,103 @@
+#ifndef DEF_ASYNC_FILE_H
+#define DEF_ASYNC_FILE_H
+
+#include "winheaders.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "mpsc_ring.h"
+
+namespace app {
+
+struct async_file_stats {
+  unsigned long long bytes;
+  unsigned long long writes;
+  unsigned long long errors;
+  unsigned long long waits;  // acquire() found every buffer queued
+  std::chrono::nanoseconds waited;
+};
+
+// A file written by a thread of its own from a few large buffers, aligned for the disk: the thread
+// filling them never waits for the disk unless all of them are queued. The file is preallocated
+// ahead of the writes, a step at a time, so that it grows without fragmenting; its end stays that
+// of the data written, a crash leaving no hole of zeros behind. next() moves the writes on to a
+// new file without waiting for those of the current one.
+class AsyncFile {
+ public:
+  static constexpr size_t buffer_count = 4;
+  static constexpr size_t buffer_size = 2 << 20;
+  static constexpr size_t alignment = 4096;
+  static constexpr uint64_t preallocation = 64 << 20;
+
+ private:
+  struct chunk {
+    uint32_t buffer;  // next_file for the next of files_
+    uint32_t offset;
+    uint32_t size;
+  };
+  static constexpr uint32_t next_file = UINT32_MAX;
+
+  std::array<unsigned char*, buffer_count> buffers_;
+  mpsc_ring<uint32_t, buffer_count, 0> free_;
+  mpsc_ring<chunk, 2 * buffer_count, 0> queued_;  // and the markers of next()
+  std::string path_;
+  std::mutex files_mutex_;
+  std::deque<std::pair<HANDLE, std::string>> files_;  // created by next(), not yet written to
+  // Writer thread only.
+  HANDLE file_;
+  std::string writing_;
+  uint64_t size_;
+  uint64_t allocated_;
+  std::atomic<bool> exit_;
+  std::thread thread_;
+
+  std::atomic<unsigned long long> bytes_;
+  std::atomic<unsigned long long> writes_;
+  std::atomic<unsigned long long> errors_;
+  std::atomic<unsigned long long> waits_;
+  std::atomic<unsigned long long> waited_;  // ns
+
+  void loop();
+  void write(const chunk& c);
+
+ public:
+  AsyncFile();
+  AsyncFile(const AsyncFile&) = delete;
+  AsyncFile& operator=(const AsyncFile&) = delete;
+  ~AsyncFile();
+
+  // Creates the file, replacing any, and starts the writer.
+  bool open(const std::string& path);
+  bool is_open() const { return thread_.joinable(); }
+  // From the thread submitting, a buffer submitted between two. Creates another file: what is
+  // submitted afterwards goes to it, the current one being closed once written.
+  bool next(const std::string& path);
+  // Writes what was submitted, then closes the file.
+  void close();
+  const std::string& path() const { return path_; }
+
+  // From a single thread. A buffer of buffer_size bytes, given back by submit(), waiting for the
+  // writer while none is free.
+  unsigned char* acquire();
+  // Queues [offset, offset + size) of `buffer` for writing, nothing when size is 0.
+  void submit(unsigned char* buffer, size_t offset, size_t size);
+
+  async_file_stats stats() const {
+    return {bytes_.load(std::memory_order_relaxed), writes_.load(std::memory_order_relaxed),
+            errors_.load(std::memory_order_relaxed), waits_.load(std::memory_order_relaxed),
+            std::chrono::nanoseconds(waited_.load(std::memory_order_relaxed))};
+  }
+};
+
+}  // namespace app
+
+#endif
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include <iostream>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+#include "bench.h"
+#include "main.h"
+#include "synchronized_ostream.h"
+
+namespace app {
+configuration configuration::config_ = configuration();
+synchronized_ostream clog{std::clog, true};
+configuration config = configuration::get_instance();
+
+}  // namespace app
+
+using namespace app;
+
+int main(int argc, char **argv) {
+  namespace po = boost::program_options;
+
+  bench::options opts;
+  po::options_description description("Allowed options");
+  description.add_options()("help,h", "prints this")(
+      "benchmark,b", po::value<std::string>(&opts.name)->required(),
+      "coalesce | action | soak | wsse | envelope | discovery | device | control | tap | record | "
+      "seek | pre-event")(
+      "events,n", po::value<int>(&opts.events)->default_value(1000), "Number of input events")(
+      "rtt,R", po::value<int>(&opts.rtt)->default_value(50), "Simulated Round Trip Time (in ms)")(
+      "json,J", po::value<std::string>(&opts.json), "JSON output file of control (stdout if none)");
+
+  po::positional_options_description p;
+  p.add("benchmark", 1);
+
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(argc, argv).options(description).positional(p).run(), vm);
+    if (vm.count("help")) {
+      std::cout << "Usage: " << argv[0] << " benchmark [options]\n" << description << '\n';
+      return 0;
+    }
+    po::notify(vm);
+    if (opts.events < 1) throw std::runtime_error("The number of events must be >= 1");
+    if (opts.rtt < 0) throw std::runtime_error("The RTT must be >= 0");
+  } catch (const std::exception &e) {
+    std::cout << e.what() << '\n';
+    std::cout << "Usage: " << argv[0] << " benchmark [options]\n" << description << '\n';
+    return 1;
+  }
+  config.round_trip_time = opts.rtt;
+
+  if (opts.name == "coalesce") return bench::coalesce(opts);
+  if (opts.name == "action") return bench::action(opts);
+  if (opts.name == "soak") return bench::soak(opts);
+  if (opts.name == "wsse") return bench::wsse(opts);
+  if (opts.name == "envelope") return bench::envelope(opts);
+  if (opts.name == "discovery") return bench::discovery(opts);
+  if (opts.name == "device") return bench::device(opts);
+  if (opts.name == "control") return bench::control(opts);
+  if (opts.name == "tap") return bench::tap(opts);
+  if (opts.name == "record") return bench::record(opts);
+  if (opts.name == "seek") return bench::seek(opts);
+  if (opts.name == "pre-event") return bench::pre_event(opts);
+
+  std::cout << "Unknown benchmark " << opts.name << '\n';
+  return 1;
+}
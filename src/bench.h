@@ -0,0 +1,65 @@
+#ifndef DEF_BENCH_H
+#define DEF_BENCH_H
+
+#include <string>
+
+namespace app {
+namespace bench {
+
+struct options {
+  std::string name;
+  int events;
+  int rtt;
+  std::string json;  // where a benchmark writing JSON writes it, stdout when empty
+};
+
+// SoapThread action queue: requests sent to a local mock per input events.
+int coalesce(const options& opts);
+
+// Per-action overhead of submitting and dispatching a SoapAction, former virtual path vs variant.
+int action(const options& opts);
+
+// Resident memory after `events` moves, with and without a SoapRequestScope per request.
+int soak(const options& opts);
+
+// CPU time of the WS-Security header per request, computed inline vs taken from SoapCredentials.
+int wsse(const options& opts);
+
+// Serialization cost per PTZ request, gSOAP object graph vs SoapEnvelopes template, and whether
+// both give the same bytes.
+int envelope(const options& opts);
+
+// WS-Discovery scan against `events` devices answering on the loopback interface: whether each is
+// listed once, duplicates and stray matches included.
+int discovery(const options& opts);
+
+// SoapThread against the in-process mock device, with the rtt of `opts` and a few failures: a
+// drag of `events` moves, the requests served and their latencies.
+int device(const options& opts);
+
+// Mouse drag, wheel and trackbar traces of `events` each through the control path of the windows,
+// against the mock device: commands per second, queue residency, event-to-ack latencies, drops and
+// merges, as JSON.
+int control(const options& opts);
+
+// A stream of `events` packets through StreamTap to consumers of every backpressure policy, some too
+// slow for it: the time the SDK thread is kept per packet, and what each consumer got.
+int tap(const options& opts);
+
+// Streams of the cameras recorded to MP4 files on the disk at their pace, `events` frames each, in
+// stages of twice as many: the streams a disk takes without losing frames.
+int record(const options& opts);
+
+// A segmented recording of `events` frames, then as many seeks to random times of it: the time
+// to find the keyframe in its catalog, and to read its fragment.
+int seek(const options& opts);
+
+// Pre-event buffers of a few durations filled by a camera, then flushed into a recording the live
+// stream follows: what they hold, the time to flush them, and the frames missing from the
+// recording.
+int pre_event(const options& opts);
+
+}  // namespace bench
+}  // namespace app
+
+#endif
@@ -0,0 +1,181 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <type_traits>
+#include <variant>
+
+#include "bench.h"
+#include "mpsc_ring.h"
+#include "soap.h"
+
+// Every allocation of the benchmark binary is counted.
+static std::atomic<unsigned long long> allocations{0};
+
+void* operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace app {
+namespace bench {
+
+namespace {
+
+// Stands for the device: keeps the compiler from optimizing the dispatch away.
+volatile float sink;
+
+// Replica of the former SoapAction path: one heap object per event, queued through a mutex
+// protected std::queue and a condition variable, coalesced with dynamic_cast, then a virtual
+// process() and a virtual runner callback.
+namespace legacy {
+
+class Action;
+class StartContinuousMoveAction;
+
+class Runner {
+ public:
+  virtual void start_continuous_move_is_done(StartContinuousMoveAction* action) = 0;
+  virtual ~Runner() = default;
+};
+
+class Action {
+ protected:
+  Runner& runner_;
+
+ public:
+  explicit Action(Runner& runner) : runner_(runner) {}
+  virtual ~Action() = default;
+  virtual bool process() = 0;
+  virtual bool absorb(const Action& next) { return false; }
+};
+
+class StartContinuousMoveAction : public Action {
+  float p_;
+  float t_;
+
+ public:
+  StartContinuousMoveAction(Runner& runner, float p, float t) : Action(runner), p_(p), t_(t) {}
+  bool process() override {
+    sink = p_ + t_;
+    runner_.start_continuous_move_is_done(this);
+    return true;
+  }
+  bool absorb(const Action& next) override {
+    const auto move = dynamic_cast<const StartContinuousMoveAction*>(&next);
+    if (!move) return false;
+    p_ = move->p_;
+    t_ = move->t_;
+    return true;
+  }
+};
+
+class NothingRunner : public Runner {
+ public:
+  void start_continuous_move_is_done(StartContinuousMoveAction* action) override { sink = 0.f; }
+};
+
+}  // namespace legacy
+
+struct overhead {
+  double nanoseconds;
+  double allocations;
+};
+
+template <typename Function>
+overhead measure(int events, Function&& function) {
+  const auto allocated = allocations.load();
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < events; ++i) function(i * 0.001f);
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  return {std::chrono::duration<double, std::nano>(elapsed).count() / events,
+          static_cast<double>(allocations.load() - allocated) / events};
+}
+
+struct notifier {
+  void done(const soap::SoapStartContinuousMoveAction& action) { sink = 0.f; }
+};
+
+void print(const char* name, const overhead& o) {
+  std::cout << std::setw(14) << name << std::setw(14) << std::fixed << std::setprecision(1)
+            << o.nanoseconds << std::setw(14) << std::setprecision(2) << o.allocations << '\n';
+}
+
+}  // namespace
+
+int action(const options& opts) {
+  std::cout << "Submitting and dispatching " << opts.events
+            << " continuous moves, one at a time (no device)\n";
+  std::cout << std::setw(14) << "" << std::setw(14) << "ns / action" << std::setw(14)
+            << "allocs / act" << '\n';
+
+  // Former path, as SoapThread::queue() and SoapThread::run() did it.
+  legacy::NothingRunner runner;
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::queue<legacy::Action*> queue;
+  std::deque<legacy::Action*> pending;
+  print("virtual", measure(opts.events, [&](float x) {
+          legacy::Action* submitted = new legacy::StartContinuousMoveAction(runner, x, -x);
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&]() { return queue.empty(); });
+            queue.push(submitted);
+          }
+          condition.notify_all();
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&]() { return !queue.empty(); });
+            while (!queue.empty()) {
+              if (!pending.empty() && pending.back()->absorb(*queue.front())) {
+                delete queue.front();
+              } else {
+                pending.push_back(queue.front());
+              }
+              queue.pop();
+            }
+          }
+          condition.notify_all();
+          legacy::Action* action = pending.front();
+          pending.pop_front();
+          action->process();
+          delete action;
+        }));
+
+  // Current path: the SoapThread submission ring and pending queue, dispatched with std::visit.
+  notifier target;
+  auto callback = soap::callback<&notifier::done>(target);
+  auto ring = std::make_unique<mpsc_ring<soap::SoapAction, soap::SoapThread::submission_capacity>>();
+  auto actions = std::make_unique<soap::SoapActionQueue>();
+  print("variant", measure(opts.events, [&](float x) {
+          soap::SoapAction action = soap::SoapStartContinuousMoveAction(x, -x, callback);
+          ring->push(action, OverflowPolicy::BLOCK, std::chrono::steady_clock::time_point::max());
+          soap::SoapAction submitted;
+          while (!actions->full() && ring->pop(submitted)) actions->push(std::move(submitted));
+          soap::SoapAction& query = actions->front();
+          std::visit(
+              [](auto& a) {
+                if constexpr (std::is_same_v<std::decay_t<decltype(a)>,
+                                             soap::SoapStartContinuousMoveAction>)
+                  sink = a.pan() + a.tilt();
+                a.done()(a);
+              },
+              query);
+          actions->pop();
+        }));
+
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace app
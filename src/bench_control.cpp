@@ -0,0 +1,416 @@
+#include "winheaders.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "Consumer.h"
+#include "bench.h"
+#include "main.h"
+#include "metrics.h"
+#include "ptz_control.h"
+#include "soap.h"
+#include "soap_mock.h"
+
+namespace app {
+namespace bench {
+
+namespace {
+
+namespace soap = app::soap;
+using std::chrono::steady_clock;
+
+// The defaults of the application, which the zeroed configuration of the benchmarks lacks.
+constexpr int ptz_rate = 20;
+constexpr int z_sensitivity = 1;
+
+// A trace is given this long past its last event for the device to acknowledge it.
+constexpr std::chrono::seconds settle_timeout{5};
+
+struct percentiles {
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  uint64_t max;
+};
+
+// What the SoapThread counted before a trace, to tell what the trace alone did.
+struct counters {
+  unsigned long long commands;
+  submission_stats submissions;
+  unsigned long long expired;
+  unsigned long long coalesced;
+  std::vector<uint64_t> residency;  // buckets of metrics::operation::SOAP_QUEUE_RESIDENCY
+
+  static counters read() {
+    const auto& h = metrics::of(metrics::operation::SOAP_QUEUE_RESIDENCY);
+    counters c{soap::soap_thread.budget_stats(soap::SoapTraffic::CONTROL).sent,
+               soap::soap_thread.queue_stats(), soap::soap_thread.expired(),
+               soap::soap_thread.coalesced(),
+               std::vector<uint64_t>(metrics::histogram::bucket_count)};
+    for (size_t b = 0; b < c.residency.size(); ++b) c.residency[b] = h.bucket_value(b);
+    return c;
+  }
+};
+
+struct result {
+  const char* name;
+  int events;
+  double seconds;  // from the first event to the last acknowledgment
+  unsigned long long commands;
+  percentiles residency;     // us, from queue() to the request sent
+  percentiles event_to_ack;  // us, from the event to the response of a request reflecting it
+  int unacked;
+  unsigned long long refused;  // by SoapThread::queue()
+  unsigned long long replaced;
+  unsigned long long expired;
+  unsigned long long coalesced;
+
+  double commands_per_second() const { return seconds > 0. ? commands / seconds : 0.; }
+};
+
+// The events of a trace, and the completions of the actions they led to. An event is acknowledged
+// by the first response to an action updated at or after it: its own, or a later one carrying it.
+class trace {
+  std::mutex mx_;
+  std::condition_variable cv_;
+  std::vector<steady_clock::time_point> events_;
+  // Updated, answered.
+  std::vector<std::pair<steady_clock::time_point, steady_clock::time_point>> acks_;
+
+ public:
+  std::atomic<unsigned long long> refused{0};  // by the loop thread too
+
+  void event() { events_.push_back(steady_clock::now()); }
+
+  template <typename Action>
+  void done(const Action& action) {
+    const auto now = steady_clock::now();
+    std::lock_guard<std::mutex> lock(mx_);
+    acks_.emplace_back(action.updated(), now);
+    cv_.notify_all();
+  }
+
+  // Waits until the last event is acknowledged.
+  void settle() {
+    if (events_.empty()) return;
+    const auto last = events_.back();
+    std::unique_lock<std::mutex> lock(mx_);
+    cv_.wait_for(lock, settle_timeout, [this, last]() {
+      return std::any_of(acks_.begin(), acks_.end(),
+                         [last](const auto& ack) { return ack.first >= last; });
+    });
+  }
+
+  result measure(const char* name, const counters& before) {
+    std::lock_guard<std::mutex> lock(mx_);
+    const counters after = counters::read();
+    result r{name,
+             static_cast<int>(events_.size()),
+             0.,
+             after.commands - before.commands,
+             {},
+             {},
+             0,
+             refused + (after.submissions.rejected - before.submissions.rejected) +
+                 (after.submissions.timed_out - before.submissions.timed_out),
+             after.submissions.replaced - before.submissions.replaced,
+             after.expired - before.expired,
+             after.coalesced - before.coalesced};
+
+    // Earliest answer to an action updated at or after each point, by update time.
+    std::sort(acks_.begin(), acks_.end());
+    std::vector<steady_clock::time_point> first_answer(acks_.size() + 1,
+                                                       steady_clock::time_point::max());
+    for (size_t i = acks_.size(); i-- > 0;)
+      first_answer[i] = std::min(first_answer[i + 1], acks_[i].second);
+    std::vector<uint64_t> latencies;
+    for (const auto& e : events_) {
+      const auto i = std::lower_bound(acks_.begin(), acks_.end(),
+                                      std::make_pair(e, steady_clock::time_point::min())) -
+                     acks_.begin();
+      if (first_answer[i] == steady_clock::time_point::max()) {
+        ++r.unacked;
+        continue;
+      }
+      latencies.push_back(static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::microseconds>(first_answer[i] - e).count()));
+    }
+    r.event_to_ack = exact(latencies);
+
+    std::vector<uint64_t> residency(after.residency.size());
+    for (size_t b = 0; b < residency.size(); ++b)
+      residency[b] = after.residency[b] - before.residency[b];
+    r.residency = bucketed(residency);
+
+    if (!events_.empty() && !acks_.empty()) {
+      auto last = acks_.front().second;
+      for (const auto& ack : acks_) last = std::max(last, ack.second);
+      r.seconds = std::chrono::duration<double>(last - events_.front()).count();
+    }
+    return r;
+  }
+
+  static uint64_t rank(double p, size_t n) {
+    return std::max<uint64_t>(1, static_cast<uint64_t>(p * n + .5));
+  }
+
+  static percentiles exact(std::vector<uint64_t>& values) {
+    if (values.empty()) return {};
+    std::sort(values.begin(), values.end());
+    const auto at = [&values](double p) { return values[rank(p, values.size()) - 1]; };
+    return {at(.5), at(.9), at(.99), values.back()};
+  }
+
+  // As metrics::histogram::percentile(), of the buckets counted during the trace.
+  static percentiles bucketed(const std::vector<uint64_t>& buckets) {
+    uint64_t n = 0;
+    size_t highest = 0;
+    for (size_t b = 0; b < buckets.size(); ++b)
+      if (buckets[b]) {
+        n += buckets[b];
+        highest = b;
+      }
+    if (!n) return {};
+    const auto at = [&buckets, n](double p) {
+      const auto r = rank(p, n);
+      uint64_t seen = 0;
+      for (size_t b = 0; b < buckets.size(); ++b) {
+        seen += buckets[b];
+        if (seen >= r) return metrics::histogram::upper_bound(b);
+      }
+      return uint64_t{0};
+    };
+    return {at(.5), at(.9), at(.99), metrics::histogram::upper_bound(highest)};
+  }
+};
+
+// Drags on the video at the 500 Hz of a gaming mouse, half a second each with a pause between:
+// PTZControlLoop sends the speeds as BGWindow has it, through what OnvifPTZBackend queues, and the
+// release queues the stop.
+result drag(trace& t, int events) {
+  const auto before = counters::read();
+  PTZControlLoop loop(
+      [&t](float pan, float tilt) {
+        const bool queued = soap::soap_thread.queue(
+            soap::SoapStartContinuousMoveAction(
+                pan, tilt,
+                soap::callback<&trace::done<soap::SoapStartContinuousMoveAction>>(t)),
+            OverflowPolicy::REPLACE_LATEST);
+        if (!queued) ++t.refused;
+        return queued;
+      },
+      ptz_rate);
+  loop.run();
+
+  constexpr int drag_events = 250;
+  constexpr auto period = std::chrono::milliseconds(2);
+  constexpr auto pause = std::chrono::milliseconds(100);
+  auto next = steady_clock::now();
+  for (int i = 0; i < events;) {
+    loop.press();
+    for (int j = 0; j < drag_events && i < events; ++j, ++i) {
+      // The cursor circles the center a turn per second, out of the deadband.
+      const float angle = i * 2.f * 3.14159265f / 500.f;
+      t.event();
+      loop.input(0.6f * std::cos(angle), 0.6f * std::sin(angle));
+      next += period;
+      std::this_thread::sleep_until(next);
+    }
+    t.event();
+    loop.release();
+    if (!soap::soap_thread.queue(soap::SoapStopContinuousMoveAction(
+            soap::callback<&trace::done<soap::SoapStopContinuousMoveAction>>(t))))
+      ++t.refused;
+    next += pause;
+    std::this_thread::sleep_until(next);
+  }
+  t.settle();
+  return t.measure("drag", before);
+}
+
+// The zoom of BGWindow: the wheel notches are summed by a Consumer, which queues a RelativeMove
+// then waits for its response before sending the notches received meanwhile.
+class wheel_trace : public trace {
+ public:
+  using consumer = Consumer<std::function<bool(float)>,
+                            std::function<std::tuple<float>(const std::queue<std::tuple<float>>&)>,
+                            float>;
+
+  // Its thread is detached and never ends: the consumer is never destroyed.
+  consumer* zoom;
+
+  wheel_trace()
+      : zoom(new consumer([this](float z_delta) { return update(z_delta); },
+                          [](const std::queue<std::tuple<float>>& q) {
+                            float z_total = 0;
+                            auto queue_copy = q;
+                            for (; !queue_copy.empty(); queue_copy.pop())
+                              z_total += std::get<0>(queue_copy.front());
+                            return std::make_tuple(z_total);
+                          })) {}
+
+  bool update(float z_delta) {
+    if (z_delta == 0) return true;
+    float d = (z_delta * z_sensitivity) / (20.f * WHEEL_DELTA);
+    d = std::max(-1.f, std::min(1.f, d));
+    zoom->block_process();
+    if (!soap::soap_thread.queue(soap::SoapRelativeMoveAction(
+            0.f, 0.f, d, soap::callback<&wheel_trace::relative_move_is_done>(*this)))) {
+      ++refused;
+      zoom->unblock_process();
+      return false;
+    }
+    return true;
+  }
+
+  void relative_move_is_done(const soap::SoapRelativeMoveAction& action) {
+    done(action);
+    zoom->unblock_process();
+  }
+};
+
+// Flicks of the wheel: ten notches 16 ms apart, a pause of 200 ms, the other way.
+result wheel(wheel_trace& t, int events) {
+  t.zoom->run();
+  const auto before = counters::read();
+  constexpr int flick_events = 10;
+  constexpr auto period = std::chrono::milliseconds(16);
+  constexpr auto pause = std::chrono::milliseconds(200);
+  auto next = steady_clock::now();
+  for (int i = 0; i < events;) {
+    const int direction = (i / flick_events) % 2 ? -1 : 1;
+    for (int j = 0; j < flick_events && i < events; ++j, ++i) {
+      t.event();
+      t.zoom->queue(static_cast<float>(direction * WHEEL_DELTA));
+      next += period;
+      std::this_thread::sleep_until(next);
+    }
+    next += pause;
+    std::this_thread::sleep_until(next);
+  }
+  t.settle();
+  return t.measure("wheel", before);
+}
+
+// The pan bar dragged back and forth across its 100 positions at 125 Hz, then the zoom bar: as
+// GlobalWindow does, each position is an AbsoluteMove replacing the one not taken yet.
+result trackbar(trace& t, int events) {
+  const auto before = counters::read();
+  constexpr int positions = 100;
+  constexpr auto period = std::chrono::milliseconds(8);
+  auto next = steady_clock::now();
+  for (int i = 0; i < events; ++i) {
+    const int sweep = i / positions;
+    const int pos = sweep % 2 ? positions - 1 - i % positions : i % positions;
+    const float d = pos * 1.f / (positions - 1);
+    auto action = soap::SoapAbsoluteMove(soap::callback<&trace::done<soap::SoapAbsoluteMove>>(t));
+    if ((sweep / 2) % 2)
+      action.setZoom(d);
+    else
+      action.setPan(d);
+    t.event();
+    if (!soap::soap_thread.queue(action, OverflowPolicy::REPLACE_LATEST)) ++t.refused;
+    next += period;
+    std::this_thread::sleep_until(next);
+  }
+  t.settle();
+  return t.measure("trackbar", before);
+}
+
+void write_json(std::ostream& out, const options& opts, const std::vector<result>& results) {
+  const auto flags = out.flags();
+  const auto precision = out.precision();
+  const auto write = [&out](const char* name, const percentiles& p) {
+    out << ", \"" << name << "\": {\"p50\": " << p.p50 << ", \"p90\": " << p.p90
+        << ", \"p99\": " << p.p99 << ", \"max\": " << p.max << '}';
+  };
+  out << "{\"benchmark\": \"control\", \"rtt_ms\": " << opts.rtt << ", \"unit\": \"us\", "
+      << "\"traces\": [";
+  bool first = true;
+  for (const auto& r : results) {
+    out << (first ? "" : ",") << "\n  {\"name\": \"" << r.name << "\", \"events\": " << r.events
+        << ", \"seconds\": " << std::fixed << std::setprecision(3) << r.seconds
+        << ", \"commands\": " << r.commands << ", \"commands_per_second\": " << std::setprecision(1)
+        << r.commands_per_second();
+    write("residency", r.residency);
+    write("event_to_ack", r.event_to_ack);
+    out << ", \"unacked\": " << r.unacked << ", \"refused\": " << r.refused
+        << ", \"replaced\": " << r.replaced << ", \"expired\": " << r.expired
+        << ", \"coalesced\": " << r.coalesced << '}';
+    first = false;
+  }
+  out << "\n]}\n";
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}  // namespace
+
+int control(const options& opts) {
+  soap::SoapMockDevice mock;
+  mock.set({std::chrono::milliseconds(opts.rtt), std::chrono::milliseconds(opts.rtt / 4), 0., 0.});
+  if (!mock.start()) return 1;
+  config.host = "127.0.0.1";
+  config.soap_port = static_cast<uint16_t>(mock.port());
+
+  soap::soap_thread.run();
+  if (!soap::soap_thread.wait_ready()) {
+    std::cout << "The SoapThread could not set up the mock device\n";
+    soap::soap_thread.must_exit();
+    soap::soap_thread.thread().join();
+    return 1;
+  }
+
+  // Alive until the SoapThread exits, for the completions of a trace that did not settle.
+  trace drag_trace, trackbar_trace;
+  wheel_trace zoom_trace;
+  std::vector<result> results;
+  results.push_back(drag(drag_trace, opts.events));
+  results.push_back(wheel(zoom_trace, opts.events));
+  results.push_back(trackbar(trackbar_trace, opts.events));
+  soap::soap_thread.must_exit();
+  soap::soap_thread.thread().join();
+  mock.stop();
+
+  std::cout << "Control traces against the mock device (rtt = " << opts.rtt << " ms + up to "
+            << opts.rtt / 4 << " ms), latencies in us\n"
+            << std::left << std::setw(10) << "trace" << std::right << std::setw(8) << "events"
+            << std::setw(10) << "cmd/s" << std::setw(10) << "queue p50" << std::setw(8) << "p99"
+            << std::setw(10) << "ack p50" << std::setw(8) << "p99" << std::setw(9) << "unacked"
+            << std::setw(9) << "dropped" << std::setw(11) << "coalesced" << '\n';
+  for (const auto& r : results)
+    std::cout << std::left << std::setw(10) << r.name << std::right << std::setw(8) << r.events
+              << std::setw(10) << std::fixed << std::setprecision(1) << r.commands_per_second()
+              << std::setw(10) << r.residency.p50 << std::setw(8) << r.residency.p99
+              << std::setw(10) << r.event_to_ack.p50 << std::setw(8) << r.event_to_ack.p99
+              << std::setw(9) << r.unacked << std::setw(9)
+              << r.refused + r.replaced + r.expired << std::setw(11) << r.coalesced << '\n';
+
+  if (opts.json.empty()) {
+    write_json(std::cout, opts, results);
+    return 0;
+  }
+  std::ofstream out(opts.json);
+  if (!out) {
+    std::cerr << "Error when opening " << opts.json << '\n';
+    return 1;
+  }
+  write_json(out, opts, results);
+  std::cout << "Results written to " << opts.json << '\n';
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace app
\ No newline at end of file
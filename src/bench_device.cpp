@@ -0,0 +1,73 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+#include "bench.h"
+#include "main.h"
+#include "metrics.h"
+#include "soap.h"
+#include "soap_mock.h"
+
+namespace app {
+namespace bench {
+
+namespace {
+
+// Of every operation of the mock device, besides a latency of the rtt asked for plus up to a
+// quarter of it: one request in a hundred failing, one in five hundred losing its connection.
+constexpr double fault_rate = 0.01;
+constexpr double drop_rate = 0.002;
+
+}  // namespace
+
+int device(const options& opts) {
+  namespace soap = app::soap;
+  soap::SoapMockDevice mock;
+  mock.set({std::chrono::milliseconds(opts.rtt), std::chrono::milliseconds(opts.rtt / 4),
+            fault_rate, drop_rate});
+  if (!mock.start()) return 1;
+  config.host = "127.0.0.1";
+  config.soap_port = static_cast<uint16_t>(mock.port());
+  std::cout << "SoapThread against the mock device " << mock.endpoint() << " (rtt = "
+            << opts.rtt << " ms + up to " << opts.rtt / 4 << " ms, " << fault_rate * 100
+            << " % faults, " << drop_rate * 100 << " % drops)\n";
+
+  soap::soap_thread.run();
+  if (!soap::soap_thread.wait_ready()) {
+    std::cout << "The SoapThread could not set up the mock device\n";
+    soap::soap_thread.must_exit();
+    soap::soap_thread.thread().join();
+    return 1;
+  }
+
+  // A drag at 1 kHz, the bars read every 50 events, then a stop once done.
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < opts.events; ++i) {
+    const float angle = i * 0.01f;
+    if (i % 50 == 30)
+      soap::soap_thread.queue(soap::SoapGetStatus());
+    else
+      soap::soap_thread.queue(
+          soap::SoapStartContinuousMoveAction(std::cos(angle) * 0.5f, std::sin(angle) * 0.5f),
+          OverflowPolicy::REPLACE_LATEST);
+    std::this_thread::sleep_until(start + std::chrono::milliseconds(i + 1));
+  }
+  using Stopped = soap::SoapCompletion<soap::SoapStopContinuousMoveAction>;
+  Stopped stopped;
+  soap::soap_thread.queue(
+      soap::SoapStopContinuousMoveAction(soap::callback<&Stopped::done>(stopped)));
+  stopped.wait();
+  soap::soap_thread.must_exit();
+  soap::soap_thread.thread().join();
+  mock.stop();
+
+  mock.dump(std::cout);
+  std::cout << '\n';
+  metrics::dump(std::cout);
+
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace app
\ No newline at end of file
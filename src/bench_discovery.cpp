@@ -0,0 +1,159 @@
+#include "winheaders.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "soap_discovery.h"
+
+namespace app {
+namespace bench {
+
+namespace {
+
+constexpr auto loopback = "127.0.0.1";
+constexpr std::chrono::milliseconds listen_timeout{2000};
+constexpr DWORD probe_timeout_ms = 5000;
+// Every duplicate_every-th device answers twice, as a device does on a lossy network.
+constexpr int duplicate_every = 5;
+
+constexpr auto match_format =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://www.w3.org/2003/05/soap-envelope\" "
+    "xmlns:wsa5=\"http://www.w3.org/2005/08/addressing\" "
+    "xmlns:wsdd=\"http://docs.oasis-open.org/ws-dd/ns/discovery/2009/01\" "
+    "xmlns:tdn=\"http://www.onvif.org/ver10/network/wsdl\"><SOAP-ENV:Header>"
+    "<wsa5:MessageID>urn:uuid:6b7c0000-0000-4000-8000-%012d</wsa5:MessageID>"
+    "<wsa5:RelatesTo>%s</wsa5:RelatesTo>"
+    "<wsa5:To>http://www.w3.org/2005/08/addressing/anonymous</wsa5:To>"
+    "<wsa5:Action>http://docs.oasis-open.org/ws-dd/ns/discovery/2009/01/ProbeMatches</wsa5:Action>"
+    "<wsdd:AppSequence InstanceId=\"1\" MessageNumber=\"%d\"></wsdd:AppSequence>"
+    "</SOAP-ENV:Header><SOAP-ENV:Body><wsdd:ProbeMatches><wsdd:ProbeMatch>"
+    "<wsa5:EndpointReference><wsa5:Address>urn:uuid:00000000-0000-4000-8000-%012d</wsa5:Address>"
+    "</wsa5:EndpointReference><wsdd:Types>tdn:NetworkVideoTransmitter</wsdd:Types>"
+    "<wsdd:Scopes>onvif://www.onvif.org/name/bench-%d</wsdd:Scopes>"
+    "<wsdd:XAddrs>http://10.0.%d.%d/onvif/device_service</wsdd:XAddrs>"
+    "<wsdd:MetadataVersion>1</wsdd:MetadataVersion>"
+    "</wsdd:ProbeMatch></wsdd:ProbeMatches></SOAP-ENV:Body></SOAP-ENV:Envelope>";
+
+// A loopback stand-in for the cameras of a network: reads one probe, answers it with a ProbeMatches
+// datagram per device, some of them twice, then with one match of another probe.
+class responder {
+  SOCKET socket_;
+  unsigned short port_;
+  int devices_;
+  int sent_;
+  std::thread thread_;
+
+  void send(const std::string& relates_to, int message, int device, sockaddr_in& to) {
+    char datagram[2048];
+    const int size = std::snprintf(datagram, sizeof datagram, match_format, message,
+                                   relates_to.c_str(), message, device, device, device / 250,
+                                   device % 250 + 1);
+    if (::sendto(socket_, datagram, size, 0, reinterpret_cast<sockaddr*>(&to), sizeof to) == size)
+      ++sent_;
+  }
+
+  void run() {
+    char datagram[8192];
+    sockaddr_in from{};
+    int length = sizeof from;
+    const int size = ::recvfrom(socket_, datagram, sizeof datagram - 1, 0,
+                                reinterpret_cast<sockaddr*>(&from), &length);
+    if (size <= 0) {
+      std::cerr << "The responder received no probe\n";
+      return;
+    }
+    const std::string probe(datagram, size);
+    const size_t begin = probe.find("MessageID>");
+    const size_t end = probe.find('<', begin);
+    if (begin == std::string::npos || end == std::string::npos) {
+      std::cerr << "The probe has no MessageID\n";
+      return;
+    }
+    const std::string message_id = probe.substr(begin + 10, end - begin - 10);
+
+    int message = 0;
+    for (int device = 0; device < devices_; ++device) {
+      send(message_id, ++message, device, from);
+      if (device % duplicate_every == 0) send(message_id, ++message, device, from);
+    }
+    send("urn:uuid:00000000-0000-0000-0000-000000000000", ++message, devices_, from);
+  }
+
+ public:
+  explicit responder(int devices)
+      : socket_(::socket(AF_INET, SOCK_DGRAM, 0)), port_(0), devices_(devices), sent_(0) {
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = ::inet_addr(loopback);
+    int length = sizeof address;
+    ::setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO,
+                 reinterpret_cast<const char*>(&probe_timeout_ms), sizeof probe_timeout_ms);
+    if (::bind(socket_, reinterpret_cast<sockaddr*>(&address), sizeof address) ||
+        ::getsockname(socket_, reinterpret_cast<sockaddr*>(&address), &length))
+      return;
+    port_ = ntohs(address.sin_port);
+    thread_ = std::thread([this]() { run(); });
+  }
+  ~responder() {
+    if (thread_.joinable()) thread_.join();
+    ::closesocket(socket_);
+  }
+
+  unsigned short port() const { return port_; }
+  int sent() {
+    thread_.join();
+    return sent_;
+  }
+};
+
+}  // namespace
+
+int discovery(const options& opts) {
+  WSADATA data;
+  ::WSAStartup(MAKEWORD(2, 2), &data);
+
+  const int duplicates = (opts.events + duplicate_every - 1) / duplicate_every;
+  responder devices(opts.events);
+  if (!devices.port()) {
+    std::cout << "Could not bind the responder\n";
+    ::WSACleanup();
+    return 1;
+  }
+  std::cout << "Probing " << opts.events << " devices answering on " << loopback << ':'
+            << devices.port() << " (" << duplicates << " of them twice) for "
+            << listen_timeout.count() << " ms\n";
+
+  soap::SoapDiscovery discovery;
+  const auto found =
+      discovery.scan({loopback}, listen_timeout,
+                     "soap.udp://" + std::string(loopback) + ':' + std::to_string(devices.port()));
+  const int sent = devices.sent();
+  const auto stats = discovery.stats();
+
+  std::cout << std::setw(14) << "sent" << std::setw(14) << "matches" << std::setw(14) << "devices"
+            << std::setw(14) << "duplicates" << std::setw(14) << "unrelated" << std::setw(14)
+            << "first (ms)" << '\n'
+            << std::setw(14) << sent << std::setw(14) << stats.matches << std::setw(14)
+            << found.size() << std::setw(14) << stats.duplicates << std::setw(14)
+            << stats.unrelated << std::setw(14) << std::fixed << std::setprecision(2)
+            << std::chrono::duration<double, std::milli>(stats.first).count() << '\n';
+  // Every device once, whatever the number of its answers.
+  const bool complete = found.size() == static_cast<size_t>(opts.events) &&
+                        stats.matches == found.size() + stats.duplicates;
+  if (!complete)
+    std::cout << opts.events + duplicates + 1 - static_cast<int>(stats.matches + stats.unrelated)
+              << " datagrams lost\n";
+
+  ::WSACleanup();
+  return complete ? 0 : 1;
+}
+
+}  // namespace bench
+}  // namespace app
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <stdsoap2.h>
+
+#include "soap/soapH.h"
+#include "soap/soapPTZBindingProxy.h"
+
+#include <plugin/wsseapi.h>
+
+#include "bench.h"
+#include "soap.h"
+
+namespace app {
+namespace bench {
+
+namespace {
+
+constexpr auto username = "admin";
+constexpr auto password = "password";
+
+const char* const kind_names[soap::SoapEnvelopes::KIND_COUNT] = {
+    "ContinuousMove", "Stop", "RelativeMove", "Rel. pan/tilt", "Rel. zoom", "GetStatus"};
+
+// Swallows the serialized requests.
+class null_buffer : public std::streambuf {
+ protected:
+  int overflow(int c) override { return c; }
+  std::streamsize xsputn(const char* s, std::streamsize n) override { return n; }
+};
+
+}  // namespace
+
+int envelope(const options& opts) {
+  // Set up as a lane: same modes, and the namespaces of the PTZ proxy.
+  struct soap* soap = ::soap_new1(SOAP_XML_CANONICAL | SOAP_IO_KEEPALIVE);
+  ::soap_register_plugin(soap, ::soap_wsse);
+  PTZBindingProxy proxy(soap);
+  soap::SoapCredentials credentials;
+  credentials.start(username, password);
+  soap::SoapEnvelopes envelopes;
+  if (!envelopes.build(soap, "Profile_1", credentials)) {
+    std::cout << "The envelopes differ from the gSOAP serialization\n";
+    credentials.stop();
+    ::soap_free(soap);
+    return 1;
+  }
+
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<float> distribution(-1.f, 1.f);
+  std::vector<float> values(3 * opts.events);
+  for (auto& v : values) v = distribution(generator);
+  const soap::SoapToken token = credentials.take(soap);
+
+  null_buffer buffer;
+  std::ostream sink(&buffer);
+  std::string rendered;
+  std::cout << "Serializing " << opts.events << " requests of each kind (random values)\n";
+  std::cout << std::setw(16) << "" << std::setw(14) << "gSOAP (ns)" << std::setw(14)
+            << "template (ns)" << std::setw(10) << "speedup" << std::setw(14) << "identical"
+            << '\n';
+  int failures = 0;
+  for (size_t k = 0; k < soap::SoapEnvelopes::KIND_COUNT; ++k) {
+    const auto kind = static_cast<soap::SoapEnvelopes::Kind>(k);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < opts.events; ++i) {
+      soap::SoapRequestScope scope(soap);
+      envelopes.serialize(soap, kind, token, values[3 * i], values[3 * i + 1], values[3 * i + 2],
+                          sink);
+    }
+    const std::chrono::duration<double, std::nano> serialized =
+        std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < opts.events; ++i) {
+      envelopes[kind].render(soap, token, values[3 * i], values[3 * i + 1], values[3 * i + 2],
+                             rendered);
+      sink.write(rendered.data(), rendered.size());
+    }
+    const std::chrono::duration<double, std::nano> templated =
+        std::chrono::steady_clock::now() - start;
+
+    // Byte for byte, on the first values.
+    const int checked = std::min(opts.events, 1000);
+    int identical = 0;
+    for (int i = 0; i < checked; ++i) {
+      soap::SoapRequestScope scope(soap);
+      std::ostringstream expected;
+      envelopes.serialize(soap, kind, token, values[3 * i], values[3 * i + 1], values[3 * i + 2],
+                          expected);
+      envelopes[kind].render(soap, token, values[3 * i], values[3 * i + 1], values[3 * i + 2],
+                             rendered);
+      identical += rendered == expected.str();
+    }
+    failures += checked - identical;
+
+    std::cout << std::setw(16) << kind_names[k] << std::setw(14) << std::fixed
+              << std::setprecision(1) << serialized.count() / opts.events << std::setw(14)
+              << templated.count() / opts.events << std::setw(9) << std::setprecision(1)
+              << serialized.count() / templated.count() << 'x' << std::setw(8) << identical
+              << " / " << std::setw(4) << checked << '\n';
+  }
+
+  credentials.stop();
+  ::soap_destroy(soap);
+  ::soap_end(soap);
+  ::soap_free(soap);
+
+  return failures ? 1 : 0;
+}
+
+}  // namespace bench
+}  // namespace app
\ No newline at end of file
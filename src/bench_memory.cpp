@@ -0,0 +1,95 @@
+#include "winheaders.h"
+
+#include <psapi.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <streambuf>
+#include <string>
+
+#include <stdsoap2.h>
+
+#include "soap/soapH.h"
+
+#include <plugin/wsseapi.h>
+
+#include "bench.h"
+#include "soap.h"
+
+namespace app {
+namespace bench {
+
+namespace {
+
+// Swallows the serialized requests.
+class null_buffer : public std::streambuf {
+ protected:
+  int overflow(int c) override { return c; }
+  std::streamsize xsputn(const char* s, std::streamsize n) override { return n; }
+};
+
+// Resident memory of the process, in KiB.
+size_t resident_kib() {
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!::K32GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+  return counters.WorkingSetSize / 1024;
+}
+
+// What SoapThread::start_move allocates in the managed heap for one move, serialized to nowhere.
+void simulate_move(struct soap* soap, const std::string& token, float p, float t) {
+  ::soap_wsse_delete_Security(soap);
+  ::soap_wsse_add_Timestamp(soap, "Time", 10);
+  ::soap_wsse_add_UsernameTokenDigest(soap, "Auth", "admin", "password");
+  ::_tptz__ContinuousMove* request = ::soap_new_req__tptz__ContinuousMove(
+      soap, token,
+      ::soap_new_set_tt__PTZSpeed(soap, ::soap_new_set_tt__Vector2D(soap, p, t, nullptr),
+                                  nullptr));
+  ::soap_write__tptz__ContinuousMove(soap, request);
+}
+
+void run(bool scoped, int moves) {
+  null_buffer buffer;
+  std::ostream sink(&buffer);
+  struct soap* soap = ::soap_new1(SOAP_XML_CANONICAL);
+  ::soap_register_plugin(soap, ::soap_wsse);
+  soap->os = &sink;
+  const std::string token = "Profile_1";
+
+  const auto before = resident_kib();
+  for (int i = 0; i < moves; ++i) {
+    if (scoped) {
+      soap::SoapRequestScope scope(soap);
+      simulate_move(soap, token, (i % 200) * 0.005f, -(i % 200) * 0.005f);
+    } else {
+      simulate_move(soap, token, (i % 200) * 0.005f, -(i % 200) * 0.005f);
+    }
+  }
+  const auto after = resident_kib();
+  std::cout << std::setw(12) << (scoped ? "scoped" : "unscoped") << std::setw(10) << moves
+            << std::setw(14) << after << std::setw(14) << static_cast<long long>(after - before)
+            << std::setw(14) << std::fixed << std::setprecision(1)
+            << (after - before) * 1024. / moves << '\n';
+
+  ::soap_destroy(soap);
+  ::soap_end(soap);
+  ::soap_free(soap);
+}
+
+}  // namespace
+
+int soak(const options& opts) {
+  // The former behaviour keeps everything: don't let it eat the machine.
+  const int unscoped_moves = std::min(opts.events, 100000);
+  std::cout << "Simulating continuous moves (WS-Security header + request serialization)\n";
+  std::cout << "Resident memory at start: " << resident_kib() << " KiB\n";
+  std::cout << std::setw(12) << "" << std::setw(10) << "moves" << std::setw(14) << "RSS (KiB)"
+            << std::setw(14) << "growth (KiB)" << std::setw(14) << "bytes / move" << '\n';
+  run(true, opts.events);
+  run(false, unscoped_moves);
+
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace app
@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bench.h"
+#include "catalog.h"
+#include "metrics.h"
+#include "recorder.h"
+#include "stream_tap.h"
+
+namespace app {
+namespace bench {
+
+namespace {
+
+using std::chrono::steady_clock;
+
+constexpr int fps = 25;
+constexpr int gop = 50;
+constexpr size_t i_frame_size = 150 << 10;
+constexpr size_t p_frame_size = 16 << 10;
+constexpr size_t max_pes_payload = 65000;
+constexpr int max_streams = 64;
+// Recorders sharing a camera: a tap per camera would take more memory than the recorders.
+constexpr int recorders_per_camera = 6;
+constexpr std::chrono::seconds seek_segment{10};
+constexpr size_t pre_event_capacity = 16 << 20;
+
+// An H.264 1080p SPS and PPS, for the recorder to describe the track.
+constexpr unsigned char sps[] = {0x67, 0x64, 0x00, 0x28, 0xAC, 0xD9, 0x40, 0x78, 0x02,
+                                 0x27, 0xE5, 0xC0, 0x44, 0x00, 0x00, 0x03, 0x00, 0x04,
+                                 0x00, 0x00, 0x03, 0x00, 0xC8, 0x3C, 0x60, 0xC6, 0x58};
+constexpr unsigned char pps[] = {0x68, 0xEB, 0xE3, 0xCB, 0x22, 0xC0};
+
+// The main stream of a camera as the SDK gives it, a PS packet per frame: 25 frames per second,
+// an I frame every 50 behind the system header and the stream map, about 4 Mbit/s. `phase`
+// frames of its first GOP are skipped, for the cameras not to send their I frames together.
+class camera {
+  std::vector<unsigned char> es_;
+  std::vector<unsigned char> packet_;
+  int frame_;
+
+  static void append(std::vector<unsigned char>& to, std::initializer_list<unsigned char> bytes) {
+    to.insert(to.end(), bytes.begin(), bytes.end());
+  }
+  static void nal(std::vector<unsigned char>& to, const unsigned char* data, size_t size) {
+    append(to, {0, 0, 0, 1});
+    to.insert(to.end(), data, data + size);
+  }
+
+ public:
+  explicit camera(int phase) : frame_(phase) {}
+
+  const std::vector<unsigned char>& next() {
+    const bool key = frame_ % gop == 0;
+    es_.clear();
+    if (key) {
+      nal(es_, sps, sizeof sps);
+      nal(es_, pps, sizeof pps);
+    }
+    append(es_, {0, 0, 0, 1, static_cast<unsigned char>(key ? 0x65 : 0x41)});
+    es_.resize(key ? i_frame_size : p_frame_size, 0x5A);
+
+    packet_.clear();
+    append(packet_, {0, 0, 1, 0xBA, 0x44, 0, 4, 0, 4, 1, 0, 0, 3, 0xF8});
+    if (key) {
+      append(packet_, {0, 0, 1, 0xBB, 0, 12, 0x80, 0, 1, 4, 0xE1, 0xFF, 0xE0, 0xE0, 0x80, 0xC0,
+                       0xC0, 0x08});
+      append(packet_, {0, 0, 1, 0xBC, 0, 14, 0xE0, 0xFF, 0, 0, 0, 4, 0x1B, 0xE0, 0, 0, 0, 0, 0, 0});
+    }
+    const uint64_t pts = static_cast<uint64_t>(frame_) * (90000 / fps);
+    for (size_t offset = 0; offset < es_.size(); offset += max_pes_payload) {
+      const size_t size = std::min(max_pes_payload, es_.size() - offset);
+      const bool first = offset == 0;
+      const size_t length = 3 + (first ? 5 : 0) + size;
+      append(packet_, {0, 0, 1, 0xE0, static_cast<unsigned char>(length >> 8),
+                       static_cast<unsigned char>(length), 0x80,
+                       static_cast<unsigned char>(first ? 0x80 : 0),
+                       static_cast<unsigned char>(first ? 5 : 0)});
+      if (first)
+        append(packet_, {static_cast<unsigned char>(0x21 | (pts >> 29 & 0x0E)),
+                         static_cast<unsigned char>(pts >> 22),
+                         static_cast<unsigned char>(pts >> 14 | 1),
+                         static_cast<unsigned char>(pts >> 7),
+                         static_cast<unsigned char>(pts << 1 | 1)});
+      packet_.insert(packet_.end(), es_.begin() + offset, es_.begin() + offset + size);
+    }
+    ++frame_;
+    return packet_;
+  }
+};
+
+struct stage {
+  int streams;
+  double seconds;
+  unsigned long long frames;
+  unsigned long long lost;     // before the recorders, or for want of a tap buffer
+  unsigned long long dropped;  // waiting for the first keyframe
+  unsigned long long bytes;
+  unsigned long long waits;
+  uint64_t write_p99;  // us
+};
+
+// `streams` recorders of the cameras for `frames` frames each, at the pace of the cameras.
+stage record(int streams, int frames, const std::filesystem::path& directory) {
+  const int cameras = (streams + recorders_per_camera - 1) / recorders_per_camera;
+  std::vector<std::unique_ptr<StreamTap>> taps;
+  std::vector<camera> sources;
+  for (int c = 0; c < cameras; ++c) {
+    taps.push_back(std::make_unique<StreamTap>());
+    taps.back()->open();
+    sources.emplace_back(c * gop / cameras);
+  }
+  std::vector<std::unique_ptr<Mp4Recorder>> recorders;
+  for (int s = 0; s < streams; ++s) {
+    recorders.push_back(std::make_unique<Mp4Recorder>("stream " + std::to_string(s)));
+    recorders.back()->start(*taps[s / recorders_per_camera],
+                            (directory / ("stream-" + std::to_string(s) + ".mp4")).string());
+  }
+
+  const auto& h = metrics::of(metrics::operation::RECORD_WRITE);
+  std::vector<uint64_t> before(metrics::histogram::bucket_count);
+  for (size_t b = 0; b < before.size(); ++b) before[b] = h.bucket_value(b);
+
+  const auto start = steady_clock::now();
+  auto next = start;
+  for (int f = 0; f < frames; ++f) {
+    for (int c = 0; c < cameras; ++c) {
+      const auto& packet = sources[c].next();
+      taps[c]->tap(NET_DVR_STREAMDATA, packet.data(), packet.size());
+    }
+    next += std::chrono::microseconds(1000000 / fps);
+    std::this_thread::sleep_until(next);
+  }
+  stage result{streams, 0., 0, 0, 0, 0, 0, 0};
+  for (auto& r : recorders) {
+    r->stop();
+    const auto s = r->stats();
+    result.frames += s.frames;
+    result.lost += s.lost;
+    result.dropped += s.dropped;
+    result.bytes += s.file.bytes;
+    result.waits += s.file.waits;
+  }
+  result.seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+  for (auto& t : taps) {
+    result.lost += t->stats().exhausted;
+    t->close();
+  }
+
+  uint64_t writes = 0;
+  std::vector<uint64_t> delta(before.size());
+  for (size_t b = 0; b < delta.size(); ++b) writes += delta[b] = h.bucket_value(b) - before[b];
+  uint64_t seen = 0;
+  for (size_t b = 0; b < delta.size() && writes; ++b) {
+    seen += delta[b];
+    if (seen >= writes * 99 / 100) {
+      result.write_p99 = metrics::histogram::upper_bound(b);
+      break;
+    }
+  }
+  return result;
+}
+
+// Feeds `frames` frames of `source` to `tap` at the pace of the camera.
+void play(camera& source, StreamTap& tap, int frames) {
+  auto next = steady_clock::now();
+  for (int f = 0; f < frames; ++f) {
+    const auto& packet = source.next();
+    tap.tap(NET_DVR_STREAMDATA, packet.data(), packet.size());
+    next += std::chrono::microseconds(1000000 / fps);
+    std::this_thread::sleep_until(next);
+  }
+}
+
+// The p50 and p99 of `values`, sorted.
+std::pair<uint64_t, uint64_t> percentiles(std::vector<uint64_t>& values) {
+  std::sort(values.begin(), values.end());
+  return {values[values.size() / 2], values[values.size() * 99 / 100]};
+}
+
+}  // namespace
+
+int record(const options& opts) {
+  const std::filesystem::path directory("record-bench");
+  std::filesystem::create_directories(directory);
+  std::cout << "Recording " << opts.events << " frames per stream, 25 frames/s, to "
+            << std::filesystem::absolute(directory).string() << '\n';
+  std::cout << std::setw(8) << "streams" << std::setw(10) << "MB/s" << std::setw(10) << "frames"
+            << std::setw(8) << "lost" << std::setw(10) << "dropped" << std::setw(8) << "waits"
+            << std::setw(16) << "write p99 (us)" << '\n';
+  int sustained = 0;
+  for (int streams = 1; streams <= max_streams; streams *= 2) {
+    const auto s = record(streams, opts.events, directory);
+    std::cout << std::setw(8) << s.streams << std::setw(10) << std::fixed << std::setprecision(1)
+              << s.bytes / s.seconds / 1e6 << std::setw(10) << s.frames << std::setw(8) << s.lost
+              << std::setw(10) << s.dropped << std::setw(8) << s.waits << std::setw(16)
+              << s.write_p99 << '\n';
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    if (s.lost) break;
+    sustained = streams;
+  }
+  std::filesystem::remove_all(directory);
+  std::cout << "Streams per disk: " << (sustained == max_streams ? "at least " : "")
+            << sustained << '\n';
+  return sustained ? 0 : 1;
+}
+
+int seek(const options& opts) {
+  const std::filesystem::path directory("seek-bench");
+  std::filesystem::remove_all(directory);
+  StreamTap tap;
+  tap.open();
+  camera source(0);
+  Mp4Recorder recorder("seek");
+  if (!recorder.start(tap, directory.string(), seek_segment)) return 1;
+  // Faster than the camera, slow enough for the recorder to lose nothing.
+  for (int f = 0; f < opts.events; ++f) {
+    const auto& packet = source.next();
+    tap.tap(NET_DVR_STREAMDATA, packet.data(), packet.size());
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  recorder.stop();
+  tap.close();
+  recorder.dump(std::cout);
+
+  Catalog catalog;
+  if (!catalog.open(directory.string()) || !catalog.size()) return 1;
+  std::cout << "Catalog of " << catalog.size() << " keyframes in "
+            << recorder.stats().segments << " segments of " << seek_segment.count()
+            << " s, seeking " << opts.events << " times\n";
+
+  std::mt19937_64 engine(42);
+  std::uniform_int_distribution<int64_t> times(catalog.begin()->time,
+                                               (catalog.end() - 1)->time + 2000);
+  std::vector<uint64_t> finds, reads;
+  std::vector<char> data;
+  int failed = 0;
+  catalog_position position;
+  for (int i = 0; i < opts.events; ++i) {
+    const int64_t time = times(engine);
+    const auto start = steady_clock::now();
+    catalog.find(time, position);
+    const auto found = steady_clock::now();
+    // The fragment of the keyframe, at most a buffer of it when the rest of the segment follows.
+    data.resize(position.size ? position.size : AsyncFile::buffer_size);
+    std::ifstream in(position.path, std::ios::binary);
+    in.seekg(static_cast<std::streamoff>(position.offset));
+    in.read(data.data(), static_cast<std::streamsize>(data.size()));
+    const auto read = steady_clock::now();
+    if (in.gcount() < 8 || std::string(data.data() + 4, 4) != "moof" || position.time > time)
+      ++failed;
+    finds.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(found - start).count());
+    reads.push_back(std::chrono::duration_cast<std::chrono::microseconds>(read - found).count());
+  }
+  catalog.close();
+  std::filesystem::remove_all(directory);
+
+  const auto f = percentiles(finds);
+  const auto r = percentiles(reads);
+  std::cout << "find p50 " << f.first << " ns, p99 " << f.second << " ns; read p50 " << r.first
+            << " us, p99 " << r.second << " us; " << failed << " failed\n";
+  return failed ? 1 : 0;
+}
+
+int pre_event(const options&) {
+  const std::filesystem::path directory("pre-event-bench");
+  std::filesystem::create_directories(directory);
+  std::cout << "Pre-event buffers of " << (pre_event_capacity >> 20)
+            << " MiB, flushed one second after they are full, then recording one second live\n";
+  std::cout << std::setw(10) << "seconds" << std::setw(10) << "held (s)" << std::setw(10)
+            << "MiB" << std::setw(10) << "packets" << std::setw(14) << "flush (us)"
+            << std::setw(10) << "frames" << std::setw(10) << "missing" << '\n';
+  int failed = 0;
+  for (const int seconds : {2, 5, 10}) {
+    StreamTap tap;
+    tap.open();
+    camera source(0);
+    Mp4Recorder recorder("pre-event");
+    recorder.arm(tap, std::chrono::seconds(seconds), pre_event_capacity);
+    play(source, tap, (seconds + 1) * fps);
+    // Once the consumer handled the last packet.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const auto held = recorder.buffered();
+    const auto start = steady_clock::now();
+    recorder.start(tap, (directory / ("pre-event-" + std::to_string(seconds) + ".mp4")).string());
+    const auto flush = steady_clock::now() - start;
+    play(source, tap, fps);
+    recorder.disarm();
+    tap.close();
+
+    // A frame per packet: those held, then the live ones.
+    const auto s = recorder.stats();
+    const long long missing = static_cast<long long>(held.packets + fps) - s.frames;
+    if (missing || s.lost || s.dropped) ++failed;
+    std::cout << std::setw(10) << seconds << std::setw(10) << std::fixed << std::setprecision(2)
+              << std::chrono::duration<double>(held.span).count() << std::setw(10)
+              << held.bytes / double(1 << 20) << std::setw(10) << held.packets << std::setw(14)
+              << std::chrono::duration_cast<std::chrono::microseconds>(flush).count()
+              << std::setw(10) << s.frames << std::setw(10) << missing << '\n';
+  }
+  std::filesystem::remove_all(directory);
+  std::cout << "Footprint per channel: the buffer, and about 48 bytes per packet held\n";
+  return failed ? 1 : 0;
+}
+
+}  // namespace bench
+}  // namespace app
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+#include "bench.h"
+#include "soap.h"
+
+namespace app {
+namespace bench {
+
+namespace {
+
+struct request_counters {
+  unsigned long long total = 0;
+  unsigned long long continuous_moves = 0;
+  unsigned long long stops = 0;
+  unsigned long long relative_moves = 0;
+  unsigned long long get_status = 0;
+  unsigned long long others = 0;
+  float zoom = 0.f;
+
+  void count(const soap::SoapAction& action) {
+    ++total;
+    if (std::holds_alternative<soap::SoapStartContinuousMoveAction>(action)) {
+      ++continuous_moves;
+    } else if (std::holds_alternative<soap::SoapStopContinuousMoveAction>(action)) {
+      ++stops;
+    } else if (const auto move = std::get_if<soap::SoapRelativeMoveAction>(&action)) {
+      ++relative_moves;
+      zoom += move->zoom();
+    } else if (std::holds_alternative<soap::SoapGetStatus>(action)) {
+      ++get_status;
+    } else {
+      ++others;
+    }
+  }
+};
+
+// Stands for the camera: a worker draining the submitted actions like SoapThread::run does, each
+// "request" taking one round trip.
+class mock_device {
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::queue<soap::SoapAction> incoming_;
+  bool done_ = false;
+  bool coalescing_;
+  std::chrono::milliseconds rtt_;
+  request_counters sent_;
+
+  void send(const soap::SoapAction& action) {
+    sent_.count(action);
+    std::this_thread::sleep_for(rtt_);
+  }
+
+ public:
+  mock_device(bool coalescing, std::chrono::milliseconds rtt) : coalescing_(coalescing), rtt_(rtt) {}
+
+  const request_counters& sent() const { return sent_; }
+
+  void submit(const soap::SoapAction& action) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      incoming_.push(action);
+    }
+    condition_.notify_all();
+  }
+
+  void finish() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_ = true;
+    }
+    condition_.notify_all();
+  }
+
+  void run() {
+    soap::SoapActionQueue pending;
+    while (true) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [&]() { return !incoming_.empty() || !pending.empty() || done_; });
+      if (incoming_.empty() && pending.empty()) break;
+
+      soap::SoapAction action;
+      if (coalescing_) {
+        while (!incoming_.empty() && !pending.full()) {
+          pending.push(std::move(incoming_.front()));
+          incoming_.pop();
+        }
+        action = pending.front();
+        pending.pop();
+      } else {
+        // Former SoapThread behaviour: everything but the last action is thrown away.
+        while (!incoming_.empty()) {
+          action = incoming_.front();
+          incoming_.pop();
+        }
+      }
+      lock.unlock();
+      send(action);
+    }
+  }
+};
+
+// A mouse-drag storm at 1 kHz: drags of 200 events with a few wheel notches and bar refreshes.
+request_counters replay(mock_device& device, int events) {
+  request_counters submitted;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < events; ++i) {
+    soap::SoapAction action;
+    const bool last = i == events - 1;
+    if (i % 200 == 199 || last) {
+      action = soap::SoapStopContinuousMoveAction();
+    } else if (i % 25 == 10) {
+      action = soap::SoapRelativeMoveAction(0.f, 0.f, 0.01f);
+    } else if (i % 50 == 30) {
+      action = soap::SoapGetStatus();
+    } else {
+      const float angle = i * 0.01f;
+      action =
+          soap::SoapStartContinuousMoveAction(std::cos(angle) * 0.5f, std::sin(angle) * 0.5f);
+    }
+    submitted.count(action);
+    device.submit(action);
+    std::this_thread::sleep_until(start + std::chrono::milliseconds(i + 1));
+  }
+  return submitted;
+}
+
+void print(const char* name, const request_counters& c, int events) {
+  std::cout << std::setw(12) << name << std::setw(10) << c.total << std::setw(10)
+            << c.total * 1000. / events << std::setw(10) << c.continuous_moves << std::setw(8)
+            << c.stops << std::setw(10) << c.relative_moves << std::setw(10) << c.zoom
+            << std::setw(10) << c.get_status << '\n';
+}
+
+}  // namespace
+
+int coalesce(const options& opts) {
+  std::cout << "Replaying " << opts.events << " input events against a mock device (rtt = "
+            << opts.rtt << " ms)\n";
+  std::cout << std::setw(12) << "" << std::setw(10) << "requests" << std::setw(10) << "per 1000"
+            << std::setw(10) << "moves" << std::setw(8) << "stops" << std::setw(10) << "rel"
+            << std::setw(10) << "zoom" << std::setw(10) << "status" << '\n';
+
+  request_counters submitted;
+  for (bool coalescing : {false, true}) {
+    mock_device device(coalescing, std::chrono::milliseconds(opts.rtt));
+    std::thread worker([&device]() { device.run(); });
+    submitted = replay(device, opts.events);
+    device.finish();
+    worker.join();
+    print(coalescing ? "coalescing" : "keep-last", device.sent(), opts.events);
+  }
+  print("submitted", submitted, opts.events);
+
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace app
@@ -0,0 +1,97 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "metrics.h"
+#include "stream_tap.h"
+
+namespace app {
+namespace bench {
+
+namespace {
+
+// A PS stream of 25 frames per second, an I frame every 50, as the SDK gives it: the system header
+// first, then a packet per frame, the I frames behind a pack header and a system header.
+constexpr size_t header_size = 40;
+constexpr size_t i_frame_size = 150 << 10;
+constexpr size_t p_frame_size = 6 << 10;
+constexpr int gop = 50;
+// The stream of two hundred cameras, to load the tap rather than wait for it.
+constexpr auto period = std::chrono::microseconds(200);
+
+std::vector<unsigned char> frame(size_t size, bool keyframe) {
+  std::vector<unsigned char> data(size, 0x5a);
+  const unsigned char pack[] = {0, 0, 1, 0xBA};
+  std::memcpy(data.data(), pack, sizeof pack);
+  if (keyframe) {
+    const unsigned char system[] = {0, 0, 1, 0xBB};
+    std::memcpy(data.data() + 20, system, sizeof system);
+  }
+  return data;
+}
+
+// Handling a packet takes `cost`.
+StreamConsumer::handler busy(std::chrono::microseconds cost) {
+  return [cost](const StreamPacket&) {
+    const auto until = std::chrono::steady_clock::now() + cost;
+    while (std::chrono::steady_clock::now() < until) {
+    }
+  };
+}
+
+}  // namespace
+
+int tap(const options& opts) {
+  const auto header = frame(header_size, false);
+  const auto i_frame = frame(i_frame_size, true);
+  const auto p_frame = frame(p_frame_size, false);
+
+  StreamTap tap;
+  tap.open();
+  // From a consumer keeping up to one that handles a packet in 25 periods.
+  StreamConsumer consumers[] = {
+      {"restreamer", StreamBackpressure::SKIP_TO_KEYFRAME, busy(std::chrono::microseconds(0))},
+      {"recorder", StreamBackpressure::SKIP_TO_KEYFRAME, busy(period / 4)},
+      {"analytics", StreamBackpressure::DROP_NEWEST, busy(period * 2)},
+      {"snapshotter", StreamBackpressure::KEEP_LATEST, busy(period * 25)}};
+  for (auto& c : consumers) {
+    c.start();
+    tap.attach(c);
+  }
+
+  std::cout << "Stream tap: " << opts.events << " packets, one per " << period.count()
+            << " us, to " << std::size(consumers) << " consumers, pool of "
+            << StreamPool::footprint() / (1 << 20) << " MiB\n";
+  const auto start = std::chrono::steady_clock::now();
+  auto next = start;
+  tap.tap(NET_DVR_SYSHEAD, header.data(), header.size());
+  for (int i = 0; i < opts.events; ++i) {
+    const auto& f = i % gop ? p_frame : i_frame;
+    tap.tap(NET_DVR_STREAMDATA, f.data(), f.size());
+    next += period;
+    std::this_thread::sleep_until(next);
+  }
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  for (auto& c : consumers) {
+    tap.detach(c);
+    c.stop();
+  }
+  tap.close();
+
+  const auto& h = metrics::of(metrics::operation::STREAM_TAP);
+  std::cout << opts.events / seconds << " packets/s, callback p50 " << h.percentile(.5)
+            << " us, p99 " << h.percentile(.99) << " us, max " << h.max() << " us\n";
+  tap.dump(std::cout);
+  for (const auto& c : consumers) c.dump(std::cout);
+
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace app
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "winheaders.h"
 
+#include <algorithm>
 #include <cmath>
 #include <functional>
 #include <future>
@@ -21,11 +22,6 @@
 namespace app {
 
 auto zoom_func = [](BGWindow* w, float zdelta) -> bool { return w->updateZPos(zdelta); };
-auto pt_func = [](BGWindow* w, float p, float t) -> bool {
-  soap::soap_thread.queue(
-      new soap::SoapStartContinuousMoveAction(soap::soap_thread, soap::do_nothing_runner, p, t));
-  return true;
-};
 
 auto zoom_accumulate = [](const std::queue<std::tuple<float>>& q) -> std::tuple<float> {
   float z_total = 0;
@@ -39,16 +35,21 @@ auto zoom_accumulate = [](const std::queue<std::tuple<float>>& q) -> std::tuple<
   return std::make_tuple(z_total);
 };
 
-auto pt_accumulate = [](const std::queue<std::tuple<float, float>>& q) -> std::tuple<float, float> {
-  return q.back();
-};
-
 BGWindow::BGWindow()
     : m_dwnd(nullptr),
       m_onDraw(false),
       update_z_thread_(std::bind(zoom_func, this, std::placeholders::_1), zoom_accumulate),
-      update_pt_thread_(std::bind(pt_func, this, std::placeholders::_1, std::placeholders::_2),
-                        pt_accumulate) {}
+      pt_backend_(PTZBackend::create(config.ptz_backend, config.uid[0], config.channel,
+                                     [this](bool stopped) { pt_move_stopped(stopped); })),
+      pt_control_([this](float p, float t) { return pt_backend_->move(p, t); }, config.ptz_rate),
+      stop_attempts_(0),
+      boxing_(false),
+      box_from_{},
+      box_{},
+      framing_{} {
+  if (!config.fov_table.empty())
+    fov_.load(config.fov_table, soap::soap_thread.device_info()->model);
+}
 BGWindow::~BGWindow() {}
 
 const MainWindow* BGWindow::DrawingWindow() const { return this->m_dwnd; }
@@ -69,7 +70,7 @@ LRESULT BGWindow::HandleMessage(UINT uMsg, WPARAM wParam, LPARAM lParam) {
   switch (uMsg) {
     case WM_CREATE: {
       update_z_thread_.run();
-      update_pt_thread_.run();
+      pt_control_.run();
       return 0;
     }
 
@@ -109,15 +110,24 @@ LRESULT BGWindow::HandleMessage(UINT uMsg, WPARAM wParam, LPARAM lParam) {
     case WM_LBUTTONDOWN: {
       setOnDraw(true);
       ::SetCapture(this->Window());
+      // The drag ends with a Stop of its own.
+      ::KillTimer(this->Window(), stop_timer);
       if (onDraw() && this->DrawingWindow()) {
-        start_pt_move_thread_wrapper();
+        pt_control_.press();
+        sample_pt_vector();
       }
 
       return 0;
     }
 
     case WM_MOUSEMOVE: {
-      if (onDraw()) start_pt_move_thread_wrapper();
+      if (onDraw()) sample_pt_vector();
+      if (boxing_) {
+        const POINT p = {GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam)};
+        box_ = {std::min(box_from_.x, p.x), std::min(box_from_.y, p.y), std::max(box_from_.x, p.x),
+                std::max(box_from_.y, p.y)};
+        if (this->DrawingWindow()) this->DrawingWindow()->SetBox(box_);
+      }
 
       return 0;
     }
@@ -126,14 +136,49 @@ LRESULT BGWindow::HandleMessage(UINT uMsg, WPARAM wParam, LPARAM lParam) {
       if (onDraw() && this->DrawingWindow())
         ::InvalidateRgn(this->DrawingWindow()->Window(), nullptr, true);
 
-      soap::soap_thread.queue(
-          new soap::SoapStopContinuousMoveAction(soap::soap_thread, *this));
+      pt_control_.release();
+      stop_attempts_ = 0;
+      stopPTMove();
       setOnDraw(false);
       ::ReleaseCapture();
 
       return 0;
     }
 
+    case WM_RBUTTONDOWN: {
+      if (onDraw()) return 0;
+      boxing_ = true;
+      box_from_ = {GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam)};
+      box_ = {box_from_.x, box_from_.y, box_from_.x, box_from_.y};
+      ::SetCapture(this->Window());
+
+      return 0;
+    }
+
+    case WM_RBUTTONUP: {
+      if (!boxing_) return 0;
+      boxing_ = false;
+      ::ReleaseCapture();
+      if (this->DrawingWindow()) this->DrawingWindow()->SetBox(RECT{});
+      frame(box_);
+
+      return 0;
+    }
+
+    case WM_TIMER: {
+      if (wParam != stop_timer) break;
+      stopPTMove();
+
+      return 0;
+    }
+
+    case stop_failed_message: {
+      // A new drag ends with a Stop of its own.
+      if (!onDraw()) retry_stop();
+
+      return 0;
+    }
+
     case WM_MOUSEWHEEL: {
       auto zDelta = GET_WHEEL_DELTA_WPARAM(wParam);
       update_z_thread_.queue(zDelta);
@@ -145,6 +190,26 @@ LRESULT BGWindow::HandleMessage(UINT uMsg, WPARAM wParam, LPARAM lParam) {
   return DefWindowProc(this->Window(), uMsg, wParam, lParam);
 }
 
+bool BGWindow::stopPTMove() {
+  if (pt_backend_->stop()) {
+    ::KillTimer(this->Window(), stop_timer);
+    return true;
+  }
+  retry_stop();
+  return false;
+}
+
+void BGWindow::retry_stop() {
+  if (++stop_attempts_ < stop_retries) {
+    clog.log("BGWindow::retry_stop: stop refused, retrying, attempt ", stop_attempts_);
+    ::SetTimer(this->Window(), stop_timer, stop_retry_interval, nullptr);
+    return;
+  }
+  ::KillTimer(this->Window(), stop_timer);
+  std::cerr << "Could not stop the camera: the " << pt_backend_->name() << " backend refused "
+            << stop_retries << " stop requests\n";
+}
+
 bool BGWindow::updateZPos(int zDelta) {
   if (zDelta == 0) return true;
 
@@ -155,14 +220,18 @@ bool BGWindow::updateZPos(int zDelta) {
   clog.log("BGWindow::updateZPos: final dz = ", d);
 
   update_z_thread_.block_process();
-  const auto action = new soap::SoapRelativeMoveAction(soap::soap_thread, *this, 0.f, 0.f, d);
-  soap::soap_thread.queue(action);
+  const auto action = soap::SoapRelativeMoveAction(
+      0.f, 0.f, d, soap::callback<&BGWindow::soap_relative_move_is_done>(*this));
+  if (!soap::soap_thread.queue(action)) {
+    // The action will never complete: don't leave the zoom thread blocked on it.
+    update_z_thread_.unblock_process();
+    return false;
+  }
 
   return true;
 }
 
-bool BGWindow::start_pt_move_thread_wrapper() {
-  clog.log("start_pt_move_thread_wrapper: Invoked");
+bool BGWindow::sample_pt_vector() {
   RECT rect;
   ::GetClientRect(this->Window(), &rect);
 
@@ -172,36 +241,104 @@ bool BGWindow::start_pt_move_thread_wrapper() {
 
   if (p.x < rect.left || p.x >= rect.right || p.y < rect.top || p.y >= rect.bottom) return false;
 
-  clog.log("start_pt_move_thread_wrapper: position changed.");
   const auto lx = rect.right - rect.left;
   const auto ly = rect.bottom - rect.top;
   const auto dx = 2 * ((p.x - lx / 2) * 1. / lx);
   const auto dy = 2 * -((p.y - ly / 2) * 1. / ly);
-  clog.log("Queueing [dp=", dx, ", dt=", dy, "]");
-  soap::soap_thread.queue(
-      new soap::SoapStartContinuousMoveAction(soap::soap_thread, *this, dx, dy));
+  pt_control_.input(dx, dy);
   return true;
 }
 
-void BGWindow::soap_absolute_move_is_done(soap::SoapAbsoluteMove* action) {
+void BGWindow::set_field_of_view(const FieldOfView& fov) {
+  std::lock_guard<std::mutex> lock(fov_mx_);
+  fov_ = fov;
+}
+
+// Framed at once when the PTZ state knows the zoom position, once it is read otherwise.
+void BGWindow::frame(const RECT& box) {
+  RECT client;
+  ::GetClientRect(this->Window(), &client);
+  const framing f = {box, client.right - client.left, client.bottom - client.top};
+  if (f.width <= 0 || f.height <= 0) return;
+
+  soap::SoapPTZState::position p;
+  if (soap::soap_thread.ptz_state().estimate(std::chrono::steady_clock::now(), p)) {
+    frame(f, p.zoom);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(fov_mx_);
+    framing_ = f;
+  }
+  soap::soap_thread.queue(
+      soap::SoapGetStatus(soap::callback<&BGWindow::frame_status_is_done>(*this)),
+      OverflowPolicy::REJECT);
+}
+
+// A single RelativeMove: the center of the box to the center of the video, and, for a box rather
+// than a click, the zoom at which the box fills the video.
+void BGWindow::frame(const framing& f, float zoom) {
+  const auto box_width = f.box.right - f.box.left;
+  const auto box_height = f.box.bottom - f.box.top;
+  const bool click = box_width <= click_tolerance && box_height <= click_tolerance;
+  float pan, tilt;
+  float dz = 0.f;
+  {
+    std::lock_guard<std::mutex> lock(fov_mx_);
+    if (!fov_.at(zoom, pan, tilt)) {
+      std::cerr << "No field of view calibrated for the model "
+                << soap::soap_thread.device_info()->model << ": run get with --calibrate-fov\n";
+      return;
+    }
+    const float scale = std::max(box_width * 1.f / f.width, box_height * 1.f / f.height);
+    float to;
+    if (!click && fov_.zoom_for(std::abs(pan) * scale, to)) dz = to - zoom;
+  }
+  // Offset of the center of the box from the center of the video, in widths and heights.
+  const float x = ((f.box.left + f.box.right) / 2.f - f.width / 2.f) / f.width;
+  const float y = ((f.box.top + f.box.bottom) / 2.f - f.height / 2.f) / f.height;
+  const soap::PTZLimits limits = soap::soap_thread.device_info()->ptz_limits;
+  clog.log("BGWindow::frame: offset [", x, ", ", y, "] at zoom ", zoom, ", zoom by ", dz);
+  soap::soap_thread.queue(soap::SoapRelativeMoveAction(
+      x * pan * (limits.pan_max - limits.pan_min), y * tilt * (limits.tilt_max - limits.tilt_min),
+      dz * (limits.zoom_max - limits.zoom_min),
+      soap::callback<&BGWindow::framed_is_done>(*this)));
+}
+
+void BGWindow::frame_status_is_done(const soap::SoapGetStatus& action) {
+  // Without the zoom, the move would be computed for the widest one.
+  if (!action.ok()) {
+    std::cerr << "Could not frame the box: the status read was not done: "
+              << soap::name(action.outcome()) << '\n';
+    return;
+  }
+  framing f;
+  {
+    std::lock_guard<std::mutex> lock(fov_mx_);
+    f = framing_;
+  }
+  frame(f, action.zoom());
+}
+
+void BGWindow::framed_is_done(const soap::SoapRelativeMoveAction& action) {
+  clog.log("BGWindow::framed_is_done");
   globalwin_->refresh_bars();
-  clog.log("BGWindow::soap_absolute_move_is_done");
 }
 
-void BGWindow::soap_relative_move_is_done(soap::SoapRelativeMoveAction* action) {
+void BGWindow::soap_relative_move_is_done(const soap::SoapRelativeMoveAction& action) {
   clog.log("BGWindow::soap_relative_move_is_done");
   update_z_thread_.unblock_process();
 }
 
-void BGWindow::start_continuous_move_is_done(soap::SoapStartContinuousMoveAction* action) {
-  clog.log("BGWindow::start_continuous_move_is_done: start");
-  clog.log("BGWindow::start_continuous_move_is_done: done");
-}
-
-void BGWindow::stop_continuous_move_is_done(soap::SoapStopContinuousMoveAction* action) {
-  clog.log("BGWindow::stop_continuous_move_is_done: start");
+void BGWindow::pt_move_stopped(bool stopped) {
+  if (!stopped) {
+    // Retried from the UI thread, which owns the timer.
+    ::PostMessage(this->Window(), stop_failed_message, 0, 0);
+    return;
+  }
+  clog.log("BGWindow::pt_move_stopped: start");
   globalwin_->refresh_bars();
-  clog.log("BGWindow::stop_continuous_move_is_done: done");
+  clog.log("BGWindow::pt_move_stopped: done");
 }
 
 }  // namespace app
\ No newline at end of file
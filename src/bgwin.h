@@ -5,12 +5,16 @@
 
 #include <cstdlib>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <queue>
 
 #include "Consumer.h"
 #include "basewin.h"
+#include "field_of_view.h"
 #include "globalwin.h"
+#include "ptz_backend.h"
+#include "ptz_control.h"
 #include "soap.h"
 #include "util.h"
 #include "win.h"
@@ -20,19 +24,46 @@ namespace app {
 class MainWindow;
 class GlobalWindow;
 
-class BGWindow : public BaseWindow<BGWindow>, public soap::SoapActionRunnerAdapter {
+class BGWindow : public BaseWindow<BGWindow> {
   GlobalWindow* globalwin_;
   MainWindow* m_dwnd;
   bool m_onDraw;
   std::mutex m_lock;
   Consumer<std::function<bool(float)>, std::function<std::tuple<float>(const std::queue<std::tuple<float>>&)>, float> update_z_thread_;
-  Consumer<std::function<bool(float, float)>, std::function<std::tuple<float, float>(const std::queue<std::tuple<float, float>>&)>, float,
-           float>
-      update_pt_thread_;
+  std::unique_ptr<PTZBackend> pt_backend_;
+  PTZControlLoop pt_control_;
+  // A Stop the backend refused is sent again on a timer, a few times before giving up.
+  static constexpr UINT_PTR stop_timer = 1;
+  static constexpr UINT stop_retry_interval = 50;  // ms
+  static constexpr int stop_retries = 20;
+  // Posted by pt_move_stopped() when the device did not stop.
+  static constexpr UINT stop_failed_message = WM_APP;
+  int stop_attempts_;
+
+  // Schedules another Stop, until stop_retries were refused.
+  void retry_stop();
+
+  // A right click centers the video on the point, a right drag frames the box.
+  struct framing {
+    RECT box;  // client coordinates
+    LONG width;
+    LONG height;
+  };
+  static constexpr LONG click_tolerance = 8;  // pixels a click may move by
+  bool boxing_;
+  POINT box_from_;
+  RECT box_;
+  std::mutex fov_mx_;  // fov_ and framing_, from the UI thread and the SoapThread
+  FieldOfView fov_;
+  framing framing_;  // waiting for the zoom position
 
   void setOnDraw(bool onDraw);
 
-  bool start_pt_move_thread_wrapper();
+  void frame(const RECT& box);
+  void frame(const framing& f, float zoom);
+
+  // Gives the control loop the vector from the center of the video to the cursor.
+  bool sample_pt_vector();
 
  public:
   BGWindow();
@@ -48,16 +79,24 @@ class BGWindow : public BaseWindow<BGWindow>, public soap::SoapActionRunnerAdapt
   const GlobalWindow* globlawin() const { return globalwin_; }
   GlobalWindow*& globalwin() { return globalwin_; }
 
+  // Stops the drag, retrying on stop_timer while the backend refuses to.
   bool stopPTMove();
 
+  PTZControlLoop& pt_control() { return pt_control_; }
+  PTZBackend& pt_backend() { return *pt_backend_; }
+
+  // Thread safe, e.g. once calibrated.
+  void set_field_of_view(const FieldOfView& fov);
+
   bool updateZPos(int zDelta);
 
   LRESULT HandleMessage(UINT uMsg, WPARAM wParam, LPARAM lParam);
 
-  virtual void soap_absolute_move_is_done(soap::SoapAbsoluteMove* action) override;
-  virtual void soap_relative_move_is_done(soap::SoapRelativeMoveAction* action) override;
-  virtual void start_continuous_move_is_done(soap::SoapStartContinuousMoveAction* action) override;
-  virtual void stop_continuous_move_is_done(soap::SoapStopContinuousMoveAction* action) override;
+  void soap_relative_move_is_done(const soap::SoapRelativeMoveAction& action);
+  void frame_status_is_done(const soap::SoapGetStatus& action);
+  void framed_is_done(const soap::SoapRelativeMoveAction& action);
+  // From a thread of the PTZ backend, once told to stop a drag.
+  void pt_move_stopped(bool stopped);
 };
 
 }  // namespace app
@@ -0,0 +1,150 @@
+#include "catalog.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "util.h"
+
+namespace app {
+
+namespace {
+
+constexpr char magic[4] = {'H', 'L', 'V', 'C'};
+constexpr uint32_t version = 1;
+
+}  // namespace
+
+std::string segment_name(uint32_t segment) {
+  std::ostringstream ss;
+  ss << "segment-" << std::setw(8) << std::setfill('0') << segment << ".mp4";
+  return ss.str();
+}
+
+/******************************************************************************\
+ *
+ *	CatalogWriter
+ *
+ \******************************************************************************/
+
+CatalogWriter::CatalogWriter() : file_(INVALID_HANDLE_VALUE) {}
+
+CatalogWriter::~CatalogWriter() { close(); }
+
+bool CatalogWriter::open(const std::string& path, std::chrono::seconds segment_duration) {
+  close();
+  file_ = ::CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    std::cerr << "Could not create " << path << ": " << winErrorStr(::GetLastError()) << '\n';
+    return false;
+  }
+  path_ = path;
+  catalog_header header;
+  std::memcpy(header.magic, magic, sizeof magic);
+  header.version = version;
+  header.entry_size = sizeof(catalog_entry);
+  header.segment_duration = static_cast<uint32_t>(segment_duration.count());
+  DWORD written = 0;
+  if (!::WriteFile(file_, &header, sizeof header, &written, nullptr) || written != sizeof header) {
+    std::cerr << "Could not write to " << path_ << ": " << winErrorStr(::GetLastError()) << '\n';
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool CatalogWriter::append(const catalog_entry& entry) {
+  DWORD written = 0;
+  if (!::WriteFile(file_, &entry, sizeof entry, &written, nullptr) || written != sizeof entry) {
+    std::cerr << "Could not write to " << path_ << ": " << winErrorStr(::GetLastError()) << '\n';
+    return false;
+  }
+  return true;
+}
+
+void CatalogWriter::close() {
+  if (!is_open()) return;
+  ::CloseHandle(file_);
+  file_ = INVALID_HANDLE_VALUE;
+}
+
+/******************************************************************************\
+ *
+ *	Catalog
+ *
+ \******************************************************************************/
+
+Catalog::Catalog()
+    : file_(INVALID_HANDLE_VALUE),
+      mapping_(nullptr),
+      view_(nullptr),
+      entries_(nullptr),
+      size_(0) {}
+
+Catalog::~Catalog() { close(); }
+
+bool Catalog::open(const std::string& directory) {
+  close();
+  const auto path = (std::filesystem::path(directory) / catalog_name).string();
+  // Shared for writing: the recording may go on.
+  file_ = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    std::cerr << "Could not open " << path << ": " << winErrorStr(::GetLastError()) << '\n';
+    return false;
+  }
+  LARGE_INTEGER size;
+  if (!::GetFileSizeEx(file_, &size) || size.QuadPart < LONGLONG(sizeof(catalog_header))) {
+    std::cerr << path << " is not a catalog\n";
+    close();
+    return false;
+  }
+  mapping_ = ::CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping_) view_ = ::MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+  if (!view_) {
+    std::cerr << "Could not map " << path << ": " << winErrorStr(::GetLastError()) << '\n';
+    close();
+    return false;
+  }
+  const auto* header = static_cast<const catalog_header*>(view_);
+  if (std::memcmp(header->magic, magic, sizeof magic) || header->version != version ||
+      header->entry_size != sizeof(catalog_entry)) {
+    std::cerr << path << " is not a catalog of version " << version << '\n';
+    close();
+    return false;
+  }
+  directory_ = directory;
+  entries_ = reinterpret_cast<const catalog_entry*>(header + 1);
+  // An entry being appended is left out.
+  size_ = static_cast<size_t>((size.QuadPart - sizeof(catalog_header)) / sizeof(catalog_entry));
+  return true;
+}
+
+void Catalog::close() {
+  if (view_) ::UnmapViewOfFile(view_);
+  if (mapping_) ::CloseHandle(mapping_);
+  if (file_ != INVALID_HANDLE_VALUE) ::CloseHandle(file_);
+  file_ = INVALID_HANDLE_VALUE;
+  mapping_ = nullptr;
+  view_ = nullptr;
+  entries_ = nullptr;
+  size_ = 0;
+}
+
+bool Catalog::find(int64_t time, catalog_position& position) const {
+  const auto it = std::upper_bound(begin(), end(), time,
+                                   [](int64_t t, const catalog_entry& e) { return t < e.time; });
+  if (it == begin()) return false;
+  const auto& entry = *(it - 1);
+  position.path = (std::filesystem::path(directory_) / segment_name(entry.segment)).string();
+  position.time = entry.time;
+  position.offset = entry.offset;
+  position.size = it != end() && it->segment == entry.segment ? it->offset - entry.offset : 0;
+  return true;
+}
+
+}  // namespace app
\ No newline at end of file
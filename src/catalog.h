@@ -0,0 +1,94 @@
+#ifndef DEF_CATALOG_H
+#define DEF_CATALOG_H
+
+#include "winheaders.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace app {
+
+// The catalog of a segmented recording: a header, then an entry per fragment starting with a
+// keyframe, in the order they were recorded, that of their times. The file is mapped as is by
+// the readers (little-endian, as the writer wrote it).
+struct catalog_header {
+  char magic[4];  // "HLVC"
+  uint32_t version;
+  uint32_t entry_size;
+  uint32_t segment_duration;  // s
+};
+
+struct catalog_entry {
+  int64_t time;     // ms since 1970-01-01 UTC, of the keyframe
+  uint64_t offset;  // of the fragment in its segment
+  uint32_t segment;
+  uint32_t reserved;
+};
+static_assert(sizeof(catalog_header) == 16 && sizeof(catalog_entry) == 24,
+              "The catalog layout is that of the files");
+
+// The file name of a segment of the recording, next to its catalog.
+std::string segment_name(uint32_t segment);
+constexpr const char* catalog_name = "catalog.hlvc";
+
+// Appends the entries as the fragments are queued for writing: an entry may reference bytes a
+// crash prevented from being written, the readers checking what they read.
+class CatalogWriter {
+  HANDLE file_;
+  std::string path_;
+
+ public:
+  CatalogWriter();
+  CatalogWriter(const CatalogWriter&) = delete;
+  CatalogWriter& operator=(const CatalogWriter&) = delete;
+  ~CatalogWriter();
+
+  // Creates `path` with its header, replacing any.
+  bool open(const std::string& path, std::chrono::seconds segment_duration);
+  bool is_open() const { return file_ != INVALID_HANDLE_VALUE; }
+  bool append(const catalog_entry& entry);
+  void close();
+};
+
+// Where to read a recording from to play it at a time: the fragment of the keyframe at or just
+// before it, up to the next entry of its segment, the whole rest of the segment when size is 0.
+// The init segment, at the start of the segment, comes before the first fragment.
+struct catalog_position {
+  std::string path;
+  int64_t time;  // of the keyframe
+  uint64_t offset;
+  uint64_t size;
+};
+
+// A catalog mapped read-only, as it was when opened: find() is a binary search of its entries.
+class Catalog {
+  std::string directory_;
+  HANDLE file_;
+  HANDLE mapping_;
+  const void* view_;
+  const catalog_entry* entries_;
+  size_t size_;
+
+ public:
+  Catalog();
+  Catalog(const Catalog&) = delete;
+  Catalog& operator=(const Catalog&) = delete;
+  ~Catalog();
+
+  // The catalog of the recording in `directory`, possibly being recorded.
+  bool open(const std::string& directory);
+  void close();
+
+  const catalog_entry* begin() const { return entries_; }
+  const catalog_entry* end() const { return entries_ + size_; }
+  size_t size() const { return size_; }
+
+  // False when `time` (ms since 1970-01-01 UTC) is before the first keyframe.
+  bool find(int64_t time, catalog_position& position) const;
+};
+
+}  // namespace app
+
+#endif
\ No newline at end of file
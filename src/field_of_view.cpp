@@ -0,0 +1,287 @@
+#include "field_of_view.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+#include "HCNetSDK.h"
+
+#include "soap.h"
+#include "synchronized_ostream.h"
+
+namespace app {
+
+namespace {
+
+// Below this variance (in gray levels squared) a frame has nothing to match, e.g. a plain wall.
+constexpr double min_variance = 16.;
+
+// Moves to a position of the trackbars, and waits for the device to answer.
+bool move_to(float pan, float tilt, float zoom) {
+  using Completion = soap::SoapCompletion<soap::SoapAbsoluteMove>;
+  Completion moved;
+  if (!soap::soap_thread.queue(
+          soap::SoapAbsoluteMove(std::max(0.f, std::min(1.f, pan)),
+                                 std::max(0.f, std::min(1.f, tilt)), zoom,
+                                 soap::callback<&Completion::done>(moved)))) {
+    std::cerr << "FieldOfView: could not queue the move\n";
+    return false;
+  }
+  if (const auto& move = moved.wait(); !move.ok()) {
+    std::cerr << "FieldOfView: the move was not done: " << soap::name(move.outcome()) << '\n';
+    return false;
+  }
+  return true;
+}
+
+bool read(soap::SoapPTZState::position& p) {
+  using Completion = soap::SoapCompletion<soap::SoapGetStatus>;
+  Completion read;
+  if (!soap::soap_thread.queue(soap::SoapGetStatus(soap::callback<&Completion::done>(read)))) {
+    std::cerr << "FieldOfView: could not queue the status read\n";
+    return false;
+  }
+  const soap::SoapGetStatus& status = read.wait();
+  // Only a status the device answered holds a position.
+  if (!status.ok()) {
+    std::cerr << "FieldOfView: the status read was not done: " << soap::name(status.outcome())
+              << '\n';
+    return false;
+  }
+  p = {status.pan(), status.tilt(), status.zoom()};
+  return true;
+}
+
+// Waits until two reads in a row agree, then for the video to show the device standing still.
+bool settle(const std::atomic<bool>& cancel) {
+  soap::SoapPTZState::position last;
+  if (!read(last)) return false;
+  const auto deadline = std::chrono::steady_clock::now() + FieldOfView::settle_timeout;
+  while (!cancel && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(FieldOfView::settle_poll);
+    soap::SoapPTZState::position p;
+    if (!read(p)) return false;
+    if (p.pan == last.pan && p.tilt == last.tilt && p.zoom == last.zoom) {
+      std::this_thread::sleep_for(FieldOfView::stream_delay);
+      return true;
+    }
+    last = p;
+  }
+  return false;
+}
+
+}  // namespace
+
+void FieldOfView::add(const sample& s) {
+  auto at = std::lower_bound(table_.begin(), table_.end(), s.zoom,
+                             [](const sample& x, float zoom) { return x.zoom < zoom; });
+  if (at != table_.end() && at->zoom == s.zoom)
+    *at = s;
+  else
+    table_.insert(at, s);
+}
+
+bool FieldOfView::at(float zoom, float& pan, float& tilt) const {
+  if (!calibrated()) return false;
+  auto upper = std::lower_bound(table_.begin(), table_.end(), zoom,
+                                [](const sample& x, float z) { return x.zoom < z; });
+  if (upper == table_.begin()) ++upper;
+  if (upper == table_.end()) --upper;
+  const auto lower = upper - 1;
+  const float x =
+      std::max(0.f, std::min(1.f, (zoom - lower->zoom) / (upper->zoom - lower->zoom)));
+  const auto geometric = [x](float a, float b) {
+    return std::copysign(
+        std::exp(std::log(std::abs(a)) + x * (std::log(std::abs(b)) - std::log(std::abs(a)))), a);
+  };
+  pan = geometric(lower->pan, upper->pan);
+  tilt = geometric(lower->tilt, upper->tilt);
+  return true;
+}
+
+bool FieldOfView::zoom_for(float pan, float& zoom) const {
+  if (!calibrated()) return false;
+  pan = std::abs(pan);
+  if (pan >= std::abs(table_.front().pan)) {
+    zoom = table_.front().zoom;
+    return true;
+  }
+  for (size_t i = 1; i < table_.size(); ++i) {
+    const float wide = std::abs(table_[i - 1].pan);
+    const float narrow = std::abs(table_[i].pan);
+    if (pan < narrow || wide == narrow) continue;
+    const float x = std::log(pan / wide) / std::log(narrow / wide);
+    zoom = table_[i - 1].zoom + x * (table_[i].zoom - table_[i - 1].zoom);
+    return true;
+  }
+  zoom = table_.back().zoom;
+  return true;
+}
+
+bool FieldOfView::load(const std::string& path, const std::string& model) {
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string entry_model;
+    if (!std::getline(fields, entry_model, '\t') || entry_model != model) continue;
+    FieldOfView entry;
+    sample s;
+    while (fields >> s.zoom >> s.pan >> s.tilt)
+      if (s.pan != 0.f && s.tilt != 0.f) entry.add(s);
+    if (!entry.calibrated()) return false;
+    table_ = entry.table_;
+    return true;
+  }
+  return false;
+}
+
+bool FieldOfView::save(const std::string& path, const std::string& model) const {
+  std::vector<std::string> lines;
+  {
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+      if (line.compare(0, model.size() + 1, model + '\t')) lines.push_back(line);
+  }
+  std::ostringstream entry;
+  entry << model << '\t' << std::setprecision(6);
+  for (const auto& s : table_) entry << ' ' << s.zoom << ' ' << s.pan << ' ' << s.tilt;
+  lines.push_back(entry.str());
+
+  std::ofstream out(path, std::ios::trunc);
+  for (const auto& line : lines) out << line << '\n';
+  return static_cast<bool>(out);
+}
+
+bool FieldOfView::calibrate(const grab_function& grab, const std::atomic<bool>& cancel) {
+  soap::SoapPTZState::position start;
+  if (!read(start)) return false;
+  // The calibration moves head for the middle of the ranges, away from their ends.
+  const float way[2] = {start.pan < 0.5f ? 1.f : -1.f, start.tilt < 0.5f ? 1.f : -1.f};
+  // Distances across the video, pan then tilt, first guessed for a wide angle lens, then those of
+  // the previous zoom, which are larger.
+  float guess[2] = {0.2f, 0.3f};
+
+  FieldOfView measured_table;
+  for (const float zoom : calibration_zooms) {
+    float measured[2] = {0.f, 0.f};
+    for (int axis = 0; axis < 2 && !cancel; ++axis) {
+      for (int attempt = 0; attempt < calibration_attempts && !cancel; ++attempt) {
+        const float d = way[axis] * std::min(0.25f, guess[axis] * calibration_shift);
+        gray_frame a, b;
+        if (!move_to(start.pan, start.tilt, zoom) || !settle(cancel) || !grab(a) ||
+            !move_to(start.pan + (axis ? 0.f : d), start.tilt + (axis ? d : 0.f), zoom) ||
+            !settle(cancel) || !grab(b)) {
+          move_to(start.pan, start.tilt, start.zoom);
+          return false;
+        }
+        int pixels;
+        if (!shift(a, b, axis == 1, pixels)) {
+          // Moved too far, or nothing to match: tried again closer.
+          guess[axis] /= 2.f;
+          continue;
+        }
+        if (std::abs(pixels) < min_shift) {
+          guess[axis] *= 2.f;
+          continue;
+        }
+        measured[axis] = -d * (axis ? a.height : a.width) / pixels;
+        guess[axis] = std::abs(measured[axis]);
+        break;
+      }
+    }
+    if (cancel) break;
+    clog.log("FieldOfView::calibrate: zoom ", zoom, ": pan ", measured[0], ", tilt ", measured[1]);
+    if (measured[0] != 0.f && measured[1] != 0.f)
+      measured_table.add({zoom, measured[0], measured[1]});
+    else
+      std::cerr << "FieldOfView: could not measure the field of view at zoom " << zoom << '\n';
+  }
+  move_to(start.pan, start.tilt, start.zoom);
+  if (cancel || !measured_table.calibrated()) return false;
+  table_ = measured_table.table_;
+  return true;
+}
+
+bool FieldOfView::shift(const gray_frame& a, const gray_frame& b, bool vertical, int& pixels) {
+  if (a.width != b.width || a.height != b.height || a.pixels.empty()) return false;
+  double sum = 0., squares = 0.;
+  for (const unsigned char p : a.pixels) {
+    sum += p;
+    squares += static_cast<double>(p) * p;
+  }
+  const double mean = sum / a.pixels.size();
+  if (squares / a.pixels.size() - mean * mean < min_variance) return false;
+
+  // b(x) = a(x - s) for a picture that moved by s.
+  const int max = (vertical ? a.height : a.width) / 3;
+  double best = std::numeric_limits<double>::max();
+  int best_shift = 0;
+  for (int s = -max; s <= max; ++s) {
+    const int dx = vertical ? 0 : s;
+    const int dy = vertical ? s : 0;
+    unsigned long long difference = 0, count = 0;
+    for (int y = std::max(0, dy); y < std::min(a.height, a.height + dy); ++y)
+      for (int x = std::max(0, dx); x < std::min(a.width, a.width + dx); ++x) {
+        difference += std::abs(b.at(x, y) - a.at(x - dx, y - dy));
+        ++count;
+      }
+    const double mean_difference = static_cast<double>(difference) / count;
+    if (mean_difference < best) {
+      best = mean_difference;
+      best_shift = s;
+    }
+  }
+  if (std::abs(best_shift) == max) return false;
+  pixels = best_shift;
+  return true;
+}
+
+bool FieldOfView::capture(LONG real_play_handle, gray_frame& frame) {
+  // Large enough for a 4K picture at 32 bits per pixel.
+  static constexpr DWORD capacity = 3840 * 2160 * 4 + 1024;
+  std::vector<char> bmp(capacity);
+  DWORD size = 0;
+  if (!::NET_DVR_SetCapturePictureMode(BMP_MODE) ||
+      !::NET_DVR_CapturePictureBlock_New(real_play_handle, bmp.data(), capacity, &size)) {
+    std::cerr << "FieldOfView: could not capture a frame: " << ::NET_DVR_GetErrorMsg() << '\n';
+    return false;
+  }
+  if (size < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER)) return false;
+  const auto& file = *reinterpret_cast<const BITMAPFILEHEADER*>(bmp.data());
+  const auto& info = *reinterpret_cast<const BITMAPINFOHEADER*>(bmp.data() + sizeof file);
+  if (file.bfType != 0x4D42 || (info.biBitCount != 24 && info.biBitCount != 32)) return false;
+  const int width = info.biWidth;
+  const int height = std::abs(info.biHeight);
+  const size_t stride = (static_cast<size_t>(width) * info.biBitCount + 31) / 32 * 4;
+  if (width <= 0 || file.bfOffBits + stride * height > size) return false;
+  const unsigned char* data = reinterpret_cast<const unsigned char*>(bmp.data()) + file.bfOffBits;
+  const int bytes = info.biBitCount / 8;
+
+  // Every pixel of the frame averages a scale x scale block of the picture.
+  const int scale = std::max(1, (width + frame_width - 1) / frame_width);
+  frame.width = width / scale;
+  frame.height = height / scale;
+  frame.pixels.resize(static_cast<size_t>(frame.width) * frame.height);
+  for (int y = 0; y < frame.height; ++y)
+    for (int x = 0; x < frame.width; ++x) {
+      unsigned gray = 0;
+      for (int j = 0; j < scale; ++j) {
+        const int row = info.biHeight > 0 ? height - 1 - (y * scale + j) : y * scale + j;
+        const unsigned char* pixel = data + row * stride + static_cast<size_t>(x) * scale * bytes;
+        for (int i = 0; i < scale; ++i, pixel += bytes)
+          gray += (29 * pixel[0] + 150 * pixel[1] + 77 * pixel[2]) >> 8;  // BGR
+      }
+      frame.pixels[static_cast<size_t>(y) * frame.width + x] =
+          static_cast<unsigned char>(gray / (scale * scale));
+    }
+  return true;
+}
+
+}  // namespace app
\ No newline at end of file
@@ -0,0 +1,86 @@
+#ifndef DEF_FIELD_OF_VIEW_H
+#define DEF_FIELD_OF_VIEW_H
+
+#include "winheaders.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace app {
+
+// A grayscale frame of the video, downscaled for the calibration.
+struct gray_frame {
+  int width;
+  int height;
+  std::vector<unsigned char> pixels;  // rows top to bottom
+
+  unsigned char at(int x, int y) const { return pixels[static_cast<size_t>(y) * width + x]; }
+};
+
+// How much of the pan and tilt ranges the video covers as the zoom changes, so that a point of the
+// video is brought to its center, or a box of it made to fill the video, by a single move. A
+// sample gives, at a zoom position in [0, 1], the pan (tilt) distance in [0, 1] of the trackbars
+// that moves the picture by its width (height), signed: a point right of (below) the center is
+// centered by moving its offset times this distance. The field of view shrinks as the
+// magnification grows, about geometrically with the zoom position: it is interpolated in log
+// between the samples.
+class FieldOfView {
+ public:
+  struct sample {
+    float zoom;
+    float pan;
+    float tilt;
+  };
+
+  // The calibration measures the table at these zoom positions.
+  static constexpr std::array<float, 5> calibration_zooms = {0.f, 0.25f, 0.5f, 0.75f, 1.f};
+  // Part of the picture a calibration move shifts it by: large enough to be measured to a few
+  // percent, small enough to leave most of the picture in both frames.
+  static constexpr float calibration_shift = 0.125f;
+  static constexpr int calibration_attempts = 4;
+  static constexpr int frame_width = 320;  // of the frames compared
+  static constexpr int min_shift = 8;      // pixels of a frame_width frame
+  static constexpr std::chrono::milliseconds settle_poll{250};
+  static constexpr std::chrono::milliseconds settle_timeout{10000};
+  // From the device standing still to the frame showing it: the latency of the stream.
+  static constexpr std::chrono::milliseconds stream_delay{700};
+
+  using grab_function = std::function<bool(gray_frame&)>;
+
+ private:
+  std::vector<sample> table_;  // by zoom
+
+ public:
+  bool calibrated() const { return table_.size() >= 2; }
+  const std::vector<sample>& samples() const { return table_; }
+  void add(const sample& s);
+
+  // The signed distances across the video at `zoom`.
+  bool at(float zoom, float& pan, float& tilt) const;
+  // The zoom position at which the video is `pan` wide (unsigned), clamped to [0, 1].
+  bool zoom_for(float pan, float& zoom) const;
+
+  // One line per camera model: the model, then zoom, pan and tilt for each sample.
+  bool load(const std::string& path, const std::string& model);
+  bool save(const std::string& path, const std::string& model) const;
+
+  // Measures the table from the current pan and tilt of the device: at each of calibration_zooms,
+  // grabs a frame, pans, grabs another one, and measures how far the picture moved, then the same
+  // for the tilt. The device is moved back where it was once done, or `cancel` set.
+  bool calibrate(const grab_function& grab, const std::atomic<bool>& cancel);
+
+  // The shift of `b` against `a` along x, or y when `vertical`: the one with the lowest mean
+  // absolute difference over the overlap, false when there is no texture to match, or when the
+  // picture moved too far to tell.
+  static bool shift(const gray_frame& a, const gray_frame& b, bool vertical, int& pixels);
+  // A frame of the live view, downscaled to frame_width.
+  static bool capture(LONG real_play_handle, gray_frame& frame);
+};
+
+}  // namespace app
+
+#endif
\ No newline at end of file
@@ -0,0 +1,275 @@
+#include "fmp4.h"
+
+#include <cstring>
+#include <utility>
+
+namespace app {
+namespace mp4 {
+
+namespace {
+
+constexpr uint32_t track_id = 1;
+
+// sample_flags of the trun: sample_depends_on 2 (an I frame), or 1 and sample_is_non_sync_sample.
+constexpr uint32_t keyframe_flags = 0x02000000;
+constexpr uint32_t frame_flags = 0x01010000;
+
+// trun flags: data-offset, sample-duration, sample-size and sample-flags present.
+constexpr uint32_t trun_flags = 0x000001 | 0x000100 | 0x000200 | 0x000400;
+// tfhd flags: default-base-is-moof, the data offsets counted from the moof.
+constexpr uint32_t tfhd_flags = 0x020000;
+
+constexpr size_t mfhd_size = 16;
+constexpr size_t tfhd_size = 16;
+constexpr size_t tfdt_size = 20;
+constexpr size_t trun_header_size = 20;
+constexpr size_t trun_entry_size = 12;
+
+// Big-endian fields, and boxes whose size is patched once their content is written.
+class writer {
+  std::vector<unsigned char>& out_;
+  std::vector<size_t> open_;
+
+ public:
+  explicit writer(std::vector<unsigned char>& out) : out_(out) {}
+
+  void u8(unsigned v) { out_.push_back(static_cast<unsigned char>(v)); }
+  void u16(unsigned v) {
+    u8(v >> 8);
+    u8(v);
+  }
+  void u32(uint32_t v) {
+    u16(v >> 16);
+    u16(v & 0xFFFF);
+  }
+  void zeros(size_t n) { out_.insert(out_.end(), n, 0); }
+  void bytes(const void* data, size_t size) {
+    const auto* p = static_cast<const unsigned char*>(data);
+    out_.insert(out_.end(), p, p + size);
+  }
+  void bytes(const std::vector<unsigned char>& data) { bytes(data.data(), data.size()); }
+
+  void open(const char* type) {
+    open_.push_back(out_.size());
+    u32(0);
+    bytes(type, 4);
+  }
+  void open(const char* type, unsigned version, uint32_t flags) {
+    open(type);
+    u32(version << 24 | flags);
+  }
+  void close() {
+    const size_t start = open_.back();
+    open_.pop_back();
+    const auto size = static_cast<uint32_t>(out_.size() - start);
+    for (int i = 0; i < 4; ++i) out_[start + i] = static_cast<unsigned char>(size >> (24 - 8 * i));
+  }
+};
+
+void put32(unsigned char*& p, uint32_t v) {
+  p[0] = static_cast<unsigned char>(v >> 24);
+  p[1] = static_cast<unsigned char>(v >> 16);
+  p[2] = static_cast<unsigned char>(v >> 8);
+  p[3] = static_cast<unsigned char>(v);
+  p += 4;
+}
+
+void box(unsigned char*& p, uint32_t size, const char* type) {
+  put32(p, size);
+  std::memcpy(p, type, 4);
+  p += 4;
+}
+
+void matrix(writer& w) {
+  for (const uint32_t v : {0x10000u, 0u, 0u, 0u, 0x10000u, 0u, 0u, 0u, 0x40000000u}) w.u32(v);
+}
+
+void avcc(writer& w, const video_parameters& v) {
+  w.open("avcC");
+  w.u8(1);
+  w.bytes(v.sps.data() + 1, 3);  // profile, constraints, level
+  w.u8(0xFC | 3);                // 4-byte lengths
+  w.u8(0xE0 | 1);
+  w.u16(static_cast<unsigned>(v.sps.size()));
+  w.bytes(v.sps);
+  w.u8(1);
+  w.u16(static_cast<unsigned>(v.pps.size()));
+  w.bytes(v.pps);
+  w.close();
+}
+
+void hvcc(writer& w, const video_parameters& v) {
+  w.open("hvcC");
+  w.u8(1);
+  w.bytes(v.profile_tier_level, sizeof v.profile_tier_level);
+  w.u16(0xF000);  // min_spatial_segmentation_idc
+  w.u8(0xFC);     // parallelismType
+  w.u8(0xFC | v.chroma_format);
+  w.u8(0xF8 | (v.bit_depth_luma - 8));
+  w.u8(0xF8 | (v.bit_depth_chroma - 8));
+  w.u16(0);  // avgFrameRate
+  w.u8((v.sub_layers & 7) << 3 | (v.temporal_id_nesting ? 4 : 0) | 3);
+  w.u8(3);
+  const std::pair<unsigned, const std::vector<unsigned char>*> sets[] = {
+      {32, &v.vps}, {33, &v.sps}, {34, &v.pps}};
+  for (const auto& s : sets) {
+    w.u8(0x80 | s.first);  // array_completeness
+    w.u16(1);
+    w.u16(static_cast<unsigned>(s.second->size()));
+    w.bytes(*s.second);
+  }
+  w.close();
+}
+
+}  // namespace
+
+void init_segment(const video_parameters& video, std::vector<unsigned char>& out) {
+  const bool hevc = video.codec == VideoCodec::H265;
+  writer w(out);
+  w.open("ftyp");
+  w.bytes("iso6", 4);
+  w.u32(0);
+  for (const char* brand : {"iso6", "isom", "mp41", hevc ? "hev1" : "avc1"}) w.bytes(brand, 4);
+  w.close();
+
+  w.open("moov");
+  w.open("mvhd", 0, 0);
+  w.zeros(8);   // creation and modification times
+  w.u32(1000);  // timescale
+  w.u32(0);     // duration: that of the fragments
+  w.u32(0x00010000);
+  w.u16(0x0100);
+  w.zeros(10);
+  matrix(w);
+  w.zeros(24);
+  w.u32(track_id + 1);
+  w.close();
+
+  w.open("trak");
+  w.open("tkhd", 0, 3);  // enabled, in the movie
+  w.zeros(8);
+  w.u32(track_id);
+  w.zeros(4);
+  w.u32(0);  // duration
+  w.zeros(8);
+  w.u16(0);  // layer
+  w.u16(0);  // alternate group
+  w.u16(0);  // volume
+  w.zeros(2);
+  matrix(w);
+  w.u32(static_cast<uint32_t>(video.width) << 16);
+  w.u32(static_cast<uint32_t>(video.height) << 16);
+  w.close();
+
+  w.open("mdia");
+  w.open("mdhd", 0, 0);
+  w.zeros(8);
+  w.u32(timescale);
+  w.u32(0);
+  w.u16(0x55C4);  // und
+  w.u16(0);
+  w.close();
+  w.open("hdlr", 0, 0);
+  w.u32(0);
+  w.bytes("vide", 4);
+  w.zeros(12);
+  w.bytes("VideoHandler", 13);
+  w.close();
+
+  w.open("minf");
+  w.open("vmhd", 0, 1);
+  w.zeros(8);
+  w.close();
+  w.open("dinf");
+  w.open("dref", 0, 0);
+  w.u32(1);
+  w.open("url ", 0, 1);  // in this file
+  w.close();
+  w.close();
+  w.close();
+
+  w.open("stbl");
+  w.open("stsd", 0, 0);
+  w.u32(1);
+  w.open(hevc ? "hev1" : "avc3");
+  w.zeros(6);
+  w.u16(1);  // data_reference_index
+  w.zeros(16);
+  w.u16(static_cast<unsigned>(video.width));
+  w.u16(static_cast<unsigned>(video.height));
+  w.u32(0x00480000);  // 72 dpi
+  w.u32(0x00480000);
+  w.u32(0);
+  w.u16(1);  // frame_count
+  w.zeros(32);
+  w.u16(0x0018);
+  w.u16(0xFFFF);
+  if (hevc)
+    hvcc(w, video);
+  else
+    avcc(w, video);
+  w.close();
+  w.close();
+  for (const char* empty : {"stts", "stsc", "stco"}) {
+    w.open(empty, 0, 0);
+    w.u32(0);
+    w.close();
+  }
+  w.open("stsz", 0, 0);
+  w.u32(0);
+  w.u32(0);
+  w.close();
+  w.close();  // stbl
+  w.close();  // minf
+  w.close();  // mdia
+  w.close();  // trak
+
+  w.open("mvex");
+  w.open("trex", 0, 0);
+  w.u32(track_id);
+  w.u32(1);  // sample description
+  w.zeros(12);
+  w.close();
+  w.close();
+  w.close();  // moov
+}
+
+size_t fragment_header_size(size_t samples) {
+  return 8 + mfhd_size + 8 + tfhd_size + tfdt_size + trun_header_size +
+         samples * trun_entry_size + 8;
+}
+
+void fragment_header(uint32_t sequence, uint64_t decode_time, const std::vector<sample>& samples,
+                     unsigned char* out) {
+  const size_t size = fragment_header_size(samples.size());
+  const auto moof = static_cast<uint32_t>(size - 8);
+  size_t data = 0;
+  for (const auto& s : samples) data += s.size;
+
+  unsigned char* p = out;
+  box(p, moof, "moof");
+  box(p, mfhd_size, "mfhd");
+  put32(p, 0);
+  put32(p, sequence);
+  box(p, moof - 8 - mfhd_size, "traf");
+  box(p, tfhd_size, "tfhd");
+  put32(p, tfhd_flags);
+  put32(p, track_id);
+  box(p, tfdt_size, "tfdt");
+  put32(p, 1 << 24);
+  put32(p, static_cast<uint32_t>(decode_time >> 32));
+  put32(p, static_cast<uint32_t>(decode_time));
+  box(p, static_cast<uint32_t>(trun_header_size + samples.size() * trun_entry_size), "trun");
+  put32(p, trun_flags);
+  put32(p, static_cast<uint32_t>(samples.size()));
+  put32(p, static_cast<uint32_t>(size));  // the data, past the mdat header
+  for (const auto& s : samples) {
+    put32(p, s.duration);
+    put32(p, s.size);
+    put32(p, s.keyframe ? keyframe_flags : frame_flags);
+  }
+  box(p, static_cast<uint32_t>(8 + data), "mdat");
+}
+
+}  // namespace mp4
+}  // namespace app
\ No newline at end of file
@@ -0,0 +1,37 @@
+#ifndef DEF_FMP4_H
+#define DEF_FMP4_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ps_demux.h"
+
+namespace app {
+namespace mp4 {
+
+// Of the decode times and durations: the 90 kHz of the PTS of the program stream.
+constexpr uint32_t timescale = 90000;
+
+struct sample {
+  uint32_t duration;
+  uint32_t size;
+  bool keyframe;
+};
+
+// ftyp and moov of a fragmented MP4 of one video track, its samples in the fragments that follow.
+// The sample entry is avc3 or hev1: the parameter sets stay in the samples as well, a camera
+// changing its resolution mid-recording still decodes.
+void init_segment(const video_parameters& video, std::vector<unsigned char>& out);
+
+// moof and the mdat header of a fragment of `samples` samples.
+size_t fragment_header_size(size_t samples);
+// Writes them to `out`, fragment_header_size(samples.size()) bytes: the sample data follows. The
+// first fragment is 1, `decode_time` that of its first sample.
+void fragment_header(uint32_t sequence, uint64_t decode_time, const std::vector<sample>& samples,
+                     unsigned char* out);
+
+}  // namespace mp4
+}  // namespace app
+
+#endif
\ No newline at end of file
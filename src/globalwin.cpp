@@ -6,9 +6,11 @@
 #include "cursors.h"
 #include "main.h"
 
+#include <chrono>
 #include <cstring>
 #include <filesystem>
 #include <iostream>
+#include <sstream>
 
 namespace app {
 LRESULT GlobalWindow::HandleMessage(UINT message, WPARAM wParam, LPARAM lParam) {
@@ -53,6 +55,11 @@ LRESULT GlobalWindow::HandleMessage(UINT message, WPARAM wParam, LPARAM lParam)
         return 1;
       }
       ::SendMessage(record_button_->Window(), BM_SETIMAGE, IMAGE_BITMAP, (LPARAM)record_on_bmp_);
+      // The recordings start with the seconds before the button was pressed.
+      if (config.pre_event &&
+          !recorder_.arm(stream_tap, std::chrono::seconds(config.pre_event),
+                         static_cast<size_t>(config.pre_event_size) << 20))
+        std::cerr << "GlobalWindow: could not arm the pre-event buffer\n";
 
       // light_button_->parent() = this;
       // if (!light_button_->Create("Light", WS_CHILD | WS_VISIBLE | BS_AUTOCHECKBOX, 0, 0, 0, 0, 0,
@@ -136,17 +143,17 @@ LRESULT GlobalWindow::HandleMessage(UINT message, WPARAM wParam, LPARAM lParam)
         const auto min = ::SendMessage(h, TBM_GETRANGEMIN, 0, 0);
         const auto max = ::SendMessage(h, TBM_GETRANGEMAX, 0, 0);
         const float d = (pos - min) * 1.f / (max - min);
-        const auto action = new soap::SoapAbsoluteMove(soap::soap_thread, *this);
+        auto action = soap::SoapAbsoluteMove();
         if (h == pbar_->Window()) {
           clog.log("GlobalWindow: Panbar Scroll:", pos);
           clog.log("GlobalWindow: Pan move to:", d);
-          action->setPan(d);
+          action.setPan(d);
         } else {
           clog.log("GlobalWindow: Tiltbar Scroll:", pos);
           clog.log("GlobalWindow: Tilt move to:", d);
-          action->setTilt(d);
+          action.setTilt(d);
         }
-        soap::soap_thread.queue(action);
+        soap::soap_thread.queue(action, OverflowPolicy::REPLACE_LATEST);
       }
     } break;
 
@@ -158,15 +165,15 @@ LRESULT GlobalWindow::HandleMessage(UINT message, WPARAM wParam, LPARAM lParam)
         const auto max = ::SendMessage(h, TBM_GETRANGEMAX, 0, 0);
         if (h == zbar_->Window()) {
           const float d = (pos - min) * 1.f / (max - min);
-          const auto action = new soap::SoapAbsoluteMove(soap::soap_thread, *this);
-          action->setZoom(d);
+          auto action = soap::SoapAbsoluteMove();
+          action.setZoom(d);
           clog.log("GlobalWindow: Zoombar Scroll:", pos);
-          soap::soap_thread.queue(action);
+          soap::soap_thread.queue(action, OverflowPolicy::REPLACE_LATEST);
         } else {
           clog.log("GlobalWindow::HandleMessage:VM_SCROLL: volume scroll");
           /* const float d = (pos - min) * 1.f / (max - min);
           const auto action =
-              new soap::SoapRelativeMoveAction(soap::soap_thread, *this, 0.f, d, 0.f);
+              soap::SoapRelativeMoveAction(0.f, d, 0.f);
           soap::soap_thread.queue(action); */
         }
       }
@@ -184,24 +191,28 @@ LRESULT GlobalWindow::HandleMessage(UINT message, WPARAM wParam, LPARAM lParam)
                     << '\n';
           return 1;
         }
-        path /= get_current_time() + ".mp4";
-        const auto path_str = path.string();
-        std::shared_ptr<char[]> pfname(new char[path_str.size() + 1]);
-        std::strcpy(pfname.get(), path_str.c_str());
-        if (recording_tmp && !::NET_DVR_SaveRealData(config.real_play_handle, pfname.get())) {
-          std::cerr << "Error when starting recording: " << ::NET_DVR_GetErrorMsg() << '\n';
-          return 1;
-        } else if (!recording_tmp && !::NET_DVR_StopSaveRealData(config.real_play_handle)) {
-          std::cerr << "Error when stopping recording: " << ::NET_DVR_GetErrorMsg() << '\n';
+        path /= get_current_time();
+        bool started = false;
+        if (recording_tmp && config.record_segment)
+          started = recorder_.start(stream_tap, path.string(),
+                                    std::chrono::seconds(config.record_segment));
+        else if (recording_tmp)
+          started = recorder_.start(stream_tap, (path += ".mp4").string());
+        if (recording_tmp && !started) {
+          std::cerr << "Error when starting recording to " << path.string() << '\n';
           return 1;
+        } else if (!recording_tmp) {
+          recorder_.stop();
         }
         recording_ = recording_tmp;
         if (recording_) {
-          clog.log("Started recording to ", pfname.get());
+          clog.log("Started recording to ", path.string());
           ::SendMessage(record_button_->Window(), BM_SETIMAGE, IMAGE_BITMAP,
                         (LPARAM)record_off_bmp_);
         } else {
-          clog.log("Stopped recording to ", pfname.get());
+          std::ostringstream stats;
+          recorder_.dump(stats);
+          clog.log("Stopped recording: ", stats.str());
           ::SendMessage(record_button_->Window(), BM_SETIMAGE, IMAGE_BITMAP,
                         (LPARAM)record_on_bmp_);
         }
@@ -244,6 +255,8 @@ LRESULT GlobalWindow::HandleMessage(UINT message, WPARAM wParam, LPARAM lParam)
     }; break;
 
     case WM_DESTROY: {
+      // Before the stream stops.
+      recorder_.disarm();
       PostQuitMessage(0);
     } break;
 
@@ -253,41 +266,56 @@ LRESULT GlobalWindow::HandleMessage(UINT message, WPARAM wParam, LPARAM lParam)
   return 0;
 }
 
+// From the PTZ state when it knows where the device is, from a GetStatus request otherwise.
 void GlobalWindow::refresh_bars() {
+  soap::SoapPTZState::position cached;
+  if (soap::soap_thread.ptz_state().estimate(std::chrono::steady_clock::now(), cached)) {
+    clog.log("GlobalWindow::refresh_bars: from the PTZ state");
+    show_position(cached.pan, cached.tilt, cached.zoom);
+    return;
+  }
   clog.log("GlobalWindow::refresh_bars: Queueing a new action");
-  soap::SoapAction* action = new soap::SoapGetStatus(soap::soap_thread, *this);
-  soap::soap_thread.queue(action);
+  const auto action =
+      soap::SoapGetStatus(soap::callback<&GlobalWindow::soap_get_status_is_done>(*this));
+  // Bars are refreshed again after the next move: not worth waiting for room.
+  soap::soap_thread.queue(action, OverflowPolicy::REJECT);
   clog.log("GlobalWindow::refresh_bars: Queueing done");
 }
 
-void GlobalWindow::soap_get_status_is_done(soap::SoapGetStatus* action) {
+void GlobalWindow::soap_get_status_is_done(const soap::SoapGetStatus& action) {
   clog.log("GlobalWindow::soap_get_status_is_done");
+  // The bars keep their positions until a read succeeds.
+  if (!action.ok()) {
+    clog.log("GlobalWindow::soap_get_status_is_done: ", soap::name(action.outcome()));
+    return;
+  }
 
-  clog.log("GlobalWindow::soap_get_status_is_done: action = ", *action);
+  clog.log("GlobalWindow::soap_get_status_is_done: pan = ", action.pan(), ", t = ", action.tilt(),
+           ", z = ", action.zoom());
+  show_position(action.pan(), action.tilt(), action.zoom());
+}
+
+void GlobalWindow::show_position(float pan, float tilt, float zoom) {
   auto min = ::SendMessage(zbar_->Window(), TBM_GETRANGEMIN, 0, 0);
   auto max = ::SendMessage(zbar_->Window(), TBM_GETRANGEMAX, 0, 0);
-  auto val = translate_interval(action->zoom(), 0, min, 1, max);
+  auto val = translate_interval(zoom, 0, min, 1, max);
   clog.log("zoom (min, max) =(", min, max, ")");
-  clog.log("GlobalWindow::soap_get_status_is_done: z val = ", val);
+  clog.log("GlobalWindow::show_position: z val = ", val);
   ::SendMessage(zbar_->Window(), TBM_SETPOS, true, (LPARAM)val);
 
   min = ::SendMessage(pbar_->Window(), TBM_GETRANGEMIN, 0, 0);
   max = ::SendMessage(pbar_->Window(), TBM_GETRANGEMAX, 0, 0);
-  val = translate_interval(action->pan(), 0, min, 1, max);
+  val = translate_interval(pan, 0, min, 1, max);
   clog.log("pan (min, max) =(", min, max, ")");
-  clog.log("GlobalWindow::soap_get_status_is_done: pan val = ", val);
+  clog.log("GlobalWindow::show_position: pan val = ", val);
   ::SendMessage(pbar_->Window(), TBM_SETPOS, true, (LPARAM)val);
 
   min = ::SendMessage(tbar_->Window(), TBM_GETRANGEMIN, 0, 0);
   max = ::SendMessage(tbar_->Window(), TBM_GETRANGEMAX, 0, 0);
   clog.log("tilt (min, max) =(", min, max, ")");
-  val = translate_interval(action->tilt(), 0, min, 1, max);
-  clog.log("GlobalWindow::soap_get_status_is_done: tilt val = ", val);
+  val = translate_interval(tilt, 0, min, 1, max);
+  clog.log("GlobalWindow::show_position: tilt val = ", val);
   ::SendMessage(tbar_->Window(), TBM_SETPOS, true, (LPARAM)val);
 }
 
-void GlobalWindow::soap_relative_move_is_done(soap::SoapRelativeMoveAction* action) {
-  clog.log("GlobalWindow::relative_move_is_done");
-}
-
 }  // namespace app
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include "bgwin.h"
 #include "button.h"
 #include "cursors.h"
+#include "recorder.h"
 #include "soap.h"
 #include "trackbars.h"
 
@@ -16,7 +17,7 @@ namespace app {
 
 class BGWindow;
 
-class GlobalWindow : public BaseWindow<GlobalWindow>, public soap::SoapActionRunnerAdapter {
+class GlobalWindow : public BaseWindow<GlobalWindow> {
   BGWindow *bgwin_;
   std::unique_ptr<Trackbar> zbar_;
   std::unique_ptr<Trackbar> pbar_;
@@ -24,6 +25,7 @@ class GlobalWindow : public BaseWindow<GlobalWindow>, public soap::SoapActionRun
   std::unique_ptr<Trackbar> vbar_;
   std::unique_ptr<Button> record_button_;
   bool recording_;
+  Mp4Recorder recorder_;
   HBITMAP record_on_bmp_;
   HBITMAP record_off_bmp_;
   boolean visible_ = false;
@@ -37,7 +39,8 @@ class GlobalWindow : public BaseWindow<GlobalWindow>, public soap::SoapActionRun
         tbar_(new Tiltbar()),
         vbar_(new Trackbar()),
         record_button_(new Button()),
-        recording_(false) {
+        recording_(false),
+        recorder_("live view") {
     record_on_bmp_ = mat2bitmap(start_record_matrix);
     record_off_bmp_ = mat2bitmap(stop_record_matrix);
   }
@@ -70,8 +73,9 @@ class GlobalWindow : public BaseWindow<GlobalWindow>, public soap::SoapActionRun
 
   void refresh_bars();
 
-  virtual void soap_get_status_is_done(soap::SoapGetStatus *action) override;
-  virtual void soap_relative_move_is_done(soap::SoapRelativeMoveAction *action) override;
+  void soap_get_status_is_done(const soap::SoapGetStatus &action);
+  // Each axis in [0, 1].
+  void show_position(float pan, float tilt, float zoom);
 };
 
 }  // namespace app
@@ -1,18 +1,24 @@
 #include "winheaders.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <cmath>
 #include <condition_variable>
 #include <cstdio>
 #include <cstring>
 #include <ctime>
+#include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include <boost/program_options.hpp>
@@ -20,8 +26,16 @@
 #include "bgwin.h"
 #include "button.h"
 #include "cursors.h"
+#include "field_of_view.h"
 #include "globalwin.h"
 #include "main.h"
+#include "metrics.h"
+#include "ptz_backend.h"
+#include "recorder.h"
+#include "soap_discovery.h"
+#include "soap_events.h"
+#include "stream_decoder.h"
+#include "stream_tap.h"
 #include "synchronized_ostream.h"
 #include "trackbars.h"
 #include "util.h"
@@ -59,16 +73,28 @@ static void list(const NET_DVR_DEVICEINFO_V40 &struDeviceInfoV40);
 static bool stream(LONG uid, const NET_DVR_DEVICEINFO_V40 &struDeviceInfoV40);
 static bool ptz(int pan, int tilt, int zoom);
 static bool night_mode(const app::soap::IRMode &mode);
+static bool ptz_latency(int samples);
+static bool ptz_backends(int samples);
+static bool events(const std::string &topics, int duration);
+static bool decode(LONG uid, const std::string &channels, int duration);
+static bool alarm_record(LONG uid, int duration);
+static bool discover(int timeout, const std::string &cache_path, int ttl);
 static bool record(bool start);
 static void CALLBACK g_ExceptionCallBack(DWORD dwType, LONG lUserID, LONG lHandle, void *pUser);
 static bool alarm_input(int channel, bool open);
 static bool alarm_output(int channel, int delay);
 static void test_ping();
+static void write_metrics(const std::string &path);
+static void print_budgets();
+static void print_stream();
 
 int main(int argc, char **argv) {
   std::showbase(clog);
 
   parse_input(argc, argv);
+  // Needs neither a device nor the SDK.
+  if (config.cmd == "discover")
+    return !discover(config.discovery_timeout, config.discovery_cache, config.discovery_ttl);
 
 #if defined(DEBUG) || !defined(NDEBUG)
   test_ping();
@@ -95,17 +121,22 @@ int main(int argc, char **argv) {
   std::cout << "Logging to the device...\n";
   NET_DVR_DEVICEINFO_V40 struDeviceInfoV40;
 
-  if ((config.uid[0] = network_request(::NET_DVR_Login_V40, &struLoginInfo, &struDeviceInfoV40)) <
-      0) {
+  if ((config.uid[0] =
+           network_request<::NET_DVR_Login_V40>(&struLoginInfo, &struDeviceInfoV40)) < 0) {
     std::cerr << "Error Login: " << ::NET_DVR_GetErrorMsg() << '\n';
     ::NET_DVR_Cleanup();
     return 1;
   }
   std::cout << "Connected\n";
 
+  const auto onvif_start = std::chrono::steady_clock::now();
   app::soap::soap_thread.run();
-  while (!app::soap::soap_thread.error() && !app::soap::soap_thread.connected())
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+  if (app::soap::soap_thread.wait_ready())
+    std::cout << "ONVIF ready in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - onvif_start)
+                     .count()
+              << " ms (" << (app::soap::soap_thread.warm_start() ? "warm" : "cold") << " start)\n";
   if (app::soap::soap_thread.error()) {
     ::NET_DVR_Cleanup();
     std::cerr << "Onvif Error. Exiting\n";
@@ -127,6 +158,16 @@ int main(int argc, char **argv) {
     ret = !night_mode(app::soap::IRMode::OFF);
   } else if (config.cmd == "IR-auto") {
     ret = !night_mode(app::soap::IRMode::AUTO);
+  } else if (config.cmd == "ptz-latency") {
+    ret = !ptz_latency(config.samples);
+  } else if (config.cmd == "ptz-backends") {
+    ret = !ptz_backends(config.samples);
+  } else if (config.cmd == "events") {
+    ret = !events(config.event_topics, config.event_duration);
+  } else if (config.cmd == "decode") {
+    ret = !decode(config.uid[0], config.decode_channels, config.decode_duration);
+  } else if (config.cmd == "alarm-record") {
+    ret = !alarm_record(config.uid[0], config.event_duration);
   } else if (config.cmd == "record-start") {
     ret = !record(true);
   } else if (config.cmd == "record-stop") {
@@ -140,9 +181,11 @@ int main(int argc, char **argv) {
   }
   app::soap::soap_thread.must_exit();
   app::soap::soap_thread.thread().join();
+  print_budgets();
 
-  network_request(::NET_DVR_Logout, config.uid[0]);
+  network_request<::NET_DVR_Logout>(config.uid[0]);
   ::NET_DVR_Cleanup();
+  if (!config.metrics.empty()) write_metrics(config.metrics);
 
   return ret;
 }
@@ -152,6 +195,8 @@ static void usage(const boost::program_options::options_description &description
   char fname[_MAX_FNAME + 1];
   _splitpath(filename, nullptr, nullptr, fname, nullptr);
   std::cout << "Usage:\n";
+  std::cout << fname << ".exe "
+            << "discover [--discovery-timeout ms] [--discovery-cache file] [--discovery-ttl s]\n";
   std::cout << fname << ".exe "
             << "list host port http-username http-password onvif-username onvif-password\n";
   std::cout << fname << ".exe "
@@ -173,6 +218,21 @@ static void usage(const boost::program_options::options_description &description
             << "IR-off host port http-username http-password onvif-username onvif-password\n";
   std::cout << fname << ".exe "
             << "IR-auto host port http-username http-password onvif-username onvif-password\n";
+  std::cout << fname << ".exe "
+            << "ptz-latency host port http-username http-password onvif-username onvif-password "
+               "[-n | --samples] samples\n";
+  std::cout << fname << ".exe "
+            << "ptz-backends host port http-username http-password onvif-username onvif-password "
+               "[-n | --samples] samples\n";
+  std::cout << fname << ".exe "
+            << "events host port http-username http-password onvif-username onvif-password "
+               "[--event-topics topics] [--event-duration seconds]\n";
+  std::cout << fname << ".exe "
+            << "decode host port http-username http-password onvif-username onvif-password "
+               "[--decode-channels channels] [--decode-duration seconds]\n";
+  std::cout << fname << ".exe "
+            << "alarm-record host port http-username http-password onvif-username onvif-password "
+               "[--pre-event seconds] [--post-event seconds] [--event-duration seconds]\n";
   std::cout << fname << ".exe "
             << "record-start host port http-username http-password onvif-username onvif-password\n";
   std::cout << fname << ".exe "
@@ -196,14 +256,13 @@ static void parse_input(int argc, char **argv) {
   po::options_description description("Allowed options");
   description.add_options()("help,h", "prints this")(
       "command,c", po::value<std::string>(&config.cmd)->required(), "list or get")(
-      "host,H", po::value<std::string>(&config.host)->required(), "server address")(
-      "port,p", po::value<uint16_t>(&config.port)->required(), "Hikvision Protocol port")(
-      "http-port,t", po::value<uint16_t>(&config.soap_port)->required(), "Onvif HTTP port")(
-      "username,u", po::value<std::string>(&config.username)->required(), "username")(
-      "password,P", po::value<std::string>(&config.password)->required(), "password")(
-      "onvif-username,U", po::value<std::string>(&config.onvif_username)->required(),
-      "Onvif username")("onvif-password,a",
-                        po::value<std::string>(&config.onvif_password)->required(),
+      "host,H", po::value<std::string>(&config.host), "server address")(
+      "port,p", po::value<uint16_t>(&config.port), "Hikvision Protocol port")(
+      "http-port,t", po::value<uint16_t>(&config.soap_port), "Onvif HTTP port")(
+      "username,u", po::value<std::string>(&config.username), "username")(
+      "password,P", po::value<std::string>(&config.password), "password")(
+      "onvif-username,U", po::value<std::string>(&config.onvif_username),
+      "Onvif username")("onvif-password,a", po::value<std::string>(&config.onvif_password),
                         "Onvif password")(
       "channel,c", po::value<int>(&config.channel)->default_value(0), "channel Number")(
       "pt-sensitivity,s", po::value<double>(&config.p_sensitivity)->default_value(1.),
@@ -212,17 +271,71 @@ static void parse_input(int argc, char **argv) {
       "Zoom Sensitivity (>= 1)")("stream,S", po::value<int>(&config.stream_type)->default_value(0),
                                  "Stream Type (0: Main-Stream. 1: Sub-Stream, ...)")(
       "rtt,R", po::value<int>(&config.round_trip_time)->default_value(50),
-      "Round Trip Time (in ms)")("pan,P", po::value<int>(&config.pan),
-                                 "Pan distance ([-100, 100])")(
+      "Round Trip Time (in ms), first estimate of the ONVIF request timeouts")(
+      "pan,P", po::value<int>(&config.pan), "Pan distance ([-100, 100])")(
       "tilt,T", po::value<int>(&config.tilt), "Tilt distance ([-100, 100])")(
       "zoom,Z", po::value<int>(&config.zoom), "Zoom distance ([-100, 100])")(
       "record-dir,D", po::value<std::string>(&config.record_dir)->default_value(std::string{"."}),
       "Recording directory (default current directory)")(
+      "record-segment", po::value<int>(&config.record_segment)->default_value(0),
+      "Duration of the segments a recording is cut into (in s), each recording being a directory "
+      "of them with their catalog, 0 (default) to record a single .mp4 file")(
+      "pre-event", po::value<int>(&config.pre_event)->default_value(0),
+      "Seconds of the stream kept in memory before a recording starts, which it begins with (0 "
+      "to disable)")(
+      "pre-event-size", po::value<int>(&config.pre_event_size)->default_value(16),
+      "Memory of the pre-event buffer (in MiB), the seconds kept being fewer when it is full")(
+      "post-event", po::value<int>(&config.post_event)->default_value(10),
+      "Seconds the alarm-record command records after the latest alarm")(
       "alarm-channel,A", po::value<int>(&config.alarm_channel),
       "The Alarm channel Number (0 -> 1st alarm channel, 1 -> 2nd one, and so on)")(
       "alarm-delay,d", po::value<int>(&config.alarm_delay),
       "The Delay of alarm out: 0 -> 5s, 1 -> 10s, 2 -> 30s, 3 -> 1 minute, 4 -> 2 minutes, 5 -> 5 "
-      "minutes, 6 -> 10 minutes, 7 -> manual");
+      "minutes, 6 -> 10 minutes, 7 -> manual")(
+      "samples,n", po::value<int>(&config.samples)->default_value(100),
+      "Number of PTZ requests timed by ptz-latency")(
+      "onvif-cache", po::value<std::string>(&config.onvif_cache)->default_value("onvif-cache.txt"),
+      "File keeping the ONVIF addresses, tokens and PTZ limits of the devices between runs (empty "
+      "to disable)")(
+      "metrics", po::value<std::string>(&config.metrics),
+      "Latency histograms of the SDK and ONVIF requests, written at exit as JSON to this file, or "
+      "as a table to the standard output when -")(
+      "event-topics", po::value<std::string>(&config.event_topics),
+      "Topics listened to by the events command, as an ONVIF ConcreteSet expression (e.g. "
+      "\"tns1:RuleEngine//.|tns1:VideoSource//.\"), all of them by default")(
+      "event-duration", po::value<int>(&config.event_duration)->default_value(60),
+      "How long the events and alarm-record commands listen (in s)")(
+      "decode-channels", po::value<std::string>(&config.decode_channels),
+      "Channels decoded by the decode command, separated by commas (e.g. \"1,2,3\"), the channel "
+      "by default")(
+      "decode-duration", po::value<int>(&config.decode_duration)->default_value(60),
+      "How long the decode command decodes (in s)")(
+      "discovery-timeout", po::value<int>(&config.discovery_timeout)->default_value(3000),
+      "How long the discover command waits for the devices to answer (in ms), 0 to only list the "
+      "cache")(
+      "discovery-cache",
+      po::value<std::string>(&config.discovery_cache)->default_value("discovery-cache.txt"),
+      "File keeping the devices found by the discover command (empty to disable)")(
+      "discovery-ttl", po::value<int>(&config.discovery_ttl)->default_value(600),
+      "How long a device found by the discover command is listed without answering (in s)")(
+      "ptz-rate", po::value<int>(&config.ptz_rate)->default_value(20),
+      "Rate (in Hz) at which a drag on the video sends its pan/tilt speed ([1, 100])")(
+      "ptz-backend", po::value<std::string>(&config.ptz_backend)->default_value("onvif"),
+      "Protocol of the pan/tilt commands of a drag: onvif, sdk (the HCNetSDK session), or auto for "
+      "the one answering faster")(
+      "fov-table", po::value<std::string>(&config.fov_table)->default_value("fov-table.txt"),
+      "File keeping the field of view per zoom position of each camera model, used by the right "
+      "click (center) and right drag (zoom to the box) on the video (empty to disable)")(
+      "calibrate-fov", po::bool_switch(&config.calibrate_fov),
+      "Measures the field of view table of the camera while the get command streams, by moving it "
+      "and comparing frames")(
+      "control-rate", po::value<double>(&config.control_rate)->default_value(25.),
+      "Budget of the ONVIF moves (requests/s, 0 for none): a move over budget waits, merged with "
+      "the next ones")(
+      "query-rate", po::value<double>(&config.query_rate)->default_value(10.),
+      "Budget of the ONVIF status reads (requests/s, 0 for none)")(
+      "configuration-rate", po::value<double>(&config.configuration_rate)->default_value(2.),
+      "Budget of the ONVIF settings changes, e.g. the IR mode (requests/s, 0 for none)");
 
   po::positional_options_description p;
   p.add("command", 1)
@@ -251,11 +364,19 @@ static void parse_input(int argc, char **argv) {
       std::exit(0);
     }
     po::notify(vm);
+    if (config.cmd != "discover")
+      for (auto option : {"host", "port", "http-port", "username", "password", "onvif-username",
+                          "onvif-password"})
+        if (!vm.count(option))
+          throw std::runtime_error(std::string("the option '--") + option + "' is required");
     if (config.cmd != "list" && config.cmd != "get" && config.cmd != "pan" &&
         config.cmd != "tilt" && config.cmd != "zoom" && config.cmd != "IR-on" &&
-        config.cmd != "IR-off" && config.cmd != "IR-auto" && config.cmd != "record-start" &&
+        config.cmd != "IR-off" && config.cmd != "IR-auto" && config.cmd != "ptz-latency" &&
+        config.cmd != "ptz-backends" && config.cmd != "events" && config.cmd != "decode" &&
+        config.cmd != "alarm-record" && config.cmd != "record-start" &&
         config.cmd != "record-stop" && config.cmd != "alarm-in-open" &&
-        config.cmd != "alarm-in-close" && config.cmd != "alarm-out-delay")
+        config.cmd != "alarm-in-close" && config.cmd != "alarm-out-delay" &&
+        config.cmd != "discover")
       throw std::runtime_error("The option " + config.cmd + " is invalid.");
     if (config.cmd == "pan" && !vm.count("pan"))
       throw std::runtime_error("The Pan distance must be set");
@@ -280,6 +401,25 @@ static void parse_input(int argc, char **argv) {
     if (config.p_sensitivity < std::numeric_limits<double>::epsilon())
       throw std::runtime_error("The Pan/Tilt sensitivity is too low");
     if (config.z_sensitivity < 1) throw std::runtime_error("The Z sensitivity must be >= 1");
+    if (config.samples < 1) throw std::runtime_error("The number of samples must be >= 1");
+    if (config.event_duration < 1) throw std::runtime_error("The event duration must be >= 1");
+    if (config.decode_duration < 1) throw std::runtime_error("The decode duration must be >= 1");
+    if (config.record_segment < 0)
+      throw std::runtime_error("The record segment duration must be >= 0");
+    if (config.pre_event < 0) throw std::runtime_error("The pre-event duration must be >= 0");
+    if (config.post_event < 1) throw std::runtime_error("The post-event duration must be >= 1");
+    if (config.pre_event_size < 1 || config.pre_event_size > 1024)
+      throw std::runtime_error("The pre-event size must be in [1, 1024] MiB");
+    if (config.discovery_timeout < 0)
+      throw std::runtime_error("The discovery timeout must be >= 0");
+    if (config.discovery_ttl < 0) throw std::runtime_error("The discovery TTL must be >= 0");
+    if (config.ptz_rate < 1 || config.ptz_rate > 100)
+      throw std::runtime_error("The PTZ rate must be in [1, 100]");
+    if (config.control_rate < 0. || config.query_rate < 0. || config.configuration_rate < 0.)
+      throw std::runtime_error("The request budgets must be >= 0");
+    if (config.ptz_backend != "onvif" && config.ptz_backend != "sdk" &&
+        config.ptz_backend != "auto")
+      throw std::runtime_error("The PTZ backend must be onvif, sdk or auto");
   } catch (const std::exception &e) {
     std::cout << e.what() << '\n';
     usage(description, argv[0]);
@@ -332,9 +472,10 @@ static bool stream(LONG uid, const NET_DVR_DEVICEINFO_V40 &struDeviceInfoV40) {
   compression_params.dwStreamType = config.stream_type;
   NET_DVR_MULTI_STREAM_COMPRESSIONCFG compression_settings;
   uint32_t status;
-  if (!network_request(::NET_DVR_GetDeviceConfig, uid, NET_DVR_GET_MULTI_STREAM_COMPRESSIONCFG, 1,
-                       &compression_params, sizeof compression_params, &status,
-                       &compression_settings, sizeof compression_settings)) {
+  if (!network_request<::NET_DVR_GetDeviceConfig>(uid, NET_DVR_GET_MULTI_STREAM_COMPRESSIONCFG, 1,
+                                                 &compression_params, sizeof compression_params,
+                                                 &status, &compression_settings,
+                                                 sizeof compression_settings)) {
     std::cerr << "Reading Channel Resolution Failed. " << ::NET_DVR_GetErrorMsg() << '\n';
     return false;
   }
@@ -409,19 +550,65 @@ static bool stream(LONG uid, const NET_DVR_DEVICEINFO_V40 &struDeviceInfoV40) {
   struPlayInfo.dwStreamType = config.stream_type;
   struPlayInfo.dwLinkMode = 1;
   struPlayInfo.bBlocked = 0;
-  if ((config.real_play_handle = NET_DVR_RealPlay_V40(uid, &struPlayInfo, nullptr, nullptr)) < 0) {
+  // The SDK still renders into hPlayWnd, the tap gets the encoded packets as well.
+  stream_tap.open();
+  if ((config.real_play_handle = network_request<::NET_DVR_RealPlay_V40>(
+           uid, &struPlayInfo, &StreamTap::callback, &stream_tap)) < 0) {
     std::cerr << ::NET_DVR_GetErrorMsg() << '\n';
+    stream_tap.close();
     return false;
   }
   ::ShowWindow(global_win.Window(), 1);
   global_win.visible() = true;
   // FreeConsole();
 
+  std::atomic<bool> closed{false};
+  std::thread calibration;
+  if (config.calibrate_fov)
+    calibration = std::thread([&bgwin, &closed]() {
+      const std::string model = app::soap::soap_thread.device_info()->model;
+      std::cout << "Calibrating the field of view of " << model << " ...\n";
+      FieldOfView fov;
+      if (!fov.calibrate(
+              [](gray_frame &frame) {
+                return FieldOfView::capture(config.real_play_handle, frame);
+              },
+              closed)) {
+        if (!closed) std::cerr << "The field of view calibration failed\n";
+        return;
+      }
+      for (const auto &s : fov.samples())
+        std::cout << "  zoom " << s.zoom << ": " << s.pan << " of the pan range across, " << s.tilt
+                  << " of the tilt range\n";
+      if (!config.fov_table.empty() && !fov.save(config.fov_table, model))
+        std::cerr << "Could not save the field of view table to " << config.fov_table << '\n';
+      bgwin.set_field_of_view(fov);
+    });
+
   MSG msg = {};
   while (::GetMessage(&msg, nullptr, 0, 0)) {
     ::TranslateMessage(&msg);
     ::DispatchMessage(&msg);
   }
+  closed = true;
+  if (calibration.joinable()) calibration.join();
+  ::NET_DVR_StopRealPlay(config.real_play_handle);
+  print_stream();
+  stream_tap.close();
+  clog.log("PTZ status reads answered by the PTZ state: ",
+           app::soap::soap_thread.ptz_state().saved_reads());
+
+  const auto control = bgwin.pt_control().stats();
+  if (control.drags) {
+    const double seconds = std::chrono::duration<double>(control.dragging).count();
+    const auto &latency = app::metrics::of(app::metrics::operation::UI_PTZ_INPUT_TO_COMMAND);
+    std::cout << "PTZ control: " << control.commands << " commands for " << control.inputs
+              << " mouse events in " << control.drags << " drags (" << std::fixed
+              << std::setprecision(1) << control.commands / seconds << " commands/s, "
+              << control.inputs / seconds << " events/s, " << control.rejected
+              << " rejected), input to command: mean " << latency.mean() / 1000. << " ms, p99 "
+              << latency.percentile(0.99) / 1000. << " ms\n";
+  }
 
   return true;
 }
@@ -429,30 +616,19 @@ static bool stream(LONG uid, const NET_DVR_DEVICEINFO_V40 &struDeviceInfoV40) {
 static bool ptz(int pan, int tilt, int zoom) {
   clog.log("main:ptz pan = ", pan, " | tilt = ", tilt, " | zoom = ", zoom);
   namespace soap = app::soap;
-  std::mutex mx;
-  std::condition_variable cv;
-  bool done = false;
-  class Runner : public soap::SoapActionRunnerAdapter {
-    std::mutex &mx_;
-    std::condition_variable &cv_;
-    bool &done_;
-
-   public:
-    Runner(std::mutex &mx, std::condition_variable &cv, bool &done)
-        : soap::SoapActionRunnerAdapter(), mx_(mx), cv_(cv), done_(done) {}
-    virtual void soap_relative_move_is_done(soap::SoapRelativeMoveAction *action) override {
-      std::unique_lock<std::mutex> lock(mx_);
-      done_ = true;
-      cv_.notify_all();
-    }
-  } runner(mx, cv, done);
-  soap::SoapRelativeMoveAction *action = new soap::SoapRelativeMoveAction(
-      soap::soap_thread, runner, pan / 100.f, tilt / 100.f, zoom / 100.f);
-  soap::soap_thread.queue(action);
-  std::unique_lock<std::mutex> lock(mx);
-  cv.wait(lock, [&done]() { return done; });
+  using Completion = soap::SoapCompletion<soap::SoapRelativeMoveAction>;
+  Completion completion;
+  if (!soap::soap_thread.queue(
+          soap::SoapRelativeMoveAction(pan / 100.f, tilt / 100.f, zoom / 100.f,
+                                       soap::callback<&Completion::done>(completion)))) {
+    std::cerr << "Could not queue the PTZ request\n";
+    return false;
+  }
+  if (const auto &moved = completion.wait(); !moved.ok()) {
+    std::cerr << "The PTZ request was not done: " << soap::name(moved.outcome()) << '\n';
+    return false;
+  }
   std::cout << "Done\n";
-  // delete action;
 
   return true;
 }
@@ -460,43 +636,432 @@ static bool ptz(int pan, int tilt, int zoom) {
 static bool night_mode(const app::soap::IRMode &mode) {
   clog.log("main::night_mode = ", mode);
   namespace soap = app::soap;
+  using Completion = soap::SoapCompletion<soap::SoapIRModeAction>;
+  Completion completion;
+  if (!soap::soap_thread.queue(
+          soap::SoapIRModeAction(mode, soap::callback<&Completion::done>(completion)))) {
+    std::cerr << "Could not queue the night mode request\n";
+    return false;
+  }
+  if (const auto &switched = completion.wait(); !switched.ok()) {
+    std::cerr << "The night mode request was not done: " << soap::name(switched.outcome())
+              << '\n';
+    return false;
+  }
+  return true;
+}
+
+// Times `samples` ContinuousMove requests sent one after the other, at a crawl, with and without
+// connection reuse, then stops the camera.
+static bool ptz_latency(int samples) {
+  namespace soap = app::soap;
+  using Completion = soap::SoapCompletion<soap::SoapStartContinuousMoveAction>;
+  const auto &connection = soap::soap_thread.ptz_connection();
+
+  std::cout << std::setw(12) << "" << std::setw(16) << "connects / req" << std::setw(12)
+            << "p50 (ms)" << std::setw(12) << "p99 (ms)" << '\n';
+  for (bool keep_alive : {true, false}) {
+    soap::soap_thread.keep_alive(keep_alive);
+    std::vector<double> latencies;
+    const auto before = connection.stats();
+    for (int i = 0; i < samples; ++i) {
+      const float speed = i % 2 ? -0.05f : 0.05f;
+      Completion completion;
+      const auto start = std::chrono::steady_clock::now();
+      if (!soap::soap_thread.queue(soap::SoapStartContinuousMoveAction(
+              speed, 0.f, soap::callback<&Completion::done>(completion)))) {
+        std::cerr << "Could not queue the PTZ request\n";
+        return false;
+      }
+      if (const auto &moved = completion.wait(); !moved.ok()) {
+        std::cerr << "The PTZ request was not done: " << soap::name(moved.outcome()) << '\n';
+        return false;
+      }
+      latencies.push_back(
+          std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+              .count());
+    }
+    const auto after = connection.stats();
+
+    std::sort(latencies.begin(), latencies.end());
+    const auto percentile = [&latencies](double p) {
+      return latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+    };
+    std::cout << std::setw(12) << (keep_alive ? "keep-alive" : "close") << std::setw(16)
+              << std::fixed << std::setprecision(2)
+              << static_cast<double>(after.connects - before.connects) /
+                     (after.requests - before.requests)
+              << std::setw(12) << percentile(.5) << std::setw(12) << percentile(.99) << '\n';
+  }
+  soap::soap_thread.keep_alive(true);
+
+  using StopCompletion = soap::SoapCompletion<soap::SoapStopContinuousMoveAction>;
+  StopCompletion stopped;
+  if (!soap::soap_thread.queue(
+          soap::SoapStopContinuousMoveAction(soap::callback<&StopCompletion::done>(stopped)))) {
+    std::cerr << "Could not queue the stop request\n";
+    return false;
+  }
+  if (const auto &stop = stopped.wait(); !stop.ok()) {
+    std::cerr << "The stop request was not done: " << soap::name(stop.outcome()) << '\n';
+    return false;
+  }
+  std::cout << '\n';
+  app::metrics::dump(std::cout);
+
+  return true;
+}
+
+// Times `samples` requests through each PTZ backend, a move at a crawl then a stop in turn, each
+// one sent once the device answered the previous one. The jitter is the mean difference between
+// consecutive round trips, as in RFC 3550.
+static bool ptz_backends(int samples) {
+  std::cout << std::setw(12) << "" << std::setw(12) << "p50 (ms)" << std::setw(12) << "p99 (ms)"
+            << std::setw(14) << "jitter (ms)" << std::setw(10) << "failed" << '\n';
+  for (const auto name : {"onvif", "sdk"}) {
+    const auto backend = PTZBackend::create(name, config.uid[0], config.channel, nullptr);
+    std::vector<double> latencies;
+    double jitter = 0.;
+    int failed = 0;
+    for (int i = 0; i < samples; ++i) {
+      const float speed = i % 2 ? 0.f : (i % 4 ? -0.05f : 0.05f);
+      std::chrono::steady_clock::duration rtt;
+      if (!backend->request(speed, 0.f, rtt)) {
+        ++failed;
+        continue;
+      }
+      const double ms = std::chrono::duration<double, std::milli>(rtt).count();
+      if (!latencies.empty()) jitter += std::abs(ms - latencies.back());
+      latencies.push_back(ms);
+    }
+    // Ends on a move: stopped.
+    if (samples % 2) {
+      std::chrono::steady_clock::duration rtt;
+      backend->request(0.f, 0.f, rtt);
+    }
+    if (latencies.empty()) {
+      std::cout << std::setw(12) << name << std::setw(12) << "-" << std::setw(12) << "-"
+                << std::setw(14) << "-" << std::setw(10) << failed << '\n';
+      continue;
+    }
+    if (latencies.size() > 1) jitter /= latencies.size() - 1;
+
+    std::sort(latencies.begin(), latencies.end());
+    const auto percentile = [&latencies](double p) {
+      return latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+    };
+    std::cout << std::setw(12) << name << std::setw(12) << std::fixed << std::setprecision(2)
+              << percentile(.5) << std::setw(12) << percentile(.99) << std::setw(14) << jitter
+              << std::setw(10) << failed << '\n';
+  }
+  std::cout << '\n';
+  app::metrics::dump(std::cout);
+
+  return true;
+}
+
+// Prints the events of the device for `duration` seconds, then what pulling them cost.
+static bool events(const std::string &topics, int duration) {
+  namespace soap = app::soap;
+  const std::string endpoint = soap::soap_thread.device_info()->events_endpoint;
+  if (endpoint.empty()) {
+    std::cerr << "The device has no event service\n";
+    return false;
+  }
+
+  soap::SoapEventThread events(soap::soap_thread.credentials());
+  events.run(endpoint, topics, std::chrono::milliseconds(config.round_trip_time));
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(duration);
+  soap::SoapEvent event;
+  while (std::chrono::steady_clock::now() < deadline) {
+    events.wait_until(deadline);
+    while (events.next(event)) std::cout << timeNow() << ' ' << event << '\n';
+  }
+  events.must_exit();
+  events.thread().join();
+
+  const auto stats = events.stats();
+  const double seconds = std::chrono::duration<double>(stats.elapsed).count();
+  std::cout << '\n'
+            << stats.messages << " messages in " << stats.pulls << " pulls ("
+            << stats.subscriptions << " subscriptions, " << stats.renewals << " renewals, "
+            << stats.dropped << " dropped)\n"
+            << std::fixed << std::setprecision(2) << stats.messages / seconds << " messages/s, "
+            << std::chrono::duration<double, std::micro>(stats.cpu).count() /
+                   std::max<unsigned long long>(stats.messages, 1)
+            << " us of CPU per message ("
+            << std::chrono::duration<double, std::milli>(stats.cpu).count() << " ms in all)\n";
+  return stats.subscriptions > 0;
+}
+
+// Decodes the streams of `channels` without any window for `duration` seconds, printing the frames
+// per second and CPU time per frame of each every second.
+static bool decode(LONG uid, const std::string &channels, int duration) {
+  std::vector<int> numbers;
+  std::istringstream in(channels);
+  for (std::string number; std::getline(in, number, ',');) {
+    try {
+      numbers.push_back(std::stoi(number));
+    } catch (const std::exception &) {
+      std::cerr << "Invalid channel: " << number << '\n';
+      return false;
+    }
+  }
+  if (numbers.empty()) numbers.push_back(config.channel);
+
+  struct channel {
+    StreamTap tap;
+    std::unique_ptr<StreamDecoder> decoder;
+    LONG handle = -1;
+  };
+  std::vector<std::unique_ptr<channel>> decoding;
+  for (const int number : numbers) {
+    auto c = std::make_unique<channel>();
+    c->decoder =
+        std::make_unique<StreamDecoder>("channel " + std::to_string(number), [](const Frame &) {});
+    c->tap.open();
+    c->decoder->start(c->tap);
+    NET_DVR_PREVIEWINFO info = {};
+    info.hPlayWnd = nullptr;
+    info.lChannel = number;
+    info.dwStreamType = config.stream_type;
+    info.dwLinkMode = 1;
+    info.bBlocked = 0;
+    if ((c->handle = network_request<::NET_DVR_RealPlay_V40>(uid, &info, &StreamTap::callback,
+                                                              &c->tap)) < 0) {
+      std::cerr << "Channel " << number << ": " << ::NET_DVR_GetErrorMsg() << '\n';
+      c->decoder->stop();
+      c->tap.close();
+      continue;
+    }
+    decoding.push_back(std::move(c));
+  }
+  if (decoding.empty()) return false;
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int s = 1; s <= duration; ++s) {
+    std::this_thread::sleep_until(start + std::chrono::seconds(s));
+    std::cout << timeNow() << '\n';
+    for (const auto &c : decoding) c->decoder->dump(std::cout);
+  }
+
+  bool decoded = true;
+  for (const auto &c : decoding) {
+    ::NET_DVR_StopRealPlay(c->handle);
+    c->decoder->stop();
+    c->tap.dump(std::cout);
+    c->tap.close();
+    decoded &= c->decoder->stats().frames > 0;
+  }
+  return decoded;
+}
+
+// What starts the recordings of alarm-record, from any thread: the SDK alarms, the ONVIF events
+// and the console.
+struct alarm_triggers {
   std::mutex mx;
   std::condition_variable cv;
-  bool done = false;
-  class Runner : public soap::SoapActionRunnerAdapter {
-    std::mutex &mx_;
-    std::condition_variable &cv_;
-    bool &done_;
-
-   public:
-    Runner(std::mutex &mx, std::condition_variable &cv, bool &done)
-        : soap::SoapActionRunnerAdapter(), mx_(mx), cv_(cv), done_(done) {}
-    virtual void soap_night_mode_is_done(soap::SoapIRModeAction *action) override {
-      std::unique_lock<std::mutex> lock(mx_);
-      done_ = true;
-      cv_.notify_all();
+  std::string source;  // of the latest trigger not taken yet
+
+  void fire(std::string from) {
+    {
+      std::lock_guard<std::mutex> lock(mx);
+      source = std::move(from);
     }
-  } runner(mx, cv, done);
+    cv.notify_one();
+  }
+  // The source of a trigger, empty when none came by `deadline`.
+  std::string wait_until(std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(mx);
+    cv.wait_until(lock, deadline, [this]() { return !source.empty(); });
+    return std::exchange(source, std::string());
+  }
+};
+
+// Outlives alarm_record(): the console thread is left blocked on the standard input.
+static alarm_triggers triggers;
+
+static BOOL CALLBACK alarm_message(LONG command, NET_DVR_ALARMER *, char *, DWORD, void *user) {
+  std::ostringstream source;
+  source << "SDK alarm " << std::hex << std::showbase << command;
+  static_cast<alarm_triggers *>(user)->fire(source.str());
+  return TRUE;
+}
 
-  soap::SoapIRModeAction *action = new soap::SoapIRModeAction(soap::soap_thread, runner, mode);
-  soap::soap_thread.queue(action);
-  std::unique_lock<std::mutex> lock(mx);
-  cv.wait(lock, [&done]() { return done; });
-  // delete action;
+// An ONVIF event reporting something going on: a motion, a tampering, an alarm input active...
+static bool alarming(const app::soap::SoapEvent &event) {
+  return std::any_of(event.data.begin(), event.data.end(),
+                     [](const auto &item) { return item.second == "true"; });
+}
+
+// Keeps the last --pre-event seconds of the channel in memory, without any window, for `duration`
+// seconds: each alarm of the device (SDK or ONVIF event) or line typed starts a recording with
+// them, which goes on until --post-event seconds after the latest one.
+static bool alarm_record(LONG uid, int duration) {
+  namespace soap = app::soap;
+  using std::chrono::steady_clock;
+  StreamTap tap;
+  Mp4Recorder recorder("alarm");
+  tap.open();
+  if (config.pre_event && !recorder.arm(tap, std::chrono::seconds(config.pre_event),
+                                        static_cast<size_t>(config.pre_event_size) << 20)) {
+    tap.close();
+    return false;
+  }
+  NET_DVR_PREVIEWINFO info = {};
+  info.hPlayWnd = nullptr;
+  info.lChannel = config.channel;
+  info.dwStreamType = config.stream_type;
+  info.dwLinkMode = 1;
+  info.bBlocked = 0;
+  const LONG handle =
+      network_request<::NET_DVR_RealPlay_V40>(uid, &info, &StreamTap::callback, &tap);
+  if (handle < 0) {
+    std::cerr << ::NET_DVR_GetErrorMsg() << '\n';
+    recorder.disarm();
+    tap.close();
+    return false;
+  }
+
+  ::NET_DVR_SetDVRMessageCallBack_V31(&alarm_message, &triggers);
+  NET_DVR_SETUPALARM_PARAM setup = {};
+  setup.dwSize = sizeof setup;
+  setup.byLevel = 1;
+  setup.byAlarmInfoType = 1;
+  const LONG alarm = ::NET_DVR_SetupAlarmChan_V41(uid, &setup);
+  if (alarm < 0) std::cerr << "No SDK alarms: " << ::NET_DVR_GetErrorMsg() << '\n';
+
+  const auto end = steady_clock::now() + std::chrono::seconds(duration);
+  std::atomic<bool> done{false};
+  soap::SoapEventThread events(soap::soap_thread.credentials());
+  std::thread onvif;
+  const std::string endpoint = soap::soap_thread.device_info()->events_endpoint;
+  if (!endpoint.empty()) {
+    events.run(endpoint, config.event_topics, std::chrono::milliseconds(config.round_trip_time));
+    // Until the end: wait_until() no longer sleeps past it.
+    onvif = std::thread([&events, &done, end]() {
+      soap::SoapEvent event;
+      do {
+        events.wait_until(end);
+        while (events.next(event))
+          if (alarming(event)) triggers.fire(event.topic);
+      } while (!done && steady_clock::now() < end);
+    });
+  } else {
+    std::cerr << "No ONVIF events: the device has no event service\n";
+  }
+  std::thread([]() {
+    for (std::string line; std::getline(std::cin, line);) triggers.fire("console");
+  }).detach();
+  std::cout << "Keeping " << config.pre_event << " s of channel " << config.channel
+            << " before the alarms, press Enter to trigger a recording\n";
+
+  int recordings = 0;
+  steady_clock::time_point until;
+  while (steady_clock::now() < end) {
+    const std::string source =
+        triggers.wait_until(recorder.recording() ? std::min(end, until) : end);
+    if (!source.empty()) {
+      until = steady_clock::now() + std::chrono::seconds(config.post_event);
+      if (recorder.recording()) continue;
+      std::filesystem::path path(config.record_dir);
+      path /= get_current_time();
+      const auto start = steady_clock::now();
+      const bool started =
+          config.record_segment
+              ? recorder.start(tap, path.string(), std::chrono::seconds(config.record_segment))
+              : recorder.start(tap, (path += ".mp4").string());
+      if (!started) continue;
+      ++recordings;
+      const auto buffered = recorder.buffered();
+      std::cout << timeNow() << ' ' << source << ": recording to " << path.string() << " from "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(buffered.span).count()
+                << " ms before, flushed in "
+                << std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now() -
+                                                                         start)
+                       .count()
+                << " us\n";
+    } else if (recorder.recording() && steady_clock::now() >= until) {
+      recorder.stop();
+      recorder.dump(std::cout);
+    }
+  }
+
+  done = true;
+  if (!endpoint.empty()) {
+    events.must_exit();
+    onvif.join();
+    events.thread().join();
+  }
+  if (alarm >= 0) ::NET_DVR_CloseAlarmChan_V30(alarm);
+  ::NET_DVR_SetDVRMessageCallBack_V31(nullptr, nullptr);
+  ::NET_DVR_StopRealPlay(handle);
+  const bool recording = recorder.recording();
+  const auto buffered = recorder.buffered();
+  recorder.disarm();
+  if (recording) recorder.dump(std::cout);
+  tap.dump(std::cout);
+  tap.close();
+  std::cout << recordings << " recordings, pre-event buffer of " << config.pre_event_size
+            << " MiB holding " << buffered.bytes / 1024 << " KiB in " << buffered.packets
+            << " packets (" << buffered.evicted << " GOPs evicted, " << buffered.skipped
+            << " packets skipped)\n";
   return true;
 }
 
+// Lists the ONVIF devices of the local networks: those answering the probe, then those of the cache
+// which did not, with how long ago they last did.
+static bool discover(int timeout, const std::string &cache_path, int ttl) {
+  namespace soap = app::soap;
+  const soap::SoapDiscoveryCache cache(cache_path, std::chrono::seconds(ttl));
+  std::vector<soap::DiscoveredDevice> cached;
+  if (!cache_path.empty()) cache.load(cached);
+
+  soap::SoapDiscovery discovery;
+  std::vector<soap::DiscoveredDevice> scanned;
+  if (timeout > 0) {
+    const auto interfaces = soap::SoapDiscovery::interfaces();
+    if (interfaces.empty()) std::cerr << "No network interface is up\n";
+    std::cout << "Probing from " << interfaces.size() << " interfaces...\n";
+    scanned = discovery.scan(interfaces, std::chrono::milliseconds(timeout));
+  }
+  const auto devices = soap::SoapDiscovery::merge(scanned, cached);
+  if (!cache_path.empty() && timeout > 0 && !cache.save(devices))
+    std::cerr << "Could not write the discovery cache " << cache_path << '\n';
+
+  const std::time_t now = std::time(nullptr);
+  for (size_t i = 0; i < devices.size(); ++i) {
+    std::cout << devices[i];
+    if (i >= scanned.size()) std::cout << " [cached, seen " << now - devices[i].seen << " s ago]";
+    std::cout << '\n';
+  }
+
+  const auto stats = discovery.stats();
+  std::cout << '\n'
+            << scanned.size() << " devices answered, " << devices.size() - scanned.size()
+            << " more in the cache\n";
+  if (timeout > 0)
+    std::cout << stats.matches << " matches (" << stats.duplicates << " duplicates, "
+              << stats.unrelated << " unrelated) on " << stats.interfaces - stats.failed << '/'
+              << stats.interfaces << " interfaces in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(stats.elapsed).count()
+              << " ms, first after "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(stats.first).count()
+              << " ms\n";
+  return !devices.empty();
+}
+
 static bool record(bool start) {
   bool ret = true;
   if (start) {
-    if (!::NET_DVR_StartDVRRecord(config.uid[0], config.channel, 0)) {
+    if (!network_request<::NET_DVR_StartDVRRecord>(config.uid[0], config.channel, 0)) {
       std::cerr << "Error when starting remote record: " << ::NET_DVR_GetErrorMsg() << '\n';
       ret = false;
     } else {
       std::cout << "Started remote record\n";
     }
   } else {
-    if (!::NET_DVR_StopDVRRecord(config.uid[0], config.channel)) {
+    if (!network_request<::NET_DVR_StopDVRRecord>(config.uid[0], config.channel)) {
       std::cerr << "Error when stopping remote record: " << ::NET_DVR_GetErrorMsg() << '\n';
       ret = false;
     } else {
@@ -513,16 +1078,17 @@ static bool alarm_input(int channel, bool open) {
   ::NET_DVR_ALARMINCFG net_dvr_alarmin_cfg;
 
   DWORD dw;
-  if (!::NET_DVR_GetDVRConfig(config.uid[0], NET_DVR_GET_ALARMINCFG, channel, &net_dvr_alarmin_cfg,
-                              sizeof net_dvr_alarmin_cfg, &dw)) {
+  if (!network_request<::NET_DVR_GetDVRConfig>(config.uid[0], NET_DVR_GET_ALARMINCFG, channel,
+                                              &net_dvr_alarmin_cfg, sizeof net_dvr_alarmin_cfg,
+                                              &dw)) {
     std::cerr << "Reading Alarm input configuration [channel = " << channel
               << "] failed: " << ::NET_DVR_GetErrorMsg() << '\n';
     return false;
   }
 
   net_dvr_alarmin_cfg.byAlarmType = !open;
-  if (!::NET_DVR_SetDVRConfig(config.uid[0], NET_DVR_SET_ALARMINCFG, channel, &net_dvr_alarmin_cfg,
-                              sizeof net_dvr_alarmin_cfg)) {
+  if (!network_request<::NET_DVR_SetDVRConfig>(config.uid[0], NET_DVR_SET_ALARMINCFG, channel,
+                                              &net_dvr_alarmin_cfg, sizeof net_dvr_alarmin_cfg)) {
     std::cerr << "Setting Alarm input parameter [channel = " << channel << ", open = " << open
               << "] failed: " << ::NET_DVR_GetErrorMsg() << '\n';
     return false;
@@ -539,8 +1105,9 @@ static bool alarm_output(int channel, int delay) {
   ::NET_DVR_ALARMOUTCFG net_dvr_alarmout_cfg;
 
   DWORD dw;
-  if (!::NET_DVR_GetDVRConfig(config.uid[0], NET_DVR_GET_ALARMOUTCFG, channel,
-                              &net_dvr_alarmout_cfg, sizeof net_dvr_alarmout_cfg, &dw)) {
+  if (!network_request<::NET_DVR_GetDVRConfig>(config.uid[0], NET_DVR_GET_ALARMOUTCFG, channel,
+                                              &net_dvr_alarmout_cfg, sizeof net_dvr_alarmout_cfg,
+                                              &dw)) {
     std::cerr << "Reading Alarm output configuration [channel = " << channel
               << "] failed: " << ::NET_DVR_GetErrorMsg() << '\n';
     return false;
@@ -549,8 +1116,8 @@ static bool alarm_output(int channel, int delay) {
   clog.log("alarm out current delay = ", net_dvr_alarmout_cfg.dwAlarmOutDelay);
   net_dvr_alarmout_cfg.dwAlarmOutDelay = delay;
   clog.log("alarm out new delay = ", net_dvr_alarmout_cfg.dwAlarmOutDelay);
-  if (!::NET_DVR_SetDVRConfig(config.uid[0], NET_DVR_GET_ALARMOUTCFG, channel,
-                              &net_dvr_alarmout_cfg, sizeof net_dvr_alarmout_cfg)) {
+  if (!network_request<::NET_DVR_SetDVRConfig>(config.uid[0], NET_DVR_GET_ALARMOUTCFG, channel,
+                                              &net_dvr_alarmout_cfg, sizeof net_dvr_alarmout_cfg)) {
     std::cerr << "Setting Alarm output delay [channel = " << channel << ", delay = " << delay
               << "] failed: " << ::NET_DVR_GetErrorMsg() << '\n';
     return false;
@@ -563,7 +1130,7 @@ static bool alarm_output(int channel, int delay) {
 static void test_ping() {
   clog.log("Measuring Ping duration");
   for (int i : {0, 1, 2}) {
-    if (!network_request(ping, config.host.c_str(), 1)) {
+    if (!network_request<ping>(config.host.c_str(), 1)) {
       auto err = ::GetLastError();
       std::cerr << "Ping Measure Failure: ";
       if (!err)
@@ -573,4 +1140,45 @@ static void test_ping() {
     }
   }
   clog.log("Done");
+}
+
+// "-" prints the latency table, anything else is the JSON export file.
+static void write_metrics(const std::string &path) {
+  if (path == "-") {
+    app::metrics::dump(std::cout);
+    return;
+  }
+  std::ofstream out(path);
+  app::metrics::export_json(out);
+  if (!out) std::cerr << "Could not write the metrics to " << path << '\n';
+}
+
+// Per class of ONVIF request: the requests sent, and those held over their budget. Printed when
+// any was held, as a hint that a budget is too tight for the camera or the operator.
+static void print_budgets() {
+  using app::soap::SoapTraffic;
+  std::ostringstream out;
+  bool throttled = false;
+  out << "ONVIF requests sent / held over budget:";
+  for (size_t t = 0; t < static_cast<size_t>(SoapTraffic::COUNT); ++t) {
+    const auto stats = app::soap::soap_thread.budget_stats(static_cast<SoapTraffic>(t));
+    out << ' ' << app::soap::name(static_cast<SoapTraffic>(t)) << ' ' << stats.sent << " / "
+        << stats.throttled;
+    throttled |= stats.throttled != 0;
+  }
+  if (throttled)
+    std::cout << out.str() << '\n';
+  else
+    clog.log(out.str());
+}
+
+// The packets of the stream tapped, printed when some were lost.
+static void print_stream() {
+  std::ostringstream out;
+  stream_tap.dump(out);
+  const auto stats = stream_tap.stats();
+  if (stats.exhausted || stats.oversize)
+    std::cout << out.str();
+  else
+    clog.log(out.str());
 }
\ No newline at end of file
@@ -63,9 +63,39 @@ struct configuration {
   int zoom;
 
   std::string record_dir;
+  int record_segment;
+  int pre_event;
+  int pre_event_size;
+  int post_event;
 
   int alarm_channel;
   int alarm_delay;
+
+  int samples;
+
+  std::string onvif_cache;
+
+  std::string metrics;
+
+  std::string event_topics;
+  int event_duration;
+
+  std::string decode_channels;
+  int decode_duration;
+
+  int discovery_timeout;
+  std::string discovery_cache;
+  int discovery_ttl;
+
+  int ptz_rate;
+  std::string ptz_backend;
+
+  std::string fov_table;
+  bool calibrate_fov;
+
+  double control_rate;
+  double query_rate;
+  double configuration_rate;
 };
 
 extern configuration config;
@@ -0,0 +1,161 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace app {
+namespace metrics {
+
+namespace {
+
+constexpr std::array<const char*, static_cast<size_t>(operation::COUNT)> names = {
+    "NET_DVR_Login_V40",
+    "NET_DVR_Logout",
+    "NET_DVR_GetDeviceConfig",
+    "NET_DVR_GetDVRConfig",
+    "NET_DVR_SetDVRConfig",
+    "NET_DVR_StartDVRRecord",
+    "NET_DVR_StopDVRRecord",
+    "NET_DVR_RealPlay_V40",
+    "NET_DVR_PTZControlWithSpeed_Other",
+    "ping",
+    "Device.GetDeviceInformation",
+    "Device.GetCapabilities",
+    "Media.GetProfiles",
+    "Media.GetAudioOutputs",
+    "PTZ.ContinuousMove",
+    "PTZ.Stop",
+    "PTZ.RelativeMove",
+    "PTZ.AbsoluteMove",
+    "PTZ.GetStatus",
+    "Imaging.GetImagingSettings",
+    "Imaging.SetImagingSettings",
+    "Events.CreatePullPointSubscription",
+    "Events.PullMessages",
+    "Events.Renew",
+    "Events.Unsubscribe",
+    "SoapThread.QueueResidency",
+    "UI.PTZInputToCommand",
+    "Stream.Tap",
+    "Recorder.Write",
+    "Recorder.Flush"};
+
+std::array<histogram, static_cast<size_t>(operation::COUNT)> histograms;
+
+}  // namespace
+
+const char* name(operation op) { return names[static_cast<size_t>(op)]; }
+
+histogram& of(operation op) { return histograms[static_cast<size_t>(op)]; }
+
+/******************************************************************************\
+ *
+ *	histogram
+ *
+ \******************************************************************************/
+
+histogram::histogram() : count_(0), errors_(0), sum_(0), max_(0) {
+  for (auto& b : buckets_) b.store(0, std::memory_order_relaxed);
+}
+
+// Below 2 * sub_buckets, one bucket per value. Above, `us` is shifted right until it has
+// sub_bucket_bits + 1 significant bits: each shift is a row of sub_buckets buckets.
+size_t histogram::bucket(uint64_t us) {
+  if (us > max_value) us = max_value;
+  if (us < 2 * sub_buckets) return static_cast<size_t>(us);
+  const unsigned shift = 63 - __builtin_clzll(us) - sub_bucket_bits;
+  return static_cast<size_t>((shift + 1) * sub_buckets + ((us >> shift) - sub_buckets));
+}
+
+uint64_t histogram::upper_bound(size_t bucket) {
+  if (bucket < 2 * sub_buckets) return bucket;
+  const unsigned shift = static_cast<unsigned>(bucket / sub_buckets - 1);
+  const uint64_t mantissa = sub_buckets + bucket % sub_buckets;
+  return ((mantissa + 1) << shift) - 1;
+}
+
+void histogram::record(std::chrono::steady_clock::duration elapsed) {
+  const auto us = static_cast<uint64_t>(
+      std::max<std::chrono::microseconds::rep>(
+          0, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+  buckets_[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(us, std::memory_order_relaxed);
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while (us > max && !max_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+  }
+}
+
+double histogram::mean() const {
+  const auto n = count();
+  return n ? static_cast<double>(sum_.load(std::memory_order_relaxed)) / n : 0.;
+}
+
+uint64_t histogram::percentile(double p) const {
+  const auto n = count();
+  if (!n) return 0;
+  const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(p * n + .5));
+  uint64_t seen = 0;
+  for (size_t b = 0; b < bucket_count; ++b) {
+    seen += bucket_value(b);
+    if (seen >= rank) return std::min(upper_bound(b), max());
+  }
+  return max();
+}
+
+/******************************************************************************\
+ *
+ *	dump / export
+ *
+ \******************************************************************************/
+
+void dump(std::ostream& out) {
+  const auto flags = out.flags();
+  const auto precision = out.precision();
+  out << std::left << std::setw(30) << "operation" << std::right << std::setw(9) << "count"
+      << std::setw(8) << "errors" << std::setw(11) << "mean (us)" << std::setw(11) << "p50"
+      << std::setw(11) << "p90" << std::setw(11) << "p99" << std::setw(11) << "p99.9"
+      << std::setw(11) << "max" << '\n';
+  for (size_t i = 0; i < histograms.size(); ++i) {
+    const histogram& h = histograms[i];
+    if (!h.count() && !h.errors()) continue;
+    out << std::left << std::setw(30) << names[i] << std::right << std::setw(9) << h.count()
+        << std::setw(8) << h.errors() << std::setw(11) << std::fixed << std::setprecision(0)
+        << h.mean() << std::setw(11) << h.percentile(.5) << std::setw(11) << h.percentile(.9)
+        << std::setw(11) << h.percentile(.99) << std::setw(11) << h.percentile(.999)
+        << std::setw(11) << h.max() << '\n';
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
+
+void export_json(std::ostream& out) {
+  const auto flags = out.flags();
+  const auto precision = out.precision();
+  out << "{\"unit\": \"us\", \"operations\": [";
+  bool first = true;
+  for (size_t i = 0; i < histograms.size(); ++i) {
+    const histogram& h = histograms[i];
+    if (!h.count() && !h.errors()) continue;
+    out << (first ? "" : ",") << "\n  {\"name\": \"" << names[i] << "\", \"count\": " << h.count()
+        << ", \"errors\": " << h.errors() << ", \"mean\": " << std::fixed << std::setprecision(1)
+        << h.mean() << ", \"p50\": " << h.percentile(.5) << ", \"p90\": " << h.percentile(.9)
+        << ", \"p99\": " << h.percentile(.99) << ", \"p999\": " << h.percentile(.999)
+        << ", \"max\": " << h.max() << ", \"buckets\": {";
+    bool first_bucket = true;
+    for (size_t b = 0; b < histogram::bucket_count; ++b) {
+      if (!h.bucket_value(b)) continue;
+      out << (first_bucket ? "" : ", ") << '"' << histogram::upper_bound(b)
+          << "\": " << h.bucket_value(b);
+      first_bucket = false;
+    }
+    out << "}}";
+    first = false;
+  }
+  out << "\n]}\n";
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}  // namespace metrics
+}  // namespace app
\ No newline at end of file
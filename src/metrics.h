@@ -0,0 +1,110 @@
+#ifndef DEF_METRICS_H
+#define DEF_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace app {
+namespace metrics {
+
+// Every measured operation: the HCNetSDK calls made through network_request(), the ONVIF
+// requests sent by SoapThread and the time their actions waited to be sent, the delay of the PTZ
+// control loop from input to command, the time the stream callback of the SDK is kept, the
+// writes of the recordings and the flushes of their pre-event buffers. The enumerator is the
+// identity of the operation, its histogram is found by index.
+enum class operation : size_t {
+  SDK_LOGIN,
+  SDK_LOGOUT,
+  SDK_GET_DEVICE_CONFIG,
+  SDK_GET_DVR_CONFIG,
+  SDK_SET_DVR_CONFIG,
+  SDK_START_DVR_RECORD,
+  SDK_STOP_DVR_RECORD,
+  SDK_REAL_PLAY,
+  SDK_PTZ_CONTROL_WITH_SPEED,
+  PING,
+  DEVICE_GET_DEVICE_INFORMATION,
+  DEVICE_GET_CAPABILITIES,
+  MEDIA_GET_PROFILES,
+  MEDIA_GET_AUDIO_OUTPUTS,
+  PTZ_CONTINUOUS_MOVE,
+  PTZ_STOP,
+  PTZ_RELATIVE_MOVE,
+  PTZ_ABSOLUTE_MOVE,
+  PTZ_GET_STATUS,
+  IMAGING_GET_IMAGING_SETTINGS,
+  IMAGING_SET_IMAGING_SETTINGS,
+  EVENTS_CREATE_PULL_POINT_SUBSCRIPTION,
+  EVENTS_PULL_MESSAGES,
+  EVENTS_RENEW,
+  EVENTS_UNSUBSCRIBE,
+  SOAP_QUEUE_RESIDENCY,
+  UI_PTZ_INPUT_TO_COMMAND,
+  STREAM_TAP,
+  RECORD_WRITE,
+  RECORD_FLUSH,
+  COUNT
+};
+
+const char* name(operation op);
+
+// Latencies in microseconds, in fixed buckets (HDR style): exact up to 63 us, then 32 buckets per
+// power of two, i.e. within 3%, up to about 71 minutes. Recording is a few relaxed atomic
+// increments: any thread may record while another one reads.
+class histogram {
+ public:
+  static constexpr unsigned sub_bucket_bits = 5;
+  static constexpr uint64_t sub_buckets = 1 << sub_bucket_bits;
+  static constexpr uint64_t max_value = (uint64_t{1} << 32) - 1;
+  static constexpr size_t bucket_count = (32 - sub_bucket_bits + 1) * sub_buckets;
+
+ private:
+  std::array<std::atomic<uint64_t>, bucket_count> buckets_;
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> errors_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+
+ public:
+  static size_t bucket(uint64_t us);
+  // Highest value counted in `bucket`.
+  static uint64_t upper_bound(size_t bucket);
+
+  histogram();
+  histogram(const histogram&) = delete;
+  histogram& operator=(const histogram&) = delete;
+
+  void record(std::chrono::steady_clock::duration elapsed);
+  void record_error() { errors_.fetch_add(1, std::memory_order_relaxed); }
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t errors() const { return errors_.load(std::memory_order_relaxed); }
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+  double mean() const;
+  // Upper bound of the bucket holding the `p` quantile (0 < p <= 1), 0 when empty.
+  uint64_t percentile(double p) const;
+  uint64_t bucket_value(size_t bucket) const {
+    return buckets_[bucket].load(std::memory_order_relaxed);
+  }
+};
+
+histogram& of(operation op);
+
+inline void record(operation op, std::chrono::steady_clock::duration elapsed) {
+  of(op).record(elapsed);
+}
+inline void record_error(operation op) { of(op).record_error(); }
+
+// One line per operation seen: count, errors, mean, p50, p90, p99, p99.9 and max, in microseconds.
+void dump(std::ostream& out);
+// The same as JSON, with the non-empty buckets (upper bound: count) of every operation.
+void export_json(std::ostream& out);
+
+}  // namespace metrics
+}  // namespace app
+
+#endif
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "main.h"
+#include "metrics.h"
+#include "soap_mock.h"
+#include "synchronized_ostream.h"
+
+namespace app {
+configuration configuration::config_ = configuration();
+synchronized_ostream clog{std::clog, true};
+configuration config = configuration::get_instance();
+
+}  // namespace app
+
+using namespace app;
+
+// "PTZ.GetStatus=latency,jitter,fault-rate,drop-rate", the operation named as in the metrics.
+static bool parse_operation(const std::string &value, metrics::operation &op,
+                            soap::mock_profile &profile) {
+  const size_t equal = value.find('=');
+  if (equal == std::string::npos) return false;
+  const std::string name = value.substr(0, equal);
+  size_t i = 0;
+  while (i < static_cast<size_t>(metrics::operation::COUNT) &&
+         name != metrics::name(static_cast<metrics::operation>(i)))
+    ++i;
+  if (i == static_cast<size_t>(metrics::operation::COUNT)) return false;
+  op = static_cast<metrics::operation>(i);
+
+  std::istringstream fields(value.substr(equal + 1));
+  long latency, jitter;
+  char comma[3];
+  if (!(fields >> latency >> comma[0] >> jitter >> comma[1] >> profile.fault_rate >> comma[2] >>
+        profile.drop_rate) ||
+      comma[0] != ',' || comma[1] != ',' || comma[2] != ',')
+    return false;
+  profile.latency = std::chrono::milliseconds(latency);
+  profile.jitter = std::chrono::milliseconds(jitter);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  namespace po = boost::program_options;
+
+  std::string host;
+  int port;
+  unsigned seed;
+  int latency, jitter;
+  soap::mock_profile profile;
+  std::vector<std::string> operations;
+  po::options_description description("Allowed options");
+  description.add_options()("help,h", "prints this")(
+      "host,H", po::value<std::string>(&host)->default_value("127.0.0.1"), "Address listened on")(
+      "port,P", po::value<int>(&port)->default_value(8000), "Port listened on, 0 for any")(
+      "seed", po::value<unsigned>(&seed)->default_value(1), "Seed of the latencies and failures")(
+      "latency", po::value<int>(&latency)->default_value(0), "Time to answer (in ms)")(
+      "jitter", po::value<int>(&jitter)->default_value(0),
+      "Added to the latency, uniform up to this (in ms)")(
+      "fault-rate", po::value<double>(&profile.fault_rate)->default_value(0.),
+      "Part of the requests answered with a SOAP fault")(
+      "drop-rate", po::value<double>(&profile.drop_rate)->default_value(0.),
+      "Part of the requests whose connection is closed instead")(
+      "operation,o", po::value<std::vector<std::string>>(&operations),
+      "Profile of one operation, e.g. PTZ.GetStatus=latency,jitter,fault-rate,drop-rate "
+      "(repeatable)");
+
+  po::variables_map vm;
+  std::vector<std::pair<metrics::operation, soap::mock_profile>> overrides;
+  try {
+    po::store(po::parse_command_line(argc, argv, description), vm);
+    if (vm.count("help")) {
+      std::cout << "Usage: " << argv[0] << " [options]\n" << description << '\n';
+      return 0;
+    }
+    po::notify(vm);
+    if (port < 0 || port > 65535) throw std::runtime_error("The port must be in [0, 65535]");
+    if (latency < 0 || jitter < 0) throw std::runtime_error("The latency and jitter must be >= 0");
+    if (profile.fault_rate < 0. || profile.drop_rate < 0.)
+      throw std::runtime_error("The fault and drop rates must be >= 0");
+    for (const auto &value : operations) {
+      std::pair<metrics::operation, soap::mock_profile> entry;
+      if (!parse_operation(value, entry.first, entry.second))
+        throw std::runtime_error("Invalid operation profile: " + value);
+      overrides.push_back(entry);
+    }
+  } catch (const std::exception &e) {
+    std::cout << e.what() << '\n';
+    std::cout << "Usage: " << argv[0] << " [options]\n" << description << '\n';
+    return 1;
+  }
+  profile.latency = std::chrono::milliseconds(latency);
+  profile.jitter = std::chrono::milliseconds(jitter);
+
+  soap::SoapMockDevice mock(seed);
+  mock.set(profile);
+  for (const auto &entry : overrides) mock.set(entry.first, entry.second);
+  if (!mock.start(host, port)) return 1;
+  std::cout << "Serving " << mock.endpoint() << ", press Enter to stop\n";
+  std::cin.get();
+  mock.stop();
+
+  mock.dump(std::cout);
+  return 0;
+}
\ No newline at end of file
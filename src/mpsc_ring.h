@@ -0,0 +1,303 @@
+#ifndef DEF_MPSC_RING_H
+#define DEF_MPSC_RING_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace app {
+
+// What a producer wants to happen when the ring has no room for its element.
+enum class OverflowPolicy {
+  REPLACE_LATEST,  // park it in the overflow slot, replacing the element parked there
+  REJECT,          // give up immediately
+  BLOCK            // retry until the deadline expires
+};
+
+enum class SubmitResult { ACCEPTED, REPLACED, REJECTED, TIMED_OUT };
+
+struct submission_stats {
+  size_t depth;
+  unsigned long long submitted;
+  unsigned long long replaced;
+  unsigned long long rejected;
+  unsigned long long timed_out;
+  std::chrono::nanoseconds average_latency;
+  std::chrono::nanoseconds max_latency;
+};
+
+// Bounded multi-producer / single-consumer ring buffer (per-cell sequence numbers, after Dmitry
+// Vyukov's bounded queue). Producers never take a lock on the submission path: the only mutex is
+// the one the consumer sleeps on, and producers touch it only to wake a sleeping consumer.
+//
+// REPLACE_LATEST producers never fill the last `Reserve` cells so that REJECT / BLOCK producers
+// (e.g. a Stop command) still find room while the consumer is busy. Once the overflow slot is
+// occupied every producer queues behind it, which keeps each producer's elements in order.
+//
+// push_urgent() never waits either: the element goes in a slot of its own, and is popped right
+// after the elements submitted before it, those still to come waiting for it. A single urgent
+// element is held at a time.
+template <typename T, size_t N, size_t Reserve = N / 4>
+class mpsc_ring {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "The ring capacity must be a power of two");
+  static_assert(Reserve < N, "The reserve must leave room for the latest-replacing producers");
+
+  struct cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  std::array<cell, N> cells_;
+  alignas(64) std::atomic<size_t> enqueue_pos_;
+  alignas(64) std::atomic<size_t> dequeue_pos_;
+
+  std::atomic_flag latest_lock_ = ATOMIC_FLAG_INIT;
+  std::atomic<bool> has_latest_;
+  T latest_;
+
+  std::atomic_flag urgent_lock_ = ATOMIC_FLAG_INIT;
+  std::atomic<bool> has_urgent_;
+  T urgent_;
+  // Where the urgent element stands: the cells claimed and the elements parked before it.
+  size_t urgent_pos_;
+  unsigned long long urgent_parked_;
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::atomic<bool> consumer_sleeping_;
+
+  std::atomic<unsigned long long> parked_;  // written under the overflow slot lock only
+  std::atomic<unsigned long long> urgent_count_;
+  std::atomic<unsigned long long> replaced_;
+  std::atomic<unsigned long long> rejected_;
+  std::atomic<unsigned long long> timed_out_;
+  std::atomic<unsigned long long> latency_sum_;
+  std::atomic<unsigned long long> latency_max_;
+
+  bool try_push(T& value, size_t reserve) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      if (pos - dequeue_pos_.load(std::memory_order_acquire) >= N - reserve) return false;
+      cell& c = cells_[pos & (N - 1)];
+      const size_t sequence = c.sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_seq_cst,
+                                               std::memory_order_relaxed)) {
+          c.value = std::move(value);
+          c.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void lock_latest() {
+    while (latest_lock_.test_and_set(std::memory_order_acquire)) std::this_thread::yield();
+  }
+  void unlock_latest() { latest_lock_.clear(std::memory_order_release); }
+
+  // The seq_cst claim of a cell (or of the overflow slot) by the producer and the seq_cst store of
+  // `consumer_sleeping_` by the consumer are totally ordered: either the consumer sees the element
+  // before going to sleep or the producer sees it asleep. No fence needed on the fast path.
+  void wake_consumer() {
+    if (consumer_sleeping_.load(std::memory_order_seq_cst)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      condition_.notify_one();
+    }
+  }
+
+  void record_wait(std::chrono::steady_clock::time_point start) {
+    const auto elapsed = static_cast<unsigned long long>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                             start)
+            .count());
+    latency_sum_.fetch_add(elapsed, std::memory_order_relaxed);
+    auto max = latency_max_.load(std::memory_order_relaxed);
+    while (elapsed > max &&
+           !latency_max_.compare_exchange_weak(max, elapsed, std::memory_order_relaxed)) {
+    }
+  }
+
+ public:
+  mpsc_ring()
+      : enqueue_pos_(0),
+        dequeue_pos_(0),
+        has_latest_(false),
+        latest_(),
+        has_urgent_(false),
+        urgent_(),
+        urgent_pos_(0),
+        urgent_parked_(0),
+        consumer_sleeping_(false),
+        parked_(0),
+        urgent_count_(0),
+        replaced_(0),
+        rejected_(0),
+        timed_out_(0),
+        latency_sum_(0),
+        latency_max_(0) {
+    for (size_t i = 0; i < N; ++i) cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  mpsc_ring(const mpsc_ring&) = delete;
+  mpsc_ring& operator=(const mpsc_ring&) = delete;
+
+  static constexpr size_t capacity() { return N; }
+
+  // Thread safe. On REPLACED, `displaced` receives the element that was parked in the overflow
+  // slot. On REJECTED / TIMED_OUT, `value` is left untouched. The submit latency only accounts for
+  // the time BLOCK producers spent waiting for room: reading the clock on every push would cost
+  // more than the push itself.
+  SubmitResult push(T& value, OverflowPolicy policy, std::chrono::steady_clock::time_point deadline,
+                    T* displaced = nullptr) {
+    std::chrono::steady_clock::time_point start;
+    SubmitResult result = SubmitResult::ACCEPTED;
+    if (policy == OverflowPolicy::REPLACE_LATEST) {
+      if (has_latest_.load(std::memory_order_acquire) || !try_push(value, Reserve)) {
+        lock_latest();
+        if (has_latest_.load(std::memory_order_relaxed)) {
+          if (displaced) *displaced = std::move(latest_);
+          replaced_.fetch_add(1, std::memory_order_relaxed);
+          result = SubmitResult::REPLACED;
+        }
+        latest_ = std::move(value);
+        parked_.store(parked_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        has_latest_.store(true, std::memory_order_seq_cst);
+        unlock_latest();
+      }
+    } else {
+      auto backoff = std::chrono::microseconds(1);
+      while (has_latest_.load(std::memory_order_acquire) || !try_push(value, 0)) {
+        if (policy == OverflowPolicy::REJECT) {
+          rejected_.fetch_add(1, std::memory_order_relaxed);
+          return SubmitResult::REJECTED;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if (start == std::chrono::steady_clock::time_point()) start = now;
+        if (now >= deadline) {
+          timed_out_.fetch_add(1, std::memory_order_relaxed);
+          return SubmitResult::TIMED_OUT;
+        }
+        std::this_thread::sleep_for(backoff);
+        backoff = std::min(backoff * 2, std::chrono::microseconds(1000));
+      }
+    }
+    if (start != std::chrono::steady_clock::time_point()) record_wait(start);
+    wake_consumer();
+    return result;
+  }
+
+  // Thread safe. Returns false, `value` left untouched, when an urgent element is already held.
+  bool push_urgent(T& value) {
+    while (urgent_lock_.test_and_set(std::memory_order_acquire)) std::this_thread::yield();
+    if (has_urgent_.load(std::memory_order_acquire)) {
+      urgent_lock_.clear(std::memory_order_release);
+      return false;
+    }
+    urgent_ = std::move(value);
+    lock_latest();
+    urgent_parked_ = parked_.load(std::memory_order_relaxed);
+    urgent_pos_ = enqueue_pos_.load(std::memory_order_seq_cst);
+    unlock_latest();
+    urgent_count_.fetch_add(1, std::memory_order_relaxed);
+    has_urgent_.store(true, std::memory_order_seq_cst);
+    urgent_lock_.clear(std::memory_order_release);
+    wake_consumer();
+    return true;
+  }
+
+  // Consumer only. The ring is drained before the overflow slot since the slot always holds the
+  // most recent element. The urgent element comes once what was submitted before it is popped.
+  bool pop(T& value) {
+    const size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    const bool urgent = has_urgent_.load(std::memory_order_acquire) && urgent_pos_ == pos;
+    if (!urgent) {
+      cell& c = cells_[pos & (N - 1)];
+      const size_t sequence = c.sequence.load(std::memory_order_acquire);
+      if (sequence == pos + 1) {
+        value = std::move(c.value);
+        c.sequence.store(pos + N, std::memory_order_release);
+        dequeue_pos_.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    }
+    // A producer may have claimed a cell without publishing it yet: keep the order.
+    if (has_latest_.load(std::memory_order_acquire) &&
+        enqueue_pos_.load(std::memory_order_acquire) == pos) {
+      lock_latest();
+      if (!urgent || parked_.load(std::memory_order_relaxed) <= urgent_parked_) {
+        value = std::move(latest_);
+        has_latest_.store(false, std::memory_order_release);
+        unlock_latest();
+        return true;
+      }
+      unlock_latest();
+    }
+    if (!urgent) return false;
+    value = std::move(urgent_);
+    has_urgent_.store(false, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return enqueue_pos_.load(std::memory_order_seq_cst) ==
+               dequeue_pos_.load(std::memory_order_acquire) &&
+           !has_latest_.load(std::memory_order_seq_cst) &&
+           !has_urgent_.load(std::memory_order_seq_cst);
+  }
+
+  // Consumer only: sleeps until an element is available or `stop` becomes true.
+  void wait(const std::atomic<bool>& stop) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    consumer_sleeping_.store(true, std::memory_order_seq_cst);
+    condition_.wait(lock, [&]() { return !empty() || stop.load(); });
+    consumer_sleeping_.store(false, std::memory_order_relaxed);
+  }
+
+  // Consumer only: the same, giving up at `deadline`. Returns false when nothing is available.
+  bool wait_until(const std::atomic<bool>& stop, std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    consumer_sleeping_.store(true, std::memory_order_seq_cst);
+    condition_.wait_until(lock, deadline, [&]() { return !empty() || stop.load(); });
+    consumer_sleeping_.store(false, std::memory_order_relaxed);
+    return !empty();
+  }
+
+  void wake_up() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    condition_.notify_all();
+  }
+
+  submission_stats stats() const {
+    const auto enqueued = enqueue_pos_.load(std::memory_order_relaxed);
+    const auto submitted = enqueued + parked_.load(std::memory_order_relaxed) +
+                           urgent_count_.load(std::memory_order_relaxed);
+    const auto dequeued = dequeue_pos_.load(std::memory_order_relaxed);
+    return {enqueued - std::min(enqueued, dequeued) +
+                (has_latest_.load(std::memory_order_relaxed) ? 1 : 0) +
+                (has_urgent_.load(std::memory_order_relaxed) ? 1 : 0),
+            submitted,
+            replaced_.load(std::memory_order_relaxed),
+            rejected_.load(std::memory_order_relaxed),
+            timed_out_.load(std::memory_order_relaxed),
+            std::chrono::nanoseconds(
+                submitted ? latency_sum_.load(std::memory_order_relaxed) / submitted : 0),
+            std::chrono::nanoseconds(latency_max_.load(std::memory_order_relaxed))};
+  }
+};
+
+}  // namespace app
+
+#endif
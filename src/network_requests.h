@@ -3,12 +3,58 @@
 
 #include <chrono>
 #include <functional>
+#include <thread>
 #include <utility>
 
+#include "metrics.h"
 #include "synchronized_ostream.h"
+#include "util.h"
 
 namespace app {
 
+// Metrics operation of every function called through network_request(), resolved at compile time:
+// calling a function that is not listed here does not compile. The functions returning a handle
+// fail with a negative one, the others with FALSE.
+template<metrics::operation Operation, bool Handle = false>
+struct network_operation_traits
+{
+    static constexpr metrics::operation id = Operation;
+
+    template<typename Ret>
+    static bool failed(Ret ret)
+    {
+        if constexpr (Handle) return ret < 0;
+        else return !ret;
+    }
+};
+
+template<auto Function>
+struct network_operation;
+
+template<> struct network_operation<ping>
+    : network_operation_traits<metrics::operation::PING> {};
+template<> struct network_operation<::NET_DVR_Login_V40>
+    : network_operation_traits<metrics::operation::SDK_LOGIN, true> {};
+template<> struct network_operation<::NET_DVR_Logout>
+    : network_operation_traits<metrics::operation::SDK_LOGOUT> {};
+template<> struct network_operation<::NET_DVR_GetDeviceConfig>
+    : network_operation_traits<metrics::operation::SDK_GET_DEVICE_CONFIG> {};
+template<> struct network_operation<::NET_DVR_GetDVRConfig>
+    : network_operation_traits<metrics::operation::SDK_GET_DVR_CONFIG> {};
+template<> struct network_operation<::NET_DVR_SetDVRConfig>
+    : network_operation_traits<metrics::operation::SDK_SET_DVR_CONFIG> {};
+template<> struct network_operation<::NET_DVR_StartDVRRecord>
+    : network_operation_traits<metrics::operation::SDK_START_DVR_RECORD> {};
+template<> struct network_operation<::NET_DVR_StopDVRRecord>
+    : network_operation_traits<metrics::operation::SDK_STOP_DVR_RECORD> {};
+template<> struct network_operation<::NET_DVR_RealPlay_V40>
+    : network_operation_traits<metrics::operation::SDK_REAL_PLAY, true> {};
+template<> struct network_operation<::NET_DVR_PTZControlWithSpeed_Other>
+    : network_operation_traits<metrics::operation::SDK_PTZ_CONTROL_WITH_SPEED> {};
+
+template<auto Function, typename... Args>
+using request_return_t = decltype(Function(std::declval<Args>()...));
+
 class network_requests
 {
 
@@ -20,18 +66,18 @@ class network_requests
 
     public:
 
-    template<typename Callable, typename... Args>
-    using request_return_t = decltype(std::declval<Callable>() (std::declval<Args>()...));
-
-    template<typename Callable, typename... Args>
-    request_return_t<Callable, Args...> request(Callable f, Args... args)
+    template<auto Function, typename... Args>
+    request_return_t<Function, Args...> request(Args... args)
     {
         using namespace std::chrono;
-        clog.log("Invoking ", get_function_name(f));
-        high_resolution_clock::time_point t1 = high_resolution_clock::now();
-        auto ret = f(args...);
-        high_resolution_clock::time_point t2 = high_resolution_clock::now();
-        
+        constexpr auto operation = network_operation<Function>::id;
+        clog.log("Invoking ", metrics::name(operation));
+        steady_clock::time_point t1 = steady_clock::now();
+        auto ret = Function(args...);
+        steady_clock::time_point t2 = steady_clock::now();
+
+        metrics::record(operation, t2 - t1);
+        if (network_operation<Function>::failed(ret)) metrics::record_error(operation);
         duration_last_request_ = duration_cast<milliseconds>(t2-t1).count();
         ++requests_count_;
         requests_sum_ += duration_last_request_;
@@ -53,37 +99,29 @@ class network_requests
     }
 };
 
-template<typename Callable, typename... Args>
-using request_return_t = decltype(std::declval<Callable>() (std::declval<Args>()...));
-
-template<typename Callable, typename... Args>
-request_return_t<Callable, Args...> network_request(Callable f, Args... args)
+template<auto Function, typename... Args>
+request_return_t<Function, Args...> network_request(Args... args)
 {
     using namespace std::chrono;
-    clog.log("Invoking ", get_function_name(f));
-    high_resolution_clock::time_point t1 = high_resolution_clock::now();
-    auto ret = f(args...);
-    high_resolution_clock::time_point t2 = high_resolution_clock::now();
+    constexpr auto operation = network_operation<Function>::id;
+    clog.log("Invoking ", metrics::name(operation));
+    steady_clock::time_point t1 = steady_clock::now();
+    auto ret = Function(args...);
+    steady_clock::time_point t2 = steady_clock::now();
 
-    auto duration = duration_cast<milliseconds>(t2-t1).count();
-    clog.log("Request took ", duration, " ms");
+    metrics::record(operation, t2 - t1);
+    if (network_operation<Function>::failed(ret)) metrics::record_error(operation);
+    clog.log("Request took ", duration_cast<milliseconds>(t2-t1).count(), " ms");
 
     return ret;
 }
 
-template<typename Callable, typename... Args>
-void network_request_async(Callable f, Args... args)
+template<auto Function, typename... Args>
+void network_request_async(Args... args)
 {
-    using namespace std::chrono;
     std::thread([=]()
     {
-        clog.log("Invoking ", get_function_name(f));
-        high_resolution_clock::time_point t1 = high_resolution_clock::now();
-        f(args...);
-        high_resolution_clock::time_point t2 = high_resolution_clock::now();
-
-        auto duration = duration_cast<milliseconds>(t2-t1).count();
-        clog.log("Request ", get_function_name(f), " took ", duration, " ms");
+        network_request<Function>(args...);
     }).detach();
 }
 
@@ -0,0 +1,87 @@
+#include "pre_event.h"
+
+#include <cstring>
+
+namespace app {
+
+PreEventBuffer::PreEventBuffer(std::chrono::steady_clock::duration duration, size_t capacity)
+    : duration_(duration),
+      capacity_(capacity),
+      memory_(new unsigned char[capacity]),
+      first_(0),
+      write_(0),
+      bytes_(0),
+      evicted_(0),
+      skipped_(0) {}
+
+size_t PreEventBuffer::room(size_t size) const {
+  if (entries_.empty()) return size <= capacity_ ? 0 : capacity_;
+  const size_t head = entries_.front().offset;
+  if (write_ > head) {
+    // [head, write_) in use: after it, or from the start.
+    if (capacity_ - write_ >= size) return write_;
+    return size <= head ? 0 : capacity_;
+  }
+  // [head, capacity_) and [0, write_) in use, full when write_ is head.
+  return head - write_ >= size ? write_ : capacity_;
+}
+
+void PreEventBuffer::evict() {
+  const uint64_t end = keyframes_.size() > 1 ? keyframes_[1] : first_ + entries_.size();
+  keyframes_.pop_front();
+  for (; first_ < end; ++first_) {
+    bytes_ -= entries_.front().size;
+    entries_.pop_front();
+  }
+  ++evicted_;
+}
+
+void PreEventBuffer::push(const StreamPacket& packet) {
+  const size_t size = packet.size();
+  if (!size) return;
+  if (size > capacity_) clear();
+  if ((entries_.empty() && !packet.keyframe()) || size > capacity_) {
+    ++skipped_;
+    return;
+  }
+  size_t at;
+  while ((at = room(size)) == capacity_) {
+    if (keyframes_.size() == 1 && !packet.keyframe()) {
+      // The GOP fills the buffer alone: none is held until the next one.
+      ++evicted_;
+      ++skipped_;
+      clear();
+      return;
+    }
+    evict();
+  }
+  std::memcpy(memory_.get() + at, packet.data(), size);
+  if (packet.keyframe()) keyframes_.push_back(first_ + entries_.size());
+  entries_.push_back({at, size, packet.sequence(), packet.received(), packet.keyframe()});
+  write_ = at + size;
+  bytes_ += size;
+
+  const auto oldest = packet.received() - duration_;
+  while (keyframes_.size() > 1 && entries_[keyframes_[1] - first_].received <= oldest) evict();
+}
+
+void PreEventBuffer::clear() {
+  first_ += entries_.size();
+  entries_.clear();
+  keyframes_.clear();
+  write_ = 0;
+  bytes_ = 0;
+}
+
+void PreEventBuffer::replay(const packet_function& f) const {
+  for (const auto& e : entries_) f(e.sequence, memory_.get() + e.offset, e.size, e.received);
+}
+
+pre_event_stats PreEventBuffer::stats() const {
+  return {entries_.size(), bytes_,
+          entries_.empty() ? std::chrono::steady_clock::duration::zero()
+                           : entries_.back().received - entries_.front().received,
+          evicted_, skipped_};
+}
+
+}  // namespace app
\ No newline at end of file
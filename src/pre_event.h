@@ -0,0 +1,73 @@
+#ifndef DEF_PRE_EVENT_H
+#define DEF_PRE_EVENT_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+
+#include "stream_tap.h"
+
+namespace app {
+
+struct pre_event_stats {
+  unsigned long long packets;  // held
+  unsigned long long bytes;    // held
+  std::chrono::steady_clock::duration span;  // from the first packet held to the last
+  unsigned long long evicted;  // GOPs, older than the duration or for want of room
+  unsigned long long skipped;  // packets, waiting for a keyframe to start at
+};
+
+// The latest packets of a stream, copied out of the tap: they would otherwise keep its buffers for
+// seconds. It holds the GOPs of the last `duration`, the oldest starting at or before it, within
+// `capacity` bytes allocated once, the whole GOPs before the packet pushed being evicted when it
+// does not fit. It always starts at a keyframe, the GOP being pushed dropped when it alone fills
+// the buffer. Its memory is the capacity, and an entry of about 48 bytes per packet held. Used by
+// a single thread at a time.
+class PreEventBuffer {
+  struct entry {
+    size_t offset;
+    size_t size;
+    uint64_t sequence;
+    std::chrono::steady_clock::time_point received;
+    bool keyframe;
+  };
+
+  std::chrono::steady_clock::duration duration_;
+  size_t capacity_;
+  std::unique_ptr<unsigned char[]> memory_;
+  std::deque<entry> entries_;
+  std::deque<uint64_t> keyframes_;  // indexes of the keyframes held
+  uint64_t first_;                  // index of the first entry held
+  size_t write_;                    // where the next packet goes, if it fits
+  size_t bytes_;
+  unsigned long long evicted_;
+  unsigned long long skipped_;
+
+  // Where a packet of `size` bytes goes, capacity_ when it does not fit.
+  size_t room(size_t size) const;
+  void evict();
+
+ public:
+  using packet_function = std::function<void(uint64_t, const unsigned char*, size_t,
+                                             std::chrono::steady_clock::time_point)>;
+
+  PreEventBuffer(std::chrono::steady_clock::duration duration, size_t capacity);
+  PreEventBuffer(const PreEventBuffer&) = delete;
+  PreEventBuffer& operator=(const PreEventBuffer&) = delete;
+
+  // A packet of the video stream (NET_DVR_STREAMDATA).
+  void push(const StreamPacket& packet);
+  void clear();
+  // Gives the packets held, oldest first, with their sequence numbers and when they were received.
+  void replay(const packet_function& f) const;
+
+  size_t capacity() const { return capacity_; }
+  pre_event_stats stats() const;
+};
+
+}  // namespace app
+
+#endif
\ No newline at end of file
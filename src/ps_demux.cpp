@@ -0,0 +1,360 @@
+#include "ps_demux.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace app {
+
+namespace {
+
+constexpr unsigned char pack_header = 0xBA;
+constexpr unsigned char program_end = 0xB9;
+constexpr unsigned char stream_map_id = 0xBC;
+constexpr unsigned char first_video_id = 0xE0;
+constexpr unsigned char last_video_id = 0xEF;
+
+// stream_type of the program stream map.
+constexpr unsigned char h264_stream = 0x1B;
+constexpr unsigned char h265_stream = 0x24;
+
+constexpr uint64_t pts_modulo = uint64_t{1} << 33;
+
+// Exp-Golomb and fixed width fields of an RBSP, reading zeros past its end.
+class bit_reader {
+  const std::vector<unsigned char>& bytes_;
+  size_t bit_;
+
+ public:
+  bit_reader(const std::vector<unsigned char>& bytes, size_t byte) : bytes_(bytes), bit_(byte * 8) {}
+
+  unsigned bits(int n) {
+    unsigned value = 0;
+    for (int i = 0; i < n; ++i, ++bit_) {
+      const size_t byte = bit_ / 8;
+      value = value << 1 | (byte < bytes_.size() ? bytes_[byte] >> (7 - bit_ % 8) & 1 : 0);
+    }
+    return value;
+  }
+  bool flag() { return bits(1) != 0; }
+  void skip(size_t n) { bit_ += n; }
+  unsigned ue() {
+    int zeros = 0;
+    while (!flag() && zeros < 32) ++zeros;
+    return zeros ? (1u << zeros) - 1 + bits(zeros) : 0;
+  }
+  int se() {
+    const unsigned v = ue();
+    return v % 2 ? static_cast<int>((v + 1) / 2) : -static_cast<int>(v / 2);
+  }
+  bool overrun() const { return bit_ > bytes_.size() * 8; }
+};
+
+// The payload of a NAL unit without its emulation prevention bytes (the 03 of 00 00 03).
+void unescape(const unsigned char* nal, size_t size, std::vector<unsigned char>& rbsp) {
+  rbsp.clear();
+  int zeros = 0;
+  for (size_t i = 0; i < size; ++i) {
+    if (zeros >= 2 && nal[i] == 3) {
+      zeros = 0;
+      continue;
+    }
+    zeros = nal[i] ? 0 : zeros + 1;
+    rbsp.push_back(nal[i]);
+  }
+}
+
+void skip_scaling_list(bit_reader& r, int size) {
+  int last = 8, next = 8;
+  for (int i = 0; i < size && next; ++i) {
+    next = (last + r.se() + 256) % 256;
+    if (next) last = next;
+  }
+}
+
+}  // namespace
+
+bool video_parameters::complete() const {
+  return !sps.empty() && !pps.empty() && (codec != VideoCodec::H265 || !vps.empty());
+}
+
+size_t access_unit::size() const {
+  size_t bytes = 0;
+  for (const auto& n : nals) bytes += 4 + n.size;
+  return bytes;
+}
+
+/******************************************************************************\
+ *
+ *	PsDemuxer
+ *
+ \******************************************************************************/
+
+PsDemuxer::PsDemuxer(unit_function on_unit)
+    : on_unit_(std::move(on_unit)),
+      has_pts_(false),
+      pts_(0),
+      raw_pts_(0),
+      started_(false),
+      stream_type_(0),
+      parameters_version_(0),
+      stats_{} {}
+
+void PsDemuxer::feed(const unsigned char* data, size_t size) {
+  if (input_.empty()) {
+    // Whole units are parsed where they are, only the incomplete end is copied.
+    const size_t parsed = parse(data, size);
+    input_.assign(data + parsed, data + size);
+  } else {
+    input_.insert(input_.end(), data, data + size);
+    const size_t parsed = parse(input_.data(), input_.size());
+    input_.erase(input_.begin(), input_.begin() + parsed);
+  }
+}
+
+void PsDemuxer::reset() {
+  input_.clear();
+  frame_.clear();
+  has_pts_ = false;
+}
+
+size_t PsDemuxer::parse(const unsigned char* data, size_t size) {
+  size_t i = 0;
+  while (i + 4 <= size) {
+    const unsigned char* p = data + i;
+    if (p[0] || p[1] || p[2] != 1 || p[3] < program_end) {
+      ++i;
+      ++stats_.skipped;
+      continue;
+    }
+    size_t length;
+    if (p[3] == pack_header) {
+      if (i + 14 > size) break;
+      length = 14 + (p[13] & 7);
+    } else if (p[3] == program_end) {
+      length = 4;
+    } else {
+      if (i + 6 > size) break;
+      length = 6 + (p[4] << 8 | p[5]);
+    }
+    if (i + length > size) break;
+    if (p[3] == stream_map_id)
+      stream_map(p, length);
+    else if (p[3] >= first_video_id && p[3] <= last_video_id)
+      pes(p, length);
+    i += length;
+  }
+  return i;
+}
+
+void PsDemuxer::stream_map(const unsigned char* data, size_t size) {
+  if (size < 12) return;
+  size_t i = 10 + (data[8] << 8 | data[9]);
+  if (i + 2 > size) return;
+  const size_t end = std::min(size, i + 2 + (data[i] << 8 | data[i + 1]));
+  for (i += 2; i + 4 <= end; i += 4 + (data[i + 2] << 8 | data[i + 3])) {
+    if (data[i + 1] >= first_video_id && data[i + 1] <= last_video_id) {
+      stream_type_ = data[i];
+      return;
+    }
+  }
+}
+
+void PsDemuxer::pes(const unsigned char* data, size_t size) {
+  if (size < 9 || size < 9 + size_t{data[8]}) {
+    ++stats_.invalid;
+    return;
+  }
+  const size_t payload = 9 + data[8];
+  if (data[7] & 0x80 && data[8] >= 5) {
+    // The first PES of a frame: the previous one is complete.
+    flush();
+    const unsigned char* t = data + 9;
+    const uint64_t raw = static_cast<uint64_t>(t[0] >> 1 & 7) << 30 |
+                         static_cast<uint64_t>(t[1]) << 22 | static_cast<uint64_t>(t[2] >> 1) << 15 |
+                         static_cast<uint64_t>(t[3]) << 7 | static_cast<uint64_t>(t[4] >> 1);
+    if (!started_) {
+      pts_ = 0;
+      started_ = true;
+    } else {
+      // Wraps every 26.5 hours.
+      const uint64_t delta = (raw - raw_pts_) % pts_modulo;
+      pts_ += delta < pts_modulo / 2 ? static_cast<int64_t>(delta)
+                                     : static_cast<int64_t>(delta) - static_cast<int64_t>(pts_modulo);
+    }
+    raw_pts_ = raw;
+    has_pts_ = true;
+  }
+  if (!has_pts_) return;
+  frame_.insert(frame_.end(), data + payload, data + size);
+  stats_.bytes += size - payload;
+}
+
+VideoCodec PsDemuxer::codec(const unsigned char* nal) const {
+  if (stream_type_ == h264_stream) return VideoCodec::H264;
+  if (stream_type_ == h265_stream) return VideoCodec::H265;
+  // No stream map yet: from the first NAL unit of a keyframe, a delimiter or a parameter set.
+  const unsigned h264 = nal[0] & 0x1F;
+  if (!(nal[0] & 0x80) && (h264 == 7 || h264 == 9)) return VideoCodec::H264;
+  const unsigned h265 = nal[0] >> 1 & 0x3F;
+  if (h265 >= 32 && h265 <= 35) return VideoCodec::H265;
+  return VideoCodec::UNKNOWN;
+}
+
+void PsDemuxer::flush() {
+  if (!has_pts_ || frame_.empty()) {
+    frame_.clear();
+    has_pts_ = false;
+    return;
+  }
+  unit_.pts = pts_;
+  unit_.keyframe = false;
+  unit_.nals.clear();
+  // NAL units start after 00 00 01, the zero of a 4-byte start code ends the previous one.
+  const unsigned char* p = frame_.data();
+  const size_t size = frame_.size();
+  size_t start = 0;
+  for (size_t i = 0; i + 3 <= size; ++i) {
+    if (p[i] || p[i + 1] || p[i + 2] != 1) continue;
+    if (start) {
+      size_t end = i;
+      while (end > start && !p[end - 1]) --end;
+      if (end > start) unit_.nals.push_back({p + start, end - start});
+    }
+    start = i + 3;
+    i += 2;
+  }
+  if (start && start < size) unit_.nals.push_back({p + start, size - start});
+
+  auto out = unit_.nals.begin();
+  for (const auto& nal : unit_.nals) {
+    if (parameters_.codec == VideoCodec::UNKNOWN) parameters_.codec = codec(nal.data);
+    bool keep = true;
+    if (parameters_.codec == VideoCodec::H264) {
+      switch (nal.data[0] & 0x1F) {
+        case 5:
+          unit_.keyframe = true;
+          break;
+        case 7:
+          parameter_set(parameters_.sps, nal.data, nal.size);
+          break;
+        case 8:
+          parameter_set(parameters_.pps, nal.data, nal.size);
+          break;
+        case 9:
+          keep = false;
+          break;
+      }
+    } else if (parameters_.codec == VideoCodec::H265 && nal.size >= 2) {
+      const unsigned type = nal.data[0] >> 1 & 0x3F;
+      if (type >= 16 && type <= 21)
+        unit_.keyframe = true;
+      else if (type == 32)
+        parameter_set(parameters_.vps, nal.data, nal.size);
+      else if (type == 33)
+        parameter_set(parameters_.sps, nal.data, nal.size);
+      else if (type == 34)
+        parameter_set(parameters_.pps, nal.data, nal.size);
+      else if (type == 35)
+        keep = false;
+    }
+    if (keep) *out++ = nal;
+  }
+  unit_.nals.erase(out, unit_.nals.end());
+
+  ++stats_.units;
+  if (!unit_.nals.empty()) on_unit_(unit_);
+  frame_.clear();
+  has_pts_ = false;
+}
+
+void PsDemuxer::parameter_set(std::vector<unsigned char>& stored, const unsigned char* nal,
+                              size_t size) {
+  if (stored.size() == size && std::equal(stored.begin(), stored.end(), nal)) return;
+  stored.assign(nal, nal + size);
+  if (&stored == &parameters_.sps) parse_sps();
+  ++parameters_version_;
+}
+
+void PsDemuxer::parse_sps() {
+  unescape(parameters_.sps.data(), parameters_.sps.size(), rbsp_);
+  video_parameters& v = parameters_;
+  if (v.codec == VideoCodec::H264) {
+    bit_reader r(rbsp_, 1);
+    const unsigned profile = r.bits(8);
+    r.skip(16);  // constraints, level
+    r.ue();      // seq_parameter_set_id
+    v.chroma_format = 1;
+    v.bit_depth_luma = v.bit_depth_chroma = 8;
+    if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 ||
+        profile == 83 || profile == 86 || profile == 118 || profile == 128 || profile == 138 ||
+        profile == 139 || profile == 134 || profile == 135) {
+      v.chroma_format = static_cast<int>(r.ue());
+      if (v.chroma_format == 3) r.skip(1);
+      v.bit_depth_luma = 8 + static_cast<int>(r.ue());
+      v.bit_depth_chroma = 8 + static_cast<int>(r.ue());
+      r.skip(1);  // qpprime_y_zero_transform_bypass_flag
+      if (r.flag())
+        for (int i = 0; i < (v.chroma_format != 3 ? 8 : 12); ++i)
+          if (r.flag()) skip_scaling_list(r, i < 6 ? 16 : 64);
+    }
+    r.ue();  // log2_max_frame_num_minus4
+    const unsigned poc_type = r.ue();
+    if (poc_type == 0) {
+      r.ue();
+    } else if (poc_type == 1) {
+      r.skip(1);
+      r.se();
+      r.se();
+      for (unsigned i = r.ue(); i > 0; --i) r.se();
+    }
+    r.ue();     // max_num_ref_frames
+    r.skip(1);  // gaps_in_frame_num_value_allowed_flag
+    const unsigned width_mbs = r.ue() + 1;
+    const unsigned height_units = r.ue() + 1;
+    const bool frame_mbs_only = r.flag();
+    if (!frame_mbs_only) r.skip(1);
+    r.skip(1);  // direct_8x8_inference_flag
+    unsigned crop[4] = {};
+    if (r.flag())
+      for (auto& c : crop) c = r.ue();
+    const int crop_x = v.chroma_format == 3 || !v.chroma_format ? 1 : 2;
+    const int crop_y = (v.chroma_format == 1 ? 2 : 1) * (frame_mbs_only ? 1 : 2);
+    v.width = static_cast<int>(width_mbs * 16 - (crop[0] + crop[1]) * crop_x);
+    v.height = static_cast<int>((frame_mbs_only ? 1 : 2) * height_units * 16 -
+                                (crop[2] + crop[3]) * crop_y);
+  } else if (v.codec == VideoCodec::H265) {
+    bit_reader r(rbsp_, 2);
+    r.skip(4);  // sps_video_parameter_set_id
+    const unsigned max_sub_layers = r.bits(3);
+    v.sub_layers = static_cast<int>(max_sub_layers) + 1;
+    v.temporal_id_nesting = r.flag();
+    for (auto& b : v.profile_tier_level) b = static_cast<unsigned char>(r.bits(8));
+    bool profile_present[8] = {}, level_present[8] = {};
+    for (unsigned i = 0; i < max_sub_layers; ++i) {
+      profile_present[i] = r.flag();
+      level_present[i] = r.flag();
+    }
+    if (max_sub_layers) r.skip(2 * (8 - max_sub_layers));
+    for (unsigned i = 0; i < max_sub_layers; ++i) {
+      if (profile_present[i]) r.skip(88);
+      if (level_present[i]) r.skip(8);
+    }
+    r.ue();  // sps_seq_parameter_set_id
+    v.chroma_format = static_cast<int>(r.ue());
+    if (v.chroma_format == 3) r.skip(1);
+    v.width = static_cast<int>(r.ue());
+    v.height = static_cast<int>(r.ue());
+    if (r.flag()) {
+      const int unit_x = v.chroma_format == 1 || v.chroma_format == 2 ? 2 : 1;
+      const int unit_y = v.chroma_format == 1 ? 2 : 1;
+      const int left = static_cast<int>(r.ue()), right = static_cast<int>(r.ue());
+      const int top = static_cast<int>(r.ue()), bottom = static_cast<int>(r.ue());
+      v.width -= (left + right) * unit_x;
+      v.height -= (top + bottom) * unit_y;
+    }
+    v.bit_depth_luma = 8 + static_cast<int>(r.ue());
+    v.bit_depth_chroma = 8 + static_cast<int>(r.ue());
+  }
+}
+
+}  // namespace app
\ No newline at end of file
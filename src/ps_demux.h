@@ -0,0 +1,110 @@
+#ifndef DEF_PS_DEMUX_H
+#define DEF_PS_DEMUX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace app {
+
+enum class VideoCodec { UNKNOWN, H264, H265 };
+
+// What the MP4 sample entry says of the video, read from its parameter sets.
+struct video_parameters {
+  VideoCodec codec = VideoCodec::UNKNOWN;
+  std::vector<unsigned char> vps;  // H.265 only
+  std::vector<unsigned char> sps;
+  std::vector<unsigned char> pps;
+  int width = 0;
+  int height = 0;
+  // H.265: the general profile, tier and level of the SPS, as the hvcC repeats them.
+  unsigned char profile_tier_level[12] = {};
+  int chroma_format = 1;
+  int bit_depth_luma = 8;
+  int bit_depth_chroma = 8;
+  int sub_layers = 1;
+  bool temporal_id_nesting = false;
+
+  // An SPS and a PPS (and a VPS) were seen.
+  bool complete() const;
+};
+
+// A NAL unit, without its start code.
+struct nal_unit {
+  const unsigned char* data;
+  size_t size;
+};
+
+// A frame of the video: its NAL units, access unit delimiters left out.
+struct access_unit {
+  int64_t pts;  // 90 kHz, unwrapped, from the first one
+  bool keyframe;
+  std::vector<nal_unit> nals;
+
+  // Once stored with 4-byte lengths instead of start codes, as MP4 does.
+  size_t size() const;
+};
+
+struct ps_demux_stats {
+  unsigned long long units;
+  unsigned long long bytes;    // of the video PES payloads
+  unsigned long long skipped;  // bytes without a start code, the stream resynchronised on
+  unsigned long long invalid;  // PES too short for their header
+};
+
+// The video of the MPEG program stream of the SDK: pack headers, system header and stream map,
+// then PES packets the frames are split into, the first one of each frame with its PTS. Packets
+// of any size are fed in order, the frames come out once the next one starts, their NAL units
+// pointing into the demuxer until the function returns. Audio and private streams are skipped.
+// No B frames: the PTS is the decoding time.
+class PsDemuxer {
+ public:
+  using unit_function = std::function<void(const access_unit&)>;
+
+ private:
+  unit_function on_unit_;
+  std::vector<unsigned char> input_;  // an incomplete header or PES, waiting for its end
+  std::vector<unsigned char> frame_;  // the PES payloads of the frame, start codes included
+  bool has_pts_;
+  int64_t pts_;
+  uint64_t raw_pts_;  // 33 bits, as read
+  bool started_;
+  unsigned char stream_type_;  // of the video in the stream map, 0 before
+  video_parameters parameters_;
+  unsigned parameters_version_;
+  access_unit unit_;
+  std::vector<unsigned char> rbsp_;
+
+  ps_demux_stats stats_;
+
+  // Returns the bytes parsed, the rest being an incomplete unit.
+  size_t parse(const unsigned char* data, size_t size);
+  void stream_map(const unsigned char* data, size_t size);
+  void pes(const unsigned char* data, size_t size);
+  void flush();
+  VideoCodec codec(const unsigned char* nal) const;
+  void parameter_set(std::vector<unsigned char>& stored, const unsigned char* nal, size_t size);
+  void parse_sps();
+
+ public:
+  explicit PsDemuxer(unit_function on_unit);
+  PsDemuxer(const PsDemuxer&) = delete;
+  PsDemuxer& operator=(const PsDemuxer&) = delete;
+
+  void feed(const unsigned char* data, size_t size);
+  // Bytes of the stream were lost: what was gathered is dropped, up to the next PES with a PTS.
+  void reset();
+  // The stream ends: the frame gathered is given without waiting for the next one.
+  void finish() { flush(); }
+
+  // Those of the latest parameter sets, and how many times they changed.
+  const video_parameters& parameters() const { return parameters_; }
+  unsigned parameters_version() const { return parameters_version_; }
+
+  const ps_demux_stats& stats() const { return stats_; }
+};
+
+}  // namespace app
+
+#endif
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include "ptz_backend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "HCNetSDK.h"
+
+#include "network_requests.h"
+#include "synchronized_ostream.h"
+
+namespace app {
+
+/******************************************************************************\
+ *
+ *	PTZBackend
+ *
+ \******************************************************************************/
+
+std::unique_ptr<PTZBackend> PTZBackend::create(const std::string& name, LONG uid, LONG channel,
+                                               stopped_function stopped) {
+  if (name == "onvif") return std::make_unique<OnvifPTZBackend>(std::move(stopped));
+  if (name == "sdk") return std::make_unique<SdkPTZBackend>(uid, channel, std::move(stopped));
+  if (name != "auto") return nullptr;
+
+  std::unique_ptr<PTZBackend> backends[] = {std::make_unique<OnvifPTZBackend>(stopped),
+                                            std::make_unique<SdkPTZBackend>(uid, channel, stopped)};
+  std::unique_ptr<PTZBackend>* chosen = nullptr;
+  auto fastest = std::chrono::steady_clock::duration::max();
+  std::cout << "PTZ backend, median stop round trip:";
+  for (auto& backend : backends) {
+    std::vector<std::chrono::steady_clock::duration> rtts;
+    for (int i = 0; i < auto_probes; ++i) {
+      std::chrono::steady_clock::duration rtt;
+      if (backend->request(0.f, 0.f, rtt)) rtts.push_back(rtt);
+    }
+    std::cout << ' ' << backend->name() << ' ';
+    if (rtts.empty()) {
+      std::cout << "failed";
+      continue;
+    }
+    std::nth_element(rtts.begin(), rtts.begin() + rtts.size() / 2, rtts.end());
+    const auto median = rtts[rtts.size() / 2];
+    std::cout << std::fixed << std::setprecision(2)
+              << std::chrono::duration<double, std::milli>(median).count() << " ms";
+    if (median < fastest) {
+      fastest = median;
+      chosen = &backend;
+    }
+  }
+  // Neither answered: ONVIF, as without the option.
+  if (!chosen) chosen = &backends[0];
+  std::cout << ", using " << (*chosen)->name() << '\n';
+  return std::move(*chosen);
+}
+
+/******************************************************************************\
+ *
+ *	OnvifPTZBackend
+ *
+ \******************************************************************************/
+
+bool OnvifPTZBackend::move(float pan, float tilt) {
+  return soap::soap_thread.queue(soap::SoapStartContinuousMoveAction(pan, tilt),
+                                 OverflowPolicy::REPLACE_LATEST);
+}
+
+bool OnvifPTZBackend::stop() {
+  return soap::soap_thread.queue(
+      soap::SoapStopContinuousMoveAction(soap::callback<&OnvifPTZBackend::stop_is_done>(*this)));
+}
+
+void OnvifPTZBackend::stop_is_done(const soap::SoapStopContinuousMoveAction& action) {
+  if (stopped_) stopped_(action.ok());
+}
+
+bool OnvifPTZBackend::request(float pan, float tilt, std::chrono::steady_clock::duration& rtt) {
+  const auto start = std::chrono::steady_clock::now();
+  bool done;
+  if (pan == 0.f && tilt == 0.f) {
+    using Completion = soap::SoapCompletion<soap::SoapStopContinuousMoveAction>;
+    Completion stopped;
+    done = soap::soap_thread.queue(
+               soap::SoapStopContinuousMoveAction(soap::callback<&Completion::done>(stopped))) &&
+           stopped.wait().ok();
+  } else {
+    using Completion = soap::SoapCompletion<soap::SoapStartContinuousMoveAction>;
+    Completion moved;
+    done = soap::soap_thread.queue(soap::SoapStartContinuousMoveAction(
+               pan, tilt, soap::callback<&Completion::done>(moved))) &&
+           moved.wait().ok();
+  }
+  rtt = std::chrono::steady_clock::now() - start;
+  return done;
+}
+
+/******************************************************************************\
+ *
+ *	SdkPTZBackend
+ *
+ \******************************************************************************/
+
+SdkPTZBackend::SdkPTZBackend(LONG uid, LONG channel, stopped_function stopped)
+    : uid_(uid),
+      channel_(channel),
+      stopped_(std::move(stopped)),
+      active_(0),
+      speed_(0),
+      pending_{},
+      has_pending_(false),
+      exit_(false),
+      thread_([this]() { loop(); }) {}
+
+SdkPTZBackend::~SdkPTZBackend() {
+  {
+    std::lock_guard<std::mutex> lock(mx_);
+    exit_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) thread_.join();
+}
+
+// The command of the fastest axis, diagonal when the other one is at least half as fast.
+DWORD SdkPTZBackend::direction(float pan, float tilt) {
+  const float fastest = std::max(std::abs(pan), std::abs(tilt));
+  if (fastest == 0.f) return 0;
+  const bool panning = 2.f * std::abs(pan) >= fastest;
+  const bool tilting = 2.f * std::abs(tilt) >= fastest;
+  if (panning && tilting)
+    return tilt > 0.f ? (pan < 0.f ? UP_LEFT : UP_RIGHT) : (pan < 0.f ? DOWN_LEFT : DOWN_RIGHT);
+  if (panning) return pan < 0.f ? PAN_LEFT : PAN_RIGHT;
+  return tilt > 0.f ? TILT_UP : TILT_DOWN;
+}
+
+bool SdkPTZBackend::send(float pan, float tilt, bool always) {
+  const DWORD to = direction(pan, tilt);
+  const float fastest = std::min(1.f, std::max(std::abs(pan), std::abs(tilt)));
+  const DWORD speed =
+      to ? min_speed + static_cast<DWORD>(std::lround(fastest * (max_speed - min_speed))) : speed_;
+
+  std::lock_guard<std::mutex> lock(send_mx_);
+  if (!always && to == active_ && (!to || speed == speed_)) return true;
+  bool sent = true;
+  // Not every device lets a new direction replace the one in progress: stopped first.
+  if (active_ && to != active_) {
+    sent =
+        network_request<::NET_DVR_PTZControlWithSpeed_Other>(uid_, channel_, active_, 1, speed_);
+    if (sent) active_ = 0;
+  } else if (!active_ && !to) {
+    // Stopped already: only a request() gets here, for the round trip of a harmless command.
+    sent = network_request<::NET_DVR_PTZControlWithSpeed_Other>(uid_, channel_, PAN_LEFT, 1,
+                                                                 min_speed);
+  }
+  if (sent && to) {
+    sent = network_request<::NET_DVR_PTZControlWithSpeed_Other>(uid_, channel_, to, 0, speed);
+    if (sent) {
+      active_ = to;
+      speed_ = speed;
+    }
+  }
+  soap::soap_thread.ptz_state().forget();
+  clog.log("SdkPTZBackend::send: [", pan, ", ", tilt, "] as command ", to, " at speed ", speed);
+  if (!sent) std::cerr << "SdkPTZBackend: " << ::NET_DVR_GetErrorMsg() << '\n';
+  return sent;
+}
+
+void SdkPTZBackend::loop() {
+  std::unique_lock<std::mutex> lock(mx_);
+  while (true) {
+    cv_.wait(lock, [this]() { return has_pending_ || exit_; });
+    if (exit_) return;
+    const command c = pending_;
+    has_pending_ = false;
+    lock.unlock();
+    // A refused stop leaves active_ set: the next stop sends it again.
+    const bool sent = send(c.pan, c.tilt, false);
+    if (c.stop && stopped_) stopped_(sent);
+    lock.lock();
+  }
+}
+
+bool SdkPTZBackend::move(float pan, float tilt) {
+  {
+    std::lock_guard<std::mutex> lock(mx_);
+    // A stop not sent yet is not replaced by the move of the next drag.
+    if (has_pending_ && pending_.stop) return false;
+    pending_ = {pan, tilt, false};
+    has_pending_ = true;
+  }
+  cv_.notify_all();
+  return true;
+}
+
+bool SdkPTZBackend::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mx_);
+    pending_ = {0.f, 0.f, true};
+    has_pending_ = true;
+  }
+  cv_.notify_all();
+  return true;
+}
+
+bool SdkPTZBackend::request(float pan, float tilt, std::chrono::steady_clock::duration& rtt) {
+  const auto start = std::chrono::steady_clock::now();
+  const bool sent = send(pan, tilt, true);
+  rtt = std::chrono::steady_clock::now() - start;
+  return sent;
+}
+
+}  // namespace app
\ No newline at end of file
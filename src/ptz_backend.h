@@ -0,0 +1,112 @@
+#ifndef DEF_PTZ_BACKEND_H
+#define DEF_PTZ_BACKEND_H
+
+#include "winheaders.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "soap.h"
+
+namespace app {
+
+// The protocol carrying the pan/tilt speeds of a drag on the video: ONVIF through the SoapThread,
+// or the native commands of the HCNetSDK session already logged in. Zoom and absolute positions
+// stay on ONVIF, which the native session has no normalized equivalent for.
+class PTZBackend {
+ public:
+  // Called once the device was told to stop, from a thread of the backend, with whether it stopped.
+  using stopped_function = std::function<void(bool stopped)>;
+
+  static constexpr int auto_probes = 5;
+
+  virtual ~PTZBackend() = default;
+
+  virtual const char* name() const = 0;
+
+  // Starts or changes a continuous move at the given speeds (each in [-1, 1]) without waiting for
+  // the device, false when the command was not accepted.
+  virtual bool move(float pan, float tilt) = 0;
+  // After the last move of a drag: false when the stop was not accepted, else the stopped function
+  // tells whether the device stopped.
+  virtual bool stop() = 0;
+  // Sends a continuous move, a stop when both speeds are zero, and waits for the device to answer.
+  virtual bool request(float pan, float tilt, std::chrono::steady_clock::duration& rtt) = 0;
+
+  // "onvif", "sdk", or "auto" for the one whose stop request has the lower median round trip over
+  // auto_probes, nullptr for any other name.
+  static std::unique_ptr<PTZBackend> create(const std::string& name, LONG uid, LONG channel,
+                                            stopped_function stopped);
+};
+
+class OnvifPTZBackend : public PTZBackend {
+  stopped_function stopped_;
+
+  void stop_is_done(const soap::SoapStopContinuousMoveAction& action);
+
+ public:
+  explicit OnvifPTZBackend(stopped_function stopped) : stopped_(std::move(stopped)) {}
+
+  const char* name() const override { return "onvif"; }
+  bool move(float pan, float tilt) override;
+  bool stop() override;
+  bool request(float pan, float tilt, std::chrono::steady_clock::duration& rtt) override;
+};
+
+// NET_DVR_PTZControlWithSpeed_Other is synchronous: the commands are sent by a thread of the
+// backend, the latest one replacing the one not sent yet, as REPLACE_LATEST does on the SoapThread.
+// The native commands have eight directions and speeds 1 to 7: the direction is the one of the
+// fastest axis, diagonal when the other one is at least half as fast. The PTZ state of the
+// SoapThread is forgotten on every command, so that the bars read the position again.
+class SdkPTZBackend : public PTZBackend {
+ public:
+  static constexpr DWORD min_speed = 1;
+  static constexpr DWORD max_speed = 7;
+
+ private:
+  struct command {
+    float pan;
+    float tilt;
+    bool stop;  // of a drag: followed by the stopped function, with whether it was sent
+  };
+
+  LONG uid_;
+  LONG channel_;
+  stopped_function stopped_;
+
+  std::mutex send_mx_;  // one command at a time on the session
+  DWORD active_;        // direction moving, 0 when stopped
+  DWORD speed_;
+
+  std::mutex mx_;
+  std::condition_variable cv_;
+  command pending_;
+  bool has_pending_;
+  bool exit_;
+  std::thread thread_;
+
+  static DWORD direction(float pan, float tilt);
+  // Sends what changed since the last command, or the command anyway when `always`.
+  bool send(float pan, float tilt, bool always);
+  void loop();
+
+ public:
+  SdkPTZBackend(LONG uid, LONG channel, stopped_function stopped);
+  SdkPTZBackend(const SdkPTZBackend&) = delete;
+  SdkPTZBackend& operator=(const SdkPTZBackend&) = delete;
+  ~SdkPTZBackend();
+
+  const char* name() const override { return "sdk"; }
+  bool move(float pan, float tilt) override;
+  bool stop() override;
+  bool request(float pan, float tilt, std::chrono::steady_clock::duration& rtt) override;
+};
+
+}  // namespace app
+
+#endif
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "ptz_control.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "metrics.h"
+#include "synchronized_ostream.h"
+
+namespace app {
+
+PTZControlLoop::PTZControlLoop(move_function move, int rate)
+    : move_(std::move(move)),
+      period_(std::chrono::microseconds(1000000 / std::max(rate, 1))),
+      active_(false),
+      exit_(false),
+      target_pan_(0.f),
+      target_tilt_(0.f),
+      sent_pan_(0.f),
+      sent_tilt_(0.f),
+      pending_(false),
+      stats_{} {}
+
+PTZControlLoop::~PTZControlLoop() {
+  {
+    std::lock_guard<std::mutex> lock(mx_);
+    exit_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) thread_.join();
+}
+
+void PTZControlLoop::run() { thread_ = std::thread([this]() { loop(); }); }
+
+// The speed of an axis given its target, and its last command for the hysteresis.
+float PTZControlLoop::filter(float target, float sent) {
+  const float deadband = sent == 0.f ? deadband_on : deadband_off;
+  return std::abs(target) < deadband ? 0.f : std::max(-1.f, std::min(1.f, target));
+}
+
+// Whether the target is worth a command: an axis starts or stops, or its speed changed enough.
+bool PTZControlLoop::changed() const {
+  const auto axis = [](float target, float sent) {
+    const float speed = filter(target, sent);
+    return (speed == 0.f) != (sent == 0.f) || std::abs(speed - sent) >= min_change;
+  };
+  return axis(target_pan_, sent_pan_) || axis(target_tilt_, sent_tilt_);
+}
+
+void PTZControlLoop::press() {
+  std::lock_guard<std::mutex> lock(mx_);
+  active_ = true;
+  target_pan_ = target_tilt_ = sent_pan_ = sent_tilt_ = 0.f;
+  pending_ = false;
+  pressed_at_ = std::chrono::steady_clock::now();
+  ++stats_.drags;
+  cv_.notify_all();
+}
+
+void PTZControlLoop::input(float pan, float tilt) {
+  const auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(mx_);
+  if (!active_) return;
+  ++stats_.inputs;
+  target_pan_ = pan;
+  target_tilt_ = tilt;
+  if (!pending_ && changed()) {
+    pending_ = true;
+    changed_at_ = now;
+  }
+}
+
+void PTZControlLoop::release() {
+  std::lock_guard<std::mutex> lock(mx_);
+  if (!active_) return;
+  active_ = false;
+  pending_ = false;
+  stats_.dragging += std::chrono::steady_clock::now() - pressed_at_;
+  cv_.notify_all();
+}
+
+// Called with mx_ held, so that release() never returns while a move is being queued.
+void PTZControlLoop::tick(std::chrono::steady_clock::time_point now) {
+  ++stats_.ticks;
+  // The target may have gone back within min_change of the last command since.
+  if (!pending_ || !changed()) {
+    pending_ = false;
+    return;
+  }
+  const float pan = filter(target_pan_, sent_pan_);
+  const float tilt = filter(target_tilt_, sent_tilt_);
+  if (!move_(pan, tilt)) {
+    ++stats_.rejected;
+    return;
+  }
+  clog.log("PTZControlLoop::tick: [", pan, ", ", tilt, "] after ",
+           std::chrono::duration_cast<std::chrono::microseconds>(now - changed_at_).count(), " us");
+  metrics::record(metrics::operation::UI_PTZ_INPUT_TO_COMMAND, now - changed_at_);
+  ++stats_.commands;
+  sent_pan_ = pan;
+  sent_tilt_ = tilt;
+  pending_ = false;
+}
+
+void PTZControlLoop::loop() {
+  std::unique_lock<std::mutex> lock(mx_);
+  auto next = std::chrono::steady_clock::now();
+  while (!exit_) {
+    if (!active_) {
+      cv_.wait(lock, [this]() { return active_ || exit_; });
+      // The first tick of a drag comes one period after the press.
+      next = std::chrono::steady_clock::now();
+      continue;
+    }
+    next += period_;
+    if (cv_.wait_until(lock, next, [this]() { return exit_ || !active_; })) continue;
+    const auto now = std::chrono::steady_clock::now();
+    // Late (the process was descheduled): no burst of ticks to catch up.
+    if (now - next > period_) next = now;
+    tick(now);
+  }
+}
+
+ptz_control_stats PTZControlLoop::stats() {
+  std::lock_guard<std::mutex> lock(mx_);
+  return stats_;
+}
+
+}  // namespace app
\ No newline at end of file
@@ -0,0 +1,80 @@
+#ifndef DEF_PTZ_CONTROL_H
+#define DEF_PTZ_CONTROL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace app {
+
+struct ptz_control_stats {
+  unsigned long long drags;
+  unsigned long long inputs;    // cursor samples given to input()
+  unsigned long long ticks;     // while dragging
+  unsigned long long commands;  // speeds sent
+  unsigned long long rejected;  // speeds the SoapThread queue did not take
+  std::chrono::steady_clock::duration dragging;
+};
+
+// The speed of a drag on the video, sent at a fixed rate whatever the rate of the mouse events
+// (125 to 1000 Hz): input() only keeps the last cursor vector, and every tick of the loop thread
+// sends it, when it differs enough from the speed the device was last given. Each axis has a
+// deadband with hysteresis, so that a cursor resting near the center neither creeps nor flickers
+// between moving and stopped, and a speed is sent again only once it changed by min_change. The
+// time from the input that made a new speed worth sending to the command is recorded under
+// metrics::operation::UI_PTZ_INPUT_TO_COMMAND.
+class PTZControlLoop {
+ public:
+  // A stopped axis starts beyond deadband_on, a moving one stops below deadband_off.
+  static constexpr float deadband_on = 0.08f;
+  static constexpr float deadband_off = 0.05f;
+  static constexpr float min_change = 0.05f;
+
+  // Queues a ContinuousMove at the given speeds, false when it was not accepted.
+  using move_function = std::function<bool(float, float)>;
+
+ private:
+  move_function move_;
+  std::chrono::microseconds period_;
+
+  std::mutex mx_;
+  std::condition_variable cv_;
+  bool active_;
+  bool exit_;
+  float target_pan_;  // last input
+  float target_tilt_;
+  float sent_pan_;  // last command, 0 when the axis is stopped
+  float sent_tilt_;
+  bool pending_;  // the target is worth a command, since changed_at_
+  std::chrono::steady_clock::time_point changed_at_;
+  std::chrono::steady_clock::time_point pressed_at_;
+  ptz_control_stats stats_;
+  std::thread thread_;
+
+  static float filter(float target, float sent);
+  bool changed() const;
+  void tick(std::chrono::steady_clock::time_point now);
+  void loop();
+
+ public:
+  PTZControlLoop(move_function move, int rate);
+  PTZControlLoop(const PTZControlLoop&) = delete;
+  PTZControlLoop& operator=(const PTZControlLoop&) = delete;
+  ~PTZControlLoop();
+
+  void run();
+
+  // From the UI thread: the drag starts, moves the cursor (each axis in [-1, 1]) and ends. Once
+  // release() returned, no move is queued anymore: the caller then queues the stop.
+  void press();
+  void input(float pan, float tilt);
+  void release();
+
+  ptz_control_stats stats();
+};
+
+}  // namespace app
+
+#endif
\ No newline at end of file
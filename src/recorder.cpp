@@ -0,0 +1,295 @@
+#include "recorder.h"
+
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+
+#include "metrics.h"
+#include "synchronized_ostream.h"
+
+namespace app {
+
+namespace {
+
+// Room left before the data of a fragment for its moof, written once its samples are known.
+const size_t header_reserve = mp4::fragment_header_size(Mp4Recorder::max_samples);
+
+using ticks = std::chrono::duration<int64_t, std::ratio<1, mp4::timescale>>;
+
+const int64_t fragment_ticks =
+    std::chrono::duration_cast<ticks>(Mp4Recorder::fragment_duration).count();
+
+// 25 frames per second, until the stream says otherwise.
+constexpr uint32_t default_duration = mp4::timescale / 25;
+
+void put32(unsigned char* p, uint32_t v) {
+  p[0] = static_cast<unsigned char>(v >> 24);
+  p[1] = static_cast<unsigned char>(v >> 16);
+  p[2] = static_cast<unsigned char>(v >> 8);
+  p[3] = static_cast<unsigned char>(v);
+}
+
+}  // namespace
+
+Mp4Recorder::Mp4Recorder(std::string name)
+    : name_(std::move(name)),
+      consumer_(name_ + " recorder", StreamBackpressure::SKIP_TO_KEYFRAME,
+                [this](const StreamPacket& packet) { handle(packet); }),
+      tap_(nullptr),
+      recording_(false),
+      demuxer_([this](const access_unit& u) { unit(u); }),
+      segment_ticks_(0),
+      has_sequence_(false),
+      next_sequence_(0),
+      initialized_(false),
+      resync_(false),
+      buffer_(nullptr),
+      end_(0),
+      offset_(0),
+      segment_(0),
+      start_time_(0),
+      first_pts_(0),
+      segment_pts_(0),
+      fragment_pts_(0),
+      last_pts_(0),
+      last_duration_(default_duration),
+      sequence_(0),
+      frames_(0),
+      fragments_(0),
+      segments_(0),
+      dropped_(0),
+      lost_(0) {}
+
+Mp4Recorder::~Mp4Recorder() { disarm(); }
+
+bool Mp4Recorder::arm(StreamTap& tap, std::chrono::seconds duration, size_t capacity) {
+  disarm();
+  pre_event_ = std::make_unique<PreEventBuffer>(duration, capacity);
+  consumer_.start();
+  if (!tap.attach(consumer_)) {
+    consumer_.stop();
+    pre_event_.reset();
+    return false;
+  }
+  tap_ = &tap;
+  return true;
+}
+
+void Mp4Recorder::disarm() {
+  stop();
+  if (!pre_event_) return;
+  tap_->detach(consumer_);
+  tap_ = nullptr;
+  consumer_.stop();
+  pre_event_.reset();
+}
+
+pre_event_stats Mp4Recorder::buffered() const {
+  std::lock_guard<std::mutex> lock(mx_);
+  return pre_event_ ? pre_event_->stats() : pre_event_stats{};
+}
+
+bool Mp4Recorder::start(StreamTap& tap, const std::string& path) {
+  if (recording()) stop();
+  if (!file_.open(path)) return false;
+  directory_.clear();
+  segment_ticks_ = 0;
+  return begin(tap);
+}
+
+bool Mp4Recorder::start(StreamTap& tap, const std::string& directory,
+                        std::chrono::seconds segment_duration) {
+  if (recording()) stop();
+  try {
+    std::filesystem::create_directories(directory);
+  } catch (const std::filesystem::filesystem_error& e) {
+    std::cerr << "Error when creating directory " << directory << ": " << e.what() << '\n';
+    return false;
+  }
+  const std::filesystem::path d(directory);
+  if (!catalog_.open((d / catalog_name).string(), segment_duration)) return false;
+  if (!file_.open((d / segment_name(0)).string())) {
+    catalog_.close();
+    return false;
+  }
+  directory_ = directory;
+  segment_ticks_ = std::chrono::duration_cast<ticks>(segment_duration).count();
+  return begin(tap);
+}
+
+bool Mp4Recorder::begin(StreamTap& tap) {
+  if (pre_event_ && tap_ != &tap) disarm();
+  const auto start = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(mx_);
+  demuxer_.reset();
+  has_sequence_ = false;
+  initialized_ = false;
+  resync_ = false;
+  samples_.clear();
+  samples_.reserve(max_samples);
+  sequence_ = 0;
+  segment_ = 0;
+  last_duration_ = default_duration;
+  frames_ = fragments_ = segments_ = dropped_ = lost_ = 0;
+  if (pre_event_) {
+    // The packets after those of the buffer follow, the consumer waiting for the lock.
+    pre_event_->replay([this](uint64_t sequence, const unsigned char* data, size_t size,
+                              std::chrono::steady_clock::time_point received) {
+      feed(sequence, data, size, received);
+    });
+    recording_ = true;
+    metrics::record(metrics::operation::RECORD_FLUSH, std::chrono::steady_clock::now() - start);
+    return true;
+  }
+  lock.unlock();
+  recording_ = true;
+  consumer_.start();
+  if (!tap.attach(consumer_)) {
+    consumer_.stop();
+    recording_ = false;
+    file_.close();
+    catalog_.close();
+    return false;
+  }
+  tap_ = &tap;
+  return true;
+}
+
+void Mp4Recorder::stop() {
+  if (!recording_) return;
+  if (!pre_event_) {
+    tap_->detach(consumer_);
+    tap_ = nullptr;
+    consumer_.stop();
+  }
+  // The consumer thread is gone, or waits for the lock: its state is ours.
+  std::lock_guard<std::mutex> lock(mx_);
+  recording_ = false;
+  demuxer_.finish();
+  if (buffer_) {
+    samples_.back().duration = last_duration_;
+    close_fragment();
+  }
+  file_.close();
+  catalog_.close();
+  clog.log("Mp4Recorder::stop: ", name_, ", ", directory_.empty() ? file_.path() : directory_);
+}
+
+void Mp4Recorder::handle(const StreamPacket& packet) {
+  // The system header is that of the SDK, not of the program stream.
+  if (packet.type() != NET_DVR_STREAMDATA) return;
+  std::lock_guard<std::mutex> lock(mx_);
+  if (pre_event_) pre_event_->push(packet);
+  if (recording_) feed(packet.sequence(), packet.data(), packet.size(), packet.received());
+}
+
+void Mp4Recorder::feed(uint64_t sequence, const unsigned char* data, size_t size,
+                       std::chrono::steady_clock::time_point received) {
+  if (has_sequence_ && sequence != next_sequence_) {
+    lost_.fetch_add(sequence - next_sequence_, std::memory_order_relaxed);
+    demuxer_.reset();
+    resync_ = true;
+  }
+  has_sequence_ = true;
+  next_sequence_ = sequence + 1;
+  received_ = received;
+  demuxer_.feed(data, size);
+}
+
+void Mp4Recorder::unit(const access_unit& unit) {
+  if (!initialized_) {
+    const auto& parameters = demuxer_.parameters();
+    if (!unit.keyframe || !parameters.complete()) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    initialized_ = true;
+    resync_ = false;
+    // The time the keyframe was received, up to the pre-event duration ago when replayed.
+    const auto age = std::chrono::steady_clock::now() - received_;
+    start_time_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      (std::chrono::system_clock::now() - age).time_since_epoch())
+                      .count();
+    first_pts_ = segment_pts_ = unit.pts;
+    write_init();
+  }
+  const size_t size = unit.size();
+  if ((resync_ && !unit.keyframe) || size > AsyncFile::buffer_size - header_reserve) {
+    // Nothing decodes until the next keyframe.
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    resync_ = true;
+    return;
+  }
+  resync_ = false;
+
+  if (buffer_) {
+    const int64_t duration = unit.pts - last_pts_;
+    if (duration > 0 && duration <= UINT32_MAX) last_duration_ = static_cast<uint32_t>(duration);
+    samples_.back().duration = last_duration_;
+    if (unit.keyframe || unit.pts - fragment_pts_ >= fragment_ticks ||
+        samples_.size() == max_samples || end_ + size > AsyncFile::buffer_size)
+      close_fragment();
+  }
+  if (unit.keyframe && segment_ticks_ && unit.pts - segment_pts_ >= segment_ticks_) {
+    const auto path = (std::filesystem::path(directory_) / segment_name(segment_ + 1)).string();
+    // Or the segment goes on, until the next keyframe.
+    if (file_.next(path)) {
+      ++segment_;
+      segment_pts_ = unit.pts;
+      sequence_ = 0;
+      write_init();
+    }
+  }
+  if (!buffer_) {
+    buffer_ = file_.acquire();
+    end_ = header_reserve;
+    fragment_pts_ = unit.pts;
+  }
+  for (const auto& nal : unit.nals) {
+    put32(buffer_ + end_, static_cast<uint32_t>(nal.size));
+    std::memcpy(buffer_ + end_ + 4, nal.data, nal.size);
+    end_ += 4 + nal.size;
+  }
+  samples_.push_back({0, static_cast<uint32_t>(size), unit.keyframe});
+  last_pts_ = unit.pts;
+  frames_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Mp4Recorder::write_init() {
+  init_.clear();
+  mp4::init_segment(demuxer_.parameters(), init_);
+  unsigned char* buffer = file_.acquire();
+  std::memcpy(buffer, init_.data(), init_.size());
+  file_.submit(buffer, 0, init_.size());
+  offset_ = init_.size();
+  segments_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Mp4Recorder::close_fragment() {
+  const size_t header = mp4::fragment_header_size(samples_.size());
+  const size_t start = header_reserve - header;
+  mp4::fragment_header(++sequence_, static_cast<uint64_t>(fragment_pts_ - segment_pts_), samples_,
+                       buffer_ + start);
+  file_.submit(buffer_, start, end_ - start);
+  if (catalog_.is_open() && samples_.front().keyframe)
+    catalog_.append({start_time_ + (fragment_pts_ - first_pts_) * 1000 / mp4::timescale, offset_,
+                     segment_, 0});
+  offset_ += end_ - start;
+  buffer_ = nullptr;
+  samples_.clear();
+  fragments_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Mp4Recorder::dump(std::ostream& out) const {
+  const auto s = stats();
+  out << std::left << std::setw(16) << name_ << std::right << std::setw(10) << s.frames
+      << " frames" << std::setw(8) << s.fragments << " fragments" << std::setw(6) << s.segments
+      << " segments" << std::setw(8) << s.dropped
+      << " dropped" << std::setw(8) << s.lost << " lost, " << s.file.bytes / 1024 << " KiB in "
+      << s.file.writes << " writes, " << s.file.errors << " failed, " << s.file.waits
+      << " waits for the disk ("
+      << std::chrono::duration_cast<std::chrono::milliseconds>(s.file.waited).count() << " ms)\n";
+}
+
+}  // namespace app
\ No newline at end of file
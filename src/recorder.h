@@ -0,0 +1,128 @@
+#ifndef DEF_RECORDER_H
+#define DEF_RECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "async_file.h"
+#include "catalog.h"
+#include "fmp4.h"
+#include "pre_event.h"
+#include "ps_demux.h"
+#include "stream_tap.h"
+
+namespace app {
+
+struct recorder_stats {
+  unsigned long long frames;
+  unsigned long long fragments;
+  unsigned long long segments;
+  unsigned long long dropped;  // frames not recorded: waiting for a keyframe, or too large
+  unsigned long long lost;     // packets lost before the recorder
+  async_file_stats file;
+};
+
+// The stream of a StreamTap remuxed into a fragmented MP4 file: a fragment per keyframe, or per
+// fragment_duration when they are further apart. Each fragment is built in a buffer of the file,
+// then queued for its writer as a whole, a crash of the process losing the one being built only
+// (and any still queued, none while the disk keeps up). Packets lost before the recorder resume
+// the recording at the next keyframe, a frame longer on screen. A segmented recording is a
+// directory of such files, each cut at the first keyframe past the segment duration, and of the
+// catalog of their keyframes. An armed recorder keeps the latest seconds of the stream in a
+// pre-event buffer: a recording started then begins with them, the live packets following without
+// a gap.
+class Mp4Recorder {
+ public:
+  static constexpr std::chrono::milliseconds fragment_duration{1000};
+  static constexpr size_t max_samples = 250;  // per fragment
+
+ private:
+  std::string name_;
+  StreamConsumer consumer_;
+  StreamTap* tap_;         // attached to, while recording or armed
+  mutable std::mutex mx_;  // the consumer thread, and a recording starting or stopping
+  std::unique_ptr<PreEventBuffer> pre_event_;
+  std::atomic<bool> recording_;
+  PsDemuxer demuxer_;
+  AsyncFile file_;
+  std::string directory_;  // empty for a single file
+  int64_t segment_ticks_;  // 0 for a single file
+  CatalogWriter catalog_;
+
+  // The consumer thread, or a recording starting or stopping, with the lock.
+  bool has_sequence_;
+  uint64_t next_sequence_;
+  bool initialized_;
+  bool resync_;
+  std::vector<unsigned char> init_;
+  unsigned char* buffer_;  // of the fragment built, nullptr between two
+  size_t end_;
+  std::vector<mp4::sample> samples_;
+  uint64_t offset_;  // in the file, of the next fragment
+  uint32_t segment_;
+  std::chrono::steady_clock::time_point received_;  // of the packet being fed
+  int64_t start_time_;  // ms since 1970-01-01 UTC, at first_pts_
+  int64_t first_pts_;
+  int64_t segment_pts_;
+  int64_t fragment_pts_;
+  int64_t last_pts_;
+  uint32_t last_duration_;
+  uint32_t sequence_;
+
+  std::atomic<unsigned long long> frames_;
+  std::atomic<unsigned long long> fragments_;
+  std::atomic<unsigned long long> segments_;
+  std::atomic<unsigned long long> dropped_;
+  std::atomic<unsigned long long> lost_;
+
+  void handle(const StreamPacket& packet);
+  void feed(uint64_t sequence, const unsigned char* data, size_t size,
+            std::chrono::steady_clock::time_point received);
+  bool begin(StreamTap& tap);
+  void unit(const access_unit& unit);
+  void write_init();
+  void close_fragment();
+
+ public:
+  explicit Mp4Recorder(std::string name);
+  Mp4Recorder(const Mp4Recorder&) = delete;
+  Mp4Recorder& operator=(const Mp4Recorder&) = delete;
+  ~Mp4Recorder();
+
+  // Creates `path`, then records what `tap` streams from its next keyframe, or from the oldest of
+  // the pre-event buffer when armed on it.
+  bool start(StreamTap& tap, const std::string& path);
+  // Creates `directory`, then records in it a segment per `segment_duration`.
+  bool start(StreamTap& tap, const std::string& directory, std::chrono::seconds segment_duration);
+  // Detaches, unless armed, then writes the last fragment and closes the file.
+  void stop();
+  bool recording() const { return recording_; }
+
+  // Keeps the packets of `tap` of the last `duration` in a buffer of `capacity` bytes.
+  bool arm(StreamTap& tap, std::chrono::seconds duration, size_t capacity);
+  // Stops any recording, then detaches.
+  void disarm();
+  bool armed() const { return pre_event_ != nullptr; }
+  pre_event_stats buffered() const;
+  // Of the segment being recorded, for a segmented recording.
+  const std::string& path() const { return file_.path(); }
+
+  recorder_stats stats() const {
+    return {frames_.load(std::memory_order_relaxed), fragments_.load(std::memory_order_relaxed),
+            segments_.load(std::memory_order_relaxed), dropped_.load(std::memory_order_relaxed),
+            lost_.load(std::memory_order_relaxed), file_.stats()};
+  }
+  // Its name, the frames, fragments and segments written, those lost, and how the writes went.
+  void dump(std::ostream& out) const;
+};
+
+}  // namespace app
+
+#endif
\ No newline at end of file
@@ -1,6 +1,12 @@
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <sstream>
+#include <vector>
 
 #include <stdsoap2.h>
 
@@ -14,8 +20,8 @@
 #include <plugin/wsddapi.h>
 #include <plugin/wsseapi.h>
 
-#include "exceptions.h"
 #include "main.h"
+#include "soap_discovery.h"
 #include "synchronized_ostream.h"
 #include "util.h"
 
@@ -23,8 +29,6 @@ namespace app {
 namespace soap {
 
 SoapThread soap_thread;
-SoapActionRunnerNothing do_nothing_runner;
-
 
 std::ostream &operator<<(std::ostream &out, const IRMode &state) {
   if (state == IRMode::ON)
@@ -39,6 +43,16 @@ std::ostream &operator<<(std::ostream &out, const IRMode &state) {
   return out;
 }
 
+// Every way the SoapThread is done with an action ends here.
+static void complete(SoapAction &action, SoapOutcome outcome, int error = SOAP_OK) {
+  std::visit(
+      [outcome, error](auto &a) {
+        a.set_outcome(outcome, error);
+        a.done()(a);
+      },
+      action);
+}
+
 /******************************************************************************\
  *
  *	SoapThread
@@ -46,29 +60,72 @@ std::ostream &operator<<(std::ostream &out, const IRMode &state) {
  \******************************************************************************/
 
 SoapThread::SoapThread()
-    : waiting_for_data_(false),
-      connected_(false),
+    : connected_(false),
       error_(false),
       exit_(false),
-      soap(soap_new1(SOAP_XML_CANONICAL)),
-      proxy_device_(soap),
-      proxy_media_(soap),
-      proxy_ptz_(soap),
-      proxy_imaging_(soap) {}
+      stopped_(false),
+      failed_(false),
+      ready_(false),
+      warm_start_(false),
+      expired_(0),
+      device_("device", credentials_),
+      media_("media", credentials_),
+      proxy_device_(device_.soap()),
+      proxy_media_(media_.soap()),
+      lanes_{{{"ptz", credentials_},
+              {"ptz-zoom", credentials_},
+              {"ptz-status", credentials_},
+              {"imaging", credentials_}}} {
+  for (auto &sent : sent_) sent = 0;
+  for (auto &throttled : throttled_) throttled = 0;
+}
 
 bool SoapThread::init() {
   soap_endpoint = std::string("http://") + config.host + ":" + std::to_string(config.soap_port) +
                   "/onvif/device_service";
-  soap->connect_timeout = soap->recv_timeout = soap->send_timeout = 30;  // 30 sec
-  ::soap_register_plugin(soap, ::soap_wsse);
   clog.log("soap_endpoint = ", soap_endpoint);
+  credentials_.start(config.onvif_username, config.onvif_password);
   proxy_device_.soap_endpoint = soap_endpoint.c_str();
+  const std::chrono::milliseconds rtt(config.round_trip_time);
+  device_.rtt().seed(rtt);
+  media_.rtt().seed(rtt);
+  for (auto &l : lanes_) l.connection.rtt().seed(rtt);
+  for (const auto [t, rate] : {std::pair{SoapTraffic::CONTROL, config.control_rate},
+                               std::pair{SoapTraffic::QUERY, config.query_rate},
+                               std::pair{SoapTraffic::CONFIGURATION, config.configuration_rate}})
+    budgets_[static_cast<size_t>(t)] =
+        SoapTokenBucket(rate, std::max(1., rate * burst_seconds));
+
+  // Warm start: no request before being ready, the cached entry is checked against the device
+  // while the first actions are already processed (see validate()).
+  const SoapDeviceCache cache(config.onvif_cache);
+  const std::string address = config.host + ":" + std::to_string(config.soap_port);
+  if (!config.onvif_cache.empty() && cache.load(address, device_info_)) {
+    clog.log("SoapThread::init: using the cached device information of ", address);
+    warm_start_ = true;
+    use(device_info_);
+    validation_ = std::async(std::launch::async, [this]() {
+      return read_device_information(read_info_);
+    });
+    return true;
+  }
 
+  if (!discover(device_info_)) return false;
+  use(device_info_);
+  if (!config.onvif_cache.empty() && !cache.save(address, device_info_))
+    std::cerr << "Could not write the ONVIF cache " << config.onvif_cache << '\n';
+  return true;
+}
+
+bool SoapThread::read_device_information(SoapDeviceInfo &info) {
+  SoapRequestScope scope(device_.soap());
   ::_tds__GetDeviceInformation GetDeviceInformation;
   ::_tds__GetDeviceInformationResponse GetDeviceInformationResponse;
-  set_credentials();
-  if (proxy_device_.GetDeviceInformation(&GetDeviceInformation, GetDeviceInformationResponse)) {
-    ::soap_stream_fault(soap, std::cerr);
+  if (device_.call(metrics::operation::DEVICE_GET_DEVICE_INFORMATION, [&]() {
+        return proxy_device_.GetDeviceInformation(&GetDeviceInformation,
+                                                  GetDeviceInformationResponse);
+      })) {
+    ::soap_stream_fault(device_.soap(), std::cerr);
     return false;
   }
   /* ::check_response(soap); */
@@ -77,13 +134,29 @@ bool SoapThread::init() {
   clog.log("FirmwareVersion: ", GetDeviceInformationResponse.FirmwareVersion);
   clog.log("SerialNumber:    ", GetDeviceInformationResponse.SerialNumber);
   clog.log("HardwareId:      ", GetDeviceInformationResponse.HardwareId);
+  info.serial = GetDeviceInformationResponse.SerialNumber;
+  info.firmware = GetDeviceInformationResponse.FirmwareVersion;
+  info.model = GetDeviceInformationResponse.Model;
+  return true;
+}
+
+// The requests that do not depend on each other are sent at the same time, each on a connection of
+// its own: the device information with the capabilities, then the profiles with the audio outputs.
+bool SoapThread::discover(SoapDeviceInfo &info) {
+  auto information = std::async(std::launch::async,
+                                [this, &info]() { return read_device_information(info); });
 
   // get device capabilities and print media
+  SoapConnection capabilities("device-capabilities", credentials_);
+  capabilities.rtt().seed(std::chrono::milliseconds(config.round_trip_time));
+  DeviceBindingProxy proxy_capabilities(capabilities.soap());
+  proxy_capabilities.soap_endpoint = soap_endpoint.c_str();
   _tds__GetCapabilities GetCapabilities;
   _tds__GetCapabilitiesResponse GetCapabilitiesResponse;
-  set_credentials();
-  if (proxy_device_.GetCapabilities(&GetCapabilities, GetCapabilitiesResponse)) {
-    ::soap_stream_fault(soap, std::cerr);
+  if (capabilities.call(metrics::operation::DEVICE_GET_CAPABILITIES, [&]() {
+        return proxy_capabilities.GetCapabilities(&GetCapabilities, GetCapabilitiesResponse);
+      })) {
+    ::soap_stream_fault(capabilities.soap(), std::cerr);
     return false;
   }
   /* ::check_response(soap); */
@@ -93,38 +166,61 @@ bool SoapThread::init() {
     std::cerr << "Missing device capabilities info" << std::endl;
     return false;
   }
-  proxy_media_.soap_endpoint = GetCapabilitiesResponse.Capabilities->Media->XAddr.c_str();
-  proxy_ptz_.soap_endpoint = GetCapabilitiesResponse.Capabilities->PTZ->XAddr.c_str();
-  proxy_imaging_.soap_endpoint = GetCapabilitiesResponse.Capabilities->Imaging->XAddr.c_str();
-  clog.log("Media XAddr: ", proxy_media_.soap_endpoint);
-  clog.log("PTZ XAddr: ", proxy_ptz_.soap_endpoint);
-  clog.log("IMAGING XAddr: ", proxy_imaging_.soap_endpoint);
+  info.media_endpoint = GetCapabilitiesResponse.Capabilities->Media->XAddr;
+  info.ptz_endpoint = GetCapabilitiesResponse.Capabilities->PTZ->XAddr;
+  info.imaging_endpoint = GetCapabilitiesResponse.Capabilities->Imaging->XAddr;
+  if (GetCapabilitiesResponse.Capabilities->Events)
+    info.events_endpoint = GetCapabilitiesResponse.Capabilities->Events->XAddr;
+  if (!information.get()) return false;
+
+  SoapRequestScope media_scope(media_.soap());
+  proxy_media_.soap_endpoint = info.media_endpoint.c_str();
+  SoapConnection audio("media-audio", credentials_);
+  audio.rtt().seed(std::chrono::milliseconds(config.round_trip_time));
+  MediaBindingProxy proxy_audio(audio.soap());
+  proxy_audio.soap_endpoint = info.media_endpoint.c_str();
+  auto audio_outputs = std::async(std::launch::async, [&]() {
+    ::_trt__GetAudioOutputs *trt__GetAudioOutputs = ::soap_new__trt__GetAudioOutputs(audio.soap());
+    ::_trt__GetAudioOutputsResponse trt__GetAudioOutputsResponse;
+    if (audio.call(metrics::operation::MEDIA_GET_AUDIO_OUTPUTS, [&]() {
+          return proxy_audio.GetAudioOutputs(trt__GetAudioOutputs, trt__GetAudioOutputsResponse);
+        })) {
+      std::cerr << "Error when Reading Audio configuration:\n";
+      ::soap_stream_fault(audio.soap(), std::cerr);
+      return false;
+    }
+    info.audio_output_token = trt__GetAudioOutputsResponse.AudioOutputs[0]->token;
+    return true;
+  });
 
   // get device profiles
   ::_trt__GetProfiles GetProfiles;
   ::_trt__GetProfilesResponse GetProfilesResponse;
-  set_credentials();
-  if (proxy_media_.GetProfiles(&GetProfiles, GetProfilesResponse)) {
-    ::soap_stream_fault(soap, std::cerr);
+  if (media_.call(metrics::operation::MEDIA_GET_PROFILES, [&]() {
+        return proxy_media_.GetProfiles(&GetProfiles, GetProfilesResponse);
+      })) {
+    ::soap_stream_fault(media_.soap(), std::cerr);
     return false;
   }
-  soap_profile_ = GetProfilesResponse.Profiles[0];
-  soap_ptz_configuration_ = soap_profile_->PTZConfiguration;
-  profile_token_ = soap_profile_->token;
-  video_source_token_ = soap_profile_->VideoSourceConfiguration->SourceToken;
-  audio_source_token_ = soap_profile_->AudioSourceConfiguration->SourceToken;
-  ::_trt__GetAudioOutputs *trt__GetAudioOutputs = ::soap_new__trt__GetAudioOutputs(soap);
-  ::_trt__GetAudioOutputsResponse trt__GetAudioOutputsResponse;
-  set_credentials();
-  if (proxy_media_.GetAudioOutputs(trt__GetAudioOutputs, trt__GetAudioOutputsResponse)) {
-    std::cerr << "Error when Reading Audio configuration:\n";
-    ::soap_stream_fault(soap, std::cerr);
+  const ::tt__Profile *profile = GetProfilesResponse.Profiles[0];
+  const ::tt__PTZConfiguration *ptz_configuration = profile->PTZConfiguration;
+  if (!ptz_configuration || !ptz_configuration->PanTiltLimits ||
+      !ptz_configuration->PanTiltLimits->Range || !ptz_configuration->ZoomLimits ||
+      !ptz_configuration->ZoomLimits->Range) {
+    std::cerr << "Missing PTZ limits in the media profile" << std::endl;
     return false;
   }
-  audio_main_output_token_ = trt__GetAudioOutputsResponse.AudioOutputs[0]->token;
+  const auto pan_tilt = ptz_configuration->PanTiltLimits->Range;
+  const auto zoom = ptz_configuration->ZoomLimits->Range;
+  info.ptz_limits = {pan_tilt->XRange->Min, pan_tilt->XRange->Max, pan_tilt->YRange->Min,
+                     pan_tilt->YRange->Max, zoom->XRange->Min,    zoom->XRange->Max};
+  info.profile_token = profile->token;
+  info.video_source_token = profile->VideoSourceConfiguration->SourceToken;
+  info.audio_source_token = profile->AudioSourceConfiguration->SourceToken;
+  if (!audio_outputs.get()) return false;
 
   // _trt__GetAudioOutputConfigurationOptions *trt__GetAudioOutputConfigurationOptions =
-  //     ::soap_new_set__trt__GetAudioOutputConfigurationOptions(soap, nullptr, &profile_token_);
+  //     ::soap_new_set__trt__GetAudioOutputConfigurationOptions(soap, nullptr, &device_info_.profile_token);
   // _trt__GetAudioOutputConfigurationOptionsResponse
   // trt__GetAudioOutputConfigurationOptionsResponse; set_credentials(); if
   // (proxy_media_.GetAudioOutputConfigurationOptions(trt__GetAudioOutputConfigurationOptions,
@@ -174,337 +270,1222 @@ bool SoapThread::init() {
   return true;
 }
 
-bool SoapThread::start_move(float dx, float dy) {
-  clog.log("Soap: Starting Move: dx = ", dx, " | dy = ", dy);
-  ::_tptz__ContinuousMove *tptz__ContinuousMove = ::soap_new_req__tptz__ContinuousMove(
-      soap, profile_token_,
-      ::soap_new_set_tt__PTZSpeed(soap, ::soap_new_set_tt__Vector2D(soap, dx, dy, nullptr),
-                                  nullptr));
-  ::_tptz__ContinuousMoveResponse tptz__ContinuousMoveResponse;
-  set_credentials();
-  if (proxy_ptz_.ContinuousMove(tptz__ContinuousMove, tptz__ContinuousMoveResponse)) {
-    std::cerr << "Error when Starting continuous move operation:\n";
-    ::soap_stream_fault(soap, std::cerr);
-    return false;
+void SoapThread::use(const SoapDeviceInfo &info) {
+  proxy_media_.soap_endpoint = info.media_endpoint.c_str();
+  for (auto &l : lanes_) {
+    l.ptz.soap_endpoint = info.ptz_endpoint.c_str();
+    l.imaging.soap_endpoint = info.imaging_endpoint.c_str();
+  }
+  envelopes_.build(lanes_[PAN_TILT_LANE].connection.soap(), info.profile_token, credentials_);
+  {
+    std::lock_guard<std::mutex> lock(info_mx_);
+    published_info_ = std::make_shared<const SoapDeviceInfo>(info);
   }
+  clog.log("Media XAddr: ", info.media_endpoint);
+  clog.log("PTZ XAddr: ", info.ptz_endpoint);
+  clog.log("IMAGING XAddr: ", info.imaging_endpoint);
+  clog.log("Events XAddr: ", info.events_endpoint);
+}
 
+// End of a warm start: a device that does not answer is an init() failure, one that changed (other
+// serial number or firmware) is discovered again.
+bool SoapThread::validate() {
+  if (!validation_.get()) return false;
+  if (read_info_.serial == device_info_.serial && read_info_.firmware == device_info_.firmware)
+    return true;
+
+  clog.log("SoapThread::validate: the device changed, discovering it again");
+  SoapDeviceInfo info;
+  if (!discover(info)) return false;
+  device_info_ = info;
+  use(device_info_);
+  if (!SoapDeviceCache(config.onvif_cache)
+           .save(config.host + ":" + std::to_string(config.soap_port), device_info_))
+    std::cerr << "Could not write the ONVIF cache " << config.onvif_cache << '\n';
   return true;
 }
 
-bool SoapThread::stop_move() {
-  clog.log("Soap: Stopping Move");
-  ::_tptz__Stop *tptz__Stop = ::soap_new_set__tptz__Stop(
-      soap, profile_token_, ::soap_new_bool(soap, true), ::soap_new_bool(soap, true));
-  ::_tptz__StopResponse tptz__StopResponse;
-  set_credentials();
-  if (proxy_ptz_.Stop(tptz__Stop, tptz__StopResponse)) {
-    std::cerr << "Error when Stopping continuous move" << std::endl;
-    ::soap_stream_fault(soap, std::cerr);
-    return false;
+bool SoapThread::wait_ready() {
+  std::unique_lock<std::mutex> lock(ready_mx_);
+  ready_cv_.wait(lock, [this]() { return ready_; });
+  return connected_;
+}
+
+/******************************************************************************\
+ *
+ *	SoapThread: requests in flight
+ *
+ \******************************************************************************/
+
+SoapThread::Lane SoapThread::lane(unsigned axes) {
+  if (axes & PAN_TILT) return PAN_TILT_LANE;
+  if (axes & ZOOM) return ZOOM_LANE;
+  if (axes & IMAGING) return IMAGING_LANE;
+  return STATUS_LANE;
+}
+
+// Starts, in queue order, every pending action whose lane is free, whose axes are neither used by
+// an action in flight nor by an earlier pending one, and whose budget has a token left.
+// Expired actions are dropped on the way. An action over budget stays pending, where the later ones
+// of its kind are merged into it: a burst is shaped into fewer requests rather than failed.
+std::chrono::steady_clock::time_point SoapThread::dispatch() {
+  unsigned blocked = NO_AXIS;
+  unsigned waiting = 0;  // lanes an earlier pending action waits for, as a bit set
+  for (const auto &l : lanes_)
+    if (l.busy) blocked |= axes(l.action);
+  const auto now = std::chrono::steady_clock::now();
+  auto next = std::chrono::steady_clock::time_point::max();
+  for (size_t i = 0; i < pending_.size();) {
+    if (deadline(pending_[i]) < now) {
+      expire(pending_.take(i));
+      continue;
+    }
+    const unsigned action_axes = axes(pending_[i]);
+    const Lane l = lane(action_axes);
+    bool ready = !lanes_[l].busy && !(action_axes & blocked) && !(waiting & (1u << l));
+    blocked |= action_axes;
+    waiting |= 1u << l;
+    if (ready) {
+      const auto t = static_cast<size_t>(traffic(pending_[i]));
+      if (!budgets_[t].take(now)) {
+        ready = false;
+        next = std::min(next, budgets_[t].available(now));
+        std::visit(
+            [this, t](auto &a) {
+              if (a.throttled()) return;
+              a.set_throttled();
+              ++throttled_[t];
+            },
+            pending_[i]);
+      }
+    }
+    if (ready)
+      start(lanes_[l], pending_.take(i));
+    else
+      ++i;
   }
+  return next;
+}
 
-  return true;
+// The callback is still called, so that whoever waits for the action is not left hanging.
+void SoapThread::expire(SoapAction &&action) {
+  clog.log("SoapThread::expire: ", action, " is too late, dropped");
+  ++expired_;
+  complete(action, SoapOutcome::EXPIRED);
 }
 
-bool SoapThread::move_to(float p, float t, float z) {
-  clog.log("Starting Absolute move to p = ", p, " | t = ", t, " | z  = ", z);
-  auto &&ptz_vec =
-      ::soap_new_set_tt__PTZVector(soap, ::soap_new_set_tt__Vector2D(soap, p, t, nullptr),
-                                   ::soap_new_set_tt__Vector1D(soap, z, nullptr));
-  _tptz__AbsoluteMove *tptz__AbsoluteMove =
-      ::soap_new_set__tptz__AbsoluteMove(soap, profile_token_, ptz_vec, nullptr);
-  _tptz__AbsoluteMoveResponse tptz__AbsoluteMoveResponse;
-  set_credentials();
-  if (proxy_ptz_.AbsoluteMove(tptz__AbsoluteMove, tptz__AbsoluteMoveResponse)) {
-    std::cerr << "Error when Absolute moving" << std::endl;
-    ::soap_stream_fault(soap, std::cerr);
-    return false;
+void SoapThread::start(SoapLane &lane, SoapAction &&action) {
+  ++sent_[static_cast<size_t>(traffic(action))];
+  metrics::record(metrics::operation::SOAP_QUEUE_RESIDENCY,
+                  std::chrono::steady_clock::now() -
+                      std::visit([](const auto &a) { return a.queued(); }, action));
+  clog.log("SoapThread::start: ", action, " on ", lane.connection.name(),
+           " | pending: ", pending_.size(), " | coalesced so far: ", pending_.coalesced());
+  lane.action = std::move(action);
+  lane.busy = true;
+  lane.step = 0;
+  send(lane);
+}
+
+void SoapThread::send(SoapLane &lane) {
+  const auto send_step = [this, &lane](auto &action) { return send(lane, action); };
+  lane.sent = std::chrono::steady_clock::now();
+  lane.connection.begin(!envelopes_.ready() || !preserialized(lane.action));
+  int error = std::visit(send_step, lane.action);
+  if (error && lane.connection.retry(error)) error = std::visit(send_step, lane.action);
+  if (error) {
+    lane.connection.end(error);
+    finish(lane, error);
   }
-  clog.log("Absolute move done");
+}
 
-  return true;
+void SoapThread::receive(SoapLane &lane) {
+  const int step = lane.step;
+  int error = std::visit([this, &lane](auto &action) { return receive(lane, action); }, lane.action);
+  if (error && lane.connection.retry(error)) {
+    error = std::visit([this, &lane](auto &action) { return send(lane, action); }, lane.action);
+    if (!error) return;
+  }
+  lane.connection.end(error);
+  if (!error) metrics::record(lane.operation, std::chrono::steady_clock::now() - lane.sent);
+  if (!error && lane.step != step)
+    send(lane);
+  else
+    finish(lane, error);
 }
 
-bool SoapThread::move_to_rel(float p, float t, float z) {
-  clog.log("SoapThread::move_to_rel: Starting Relative move to p = ", p, " | t = ", t,
-           " | z  = ", z);
-  auto &&ptz_vec =
-      ::soap_new_set_tt__PTZVector(soap, ::soap_new_set_tt__Vector2D(soap, p, t, nullptr),
-                                   ::soap_new_set_tt__Vector1D(soap, z, nullptr));
-  _tptz__RelativeMove *tptz__RelativeMove =
-      ::soap_new_set__tptz__RelativeMove(soap, profile_token_, ptz_vec, nullptr);
-  _tptz__RelativeMoveResponse tptz__RelativeMoveResponse;
-  set_credentials();
-  if (proxy_ptz_.RelativeMove(tptz__RelativeMove, tptz__RelativeMoveResponse)) {
-    std::cerr << "Error when Relative moving" << std::endl;
+void SoapThread::finish(SoapLane &lane, int error, bool timed_out) {
+  struct soap *soap = lane.connection.soap();
+  if (error) {
+    metrics::record_error(lane.operation);
+    std::cerr << "Error when processing " << lane.action << ":\n";
     ::soap_stream_fault(soap, std::cerr);
-    return false;
+    // As before, a failed move stops the thread, a failed status read or IR switch is only reported.
+    // A timeout only drops the action while the device may still be given a longer one.
+    if (!std::holds_alternative<SoapGetStatus>(lane.action) &&
+        !std::holds_alternative<SoapIRModeAction>(lane.action) &&
+        !(timed_out && lane.connection.timeout() < SoapRttEstimator::max_rto)) {
+      // Set before the callback, for whoever it wakes up to see it.
+      failed_ = true;
+      error_ = true;
+    }
   }
-  clog.log("SoapThread::move_to_rel Relative move done");
+  complete(lane.action, error ? SoapOutcome::FAILED : SoapOutcome::OK, error);
+  lane.busy = false;
+  lane.imaging_settings = nullptr;
+  ::soap_destroy(soap);
+  ::soap_end(soap);
+}
 
-  return true;
+bool SoapThread::in_flight() const {
+  return std::any_of(lanes_.begin(), lanes_.end(), [](const SoapLane &l) { return l.busy; });
 }
 
-bool SoapThread::night_mode(const IRMode &state) {
-  clog.log("SoapThread::night_mode: Start switching night_mode to ", state);
-  _timg__GetImagingSettings *timg__GetImagingSettings =
-      ::soap_new_set__timg__GetImagingSettings(soap, video_source_token_);
-  _timg__GetImagingSettingsResponse timg__GetImagingSettingsResponse;
+// Waits up to `timeout` for a response, then reads every response that arrived.
+void SoapThread::poll(std::chrono::milliseconds timeout) {
+  fd_set readable;
+  FD_ZERO(&readable);
+  SOAP_SOCKET highest = 0;
+  for (auto &l : lanes_) {
+    if (!l.busy || !soap_valid_socket(l.connection.socket())) continue;
+    FD_SET(l.connection.socket(), &readable);
+    highest = std::max(highest, l.connection.socket());
+  }
+  timeval tv = {0, static_cast<long>(std::chrono::microseconds(timeout).count())};
+  const int ready = ::select(static_cast<int>(highest) + 1, &readable, nullptr, nullptr, &tv);
+
+  const auto now = std::chrono::steady_clock::now();
+  for (auto &l : lanes_) {
+    if (!l.busy) continue;
+    if (!soap_valid_socket(l.connection.socket()) ||
+        (ready > 0 && FD_ISSET(l.connection.socket(), &readable))) {
+      receive(l);
+    } else if (now - l.sent > l.connection.timeout()) {
+      clog.log("SoapThread::poll: no response on ", l.connection.name(), " after ",
+               std::chrono::duration_cast<std::chrono::milliseconds>(l.connection.timeout()).count(),
+               " ms");
+      l.connection.timed_out();
+      finish(l, l.connection.soap()->error = SOAP_EOF, true);
+    }
+  }
+}
 
-  set_credentials();
-  if (proxy_imaging_.GetImagingSettings(timg__GetImagingSettings,
-                                        timg__GetImagingSettingsResponse)) {
-    std::cerr << "SoapThread::night_mode: Error when retrieving Imaging Settings" << std::endl;
-    ::soap_stream_fault(soap, std::cerr);
-    return false;
+int SoapThread::send(SoapLane &lane, SoapStopContinuousMoveAction &action) {
+  struct soap *soap = lane.connection.soap();
+  clog.log("Soap: Stopping Move");
+  lane.operation = metrics::operation::PTZ_STOP;
+  if (envelopes_.ready()) return send(lane, SoapEnvelopes::STOP, 0.f, 0.f, 0.f);
+  return lane.ptz.send_Stop(nullptr, nullptr,
+                            ::soap_new_set__tptz__Stop(soap, device_info_.profile_token,
+                                                       ::soap_new_bool(soap, true),
+                                                       ::soap_new_bool(soap, true)));
+}
+
+int SoapThread::receive(SoapLane &lane, SoapStopContinuousMoveAction &action) {
+  ::_tptz__StopResponse tptz__StopResponse;
+  if (const int error = lane.ptz.recv_Stop(tptz__StopResponse)) return error;
+  ptz_state_.stop(std::chrono::steady_clock::now());
+  return SOAP_OK;
+}
+
+int SoapThread::send(SoapLane &lane, SoapStartContinuousMoveAction &action) {
+  struct soap *soap = lane.connection.soap();
+  clog.log("Soap: Starting Move: dx = ", action.pan(), " | dy = ", action.tilt());
+  lane.operation = metrics::operation::PTZ_CONTINUOUS_MOVE;
+  if (envelopes_.ready())
+    return send(lane, SoapEnvelopes::CONTINUOUS_MOVE, action.pan(), action.tilt(), 0.f);
+  return lane.ptz.send_ContinuousMove(
+      nullptr, nullptr,
+      ::soap_new_req__tptz__ContinuousMove(
+          soap, device_info_.profile_token,
+          ::soap_new_set_tt__PTZSpeed(
+              soap, ::soap_new_set_tt__Vector2D(soap, action.pan(), action.tilt(), nullptr),
+              nullptr)));
+}
+
+int SoapThread::receive(SoapLane &lane, SoapStartContinuousMoveAction &action) {
+  ::_tptz__ContinuousMoveResponse tptz__ContinuousMoveResponse;
+  if (const int error = lane.ptz.recv_ContinuousMove(tptz__ContinuousMoveResponse)) return error;
+  ptz_state_.move(action.pan(), action.tilt(), std::chrono::steady_clock::now());
+  return SOAP_OK;
+}
+
+// Only the axes that move are sent, so that a pan leaves a zoom in flight alone.
+int SoapThread::send(SoapLane &lane, SoapRelativeMoveAction &action) {
+  struct soap *soap = lane.connection.soap();
+  clog.log("SoapThread::send: Starting Relative move to p = ", action.pan(), " | t = ",
+           action.tilt(), " | z  = ", action.zoom());
+  const unsigned moved = action.axes();
+  lane.operation = metrics::operation::PTZ_RELATIVE_MOVE;
+  if (envelopes_.ready())
+    return send(lane,
+                moved == (PAN_TILT | ZOOM) ? SoapEnvelopes::RELATIVE_MOVE
+                : moved & ZOOM             ? SoapEnvelopes::RELATIVE_MOVE_ZOOM
+                                           : SoapEnvelopes::RELATIVE_MOVE_PAN_TILT,
+                action.pan(), action.tilt(), action.zoom());
+  auto &&ptz_vec = ::soap_new_set_tt__PTZVector(
+      soap,
+      moved & PAN_TILT ? ::soap_new_set_tt__Vector2D(soap, action.pan(), action.tilt(), nullptr)
+                       : nullptr,
+      moved & ZOOM ? ::soap_new_set_tt__Vector1D(soap, action.zoom(), nullptr) : nullptr);
+  return lane.ptz.send_RelativeMove(
+      nullptr, nullptr, ::soap_new_set__tptz__RelativeMove(soap, device_info_.profile_token, ptz_vec, nullptr));
+}
+
+int SoapThread::receive(SoapLane &lane, SoapRelativeMoveAction &action) {
+  ::_tptz__RelativeMoveResponse tptz__RelativeMoveResponse;
+  if (const int error = lane.ptz.recv_RelativeMove(tptz__RelativeMoveResponse)) return error;
+  const unsigned moved = action.axes();
+  ptz_state_.moved_by(moved & PAN_TILT ? action.pan() / (pan_max() - pan_min()) : 0.f,
+                      moved & PAN_TILT ? action.tilt() / (tilt_max() - tilt_min()) : 0.f,
+                      moved & ZOOM ? action.zoom() / (zoom_max() - zoom_min()) : 0.f,
+                      std::chrono::steady_clock::now());
+  return SOAP_OK;
+}
+
+// Step 0 reads the current position when only one of pan and tilt is set, since they are sent
+// together, and the PTZ state cannot tell it. Step 1 moves.
+int SoapThread::send(SoapLane &lane, SoapAbsoluteMove &action) {
+  struct soap *soap = lane.connection.soap();
+  SoapPTZState::position cached;
+  if (lane.step == 0 && action.has_pan() != action.has_tilt() &&
+      ptz_state_.exact(std::chrono::steady_clock::now(), cached)) {
+    lane.p = translate_interval(cached.pan, 0., pan_min(), 1., pan_max());
+    lane.t = translate_interval(cached.tilt, 0., tilt_min(), 1., tilt_max());
+    lane.step = 1;
+  }
+  if (lane.step == 0 && action.has_pan() != action.has_tilt()) {
+    lane.operation = metrics::operation::PTZ_GET_STATUS;
+    return lane.ptz.send_GetStatus(nullptr, nullptr,
+                                   ::soap_new_set__tptz__GetStatus(soap, device_info_.profile_token));
   }
-  _timg__SetImagingSettings *timg__SetImagingSettings = ::soap_new_req__timg__SetImagingSettings(
-      soap, video_source_token_, timg__GetImagingSettingsResponse.ImagingSettings);
+  lane.step = 1;
+  lane.operation = metrics::operation::PTZ_ABSOLUTE_MOVE;
+
+  const float p = action.has_pan() ? translate_interval(action.pan(), 0., pan_min(), 1., pan_max())
+                                   : lane.p;
+  const float t = action.has_tilt()
+                      ? translate_interval(action.tilt(), 0., tilt_min(), 1., tilt_max())
+                      : lane.t;
+  const float z = translate_interval(action.zoom(), 0., zoom_min(), 1., zoom_max());
+  clog.log("Starting Absolute move to p = ", p, " | t = ", t, " | z  = ", z);
+  auto &&ptz_vec = ::soap_new_set_tt__PTZVector(
+      soap,
+      action.has_pan() || action.has_tilt() ? ::soap_new_set_tt__Vector2D(soap, p, t, nullptr)
+                                            : nullptr,
+      action.has_zoom() ? ::soap_new_set_tt__Vector1D(soap, z, nullptr) : nullptr);
+  return lane.ptz.send_AbsoluteMove(
+      nullptr, nullptr, ::soap_new_set__tptz__AbsoluteMove(soap, device_info_.profile_token, ptz_vec, nullptr));
+}
 
+int SoapThread::receive(SoapLane &lane, SoapAbsoluteMove &action) {
+  if (lane.step == 0) {
+    ::_tptz__GetStatusResponse tptz__GetStatusResponse;
+    if (const int error = lane.ptz.recv_GetStatus(tptz__GetStatusResponse)) return error;
+    const auto position = tptz__GetStatusResponse.PTZStatus->Position;
+    lane.p = position->PanTilt->x;
+    lane.t = position->PanTilt->y;
+    ptz_state_.read(normalized(lane.p, lane.t, position->Zoom->x),
+                    std::chrono::steady_clock::now());
+    lane.step = 1;
+    return SOAP_OK;
+  }
+  ::_tptz__AbsoluteMoveResponse tptz__AbsoluteMoveResponse;
+  if (const int error = lane.ptz.recv_AbsoluteMove(tptz__AbsoluteMoveResponse)) return error;
+  const bool pan_tilt = action.has_pan() || action.has_tilt();
+  const SoapPTZState::position other = normalized(lane.p, lane.t, 0.f);
+  ptz_state_.moved_to(
+      pan_tilt ? std::optional<float>(action.has_pan() ? action.pan() : other.pan) : std::nullopt,
+      pan_tilt ? std::optional<float>(action.has_tilt() ? action.tilt() : other.tilt)
+               : std::nullopt,
+      action.has_zoom() ? std::optional<float>(action.zoom()) : std::nullopt,
+      std::chrono::steady_clock::now());
+  return SOAP_OK;
+}
+
+int SoapThread::send(SoapLane &lane, SoapGetStatus &action) {
+  clog.log("Soap: Getting Position");
+  lane.operation = metrics::operation::PTZ_GET_STATUS;
+  if (envelopes_.ready()) return send(lane, SoapEnvelopes::GET_STATUS, 0.f, 0.f, 0.f);
+  return lane.ptz.send_GetStatus(
+      nullptr, nullptr, ::soap_new_set__tptz__GetStatus(lane.connection.soap(), device_info_.profile_token));
+}
+
+int SoapThread::receive(SoapLane &lane, SoapGetStatus &action) {
+  ::_tptz__GetStatusResponse tptz__GetStatusResponse;
+  if (const int error = lane.ptz.recv_GetStatus(tptz__GetStatusResponse)) return error;
+  const auto position = tptz__GetStatusResponse.PTZStatus->Position;
+  clog.log("PTZ Position: ", position->PanTilt->x, " | ", position->PanTilt->y, " | ",
+           position->Zoom->x);
+  const SoapPTZState::position p =
+      normalized(position->PanTilt->x, position->PanTilt->y, position->Zoom->x);
+  action.p_ = p.pan;
+  action.t_ = p.tilt;
+  action.z_ = p.zoom;
+  ptz_state_.read(p, std::chrono::steady_clock::now());
+  return SOAP_OK;
+}
+
+SoapPTZState::position SoapThread::normalized(float p, float t, float z) const {
+  return {translate_interval(p, pan_min(), 0, pan_max(), 1),
+          translate_interval(t, tilt_min(), 0, tilt_max(), 1),
+          translate_interval(z, zoom_min(), 0, zoom_max(), 1)};
+}
+
+// Step 0 reads the imaging settings, step 1 writes them back with the new IR cut filter mode.
+int SoapThread::send(SoapLane &lane, SoapIRModeAction &action) {
+  struct soap *soap = lane.connection.soap();
+  if (lane.step == 0) {
+    clog.log("SoapThread::send: Start switching night_mode to ", action.state());
+    lane.operation = metrics::operation::IMAGING_GET_IMAGING_SETTINGS;
+    return lane.imaging.send_GetImagingSettings(
+        nullptr, nullptr, ::soap_new_set__timg__GetImagingSettings(soap, device_info_.video_source_token));
+  }
+  _timg__SetImagingSettings *timg__SetImagingSettings =
+      ::soap_new_req__timg__SetImagingSettings(soap, device_info_.video_source_token, lane.imaging_settings);
   *(timg__SetImagingSettings->ImagingSettings->IrCutFilter) =
-      state == IRMode::OFF
+      action.state() == IRMode::OFF
           ? tt__IrCutFilterMode::OFF
-          : state == IRMode::ON ? tt__IrCutFilterMode::ON : tt__IrCutFilterMode::AUTO;
+          : action.state() == IRMode::ON ? tt__IrCutFilterMode::ON : tt__IrCutFilterMode::AUTO;
   clog.log(
-      "SoapThread::night_mode: IrCutFilter = ",
+      "SoapThread::send: IrCutFilter = ",
       *(timg__SetImagingSettings->ImagingSettings->IrCutFilter) == tt__IrCutFilterMode::OFF
           ? "OFF"
           : *(timg__SetImagingSettings->ImagingSettings->IrCutFilter) == tt__IrCutFilterMode::ON
                 ? "ON"
                 : "AUTO");
-  _timg__SetImagingSettingsResponse timg__SetImagingSettingsResponse;
-  set_credentials();
-  if (proxy_imaging_.SetImagingSettings(timg__SetImagingSettings,
-                                        timg__SetImagingSettingsResponse)) {
-    std::cerr << "SoapThread::night_mode: Error when setting Imaging Settings" << std::endl;
-    ::soap_stream_fault(soap, std::cerr);
-    return false;
-  }
-  clog.log("SoapThread::night_mode: done");
-
-  return true;
-}
-
-void SoapThread::soap_release() {
-  ::soap_destroy(soap);
-  ::soap_end(soap);
-  ::soap_free(soap);
+  lane.operation = metrics::operation::IMAGING_SET_IMAGING_SETTINGS;
+  return lane.imaging.send_SetImagingSettings(nullptr, nullptr, timg__SetImagingSettings);
 }
 
-bool SoapThread::get_position(float &p, float &t, float &z) {
-  clog.log("Soap: Getting Position");
-  ::_tptz__GetStatus *tptz__GetStatus = ::soap_new_set__tptz__GetStatus(soap, profile_token_);
-  ::_tptz__GetStatusResponse tptz__GetStatusResponse;
-  set_credentials();
-  if (proxy_ptz_.GetStatus(tptz__GetStatus, tptz__GetStatusResponse)) {
-    std::cerr << "Unable to read current PTZ position" << std::endl;
-    ::soap_stream_fault(soap, std::cerr);
-    return false;
+int SoapThread::receive(SoapLane &lane, SoapIRModeAction &action) {
+  if (lane.step == 0) {
+    _timg__GetImagingSettingsResponse timg__GetImagingSettingsResponse;
+    if (const int error = lane.imaging.recv_GetImagingSettings(timg__GetImagingSettingsResponse))
+      return error;
+    lane.imaging_settings = timg__GetImagingSettingsResponse.ImagingSettings;
+    lane.step = 1;
+    return SOAP_OK;
   }
-  clog.log("PTZ Position: ", tptz__GetStatusResponse.PTZStatus->Position->PanTilt->x, " | ",
-           tptz__GetStatusResponse.PTZStatus->Position->PanTilt->y, " | ",
-           tptz__GetStatusResponse.PTZStatus->Position->Zoom->x);
-  p = tptz__GetStatusResponse.PTZStatus->Position->PanTilt->x;
-  t = tptz__GetStatusResponse.PTZStatus->Position->PanTilt->y;
-  z = tptz__GetStatusResponse.PTZStatus->Position->Zoom->x;
+  _timg__SetImagingSettingsResponse timg__SetImagingSettingsResponse;
+  if (const int error = lane.imaging.recv_SetImagingSettings(timg__SetImagingSettingsResponse))
+    return error;
+  clog.log("SoapThread::receive: night_mode done");
+  return SOAP_OK;
+}
 
-  return true;
+int SoapThread::send(SoapLane &lane, SoapEnvelopes::Kind kind, float p, float t, float z) {
+  struct soap *soap = lane.connection.soap();
+  envelopes_[kind].render(soap, credentials_.take(soap), p, t, z, lane.envelope);
+  return lane.connection.send(lane.ptz.soap_endpoint, SoapEnvelopes::action(kind), lane.envelope);
 }
 
-bool SoapThread::set_credentials() {
-  ::soap_wsse_delete_Security(soap);
-  return !(::soap_wsse_add_Timestamp(soap, "Time", 10) ||
-           ::soap_wsse_add_UsernameTokenDigest(soap, "Auth", config.onvif_username.c_str(),
-                                               config.onvif_password.c_str()));
+void SoapThread::soap_release() {
+  device_.release();
+  media_.release();
+  for (auto &l : lanes_) l.connection.release();
+  credentials_.stop();
 }
 
 void SoapThread::run() {
   thread_ = std::thread([this]() {
     do {
       clog.log("SoapThread::run: Started running");
-      connected_ = init();
-      error_ = !connected_;
+      const bool connected = init();
+      {
+        std::unique_lock<std::mutex> lock(ready_mx_);
+        connected_ = connected;
+        error_ = !connected;
+        ready_ = true;
+      }
+      ready_cv_.notify_all();
       if (!connected_) break;
       while (true) {
-        waiting_for_data_ = true;
-        std::unique_lock<std::mutex> locker(mutex_);
-        condition_to_consume_.wait(locker, [this]() { return !queue().empty() || exit(); });
         if (exit()) return;
-
-        SoapAction *query;
-        while (!queue_.empty()) {
-          query = queue_.front();
-          assert(query || !(std::cerr << "query == nullptr"));
-          queue_.pop();
-          if (!queue_.empty()) delete query;
+        if (validation_.valid() &&
+            validation_.wait_for(std::chrono::seconds(0)) == std::future_status::ready &&
+            !validate()) {
+          error_ = true;
+          break;
         }
 
-        waiting_for_data_ = false;
-        locker.unlock();
-        condition_to_queue_.notify_all();
-
-        clog.log("SoapThread::run: processing request: ", *query);
-        auto ret = query->process();
-        delete query;
-        if (!ret) break;
+        // What does not fit stays in the ring, whose producers are then the ones to wait.
+        SoapAction submitted;
+        while (!pending_.full() && submissions_.pop(submitted)) pending_.push(std::move(submitted));
+        const auto budget = dispatch();
+
+        // Responses are polled for, so new submissions are seen at least every poll_interval.
+        if (in_flight())
+          poll(poll_interval);
+        else if (pending_.empty())
+          submissions_.wait(exit_);
+        else if (budget != std::chrono::steady_clock::time_point::max())
+          submissions_.wait_until(exit_, budget);
+        if (failed_) break;
       }
 
     } while (0);
 
+    abandon();
     soap_release();
   });
 }
 
-void SoapThread::queue(SoapAction *action) {
-  assert(action || !(std::cerr << "action == null"));
-  std::unique_lock<std::mutex> locker(mutex_);
-  // clog.log("Waiting for empty queue or the consumer thread to finish task");
-  condition_to_queue_.wait(locker,
-                           [this]() { return queue_.empty() || !waiting_for_data_ || exit(); });
-  if (exit()) return;
-  clog.log("Adding to queue one element: ", action, " | ", *action);
-  queue_.push(action);
-  locker.unlock();
-  condition_to_consume_.notify_all();
+// Nothing is left waiting on a worker that stopped: the actions in flight, pending or still in the
+// ring are completed unsent, and queue() refuses any other.
+void SoapThread::abandon() {
+  stopped_ = true;
+  for (auto &l : lanes_) {
+    if (!l.busy) continue;
+    clog.log("SoapThread::abandon: ", l.action, " left unanswered");
+    complete(l.action, SoapOutcome::ABANDONED);
+    l.busy = false;
+    l.imaging_settings = nullptr;
+  }
+  for (size_t i = 0; i < pending_.size(); ++i) {
+    clog.log("SoapThread::abandon: ", pending_[i], " never sent");
+    complete(pending_[i], SoapOutcome::ABANDONED);
+  }
+  pending_.clear();
+  drain();
+}
+
+// Once stopped, the ring has several consumers: the worker and the producers that got in too late.
+void SoapThread::drain() {
+  std::lock_guard<std::mutex> lock(drain_mx_);
+  SoapAction action;
+  while (submissions_.pop(action)) {
+    clog.log("SoapThread::drain: ", action, " never sent");
+    complete(action, SoapOutcome::ABANDONED);
+  }
+}
+
+bool SoapThread::queue(SoapAction action, OverflowPolicy policy,
+                       std::chrono::milliseconds timeout) {
+  if (exit() || stopped_) return false;
+  std::visit(
+      [this](auto &a) {
+        const auto now = std::chrono::steady_clock::now();
+        a.set_queued(now);
+        if constexpr (std::decay_t<decltype(a)>::perishable)
+          a.set_deadline(now + lanes_[lane(a.axes())].connection.timeout());
+      },
+      action);
+  clog.log("Adding to queue one element: ", action);
+  SoapAction displaced;
+  // A Stop does not wait for room, e.g. behind a drag: it has a slot of its own, unless another Stop
+  // holds it already.
+  const bool urgent = std::holds_alternative<SoapStopContinuousMoveAction>(action) &&
+                      submissions_.push_urgent(action);
+  switch (urgent ? SubmitResult::ACCEPTED
+                 : submissions_.push(action, policy, std::chrono::steady_clock::now() + timeout,
+                                     &displaced)) {
+    case SubmitResult::ACCEPTED:
+      break;
+    case SubmitResult::REPLACED:
+      clog.log("SoapThread::queue: queue full, dropped ", displaced);
+      break;
+    case SubmitResult::REJECTED:
+    case SubmitResult::TIMED_OUT:
+    default:
+      clog.log("SoapThread::queue: queue full, rejected ", action);
+      return false;
+  }
+  // The worker may have stopped, and drained the ring, while the action was getting in.
+  if (stopped_) drain();
+  return true;
+}
+
+void SoapThread::keep_alive(bool on) {
+  device_.keep_alive(on);
+  media_.keep_alive(on);
+  for (auto &l : lanes_) l.connection.keep_alive(on);
 }
 
 void SoapThread::must_exit() {
   exit_ = true;
-  condition_to_consume_.notify_all();
-  condition_to_queue_.notify_all();
+  submissions_.wake_up();
 }
 
 /******************************************************************************\
  *
- *	SoapAction
+ *	SoapDeviceCache
  *
  \******************************************************************************/
-SoapAction::SoapAction(SoapThread &soap_thread, SoapActionRunner &runner)
-    : soap_thread_(soap_thread), runner_(runner) {}
-SoapAction::~SoapAction() {}
 
-SoapStopContinuousMoveAction::SoapStopContinuousMoveAction(SoapThread &soap_thread,
-                                                           SoapActionRunner &runner)
-    : SoapAction(soap_thread, runner) {}
-bool SoapStopContinuousMoveAction::process() {
-  bool ret = soap_thread().stop_move();
-  runner_.stop_continuous_move_is_done(this);
-  return ret;
+// address serial firmware media-XAddr ptz-XAddr imaging-XAddr events-XAddr profile video-source
+// audio-source audio-output pan-min pan-max tilt-min tilt-max zoom-min zoom-max, separated by tabs.
+bool SoapDeviceCache::load(const std::string &address, SoapDeviceInfo &info) const {
+  std::ifstream in(path_);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string entry_address;
+    if (!std::getline(fields, entry_address, '\t') || entry_address != address) continue;
+    SoapDeviceInfo entry;
+    for (auto field : {&entry.serial, &entry.firmware, &entry.model, &entry.media_endpoint,
+                       &entry.ptz_endpoint, &entry.imaging_endpoint, &entry.events_endpoint,
+                       &entry.profile_token, &entry.video_source_token, &entry.audio_source_token,
+                       &entry.audio_output_token})
+      if (!std::getline(fields, *field, '\t')) return false;
+    PTZLimits &limits = entry.ptz_limits;
+    if (!(fields >> limits.pan_min >> limits.pan_max >> limits.tilt_min >> limits.tilt_max >>
+          limits.zoom_min >> limits.zoom_max))
+      return false;
+    info = entry;
+    return true;
+  }
+  return false;
 }
 
-std::string SoapStopContinuousMoveAction::str() const { return "SoapStopContinuousMoveAction"; }
+bool SoapDeviceCache::save(const std::string &address, const SoapDeviceInfo &info) const {
+  std::vector<std::string> lines;
+  {
+    std::ifstream in(path_);
+    std::string line;
+    while (std::getline(in, line))
+      if (line.compare(0, address.size() + 1, address + '\t')) lines.push_back(line);
+  }
+  std::ostringstream entry;
+  entry << address;
+  for (auto field : {&info.serial, &info.firmware, &info.model, &info.media_endpoint,
+                     &info.ptz_endpoint, &info.imaging_endpoint, &info.events_endpoint,
+                     &info.profile_token, &info.video_source_token, &info.audio_source_token,
+                     &info.audio_output_token})
+    entry << '\t' << *field;
+  const PTZLimits &limits = info.ptz_limits;
+  entry << std::setprecision(9) << '\t' << limits.pan_min << ' ' << limits.pan_max << ' '
+        << limits.tilt_min << ' ' << limits.tilt_max << ' ' << limits.zoom_min << ' '
+        << limits.zoom_max;
+  lines.push_back(entry.str());
+
+  std::ofstream out(path_, std::ios::trunc);
+  for (const auto &line : lines) out << line << '\n';
+  return static_cast<bool>(out);
+}
 
-SoapStartContinuousMoveAction::SoapStartContinuousMoveAction(SoapThread &soap_thread,
-                                                             SoapActionRunner &runner, float p,
-                                                             float t)
-    : SoapAction(soap_thread, runner), p_(p), t_(t) {}
-bool SoapStartContinuousMoveAction::process() { return soap_thread().start_move(p_, t_); }
-std::string SoapStartContinuousMoveAction::str() const {
-  std::stringstream ss;
-  ss << "SoapStartContinuousMoveAction[" << p_ << ", " << t_ << "]";
-  return ss.str();
+/******************************************************************************\
+ *
+ *	SoapPTZState
+ *
+ \******************************************************************************/
+
+SoapPTZState::SoapPTZState()
+    : base_{0.f, 0.f, 0.f},
+      known_(false),
+      speed_pan_(0.f),
+      speed_tilt_(0.f),
+      travel_pan_(0.f),
+      travel_tilt_(0.f),
+      calibratable_(false),
+      rate_pan_(0.f),
+      rate_tilt_(0.f),
+      samples_pan_(0),
+      samples_tilt_(0),
+      saved_(0) {}
+
+// Adds the travel of the continuous move since since_.
+void SoapPTZState::integrate(std::chrono::steady_clock::time_point now) {
+  const float seconds = std::chrono::duration<float>(now - since_).count();
+  travel_pan_ += speed_pan_ * seconds;
+  travel_tilt_ += speed_tilt_ * seconds;
+  since_ = now;
 }
 
-SoapRelativeMoveAction::SoapRelativeMoveAction(SoapThread &soap_thread, SoapActionRunner &runner,
-                                               float p, float t, float z)
-    : SoapAction(soap_thread, runner), p_(p), t_(t), z_(z) {}
-bool SoapRelativeMoveAction::process() {
-  bool res = soap_thread().move_to_rel(p_, t_, z_);
-  runner_.soap_relative_move_is_done(this);
-  return res;
+SoapPTZState::position SoapPTZState::predict(std::chrono::steady_clock::time_point now) const {
+  const float seconds = std::chrono::duration<float>(now - since_).count();
+  const auto clamp = [](float x) { return std::max(0.f, std::min(1.f, x)); };
+  return {clamp(base_.pan + (travel_pan_ + speed_pan_ * seconds) * rate_pan_),
+          clamp(base_.tilt + (travel_tilt_ + speed_tilt_ * seconds) * rate_tilt_), base_.zoom};
 }
-std::string SoapRelativeMoveAction::str() const {
-  std::stringstream ss;
-  ss << "SoapRelativeMoveAction[p = " << p_ << ", t = " << t_ << ", z = " << z_ << "]";
-  return ss.str();
+
+void SoapPTZState::read(const position &p, std::chrono::steady_clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mx_);
+  integrate(now);
+  // A speed sample is the distance moved over the commanded travel, unless the axis ran into one of
+  // its ends, or went the other way (inverted axis, wrapping pan).
+  const auto sample = [this](float moved, float travel, float at, float &rate, int &samples) {
+    if (!calibratable_ || std::abs(travel) < min_travel || moved * travel <= 0.f || at <= 0.f ||
+        at >= 1.f)
+      return;
+    const float speed = moved / travel;
+    rate = samples++ ? rate + speed_gain * (speed - rate) : speed;
+  };
+  if (known_) {
+    sample(p.pan - base_.pan, travel_pan_, p.pan, rate_pan_, samples_pan_);
+    sample(p.tilt - base_.tilt, travel_tilt_, p.tilt, rate_tilt_, samples_tilt_);
+  }
+  base_ = p;
+  known_ = true;
+  read_ = now;
+  travel_pan_ = travel_tilt_ = 0.f;
+  calibratable_ = true;
 }
 
-SoapAbsoluteMove::SoapAbsoluteMove(SoapThread &soap_thread, SoapActionRunner &runner)
-    : SoapAction(soap_thread, runner), use_p_(false), use_t_(false), use_z_(false) {}
-SoapAbsoluteMove::SoapAbsoluteMove(SoapThread &soap_thread, SoapActionRunner &runner, float p,
-                                   float t, float z)
-    : SoapAction(soap_thread, runner),
-      p_(p),
-      use_p_(true),
-      t_(t),
-      use_t_(true),
-      z_(z),
-      use_z_(true) {}
-bool SoapAbsoluteMove::process() {
-  float p, t, z;
-  if (!use_p_ || !use_t_ || !use_z_) soap_thread().get_position(p, t, z);
-  if (use_p_) p = translate_interval(p_, 0., pan_min(), 1., pan_max());
-  if (use_t_) t = translate_interval(t_, 0., tilt_min(), 1., tilt_max());
-  if (use_z_) z = translate_interval(z_, 0., zoom_min(), 1., zoom_max());
-
-  return soap_thread().move_to(p, t, z);
+void SoapPTZState::move(float pan_speed, float tilt_speed,
+                        std::chrono::steady_clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mx_);
+  integrate(now);
+  speed_pan_ = pan_speed;
+  speed_tilt_ = tilt_speed;
 }
-std::string SoapAbsoluteMove::str() const { return "SoapAbsoluteMove"; }
 
-SoapGetStatus::SoapGetStatus(SoapThread &soap_thread, SoapActionRunner &runner)
-    : SoapAction(soap_thread, runner) {}
-SoapGetStatus::~SoapGetStatus() {}
-std::string SoapGetStatus::str() const {
-  return "SoapGetStatus[pan = " + std::to_string(p_) + ", t = " + std::to_string(t_) +
-         ", z = " + std::to_string(z_) + "]";
+void SoapPTZState::stop(std::chrono::steady_clock::time_point now) { move(0.f, 0.f, now); }
+
+void SoapPTZState::moved_to(std::optional<float> pan, std::optional<float> tilt,
+                            std::optional<float> zoom, std::chrono::steady_clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mx_);
+  integrate(now);
+  if (pan || tilt) {
+    // What was dead-reckoned so far is where the move started from, the commanded axes end up at
+    // their target.
+    const position at = predict(now);
+    base_.pan = pan ? *pan : at.pan;
+    base_.tilt = tilt ? *tilt : at.tilt;
+    travel_pan_ = travel_tilt_ = 0.f;
+    calibratable_ = false;
+  }
+  if (zoom) base_.zoom = *zoom;
+}
+
+void SoapPTZState::moved_by(float pan, float tilt, float zoom,
+                            std::chrono::steady_clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mx_);
+  integrate(now);
+  const auto clamp = [](float x) { return std::max(0.f, std::min(1.f, x)); };
+  if (pan != 0.f || tilt != 0.f) {
+    const position at = predict(now);
+    base_.pan = clamp(at.pan + pan);
+    base_.tilt = clamp(at.tilt + tilt);
+    travel_pan_ = travel_tilt_ = 0.f;
+    calibratable_ = false;
+  }
+  base_.zoom = clamp(base_.zoom + zoom);
+}
+
+void SoapPTZState::forget() {
+  std::lock_guard<std::mutex> lock(mx_);
+  known_ = false;
+  speed_pan_ = speed_tilt_ = 0.f;
+  travel_pan_ = travel_tilt_ = 0.f;
+  calibratable_ = false;
 }
-bool SoapGetStatus::process() {
-  clog.log("SoapGetStatus::process");
-  float p, t, z;
-  soap_thread().get_position(p, t, z);
-  p_ = translate_interval(p, pan_min(), 0, pan_max(), 1);
-  t_ = translate_interval(t, tilt_min(), 0, tilt_max(), 1);
-  z_ = translate_interval(z, zoom_min(), 0, zoom_max(), 1);
-  runner_.soap_get_status_is_done(this);
+
+bool SoapPTZState::exact(std::chrono::steady_clock::time_point now, position &p) const {
+  std::lock_guard<std::mutex> lock(mx_);
+  if (!known_ || now - read_ >= reconcile_interval || speed_pan_ != 0.f || speed_tilt_ != 0.f ||
+      travel_pan_ != 0.f || travel_tilt_ != 0.f)
+    return false;
+  p = base_;
+  ++saved_;
   return true;
 }
 
-SoapIRModeAction::SoapIRModeAction(SoapThread &soap_thread, SoapActionRunner &runner,
-                                   const IRMode &state)
-    : SoapAction(soap_thread, runner), state_(state) {}
-SoapIRModeAction::~SoapIRModeAction() {}
-std::string SoapIRModeAction::str() const { return "SoapIRModeAction"; }
-bool SoapIRModeAction::process() {
-  clog.log("SoapIRModeAction::process");
-  soap_thread().night_mode(state_);
-  runner_.soap_night_mode_is_done(this);
+bool SoapPTZState::estimate(std::chrono::steady_clock::time_point now, position &p) const {
+  std::lock_guard<std::mutex> lock(mx_);
+  const bool pan_moved = travel_pan_ != 0.f || speed_pan_ != 0.f;
+  const bool tilt_moved = travel_tilt_ != 0.f || speed_tilt_ != 0.f;
+  if (!known_ || now - read_ >= reconcile_interval ||
+      (pan_moved && samples_pan_ < calibration_samples) ||
+      (tilt_moved && samples_tilt_ < calibration_samples))
+    return false;
+  p = predict(now);
+  ++saved_;
   return true;
 }
+
 /******************************************************************************\
  *
- *	SoapActionRunner
+ *	SoapCredentials
  *
  \******************************************************************************/
-SoapActionRunner::~SoapActionRunner() {}
 
-SoapActionRunnerAdapter::~SoapActionRunnerAdapter() {}
+SoapCredentials::SoapCredentials() : first_(0), size_(0), stop_(true), hits_(0), misses_(0) {}
 
-void SoapActionRunnerAdapter::start_continuous_move_is_done(SoapStartContinuousMoveAction *action) {
-  throw not_implemented_exception{"start_continuous_move_is_done not implemented"};
+SoapCredentials::~SoapCredentials() { stop(); }
+
+void SoapCredentials::start(const std::string &username, const std::string &password) {
+  stop();
+  username_ = username;
+  password_ = password;
+  first_ = size_ = 0;
+  stop_ = false;
+  thread_ = std::thread(&SoapCredentials::refill, this);
 }
-void SoapActionRunnerAdapter::stop_continuous_move_is_done(SoapStopContinuousMoveAction *action) {
-  throw not_implemented_exception{"stop_continuous_move_is_done not implemented"};
+
+void SoapCredentials::stop() {
+  {
+    std::unique_lock<std::mutex> lock(mx_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) thread_.join();
 }
-void SoapActionRunnerAdapter::soap_absolute_move_is_done(SoapAbsoluteMove *action) {
-  throw not_implemented_exception{"soap_absolute_move_is_done not implemented"};
+
+// What soap_wsse_add_Timestamp and soap_wsse_add_UsernameTokenDigest compute:
+// digest = base64(SHA1(nonce + created + password)).
+void SoapCredentials::compute(struct soap *soap, SoapToken &t) const {
+  char nonce[20];
+  char digest[SOAP_SMD_SHA1_SIZE];
+  const time_t now = std::time(nullptr);
+  t.computed = std::chrono::steady_clock::now();
+  std::strcpy(t.created, ::soap_dateTime2s(soap, now));
+  std::strcpy(t.expires, ::soap_dateTime2s(soap, now + lifetime.count()));
+  ::soap_wsse_rand_nonce(nonce, sizeof nonce);
+  ::soap_s2base64(soap, reinterpret_cast<unsigned char *>(nonce), t.nonce, sizeof nonce);
+  struct soap_smd_data context;
+  ::soap_smd_init(soap, &context, SOAP_SMD_DGST_SHA1, nullptr, 0);
+  ::soap_smd_update(soap, &context, nonce, sizeof nonce);
+  ::soap_smd_update(soap, &context, t.created, std::strlen(t.created));
+  ::soap_smd_update(soap, &context, password_.c_str(), password_.size());
+  ::soap_smd_final(soap, &context, digest, nullptr);
+  ::soap_s2base64(soap, reinterpret_cast<unsigned char *>(digest), t.digest, sizeof digest);
 }
-void SoapActionRunnerAdapter::soap_get_status_is_done(SoapGetStatus *action) {
-  throw not_implemented_exception{"soap_get_status_is_done not implemented"};
+
+// Tokens are computed in order: the oldest is first.
+void SoapCredentials::expire(std::chrono::steady_clock::time_point now) {
+  while (size_ && now - tokens_[first_].computed > max_age) {
+    first_ = (first_ + 1) % capacity;
+    --size_;
+  }
 }
-void SoapActionRunnerAdapter::soap_relative_move_is_done(SoapRelativeMoveAction *action) {
-  throw not_implemented_exception{"soap_relative_move_is_done not implemented"};
+
+void SoapCredentials::refill() {
+  struct soap *soap = ::soap_new();
+  std::unique_lock<std::mutex> lock(mx_);
+  while (!stop_) {
+    expire(std::chrono::steady_clock::now());
+    if (size_ < capacity) {
+      lock.unlock();
+      SoapToken t;
+      compute(soap, t);
+      lock.lock();
+      tokens_[(first_ + size_) % capacity] = t;
+      ++size_;
+      continue;
+    }
+    // Full: sleep until a token is taken or the oldest one gets too old.
+    cv_.wait_until(lock, tokens_[first_].computed + max_age,
+                   [this]() { return stop_ || size_ < capacity; });
+  }
+  lock.unlock();
+  ::soap_end(soap);
+  ::soap_free(soap);
 }
-void SoapActionRunnerAdapter::soap_night_mode_is_done(SoapIRModeAction *action) {
-  throw not_implemented_exception{"soap_night_mode_is_done not implemented"};
+
+SoapToken SoapCredentials::take(struct soap *soap) {
+  SoapToken t;
+  {
+    std::unique_lock<std::mutex> lock(mx_);
+    expire(std::chrono::steady_clock::now());
+    if (!size_) {
+      lock.unlock();
+      ++misses_;
+      clog.log("SoapCredentials: no token ready, computing one");
+      compute(soap, t);
+      return t;
+    }
+    t = tokens_[first_];
+    first_ = (first_ + 1) % capacity;
+    --size_;
+  }
+  cv_.notify_one();
+  ++hits_;
+  return t;
 }
 
-void SoapActionRunnerNothing::start_continuous_move_is_done(SoapStartContinuousMoveAction *action) {
+// The header soap_wsse_add_Timestamp and soap_wsse_add_UsernameTokenDigest would add.
+int SoapCredentials::put(struct soap *soap, const SoapToken &t) const {
+  ::_wsse__Security *security = ::soap_wsse_add_Security(soap);
+  ::_wsu__Timestamp *timestamp = ::soap_new__wsu__Timestamp(soap);
+  if (!timestamp) return soap->error = SOAP_EOM;
+  timestamp->wsu__Id = const_cast<char *>("Time");
+  timestamp->Created = ::soap_strdup(soap, t.created);
+  timestamp->Expires = ::soap_strdup(soap, t.expires);
+  security->wsu__Timestamp = timestamp;
+  if (::soap_wsse_add_UsernameTokenText(soap, "Auth", username_.c_str(), t.digest))
+    return soap->error;
+  ::_wsse__UsernameToken *username_token = security->UsernameToken;
+  username_token->Password->Type = const_cast<char *>(::wsse_PasswordDigestURI);
+  username_token->Nonce = ::soap_new_wsse__EncodedString(soap);
+  if (!username_token->Nonce) return soap->error = SOAP_EOM;
+  username_token->Nonce->__item = ::soap_strdup(soap, t.nonce);
+  username_token->Nonce->EncodingType = const_cast<char *>(::wsse_Base64BinaryURI);
+  username_token->wsu__Created = ::soap_strdup(soap, t.created);
+  return SOAP_OK;
+}
+
+std::size_t SoapCredentials::ready() {
+  std::unique_lock<std::mutex> lock(mx_);
+  expire(std::chrono::steady_clock::now());
+  return size_;
+}
+
+/******************************************************************************\
+ *
+ *	SoapConnection
+ *
+ \******************************************************************************/
+
+SoapConnection::SoapConnection(const char *name, SoapCredentials &credentials)
+    : soap_(soap_new1(SOAP_XML_CANONICAL | SOAP_IO_KEEPALIVE)),
+      name_(name),
+      credentials_(credentials),
+      keep_alive_(true),
+      keeping_alive_(true),
+      reused_(false),
+      header_(true),
+      requests_(0),
+      connects_(0),
+      reconnects_(0),
+      timeouts_(0),
+      retried_(false),
+      held_(false) {
+  ::soap_register_plugin(soap_, ::soap_wsse);
+  soap_->user = this;
+  connect_ = soap_->fopen;
+  soap_->fopen = counting_connect;
+}
+
+SoapConnection::~SoapConnection() { release(); }
+
+SOAP_SOCKET SoapConnection::counting_connect(struct soap *soap, const char *endpoint,
+                                             const char *host, int port) {
+  const auto connection = static_cast<SoapConnection *>(soap->user);
+  ++connection->connects_;
+  clog.log("SoapConnection: ", connection->name_, ": connecting to ", endpoint);
+  return connection->connect_(soap, endpoint, host, port);
+}
+
+void SoapConnection::prepare() {
+  if (keep_alive_ != keeping_alive_) {
+    keeping_alive_ = keep_alive_;
+    close();
+    if (keeping_alive_)
+      soap_set_mode(soap_, SOAP_IO_KEEPALIVE);
+    else
+      soap_clr_mode(soap_, SOAP_IO_KEEPALIVE);
+  }
+  if (soap_valid_socket(soap_->socket) &&
+      std::chrono::steady_clock::now() - last_used_ > idle_timeout) {
+    clog.log("SoapConnection: ", name_, ": idle for too long, closing");
+    close();
+  }
+}
+
+void SoapConnection::begin(bool header) {
+  prepare();
+  reused_ = soap_valid_socket(soap_->socket);
+  header_ = header;
+  retried_ = false;
+  held_ = false;
+  started_ = std::chrono::steady_clock::now();
+  ++requests_;
+  // Negative gSOAP timeouts are in microseconds.
+  soap_->connect_timeout = soap_->send_timeout = soap_->recv_timeout =
+      -static_cast<int>(timeout().count());
+  if (header_) set_credentials();
+}
+
+bool SoapConnection::retry(int error) {
+  if (!reused_ || (error != SOAP_EOF && error != SOAP_TCP_ERROR)) return false;
+  clog.log("SoapConnection: ", name_, ": closed by the server, sending again");
+  reused_ = false;
+  retried_ = true;
+  ++reconnects_;
+  close();
+  if (header_) set_credentials();
+  return true;
+}
+
+void SoapConnection::end(int error) {
+  last_used_ = std::chrono::steady_clock::now();
+  if (!error && !retried_ && !held_)
+    rtt_.sample(std::chrono::duration_cast<std::chrono::microseconds>(last_used_ - started_));
+}
+
+void SoapConnection::hold(std::chrono::microseconds wait) {
+  held_ = true;
+  soap_->recv_timeout = -static_cast<int>((timeout() + wait).count());
+}
+
+void SoapConnection::timed_out() {
+  clog.log("SoapConnection: ", name_, ": timed out, rto = ",
+           std::chrono::duration_cast<std::chrono::milliseconds>(timeout()).count(), " ms");
+  close();
+  ++timeouts_;
+  rtt_.timed_out();
+  last_used_ = std::chrono::steady_clock::now();
+}
+
+// As send_X does, with the length of `envelope` as the result of the counting pass.
+int SoapConnection::send(const char *endpoint, const char *action, const std::string &envelope) {
+  ::soap_begin(soap_);
+  soap_set_version(soap_, 2); /* use SOAP1.2 */
+  soap_->encodingStyle = nullptr;
+  if (::soap_begin_count(soap_)) return soap_->error;
+  soap_->count = envelope.size();
+  if (::soap_end_count(soap_) || ::soap_connect(soap_, endpoint, action) ||
+      ::soap_send_raw(soap_, envelope.data(), envelope.size()) || ::soap_end_send(soap_))
+    return ::soap_closesock(soap_);
+  return SOAP_OK;
+}
+
+bool SoapConnection::set_credentials() {
+  ::soap_wsse_delete_Security(soap_);
+  return credentials_.add(soap_) == SOAP_OK;
+}
+
+void SoapConnection::close() {
+  if (soap_valid_socket(soap_->socket)) ::soap_force_closesock(soap_);
+}
+
+void SoapConnection::release() {
+  if (!soap_) return;
+  ::soap_destroy(soap_);
+  ::soap_end(soap_);
+  ::soap_free(soap_);
+  soap_ = nullptr;
+}
+
+/******************************************************************************\
+ *
+ *	SoapRttEstimator
+ *
+ \******************************************************************************/
+
+SoapRttEstimator::SoapRttEstimator()
+    : srtt_(max_rto), rttvar_(0), rto_(std::chrono::microseconds(max_rto).count()) {}
+
+void SoapRttEstimator::seed(std::chrono::microseconds rtt) {
+  srtt_ = rtt;
+  rttvar_ = rtt / 2;
+  update();
+}
+
+// alpha = 1/8, beta = 1/4
+void SoapRttEstimator::sample(std::chrono::microseconds rtt) {
+  rttvar_ = (3 * rttvar_ + (srtt_ > rtt ? srtt_ - rtt : rtt - srtt_)) / 4;
+  srtt_ = (7 * srtt_ + rtt) / 8;
+  update();
+}
+
+void SoapRttEstimator::timed_out() {
+  rto_ = std::min<long long>(2 * rto_.load(std::memory_order_relaxed),
+                             std::chrono::microseconds(max_rto).count());
+}
+
+void SoapRttEstimator::update() {
+  using std::chrono::microseconds;
+  const microseconds rto = srtt_ + 4 * rttvar_;
+  rto_ = std::max<microseconds>(min_rto, std::min<microseconds>(rto, max_rto)).count();
+}
+
+/******************************************************************************\
+ *
+ *	SoapTokenBucket
+ *
+ \******************************************************************************/
+
+SoapTokenBucket::SoapTokenBucket(double rate, double burst)
+    : rate_(rate), burst_(burst), tokens_(burst), refilled_(std::chrono::steady_clock::now()) {}
+
+void SoapTokenBucket::refill(std::chrono::steady_clock::time_point now) {
+  if (now <= refilled_) return;
+  tokens_ = std::min(burst_,
+                     tokens_ + rate_ * std::chrono::duration<double>(now - refilled_).count());
+  refilled_ = now;
+}
+
+bool SoapTokenBucket::take(std::chrono::steady_clock::time_point now) {
+  if (rate_ <= 0.) return true;
+  refill(now);
+  if (tokens_ < 1.) return false;
+  tokens_ -= 1.;
+  return true;
+}
+
+std::chrono::steady_clock::time_point SoapTokenBucket::available(
+    std::chrono::steady_clock::time_point now) const {
+  if (rate_ <= 0.) return now;
+  const double tokens =
+      std::min(burst_, tokens_ + rate_ * std::chrono::duration<double>(now - refilled_).count());
+  if (tokens >= 1.) return now;
+  return now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                   std::chrono::duration<double>((1. - tokens) / rate_));
+}
+
+/******************************************************************************\
+ *
+ *	SoapLane
+ *
+ \******************************************************************************/
+
+SoapLane::SoapLane(const char *name, SoapCredentials &credentials)
+    : connection(name, credentials),
+      ptz(connection.soap()),
+      imaging(connection.soap()),
+      busy(false),
+      step(0),
+      operation(metrics::operation::PTZ_GET_STATUS),
+      p(0.f),
+      t(0.f),
+      imaging_settings(nullptr) {}
+
+/******************************************************************************\
+ *
+ *	SoapActionQueue
+ *
+ \******************************************************************************/
+
+void SoapActionQueue::push(SoapAction &&action) {
+  assert(!full() || !(std::cerr << "SoapActionQueue::push: queue full"));
+  ++pushed_;
+  if (!empty()) {
+    if (std::visit([&action](auto &back) { return back.absorb(action); }, back())) {
+      clog.log("SoapActionQueue::push: ", action, " merged into ", back());
+      const auto updated = std::visit([](const auto &a) { return a.updated(); }, action);
+      std::visit([updated](auto &back) { back.set_updated(updated); }, back());
+      ++coalesced_;
+      return;
+    }
+    if (std::visit([this](const auto &next) { return next.supersedes(back()); }, action)) {
+      clog.log("SoapActionQueue::push: ", action, " supersedes ", back());
+      // Never sent, the superseded action is still completed for whoever waits for it.
+      complete(back(), SoapOutcome::SUPERSEDED);
+      ++coalesced_;
+      ++superseded_;
+      --size_;
+    }
+  }
+  actions_[(head_ + size_) % capacity] = std::move(action);
+  ++size_;
+}
+
+SoapAction SoapActionQueue::take(size_t i) {
+  SoapAction action = std::move((*this)[i]);
+  for (; i + 1 < size_; ++i) (*this)[i] = std::move((*this)[i + 1]);
+  --size_;
+  return action;
+}
+
+/******************************************************************************\
+ *
+ *	SoapAction
+ *
+ \******************************************************************************/
+std::ostream &operator<<(std::ostream &out, const SoapAction &action) {
+  return std::visit([&out](const auto &a) -> std::ostream & { return out << a.str(); }, action);
+}
+
+unsigned axes(const SoapAction &action) {
+  return std::visit([](const auto &a) { return a.axes(); }, action);
+}
+
+std::chrono::steady_clock::time_point deadline(const SoapAction &action) {
+  return std::visit([](const auto &a) { return a.deadline(); }, action);
+}
+
+bool preserialized(const SoapAction &action) {
+  return std::visit([](const auto &a) { return std::decay_t<decltype(a)>::preserialized; }, action);
+}
+
+const char *name(SoapTraffic traffic) {
+  static constexpr const char *names[] = {"control", "query", "configuration"};
+  return names[static_cast<size_t>(traffic)];
+}
+
+const char *name(SoapOutcome outcome) {
+  static constexpr const char *names[] = {"pending", "ok", "failed", "expired", "superseded",
+                                          "abandoned"};
+  return names[static_cast<size_t>(outcome)];
+}
+
+SoapTraffic traffic(const SoapAction &action) {
+  return std::visit([](const auto &a) { return std::decay_t<decltype(a)>::traffic; }, action);
+}
+
+SoapStopContinuousMoveAction::SoapStopContinuousMoveAction(
+    SoapCallback<SoapStopContinuousMoveAction> done)
+    : done_(done) {}
+std::string SoapStopContinuousMoveAction::str() const { return "SoapStopContinuousMoveAction"; }
+// A continuous move that has not been sent yet would be stopped right away: skip it.
+bool SoapStopContinuousMoveAction::supersedes(const SoapAction &pending) const {
+  return std::holds_alternative<SoapStartContinuousMoveAction>(pending);
+}
+
+SoapStartContinuousMoveAction::SoapStartContinuousMoveAction(
+    float p, float t, SoapCallback<SoapStartContinuousMoveAction> done)
+    : p_(p), t_(t), done_(done) {}
+std::string SoapStartContinuousMoveAction::str() const {
+  std::stringstream ss;
+  ss << "SoapStartContinuousMoveAction[" << p_ << ", " << t_ << "]";
+  return ss.str();
+}
+// Only the latest speed matters. As for the other moves, both actions must share the callback.
+bool SoapStartContinuousMoveAction::absorb(const SoapAction &next) {
+  const auto move = std::get_if<SoapStartContinuousMoveAction>(&next);
+  if (!move || move->done_ != done_) return false;
+  p_ = move->p_;
+  t_ = move->t_;
+  deadline_ = move->deadline_;
+  return true;
+}
+
+SoapRelativeMoveAction::SoapRelativeMoveAction(float p, float t, float z,
+                                               SoapCallback<SoapRelativeMoveAction> done)
+    : p_(p), t_(t), z_(z), done_(done) {}
+std::string SoapRelativeMoveAction::str() const {
+  std::stringstream ss;
+  ss << "SoapRelativeMoveAction[p = " << p_ << ", t = " << t_ << ", z = " << z_ << "]";
+  return ss.str();
+}
+// Deltas add up. The callback is called once for the merged move, so both actions must share it.
+bool SoapRelativeMoveAction::absorb(const SoapAction &next) {
+  const auto move = std::get_if<SoapRelativeMoveAction>(&next);
+  if (!move || move->done_ != done_) return false;
+  p_ = std::max(-1.f, std::min(1.f, p_ + move->p_));
+  t_ = std::max(-1.f, std::min(1.f, t_ + move->t_));
+  z_ = std::max(-1.f, std::min(1.f, z_ + move->z_));
+  return true;
+}
+
+SoapAbsoluteMove::SoapAbsoluteMove(SoapCallback<SoapAbsoluteMove> done)
+    : p_(0.f), use_p_(false), t_(0.f), use_t_(false), z_(0.f), use_z_(false), done_(done) {}
+SoapAbsoluteMove::SoapAbsoluteMove(float p, float t, float z, SoapCallback<SoapAbsoluteMove> done)
+    : p_(p), use_p_(true), t_(t), use_t_(true), z_(z), use_z_(true), done_(done) {}
+std::string SoapAbsoluteMove::str() const { return "SoapAbsoluteMove"; }
+// Axes set by the later move override ours, the others are kept.
+bool SoapAbsoluteMove::absorb(const SoapAction &next) {
+  const auto move = std::get_if<SoapAbsoluteMove>(&next);
+  if (!move || move->done_ != done_) return false;
+  if (move->use_p_) setPan(move->p_);
+  if (move->use_t_) setTilt(move->t_);
+  if (move->use_z_) setZoom(move->z_);
+  return true;
+}
+
+SoapGetStatus::SoapGetStatus(SoapCallback<SoapGetStatus> done)
+    : p_(0.f), t_(0.f), z_(0.f), done_(done) {}
+std::string SoapGetStatus::str() const {
+  return "SoapGetStatus[pan = " + std::to_string(p_) + ", t = " + std::to_string(t_) +
+         ", z = " + std::to_string(z_) + "]";
+}
+// A single status read answers every pending request of the same callback.
+bool SoapGetStatus::absorb(const SoapAction &next) {
+  const auto status = std::get_if<SoapGetStatus>(&next);
+  return status && status->done_ == done_;
+}
+
+SoapIRModeAction::SoapIRModeAction(const IRMode &state, SoapCallback<SoapIRModeAction> done)
+    : state_(state), done_(done) {}
+std::string SoapIRModeAction::str() const { return "SoapIRModeAction"; }
+bool SoapIRModeAction::absorb(const SoapAction &next) {
+  const auto mode = std::get_if<SoapIRModeAction>(&next);
+  if (!mode || mode->done_ != done_) return false;
+  state_ = mode->state_;
+  return true;
 }
-void SoapActionRunnerNothing::stop_continuous_move_is_done(SoapStopContinuousMoveAction *action) {}
-void SoapActionRunnerNothing::soap_absolute_move_is_done(SoapAbsoluteMove *action) {}
-void SoapActionRunnerNothing::soap_get_status_is_done(SoapGetStatus *action) {}
-void SoapActionRunnerNothing::soap_relative_move_is_done(SoapRelativeMoveAction *action) {}
-void SoapActionRunnerNothing::soap_night_mode_is_done(SoapIRModeAction *action) {}
 
 /******************************************************************************\
  *
@@ -613,7 +1594,9 @@ soap_wsdd_mode wsdd_event_Probe(struct soap *soap, const char *MessageID, const
 
 void wsdd_event_ProbeMatches(struct soap *soap, unsigned int InstanceId, const char *SequenceId,
                              unsigned int MessageNumber, const char *MessageID,
-                             const char *RelatesTo, struct wsdd__ProbeMatchesType *ProbeMatches) {}
+                             const char *RelatesTo, struct wsdd__ProbeMatchesType *ProbeMatches) {
+  app::soap::SoapDiscovery::matched(soap, RelatesTo, ProbeMatches);
+}
 
 soap_wsdd_mode wsdd_event_Resolve(struct soap *soap, const char *MessageID, const char *ReplyTo,
                                   const char *EndpointReference,
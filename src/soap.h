@@ -2,13 +2,23 @@
 #define DEF_SOAP_H
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <ctime>
+#include <future>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <thread>
 
 #include <string>
 
-#include <queue>
+#include <array>
+#include <variant>
+
+#include "metrics.h"
+#include "mpsc_ring.h"
+#include "soap_envelope.h"
 
 #include "soap/soapDeviceBindingProxy.h"
 #include "soap/soapH.h"
@@ -23,9 +33,6 @@ namespace soap {
 int CRYPTO_thread_setup();
 void CRYPTO_thread_cleanup();
 
-class SoapAction;
-class SoapActionRunner;
-
 enum class IRMode {
   ON,
   OFF,
@@ -33,164 +40,223 @@ enum class IRMode {
 };
 std::ostream& operator<<(std::ostream& out, const IRMode& state);
 
-class SoapThread {
-  std::mutex mutex_;
-  std::condition_variable condition_to_consume_;
-  std::condition_variable condition_to_queue_;
-  std::queue<SoapAction*> queue_;
-  std::queue<SoapAction*> processed_queue_;
-  bool waiting_for_data_;
-  std::atomic<bool> connected_;
-  std::atomic<bool> error_;
-  std::atomic<bool> exit_;
-  std::thread thread_;
-
-  std::string onvif_username;
-  std::string onvif_password;
-  // uint16_t soap_port;
-  std::string soap_endpoint;
-  struct soap* soap;
-  DeviceBindingProxy proxy_device_;
-  MediaBindingProxy proxy_media_;
-  PTZBindingProxy proxy_ptz_;
-  ImagingBindingProxy proxy_imaging_;
-  ::tt__Profile* soap_profile_;
-  ::tt__PTZConfiguration* soap_ptz_configuration_;
-  tt__ReferenceToken profile_token_;
-  tt__ReferenceToken video_source_token_;
-  tt__ReferenceToken audio_source_token_;
-  tt__ReferenceToken audio_main_output_token_;
-
-  // int main_audio_output_level_min_;
-  // int main_audio_output_level_max_;
-
-  bool init();
-  bool set_credentials();
-  void soap_release();
-
-  const float& pan_max() const { return soap_ptz_configuration_->PanTiltLimits->Range->XRange->Max; }
-  const float& pan_min() const { return soap_ptz_configuration_->PanTiltLimits->Range->XRange->Min; }
-
-  const float& tilt_max() const { return soap_ptz_configuration_->PanTiltLimits->Range->YRange->Max; }
-  const float& tilt_min() const { return soap_ptz_configuration_->PanTiltLimits->Range->YRange->Min; }
-
-  const float& zoom_max() const { return soap_ptz_configuration_->ZoomLimits->Range->XRange->Max; }
-  const float& zoom_min() const { return soap_ptz_configuration_->ZoomLimits->Range->XRange->Min; }
-
-  friend class SoapAction;
+// Completion callback of an action: a plain function and its context, stored inline in the action
+// so that queueing one never allocates. Two callbacks compare equal when they notify the same
+// object, which is what coalescing checks.
+template <typename Action>
+class SoapCallback {
+  void (*function_)(void*, const Action&);
+  void* context_;
 
  public:
-  SoapThread();
-
-  const std::mutex& mutex() const { return mutex_; }
-  std::mutex& mutex() { return mutex_; }
-
-  const std::queue<SoapAction*>& queue() const { return queue_; }
-  std::queue<SoapAction*>& queue() { return queue_; }
-
-  const std::atomic<bool>& connected() const { return connected_; }
+  constexpr SoapCallback() : function_(nullptr), context_(nullptr) {}
+  constexpr SoapCallback(void (*function)(void*, const Action&), void* context)
+      : function_(function), context_(context) {}
 
-  const std::atomic<bool>& error() const { return error_; }
-
-  const std::atomic<bool>& exit() const { return exit_; }
-  std::atomic<bool>& exit() { return exit_; }
-
-  const std::thread& thread() const { return thread_; }
-  std::thread& thread() { return thread_; }
-
-  void run();
-
-  void queue(SoapAction* action);
-
-  void must_exit();
+  explicit operator bool() const { return function_ != nullptr; }
+  bool operator==(const SoapCallback& other) const {
+    return function_ == other.function_ && context_ == other.context_;
+  }
+  bool operator!=(const SoapCallback& other) const { return !(*this == other); }
 
-  bool get_position(float& p, float& t, float& z);
+  void operator()(const Action& action) const {
+    if (function_) function_(context_, action);
+  }
+};
 
-  bool start_move(float p, float t);
+template <typename Method>
+struct soap_callback_traits;
 
-  bool stop_move();
+template <typename T, typename Action>
+struct soap_callback_traits<void (T::*)(const Action&)> {
+  using object = T;
+  using action = Action;
+};
 
-  bool move_to(float p, float t, float z);
+// Binds a member function to its object, e.g. callback<&BGWindow::soap_relative_move_is_done>(*this)
+template <auto Method>
+SoapCallback<typename soap_callback_traits<decltype(Method)>::action> callback(
+    typename soap_callback_traits<decltype(Method)>::object& target) {
+  using traits = soap_callback_traits<decltype(Method)>;
+  return {[](void* context, const typename traits::action& action) {
+            (static_cast<typename traits::object*>(context)->*Method)(action);
+          },
+          &target};
+}
+
+// Lets a thread wait until the SoapThread is done with an action, e.g. the command line. The
+// callback is called even when the action fails, expires or is superseded, the action as it
+// completed is kept: its outcome() tells which.
+template <typename Action>
+class SoapCompletion {
+  std::mutex mx_;
+  std::condition_variable cv_;
+  std::optional<Action> action_;
 
-  bool move_to_rel(float p, float t, float z);
+ public:
+  void done(const Action& action) {
+    std::unique_lock<std::mutex> lock(mx_);
+    action_ = action;
+    cv_.notify_all();
+  }
 
-  bool night_mode(const IRMode& state);
+  const Action& wait() {
+    std::unique_lock<std::mutex> lock(mx_);
+    cv_.wait(lock, [this]() { return action_.has_value(); });
+    return *action_;
+  }
 };
 
-extern SoapThread soap_thread;
-
-class SoapAction {
-  SoapThread& soap_thread_;
-
+class SoapStopContinuousMoveAction;
+class SoapStartContinuousMoveAction;
+class SoapRelativeMoveAction;
+class SoapAbsoluteMove;
+class SoapGetStatus;
+class SoapIRModeAction;
+
+// Actions are small values, queued inline and dispatched by SoapThread with std::visit.
+using SoapAction =
+    std::variant<SoapStopContinuousMoveAction, SoapStartContinuousMoveAction, SoapRelativeMoveAction,
+                 SoapAbsoluteMove, SoapGetStatus, SoapIRModeAction>;
+std::ostream& operator<<(std::ostream& out, const SoapAction& action);
+
+// What an action moves (or reads), as a bit set. Actions sharing an axis are sent to the device in
+// the order they were queued; the others may be in flight at the same time.
+enum SoapAxes : unsigned { NO_AXIS = 0, PAN_TILT = 1 << 0, ZOOM = 1 << 1, IMAGING = 1 << 2 };
+unsigned axes(const SoapAction& action);
+std::chrono::steady_clock::time_point deadline(const SoapAction& action);
+bool preserialized(const SoapAction& action);
+
+// The budgets of the requests sent to the device: moves, reads, and settings changes, so that the
+// status reads of the trackbars do not slow the control of the camera down, nor the other way.
+enum class SoapTraffic : size_t { CONTROL, QUERY, CONFIGURATION, COUNT };
+const char* name(SoapTraffic traffic);
+SoapTraffic traffic(const SoapAction& action);
+
+// How the SoapThread was done with an action, which its callback reads: answered by the device,
+// or why not. Only an OK action holds what the device answered.
+enum class SoapOutcome { PENDING, OK, FAILED, EXPIRED, SUPERSEDED, ABANDONED };
+const char* name(SoapOutcome outcome);
+
+// Coalescing rules used by SoapActionQueue. A pending action absorbs a later one by taking over its
+// parameters; a later action supersedes a pending one that it makes pointless. Actions override
+// (hide) these defaults when they have such a rule.
+//
+// A perishable action is worth nothing once late: SoapThread::queue() gives it a deadline, one
+// retransmission timeout of its lane away, and an action still pending past its deadline is dropped
+// instead of sent. The others never expire.
+//
+// A preserialized action is sent from a SoapEnvelopes template instead of a gSOAP object graph.
+//
+// An action is control traffic unless it says otherwise; it is throttled once it waited for a token
+// of its budget.
+//
+// SoapThread::queue() stamps an action with the time it was queued; an action absorbing later ones
+// keeps it, and is updated at the time of the latest one.
+//
+// Its outcome is set right before its callback is called, with the gSOAP error code of a FAILED one.
+class SoapActionBase {
  protected:
-  SoapActionRunner& runner_;
-  SoapAction(SoapThread& soap_thread, SoapActionRunner& runner_);
+  std::chrono::steady_clock::time_point deadline_ = std::chrono::steady_clock::time_point::max();
+  bool throttled_ = false;
+  std::chrono::steady_clock::time_point queued_;
+  std::chrono::steady_clock::time_point updated_;
+  SoapOutcome outcome_ = SoapOutcome::PENDING;
+  int error_ = 0;
 
  public:
-  virtual ~SoapAction() = 0;
-
-  const SoapThread& soap_thread() const { return soap_thread_; }
-  SoapThread& soap_thread() { return soap_thread_; }
-
-  const SoapActionRunner& soap_action_runner() const { return runner_; }
-  SoapActionRunner& soap_action_runner() { return runner_; }
-
-  const float& pan_max() const { return soap_thread_.pan_max(); }
-  const float& pan_min() const { return soap_thread_.pan_min(); }
-  const float& tilt_max() const { return soap_thread_.tilt_max(); }
-  const float& tilt_min() const { return soap_thread_.tilt_min(); }
-  const float& zoom_max() const { return soap_thread_.zoom_max(); }
-  const float& zoom_min() const { return soap_thread_.zoom_min(); }
-
-  virtual bool process() = 0;
-  virtual std::string str() const = 0;
-  friend std::ostream& operator<<(std::ostream& out, const SoapAction& action) { return (out << action.str()); }
+  static constexpr bool perishable = false;
+  static constexpr bool preserialized = false;
+  static constexpr SoapTraffic traffic = SoapTraffic::CONTROL;
+
+  bool absorb(const SoapAction& next) { return false; }
+  bool supersedes(const SoapAction& pending) const { return false; }
+
+  std::chrono::steady_clock::time_point deadline() const { return deadline_; }
+  void set_deadline(std::chrono::steady_clock::time_point deadline) { deadline_ = deadline; }
+  bool throttled() const { return throttled_; }
+  void set_throttled() { throttled_ = true; }
+
+  std::chrono::steady_clock::time_point queued() const { return queued_; }
+  std::chrono::steady_clock::time_point updated() const { return updated_; }
+  void set_queued(std::chrono::steady_clock::time_point t) { queued_ = updated_ = t; }
+  void set_updated(std::chrono::steady_clock::time_point t) { updated_ = t; }
+
+  SoapOutcome outcome() const { return outcome_; }
+  bool ok() const { return outcome_ == SoapOutcome::OK; }
+  int error() const { return error_; }
+  void set_outcome(SoapOutcome outcome, int error = 0) {
+    outcome_ = outcome;
+    error_ = error;
+  }
 };
 
-class SoapStopContinuousMoveAction : public SoapAction {
+class SoapStopContinuousMoveAction : public SoapActionBase {
+  SoapCallback<SoapStopContinuousMoveAction> done_;
+
  public:
-  SoapStopContinuousMoveAction(SoapThread& soap_thread, SoapActionRunner& runner);
-  virtual ~SoapStopContinuousMoveAction() = default;
-  virtual bool process();
-  virtual std::string str() const override;
+  SoapStopContinuousMoveAction(SoapCallback<SoapStopContinuousMoveAction> done = {});
+  const SoapCallback<SoapStopContinuousMoveAction>& done() const { return done_; }
+  static constexpr bool preserialized = true;
+
+  std::string str() const;
+  unsigned axes() const { return PAN_TILT | ZOOM; }
+  bool supersedes(const SoapAction& pending) const;
 };
 
-class SoapStartContinuousMoveAction : public SoapAction {
+class SoapStartContinuousMoveAction : public SoapActionBase {
   float p_;
   float t_;
+  SoapCallback<SoapStartContinuousMoveAction> done_;
 
  public:
-  SoapStartContinuousMoveAction(SoapThread& soap_thread, SoapActionRunner& runner, float p, float t);
-  virtual ~SoapStartContinuousMoveAction() = default;
-  virtual bool process();
-  virtual std::string str() const override;
+  SoapStartContinuousMoveAction(float p, float t,
+                                SoapCallback<SoapStartContinuousMoveAction> done = {});
+  const SoapCallback<SoapStartContinuousMoveAction>& done() const { return done_; }
+  float pan() const { return p_; }
+  float tilt() const { return t_; }
+  static constexpr bool perishable = true;
+  static constexpr bool preserialized = true;
+
+  std::string str() const;
+  unsigned axes() const { return PAN_TILT; }
+  bool absorb(const SoapAction& next);
 };
 
-class SoapRelativeMoveAction : public SoapAction {
+class SoapRelativeMoveAction : public SoapActionBase {
   float p_;
   float t_;
   float z_;
-  
+  SoapCallback<SoapRelativeMoveAction> done_;
+
  public:
-  SoapRelativeMoveAction(SoapThread& soap_thread, SoapActionRunner& runner, float t, float p, float z);
-  virtual ~SoapRelativeMoveAction() = default;
-  virtual bool process();
-  virtual std::string str() const override;
+  SoapRelativeMoveAction(float p, float t, float z, SoapCallback<SoapRelativeMoveAction> done = {});
+  const SoapCallback<SoapRelativeMoveAction>& done() const { return done_; }
+  float pan() const { return p_; }
+  float tilt() const { return t_; }
+  float zoom() const { return z_; }
+  static constexpr bool preserialized = true;
+
+  std::string str() const;
+  unsigned axes() const {
+    return (p_ != 0.f || t_ != 0.f || z_ == 0.f ? PAN_TILT : NO_AXIS) | (z_ != 0.f ? ZOOM : NO_AXIS);
+  }
+  bool absorb(const SoapAction& next);
 };
 
-class SoapAbsoluteMove : public SoapAction {
+class SoapAbsoluteMove : public SoapActionBase {
   float p_;
-
   bool use_p_;
   float t_;
   bool use_t_;
   float z_;
   bool use_z_;
+  SoapCallback<SoapAbsoluteMove> done_;
 
  public:
-  SoapAbsoluteMove(SoapThread& soap_thread, SoapActionRunner& runner);
-  SoapAbsoluteMove(SoapThread& soap_thread, SoapActionRunner& runner, float p, float t, float z);
-  virtual ~SoapAbsoluteMove() = default;
+  SoapAbsoluteMove(SoapCallback<SoapAbsoluteMove> done = {});
+  SoapAbsoluteMove(float p, float t, float z, SoapCallback<SoapAbsoluteMove> done = {});
+  const SoapCallback<SoapAbsoluteMove>& done() const { return done_; }
 
   bool has_pan() const { return use_p_; }
   float pan() const { return p_; }
@@ -218,76 +284,610 @@ class SoapAbsoluteMove : public SoapAction {
 
   void clear() { use_p_ = use_t_ = use_z_ = false; }
 
-  virtual std::string str() const override;
-  virtual bool process();
+  std::string str() const;
+  unsigned axes() const {
+    return (use_p_ || use_t_ || !use_z_ ? PAN_TILT : NO_AXIS) | (use_z_ ? ZOOM : NO_AXIS);
+  }
+  bool absorb(const SoapAction& next);
 };
 
-class SoapGetStatus : public SoapAction {
- private:
+class SoapGetStatus : public SoapActionBase {
   float p_;
   float t_;
   float z_;
+  SoapCallback<SoapGetStatus> done_;
+
+  friend class SoapThread;
 
  public:
-  SoapGetStatus(SoapThread& soap_thread, SoapActionRunner& runner);
-  ~SoapGetStatus();
+  SoapGetStatus(SoapCallback<SoapGetStatus> done = {});
+  const SoapCallback<SoapGetStatus>& done() const { return done_; }
   float pan() const { return p_; }
   float tilt() const { return t_; }
   float zoom() const { return z_; }
-  virtual std::string str() const override;
-  bool process() override;
+  static constexpr bool preserialized = true;
+  static constexpr SoapTraffic traffic = SoapTraffic::QUERY;
+
+  std::string str() const;
+  unsigned axes() const { return NO_AXIS; }
+  bool absorb(const SoapAction& next);
 };
 
-class SoapIRModeAction: public SoapAction {
-  private:
+class SoapIRModeAction : public SoapActionBase {
   IRMode state_;
-  public:
-  SoapIRModeAction(SoapThread& soap_thread, SoapActionRunner& runner, const IRMode& state);
-  ~SoapIRModeAction();
+  SoapCallback<SoapIRModeAction> done_;
+
+ public:
+  SoapIRModeAction(const IRMode& state, SoapCallback<SoapIRModeAction> done = {});
+  const SoapCallback<SoapIRModeAction>& done() const { return done_; }
   IRMode state() const { return state_; }
-  virtual std::string str() const override;
-  bool process() override;
+  static constexpr SoapTraffic traffic = SoapTraffic::CONFIGURATION;
+
+  std::string str() const;
+  unsigned axes() const { return IMAGING; }
+  bool absorb(const SoapAction& next);
 };
 
-class SoapActionRunner {
- protected:
-  SoapActionRunner() = default;
+// Actions waiting to be sent to the device. Every pushed action is merged, when its kind allows it,
+// into the one at the back of the queue, so a burst of UI events is sent as few requests as
+// possible while the relative order between different kinds of actions is preserved. The storage
+// is a fixed array: the producer must check full() before pushing.
+class SoapActionQueue {
+ public:
+  static constexpr size_t capacity = 64;
+
+ private:
+  std::array<SoapAction, capacity> actions_;
+  size_t head_ = 0;
+  size_t size_ = 0;
+  unsigned long long pushed_ = 0;
+  std::atomic<unsigned long long> coalesced_{0};   // read by any thread
+  std::atomic<unsigned long long> superseded_{0};  // read by any thread
+
+  SoapAction& back() { return actions_[(head_ + size_ - 1) % capacity]; }
 
  public:
-  virtual void start_continuous_move_is_done(SoapStartContinuousMoveAction* action) = 0;
-  virtual void stop_continuous_move_is_done(SoapStopContinuousMoveAction* action) = 0;
-  virtual void soap_absolute_move_is_done(SoapAbsoluteMove* action) = 0;
-  virtual void soap_get_status_is_done(SoapGetStatus* action) = 0;
-  virtual void soap_relative_move_is_done(SoapRelativeMoveAction* action) = 0;
-  virtual void soap_night_mode_is_done(SoapIRModeAction* action) = 0;
-  virtual ~SoapActionRunner() = 0;
+  SoapActionQueue() = default;
+  SoapActionQueue(const SoapActionQueue&) = delete;
+  SoapActionQueue& operator=(const SoapActionQueue&) = delete;
+
+  bool empty() const { return size_ == 0; }
+  bool full() const { return size_ == capacity; }
+  size_t size() const { return size_; }
+
+  unsigned long long pushed() const { return pushed_; }
+  unsigned long long coalesced() const { return coalesced_.load(std::memory_order_relaxed); }
+  unsigned long long superseded() const { return superseded_.load(std::memory_order_relaxed); }
+
+  void push(SoapAction&& action);
+  // Like std::queue: the front action is processed in place, then popped.
+  SoapAction& front() { return actions_[head_]; }
+  void pop() {
+    head_ = (head_ + 1) % capacity;
+    --size_;
+  }
+  // Actions that are not blocked may be taken from the middle, the others keep their order.
+  SoapAction& operator[](size_t i) { return actions_[(head_ + i) % capacity]; }
+  SoapAction take(size_t i);
+  void clear() { head_ = size_ = 0; }
 };
 
-class SoapActionRunnerAdapter : public SoapActionRunner {
+// Everything allocated in the managed heap of `soap` while the scope is alive (requests, responses,
+// WS-Security headers) is released when it ends, so that memory does not grow with every request.
+// Nothing read from a response may be kept by pointer past the scope: copy it out.
+class SoapRequestScope {
+  struct soap* soap_;
+
  public:
-  SoapActionRunnerAdapter() = default;
-  virtual ~SoapActionRunnerAdapter();
-  virtual void start_continuous_move_is_done(SoapStartContinuousMoveAction* action) override;
-  virtual void stop_continuous_move_is_done(SoapStopContinuousMoveAction* action) override;
-  virtual void soap_absolute_move_is_done(SoapAbsoluteMove* action) override;
-  virtual void soap_get_status_is_done(SoapGetStatus* action) override;
-  virtual void soap_relative_move_is_done(SoapRelativeMoveAction* action) override;
-  virtual void soap_night_mode_is_done(SoapIRModeAction* action) override;
+  explicit SoapRequestScope(struct soap* soap) : soap_(soap) {}
+  SoapRequestScope(const SoapRequestScope&) = delete;
+  SoapRequestScope& operator=(const SoapRequestScope&) = delete;
+  ~SoapRequestScope() {
+    ::soap_destroy(soap_);
+    ::soap_end(soap_);
+  }
 };
 
-class SoapActionRunnerNothing : public SoapActionRunner {
+// WS-Security credentials (Timestamp and UsernameToken digest) computed ahead of time by a
+// background thread: formatting the timestamps, drawing the nonce and hashing the password are off
+// the request path, which only copies a ready header. Each token is used once, since the camera
+// rejects a replayed nonce, and is thrown away once older than max_age so that its timestamp is
+// still well within the validity window when it reaches the camera.
+class SoapCredentials {
  public:
-  SoapActionRunnerNothing() = default;
-  ~SoapActionRunnerNothing() = default;
-  void start_continuous_move_is_done(SoapStartContinuousMoveAction* action) override final;
-  void stop_continuous_move_is_done(SoapStopContinuousMoveAction* action) override final;
-  void soap_absolute_move_is_done(SoapAbsoluteMove* action) override final;
-  void soap_get_status_is_done(SoapGetStatus* action) override final;
-  void soap_relative_move_is_done(SoapRelativeMoveAction* action) override final;
-  virtual void soap_night_mode_is_done(SoapIRModeAction* action) override;
+  static constexpr std::size_t capacity = 16;
+  static constexpr std::chrono::seconds lifetime{10};  // wsu:Timestamp/Expires - wsu:Created
+  static constexpr std::chrono::seconds max_age{5};
+
+ private:
+  std::string username_;
+  std::string password_;
+  std::array<SoapToken, capacity> tokens_;
+  std::size_t first_;
+  std::size_t size_;
+  std::mutex mx_;
+  std::condition_variable cv_;
+  bool stop_;
+  std::thread thread_;
+  std::atomic<unsigned long long> hits_;
+  std::atomic<unsigned long long> misses_;
+
+  void compute(struct soap* soap, SoapToken& t) const;
+  void expire(std::chrono::steady_clock::time_point now);
+  void refill();
+
+ public:
+  SoapCredentials();
+  SoapCredentials(const SoapCredentials&) = delete;
+  SoapCredentials& operator=(const SoapCredentials&) = delete;
+  ~SoapCredentials();
+
+  void start(const std::string& username, const std::string& password);
+  void stop();
+
+  // Adds the wsse:Security header to the next request of `soap`, computing it on the spot when no
+  // fresh token is ready. Returns a gSOAP error code.
+  int add(struct soap* soap) { return put(soap, take(soap)); }
+  // The next token, computed with `soap` when none is ready.
+  SoapToken take(struct soap* soap);
+  // Adds the wsse:Security header made of `token` to the next request of `soap`.
+  int put(struct soap* soap, const SoapToken& token) const;
+
+  std::size_t ready();
+  unsigned long long hits() const { return hits_; }
+  unsigned long long misses() const { return misses_; }
 };
 
-extern SoapActionRunnerNothing do_nothing_runner;
+// Round-trip time of a connection, smoothed as TCP does (RFC 6298): srtt and rttvar are moving
+// averages of the samples and of their deviation, and a request is given up after
+// rto = srtt + 4 * rttvar, kept within [min_rto, max_rto]. A timeout doubles rto until the next
+// sample. rto() may be read from any thread.
+class SoapRttEstimator {
+ public:
+  static constexpr std::chrono::milliseconds min_rto{1000};
+  static constexpr std::chrono::milliseconds max_rto{30000};  // the former fixed timeout
+
+ private:
+  std::chrono::microseconds srtt_;
+  std::chrono::microseconds rttvar_;
+  std::atomic<long long> rto_;  // in microseconds
+
+  void update();
+
+ public:
+  SoapRttEstimator();
+
+  // Starts over from `rtt` as the first sample.
+  void seed(std::chrono::microseconds rtt);
+  void sample(std::chrono::microseconds rtt);
+  void timed_out();
+
+  std::chrono::microseconds srtt() const { return srtt_; }
+  std::chrono::microseconds rto() const {
+    return std::chrono::microseconds(rto_.load(std::memory_order_relaxed));
+  }
+};
+
+// A request may be sent while a token is left: they come back at `rate` per second, up to
+// `burst`, so that a device is never sent more than `burst` requests at once, nor more than `rate`
+// per second over time. A rate of 0 is no limit. Owned by the SoapThread.
+class SoapTokenBucket {
+  double rate_;
+  double burst_;
+  double tokens_;
+  std::chrono::steady_clock::time_point refilled_;
+
+  void refill(std::chrono::steady_clock::time_point now);
+
+ public:
+  SoapTokenBucket(double rate = 0., double burst = 1.);
+
+  bool take(std::chrono::steady_clock::time_point now);
+  // When take() succeeds next.
+  std::chrono::steady_clock::time_point available(std::chrono::steady_clock::time_point now) const;
+};
+
+struct traffic_stats {
+  unsigned long long sent;
+  unsigned long long throttled;  // sent (or expired) later than they could have been
+};
+
+struct connection_stats {
+  unsigned long long requests;
+  unsigned long long connects;
+  unsigned long long reconnects;  // requests sent again after the server closed an idle socket
+  unsigned long long timeouts;    // requests not answered within the retransmission timeout
+};
+
+// A persistent (keep-alive) HTTP connection to one ONVIF service: each service gets its own gSOAP
+// context, so that requests to different XAddrs never close each other's socket. Used from the
+// SoapThread only, except for stats() and keep_alive().
+class SoapConnection {
+  struct soap* soap_;
+  const char* name_;
+  SoapCredentials& credentials_;
+  std::atomic<bool> keep_alive_;
+  bool keeping_alive_;
+  bool reused_;
+  bool header_;
+  std::chrono::steady_clock::time_point last_used_;
+  std::atomic<unsigned long long> requests_;
+  std::atomic<unsigned long long> connects_;
+  std::atomic<unsigned long long> reconnects_;
+  std::atomic<unsigned long long> timeouts_;
+  SOAP_SOCKET (*connect_)(struct soap*, const char*, const char*, int);
+  SoapRttEstimator rtt_;
+  bool retried_;
+  bool held_;
+  std::chrono::steady_clock::time_point started_;
+
+  static SOAP_SOCKET counting_connect(struct soap* soap, const char* endpoint, const char* host,
+                                      int port);
+  void prepare();
+  bool set_credentials();
+
+ public:
+  // Most cameras close a keep-alive connection after 15 s or more without requests: close it first.
+  static constexpr std::chrono::seconds idle_timeout{10};
+
+  SoapConnection(const char* name, SoapCredentials& credentials);
+  SoapConnection(const SoapConnection&) = delete;
+  SoapConnection& operator=(const SoapConnection&) = delete;
+  ~SoapConnection();
+
+  struct soap* soap() const { return soap_; }
+  const char* name() const { return name_; }
+
+  // Thread safe, applied before the next request.
+  void keep_alive(bool on) { keep_alive_ = on; }
+  connection_stats stats() const { return {requests_, connects_, reconnects_, timeouts_}; }
+  const SoapRttEstimator& rtt() const { return rtt_; }
+  SoapRttEstimator& rtt() { return rtt_; }
+  // How long the request in flight may wait for its response.
+  std::chrono::microseconds timeout() const { return rtt_.rto(); }
+
+  SOAP_SOCKET socket() const { return soap_->socket; }
+
+  void close();
+  void release();
+
+  // A request is begin(), its sending (twice when retry() says so), then end() once answered, or
+  // timed_out() when the answer is not there after timeout(). Credentials are added, unless
+  // `header` is false for a pre-serialized request that carries its own, and the socket timeouts
+  // set from the round-trip time, before each attempt. A request answered without error is a
+  // round-trip time sample, unless it was sent twice (Karn's rule).
+  void begin(bool header = true);
+  // True when `error` comes from a reused socket that the server had closed: the request must then
+  // be sent once more, on a fresh connection.
+  bool retry(int error);
+  void end(int error);
+  // For a request the server may hold up to `wait` before answering (long polling), called after
+  // begin(): the receive timeout is extended by `wait`, and the request is no round-trip time
+  // sample.
+  void hold(std::chrono::microseconds wait);
+  // Closes the connection, whose response would come too late to be read, and backs off.
+  void timed_out();
+
+  // Sends a pre-serialized envelope the way the proxies send theirs, the response is read with the
+  // proxy's recv_X. Returns a gSOAP error code.
+  int send(const char* endpoint, const char* action, const std::string& envelope);
+
+  // Sends one request and waits for the answer: `request` is the proxy call, returning the gSOAP
+  // error code. Its latency, retry included, is recorded under `operation`.
+  template <typename Request>
+  int call(metrics::operation operation, Request&& request) {
+    const auto start = std::chrono::steady_clock::now();
+    begin();
+    int error = request();
+    if (error && retry(error)) error = request();
+    end(error);
+    if (error)
+      metrics::record_error(operation);
+    else
+      metrics::record(operation, std::chrono::steady_clock::now() - start);
+    return error;
+  }
+};
+
+// A connection of its own, with at most one request in flight: the request is sent with the send_X
+// half of the generated proxy, and its response read with recv_X once the socket is readable.
+// SoapThread keeps one lane per axis, so that a zoom does not wait for the round trip of a pan.
+// Used from the SoapThread only.
+struct SoapLane {
+  SoapConnection connection;
+  PTZBindingProxy ptz;
+  ImagingBindingProxy imaging;
+
+  bool busy;
+  SoapAction action;
+  int step;  // index of the request in flight, for the actions made of several requests
+  metrics::operation operation;  // of the request in flight, set by its send
+  std::chrono::steady_clock::time_point sent;
+  std::string envelope;  // pre-serialized request, its capacity kept between requests
+
+  // Read by a request of the action, for the next one.
+  float p;
+  float t;
+  tt__ImagingSettings20* imaging_settings;
+
+  SoapLane(const char* name, SoapCredentials& credentials);
+  SoapLane(const SoapLane&) = delete;
+  SoapLane& operator=(const SoapLane&) = delete;
+};
+
+// PTZ ranges of the media profile, copied out of the gSOAP managed heap.
+struct PTZLimits {
+  float pan_min;
+  float pan_max;
+  float tilt_min;
+  float tilt_max;
+  float zoom_min;
+  float zoom_max;
+};
+
+// Where the PTZ is, each axis in [0, 1] as the trackbars show it, known without asking the device:
+// a command that succeeds moves it, a continuous move is dead-reckoned from its commanded speed,
+// and a GetStatus response sets it back to what the device says. The pan and tilt full speeds
+// (position per second) are calibrated from the status read after continuous moves: until then, and
+// once reconcile_interval passed since the last read, the position is read again. Thread safe.
+class SoapPTZState {
+ public:
+  // Another client may have moved the device meanwhile.
+  static constexpr std::chrono::seconds reconcile_interval{30};
+  // A continuous move shorter than this (in seconds at full speed) is no speed sample: the ramp up
+  // of the motors is most of it.
+  static constexpr float min_travel = 0.2f;
+  static constexpr int calibration_samples = 3;
+  static constexpr float speed_gain = 0.25f;  // weight of a new speed sample, as for srtt
+
+  struct position {
+    float pan;
+    float tilt;
+    float zoom;
+  };
+
+ private:
+  mutable std::mutex mx_;
+  position base_;  // read or commanded, before the travel since
+  bool known_;
+  std::chrono::steady_clock::time_point read_;
+  float speed_pan_;  // of the continuous move in progress, in [-1, 1]
+  float speed_tilt_;
+  std::chrono::steady_clock::time_point since_;
+  // Commanded travel (speed x seconds) since the last read, a speed sample unless a pan/tilt command
+  // moved base_ meanwhile.
+  float travel_pan_;
+  float travel_tilt_;
+  bool calibratable_;
+  float rate_pan_;
+  float rate_tilt_;
+  int samples_pan_;
+  int samples_tilt_;
+  mutable std::atomic<unsigned long long> saved_;
+
+  void integrate(std::chrono::steady_clock::time_point now);
+  position predict(std::chrono::steady_clock::time_point now) const;
+
+ public:
+  SoapPTZState();
+
+  // Results of the commands, from the SoapThread.
+  void read(const position& p, std::chrono::steady_clock::time_point now);
+  void move(float pan_speed, float tilt_speed, std::chrono::steady_clock::time_point now);
+  void stop(std::chrono::steady_clock::time_point now);
+  void moved_to(std::optional<float> pan, std::optional<float> tilt, std::optional<float> zoom,
+                std::chrono::steady_clock::time_point now);
+  void moved_by(float pan, float tilt, float zoom, std::chrono::steady_clock::time_point now);
+  // Moved by other means than ONVIF (the native SDK commands): unknown until read again.
+  void forget();
+
+  // The position a command may rely on: the device stands still, and nothing was dead-reckoned
+  // since a recent read.
+  bool exact(std::chrono::steady_clock::time_point now, position& p) const;
+  // The position to show: dead-reckoned once the speeds of the axes that moved are calibrated.
+  bool estimate(std::chrono::steady_clock::time_point now, position& p) const;
+  // GetStatus requests answered by exact() or estimate() instead.
+  unsigned long long saved_reads() const { return saved_; }
+};
+
+// Everything init() needs to know about the device before sending it PTZ and imaging requests.
+struct SoapDeviceInfo {
+  std::string serial;
+  std::string firmware;
+  std::string model;
+  std::string media_endpoint;
+  std::string ptz_endpoint;
+  std::string imaging_endpoint;
+  std::string events_endpoint;  // empty when the device has no event service
+  std::string profile_token;
+  std::string video_source_token;
+  std::string audio_source_token;
+  std::string audio_output_token;
+  PTZLimits ptz_limits;
+};
+
+// SoapDeviceInfo saved between runs, one line per device. An entry is found by the address the
+// device is reached at, and belongs to the serial number and firmware version it was read from:
+// the caller checks that they still match.
+class SoapDeviceCache {
+  std::string path_;
+
+ public:
+  explicit SoapDeviceCache(const std::string& path) : path_(path) {}
+
+  bool load(const std::string& address, SoapDeviceInfo& info) const;
+  bool save(const std::string& address, const SoapDeviceInfo& info) const;
+};
+
+class SoapThread {
+ public:
+  static constexpr size_t submission_capacity = 64;
+  static constexpr std::chrono::milliseconds default_submit_timeout{200};
+  // While requests are in flight, how often the submissions are looked at.
+  static constexpr std::chrono::milliseconds poll_interval{1};
+  // The burst of a budget: what it earns in that time, one request at least.
+  static constexpr double burst_seconds = 0.25;
+
+  enum Lane : size_t { PAN_TILT_LANE, ZOOM_LANE, STATUS_LANE, IMAGING_LANE, LANE_COUNT };
+
+ private:
+  mpsc_ring<SoapAction, submission_capacity> submissions_;
+  SoapActionQueue pending_;
+  std::atomic<bool> connected_;
+  std::atomic<bool> error_;
+  std::atomic<bool> exit_;
+  std::atomic<bool> stopped_;  // the worker no longer reads the ring
+  std::mutex drain_mx_;
+  bool failed_;
+  std::thread thread_;
+  std::mutex ready_mx_;
+  std::condition_variable ready_cv_;
+  bool ready_;
+  bool warm_start_;
+  std::atomic<unsigned long long> expired_;
+  std::array<SoapTokenBucket, static_cast<size_t>(SoapTraffic::COUNT)> budgets_;
+  std::array<std::atomic<unsigned long long>, static_cast<size_t>(SoapTraffic::COUNT)> sent_;
+  std::array<std::atomic<unsigned long long>, static_cast<size_t>(SoapTraffic::COUNT)> throttled_;
+
+  std::string onvif_username;
+  std::string onvif_password;
+  // uint16_t soap_port;
+  std::string soap_endpoint;
+  SoapCredentials credentials_;
+  SoapConnection device_;
+  SoapConnection media_;
+  DeviceBindingProxy proxy_device_;
+  MediaBindingProxy proxy_media_;
+  std::array<SoapLane, LANE_COUNT> lanes_;
+  SoapDeviceInfo device_info_;
+  // What the other threads read of device_info_: replaced whole, never changed in place.
+  std::shared_ptr<const SoapDeviceInfo> published_info_;
+  mutable std::mutex info_mx_;
+  SoapEnvelopes envelopes_;
+  SoapPTZState ptz_state_;
+  // Serial number and firmware version read on a warm start, to compare with the cached ones.
+  std::future<bool> validation_;
+  SoapDeviceInfo read_info_;
+
+  // int main_audio_output_level_min_;
+  // int main_audio_output_level_max_;
+
+  bool init();
+  bool read_device_information(SoapDeviceInfo& info);
+  bool discover(SoapDeviceInfo& info);
+  void use(const SoapDeviceInfo& info);
+  bool validate();
+  void soap_release();
+
+  float pan_max() const { return device_info_.ptz_limits.pan_max; }
+  float pan_min() const { return device_info_.ptz_limits.pan_min; }
+
+  float tilt_max() const { return device_info_.ptz_limits.tilt_max; }
+  float tilt_min() const { return device_info_.ptz_limits.tilt_min; }
+
+  float zoom_max() const { return device_info_.ptz_limits.zoom_max; }
+  float zoom_min() const { return device_info_.ptz_limits.zoom_min; }
+
+  // From the PTZ space of the device to the [0, 1] of SoapPTZState.
+  SoapPTZState::position normalized(float p, float t, float z) const;
+
+  static Lane lane(unsigned axes);
+  // Returns when an action held back by its budget may be sent, time_point::max() without any.
+  std::chrono::steady_clock::time_point dispatch();
+  void start(SoapLane& lane, SoapAction&& action);
+  void send(SoapLane& lane);
+  void receive(SoapLane& lane);
+  void expire(SoapAction&& action);
+  void finish(SoapLane& lane, int error, bool timed_out = false);
+  void abandon();
+  void drain();
+  bool in_flight() const;
+  void poll(std::chrono::milliseconds timeout);
+
+  // One pair per action kind, picked by std::visit: send() sends the request of `lane.step`,
+  // receive() reads its response, and moves on to the next step, if any. Both return the gSOAP error
+  // code.
+  int send(SoapLane& lane, SoapStopContinuousMoveAction& action);
+  int receive(SoapLane& lane, SoapStopContinuousMoveAction& action);
+  int send(SoapLane& lane, SoapStartContinuousMoveAction& action);
+  int receive(SoapLane& lane, SoapStartContinuousMoveAction& action);
+  int send(SoapLane& lane, SoapRelativeMoveAction& action);
+  int receive(SoapLane& lane, SoapRelativeMoveAction& action);
+  int send(SoapLane& lane, SoapAbsoluteMove& action);
+  int receive(SoapLane& lane, SoapAbsoluteMove& action);
+  int send(SoapLane& lane, SoapGetStatus& action);
+  int receive(SoapLane& lane, SoapGetStatus& action);
+  int send(SoapLane& lane, SoapIRModeAction& action);
+  int receive(SoapLane& lane, SoapIRModeAction& action);
+  // Sends the envelope of `kind`, with a fresh token, on the PTZ endpoint.
+  int send(SoapLane& lane, SoapEnvelopes::Kind kind, float p, float t, float z);
+
+ public:
+  SoapThread();
+
+  const std::atomic<bool>& connected() const { return connected_; }
+
+  const std::atomic<bool>& error() const { return error_; }
+
+  // Waits for the end of init(): returns connected().
+  bool wait_ready();
+  // Whether init() used the cached device information instead of asking the device.
+  bool warm_start() const { return warm_start_; }
+
+  const std::atomic<bool>& exit() const { return exit_; }
+  std::atomic<bool>& exit() { return exit_; }
+
+  const std::thread& thread() const { return thread_; }
+  std::thread& thread() { return thread_; }
+
+  void run();
+
+  // Never waits for the worker: the action is copied into a lock-free ring. Returns false when it
+  // was not accepted, i.e. on exit or once the worker stopped on an error, when `policy` is REJECT
+  // and the ring is full or when BLOCK could not get room before `timeout`. With REPLACE_LATEST the
+  // action replaces the previous overflowing one, if any, whose completion callback is never
+  // called. That of an accepted action is, even when the worker stops before sending it. A Stop is
+  // accepted at once, whatever the policy, unless another Stop is still waiting for the worker.
+  bool queue(SoapAction action, OverflowPolicy policy = OverflowPolicy::BLOCK,
+             std::chrono::milliseconds timeout = default_submit_timeout);
+
+  // Queue depth, drops and submit latency of the submission ring.
+  submission_stats queue_stats() const { return submissions_.stats(); }
+  // Perishable actions dropped for being still pending past their deadline.
+  unsigned long long expired() const { return expired_; }
+  // Actions merged into, or superseding, a pending one.
+  unsigned long long coalesced() const { return pending_.coalesced(); }
+  // Pending actions dropped, callback called, because a later one made them pointless.
+  unsigned long long superseded() const { return pending_.superseded(); }
+  // Requests sent and throttled per budget.
+  traffic_stats budget_stats(SoapTraffic t) const {
+    return {sent_[static_cast<size_t>(t)], throttled_[static_cast<size_t>(t)]};
+  }
+
+  const SoapConnection& device_connection() const { return device_; }
+  const SoapConnection& media_connection() const { return media_; }
+  const SoapConnection& ptz_connection() const { return lanes_[PAN_TILT_LANE].connection; }
+  const SoapConnection& lane_connection(Lane lane) const { return lanes_[lane].connection; }
+
+  // Read once wait_ready() returned true. Thread safe: a snapshot, which the end of a warm start
+  // replaces when the device changed.
+  std::shared_ptr<const SoapDeviceInfo> device_info() const {
+    std::lock_guard<std::mutex> lock(info_mx_);
+    return published_info_;
+  }
+  // Thread safe, shared with the other ONVIF clients of the device.
+  SoapCredentials& credentials() { return credentials_; }
+  // Thread safe, kept up to date by the PTZ requests.
+  const SoapPTZState& ptz_state() const { return ptz_state_; }
+  SoapPTZState& ptz_state() { return ptz_state_; }
+
+  // Thread safe: turns connection reuse on or off for every service.
+  void keep_alive(bool on);
+
+  void must_exit();
+};
+
+extern SoapThread soap_thread;
 
 }  // namespace soap
 }  // namespace app
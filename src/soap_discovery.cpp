@@ -0,0 +1,262 @@
+#include "soap_discovery.h"
+
+#include "winheaders.h"
+
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <sstream>
+
+#include "soap/soapH.h"
+
+#include <plugin/wsaapi.h>
+#include <plugin/wsddapi.h>
+
+#include "synchronized_ostream.h"
+
+namespace app {
+namespace soap {
+
+namespace {
+
+// The namespaces of the WS-Discovery messages, and tdn for the type of the devices probed.
+SOAP_NMAC struct Namespace discovery_namespaces[] = {
+    {"SOAP-ENV", "http://www.w3.org/2003/05/soap-envelope", "http://www.w3.org/*/soap-envelope",
+     nullptr},
+    {"SOAP-ENC", "http://www.w3.org/2003/05/soap-encoding", "http://www.w3.org/*/soap-encoding",
+     nullptr},
+    {"xsi", "http://www.w3.org/2001/XMLSchema-instance", "http://www.w3.org/*/XMLSchema-instance",
+     nullptr},
+    {"xsd", "http://www.w3.org/2001/XMLSchema", "http://www.w3.org/*/XMLSchema", nullptr},
+    {"wsa5", "http://www.w3.org/2005/08/addressing",
+     "http://schemas.xmlsoap.org/ws/2004/08/addressing", nullptr},
+    {"wsdd", "http://docs.oasis-open.org/ws-dd/ns/discovery/2009/01", nullptr, nullptr},
+    {"tdn", "http://www.onvif.org/ver10/network/wsdl", nullptr, nullptr},
+    {nullptr, nullptr, nullptr, nullptr}};
+
+std::string text(const char* s) { return s ? s : ""; }
+
+}  // namespace
+
+std::ostream& operator<<(std::ostream& out, const DiscoveredDevice& device) {
+  out << device.endpoint << ' ' << device.xaddrs;
+  if (!device.interface.empty()) out << " (on " << device.interface << ')';
+  return out;
+}
+
+/******************************************************************************\
+ *
+ *	SoapDiscoveryCache
+ *
+ \******************************************************************************/
+
+bool SoapDiscoveryCache::load(std::vector<DiscoveredDevice>& devices) const {
+  const std::time_t now = std::time(nullptr);
+  const size_t loaded = devices.size();
+  std::ifstream in(path_);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    DiscoveredDevice entry;
+    std::string seen, version;
+    if (!std::getline(fields, entry.endpoint, '\t') || !std::getline(fields, seen, '\t') ||
+        !std::getline(fields, version, '\t') || !std::getline(fields, entry.interface, '\t') ||
+        !std::getline(fields, entry.xaddrs, '\t') || !std::getline(fields, entry.types, '\t'))
+      continue;
+    std::getline(fields, entry.scopes);
+    try {
+      entry.seen = static_cast<std::time_t>(std::stoll(seen));
+      entry.metadata_version = static_cast<unsigned int>(std::stoul(version));
+    } catch (const std::exception&) {
+      continue;
+    }
+    if (now - entry.seen >= ttl_.count()) continue;
+    devices.push_back(std::move(entry));
+  }
+  return devices.size() > loaded;
+}
+
+bool SoapDiscoveryCache::save(const std::vector<DiscoveredDevice>& devices) const {
+  std::ofstream out(path_, std::ios::trunc);
+  for (const auto& device : devices)
+    out << device.endpoint << '\t' << device.seen << '\t' << device.metadata_version << '\t'
+        << device.interface << '\t' << device.xaddrs << '\t' << device.types << '\t'
+        << device.scopes << '\n';
+  return static_cast<bool>(out);
+}
+
+/******************************************************************************\
+ *
+ *	SoapDiscovery
+ *
+ \******************************************************************************/
+
+std::vector<std::string> SoapDiscovery::interfaces(bool loopback) {
+  std::vector<std::string> addresses;
+  ULONG size = 16 * 1024;
+  std::vector<char> buffer;
+  ULONG result;
+  do {
+    buffer.resize(size);
+    result = ::GetAdaptersAddresses(
+        AF_INET, GAA_FLAG_SKIP_ANYCAST | GAA_FLAG_SKIP_MULTICAST | GAA_FLAG_SKIP_DNS_SERVER,
+        nullptr, reinterpret_cast<PIP_ADAPTER_ADDRESSES>(buffer.data()), &size);
+  } while (result == ERROR_BUFFER_OVERFLOW);
+  if (result != ERROR_SUCCESS) {
+    std::cerr << "SoapDiscovery: could not list the network interfaces (" << result << ")\n";
+    return addresses;
+  }
+
+  for (auto adapter = reinterpret_cast<PIP_ADAPTER_ADDRESSES>(buffer.data()); adapter;
+       adapter = adapter->Next) {
+    if (adapter->OperStatus != IfOperStatusUp) continue;
+    if (adapter->IfType == IF_TYPE_SOFTWARE_LOOPBACK && !loopback) continue;
+    for (auto unicast = adapter->FirstUnicastAddress; unicast; unicast = unicast->Next) {
+      const sockaddr* address = unicast->Address.lpSockaddr;
+      if (address->sa_family != AF_INET) continue;
+      const auto bytes = reinterpret_cast<const unsigned char*>(
+          &reinterpret_cast<const sockaddr_in*>(address)->sin_addr);
+      std::ostringstream dotted;
+      dotted << +bytes[0] << '.' << +bytes[1] << '.' << +bytes[2] << '.' << +bytes[3];
+      addresses.push_back(dotted.str());
+    }
+  }
+  return addresses;
+}
+
+bool SoapDiscovery::send(const std::string& interface, const std::string& endpoint,
+                         std::chrono::milliseconds timeout) {
+  struct soap* soap = ::soap_new1(SOAP_IO_UDP);
+  ::soap_set_namespaces(soap, discovery_namespaces);
+  soap->rcvbuf = receive_buffer;
+  // The multicast probe leaves by the interface, and goes no further than its network.
+  in_addr multicast_if;
+  multicast_if.s_addr = ::inet_addr(interface.c_str());
+  soap->ipv4_multicast_if = reinterpret_cast<char*>(&multicast_if);
+  soap->ipv4_multicast_ttl = 1;
+
+  // The matches are sent back to the address and port of the probe: bound first, so that they are
+  // read from the same socket.
+  if (!soap_valid_socket(::soap_bind(soap, interface.c_str(), 0, 100))) {
+    std::cerr << "SoapDiscovery: could not bind to " << interface << ": ";
+    ::soap_print_fault(soap, stderr);
+    ::soap_free(soap);
+    return false;
+  }
+
+  probe p{this, interface, ::soap_wsa_rand_uuid(soap)};
+  soap->user = &p;
+  if (::soap_wsdd_Probe(soap, SOAP_WSDD_ADHOC, SOAP_WSDD_TO_TS, endpoint.c_str(),
+                        p.message_id.c_str(), nullptr, device_types, nullptr, nullptr)) {
+    std::cerr << "SoapDiscovery: could not probe from " << interface << ": ";
+    ::soap_print_fault(soap, stderr);
+    ::soap_destroy(soap);
+    ::soap_end(soap);
+    ::soap_free(soap);
+    return false;
+  }
+  clog.log("SoapDiscovery: probe ", p.message_id, " sent from ", interface);
+
+  // soap_wsdd_listen() gives up on the first message it cannot read: listened to again until the
+  // timeout, so that a stray datagram does not hide the matches after it.
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  for (auto left = std::chrono::duration_cast<std::chrono::microseconds>(timeout);
+       left.count() > 0; left = std::chrono::duration_cast<std::chrono::microseconds>(
+                             deadline - std::chrono::steady_clock::now())) {
+    if (!::soap_wsdd_listen(soap, -static_cast<int>(left.count()))) break;
+    clog.log("SoapDiscovery: unreadable message on ", interface, ", error ", soap->error);
+  }
+
+  ::soap_destroy(soap);
+  ::soap_end(soap);
+  ::soap_free(soap);
+  return true;
+}
+
+void SoapDiscovery::matched(struct soap* soap, const char* relates_to,
+                            const wsdd__ProbeMatchesType* matches) {
+  const auto p = static_cast<const probe*>(soap->user);
+  if (!p || !matches) return;
+  if (!relates_to || p->message_id != relates_to) {
+    std::lock_guard<std::mutex> lock(p->discovery->mx_);
+    ++p->discovery->stats_.unrelated;
+    return;
+  }
+  p->discovery->add(*p, *matches);
+}
+
+void SoapDiscovery::add(const probe& p, const wsdd__ProbeMatchesType& matches) {
+  const std::time_t now = std::time(nullptr);
+  std::lock_guard<std::mutex> lock(mx_);
+  for (int i = 0; i < matches.__sizeProbeMatch; ++i) {
+    const wsdd__ProbeMatchType& match = matches.ProbeMatch[i];
+    if (!match.wsa5__EndpointReference.Address) continue;
+    if (!stats_.matches++) stats_.first = std::chrono::steady_clock::now() - started_;
+
+    const std::string endpoint = match.wsa5__EndpointReference.Address;
+    auto found = devices_.find(endpoint);
+    if (found != devices_.end()) {
+      ++stats_.duplicates;
+      // Answered again: only a newer version of its metadata is of interest.
+      if (match.MetadataVersion <= found->second.metadata_version) continue;
+    } else {
+      found = devices_.emplace(endpoint, DiscoveredDevice{endpoint}).first;
+      found->second.interface = p.interface;
+    }
+    DiscoveredDevice& device = found->second;
+    device.xaddrs = text(match.XAddrs);
+    device.types = text(match.Types);
+    device.scopes = match.Scopes ? text(match.Scopes->__item) : "";
+    device.metadata_version = match.MetadataVersion;
+    device.seen = now;
+  }
+}
+
+std::vector<DiscoveredDevice> SoapDiscovery::scan(const std::vector<std::string>& interfaces,
+                                                  std::chrono::milliseconds timeout,
+                                                  const std::string& endpoint) {
+  {
+    std::lock_guard<std::mutex> lock(mx_);
+    devices_.clear();
+    stats_ = discovery_stats{};
+    stats_.interfaces = interfaces.size();
+    started_ = std::chrono::steady_clock::now();
+  }
+
+  // One probe per interface, all of them in flight together: the scan lasts one timeout.
+  std::vector<std::future<bool>> probes;
+  for (const auto& interface : interfaces)
+    probes.push_back(std::async(std::launch::async, [this, &interface, &endpoint, timeout]() {
+      return send(interface, endpoint, timeout);
+    }));
+  size_t failed = 0;
+  for (auto& sent : probes) failed += !sent.get();
+
+  std::lock_guard<std::mutex> lock(mx_);
+  stats_.failed = failed;
+  stats_.elapsed = std::chrono::steady_clock::now() - started_;
+  std::vector<DiscoveredDevice> devices;
+  devices.reserve(devices_.size());
+  for (const auto& device : devices_) devices.push_back(device.second);
+  return devices;
+}
+
+discovery_stats SoapDiscovery::stats() const {
+  std::lock_guard<std::mutex> lock(mx_);
+  return stats_;
+}
+
+std::vector<DiscoveredDevice> SoapDiscovery::merge(const std::vector<DiscoveredDevice>& scanned,
+                                                   const std::vector<DiscoveredDevice>& cached) {
+  std::vector<DiscoveredDevice> devices = scanned;
+  for (const auto& device : cached)
+    if (std::none_of(scanned.begin(), scanned.end(), [&device](const DiscoveredDevice& d) {
+          return d.endpoint == device.endpoint;
+        }))
+      devices.push_back(device);
+  return devices;
+}
+
+}  // namespace soap
+}  // namespace app
\ No newline at end of file
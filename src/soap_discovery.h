@@ -0,0 +1,108 @@
+#ifndef DEF_SOAP_DISCOVERY_H
+#define DEF_SOAP_DISCOVERY_H
+
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <stdsoap2.h>
+
+struct wsdd__ProbeMatchesType;
+
+namespace app {
+
+namespace soap {
+
+// A device answering the WS-Discovery probe, as told by its ProbeMatch.
+struct DiscoveredDevice {
+  std::string endpoint;   // wsa:EndpointReference, e.g. urn:uuid:..., the same on every interface
+  std::string xaddrs;     // addresses of the device service, separated by spaces
+  std::string types;      // e.g. dn:NetworkVideoTransmitter tds:Device
+  std::string scopes;     // onvif://www.onvif.org/name/..., /hardware/..., /location/...
+  unsigned int metadata_version;
+  std::string interface;  // local address the first match was received on
+  std::time_t seen;
+};
+
+std::ostream& operator<<(std::ostream& out, const DiscoveredDevice& device);
+
+struct discovery_stats {
+  size_t interfaces;
+  size_t matches;     // ProbeMatch received, duplicates included
+  size_t duplicates;  // the same endpoint again: answered on several interfaces, or twice
+  size_t unrelated;   // ProbeMatches of another probe
+  size_t failed;      // interfaces whose probe could not be sent
+  std::chrono::steady_clock::duration first;  // until the first match, zero without any
+  std::chrono::steady_clock::duration elapsed;
+};
+
+// The devices found by the last scans, one line per device, so that a device seen less than `ttl`
+// ago is listed before the next scan answers, or when it misses a probe (UDP is lossy).
+class SoapDiscoveryCache {
+  std::string path_;
+  std::chrono::seconds ttl_;
+
+ public:
+  SoapDiscoveryCache(const std::string& path, std::chrono::seconds ttl) : path_(path), ttl_(ttl) {}
+
+  // Appends the entries which have not expired, false without any.
+  bool load(std::vector<DiscoveredDevice>& devices) const;
+  bool save(const std::vector<DiscoveredDevice>& devices) const;
+};
+
+// WS-Discovery of the ONVIF devices on the local networks. A Probe is multicast on every interface
+// at once, from a socket bound to the address of the interface, and the ProbeMatches are gathered
+// from all of them for the same timeout. The devices are told apart by their endpoint reference,
+// since a device on several networks, or answering twice, keeps the same one.
+class SoapDiscovery {
+ public:
+  static constexpr auto multicast_endpoint = "soap.udp://239.255.255.250:3702";
+  static constexpr auto device_types = "tdn:NetworkVideoTransmitter";
+  // Large enough for the burst of matches following a probe on a busy network.
+  static constexpr int receive_buffer = 1 << 20;
+
+ private:
+  // soap->user of the contexts of scan().
+  struct probe {
+    SoapDiscovery* discovery;
+    std::string interface;
+    std::string message_id;
+  };
+
+  mutable std::mutex mx_;
+  std::map<std::string, DiscoveredDevice> devices_;
+  discovery_stats stats_;
+  std::chrono::steady_clock::time_point started_;
+
+  bool send(const std::string& interface, const std::string& endpoint,
+            std::chrono::milliseconds timeout);
+  void add(const probe& p, const wsdd__ProbeMatchesType& matches);
+
+ public:
+  // The IPv4 addresses of the interfaces which are up, the loopback one only when asked for.
+  static std::vector<std::string> interfaces(bool loopback = false);
+
+  // Probes from every interface in `interfaces` at `endpoint`, and returns the devices which answered
+  // within `timeout`, ordered by endpoint reference.
+  std::vector<DiscoveredDevice> scan(const std::vector<std::string>& interfaces,
+                                     std::chrono::milliseconds timeout,
+                                     const std::string& endpoint = multicast_endpoint);
+  discovery_stats stats() const;
+
+  // The devices of `scanned`, followed by those of `cached` which did not answer.
+  static std::vector<DiscoveredDevice> merge(const std::vector<DiscoveredDevice>& scanned,
+                                             const std::vector<DiscoveredDevice>& cached);
+
+  // From wsdd_event_ProbeMatches, on the thread of the probe.
+  static void matched(struct soap* soap, const char* relates_to,
+                      const wsdd__ProbeMatchesType* matches);
+};
+
+}  // namespace soap
+}  // namespace app
+
+#endif
\ No newline at end of file
@@ -0,0 +1,247 @@
+#include "soap_envelope.h"
+
+#include <iostream>
+#include <sstream>
+
+#include "soap/soapH.h"
+
+#include <plugin/wsseapi.h>
+
+#include "soap.h"
+#include "synchronized_ostream.h"
+
+namespace app {
+namespace soap {
+
+namespace {
+
+// Put in place of the fields when the envelopes are serialized: they must not appear anywhere else
+// in a request, nor be a prefix of each other.
+const SoapToken marker_token = {{}, "{created}", "{expires}", "{nonce}", "{digest}"};
+constexpr float marker_pan = -0.00123456791f;
+constexpr float marker_tilt = 0.00234567891f;
+constexpr float marker_zoom = 0.00345678912f;
+
+// Rendered and compared with gSOAP when the envelopes are built.
+struct sample {
+  SoapToken token;
+  float pan;
+  float tilt;
+  float zoom;
+};
+const sample samples[] = {
+    {{{}, "2024-01-01T00:00:00Z", "2024-01-01T00:00:10Z", "c2FtcGxlLW5vbmNlLTEyMzQ1Njc4",
+      "KzEvMj0zKzQvNT02Kzc4OTAxMjM="},
+     0.05f,
+     -0.05f,
+     0.f},
+    {{{}, "2031-12-31T23:59:59Z", "2032-01-01T00:00:09Z", "/////////////////////w==",
+      "AAAAAAAAAAAAAAAAAAAAAAAAAAA="},
+     -1.f,
+     1.f,
+     0.333333343f},
+    {{{}, "2026-06-15T12:30:45Z", "2026-06-15T12:30:55Z", "MDEyMzQ1Njc4OWFiY2RlZmdo",
+      "bWFya2VyLWRpZ2VzdC0wMTIzNDU="},
+     1e-6f,
+     -0.999999f,
+     1.f}};
+
+// What the generated send_X does, writing the envelope to `out` instead of a connection.
+template <typename Message>
+int write(struct soap* soap, const Message& message, void (*mark)(struct soap*, const Message*),
+          int (*put)(struct soap*, const Message*, const char*, const char*), const char* tag,
+          std::ostream& out) {
+  soap_set_version(soap, 2); /* use SOAP1.2 */
+  soap->encodingStyle = nullptr;
+  ::soap_serializeheader(soap);
+  mark(soap, &message);
+  if (::soap_begin_count(soap)) return soap->error;
+  if ((soap->mode & SOAP_IO_LENGTH) &&
+      (::soap_envelope_begin_out(soap) || ::soap_putheader(soap) || ::soap_body_begin_out(soap) ||
+       put(soap, &message, tag, "") || ::soap_body_end_out(soap) ||
+       ::soap_envelope_end_out(soap)))
+    return soap->error;
+  if (::soap_end_count(soap)) return soap->error;
+  soap->os = &out;
+  const bool failed = ::soap_begin_send(soap) || ::soap_envelope_begin_out(soap) ||
+                      ::soap_putheader(soap) || ::soap_body_begin_out(soap) ||
+                      put(soap, &message, tag, "") || ::soap_body_end_out(soap) ||
+                      ::soap_envelope_end_out(soap) || ::soap_end_send(soap);
+  soap->os = nullptr;
+  return failed ? soap->error : SOAP_OK;
+}
+
+}  // namespace
+
+/******************************************************************************\
+ *
+ *	SoapEnvelope
+ *
+ \******************************************************************************/
+
+bool SoapEnvelope::parse(struct soap* soap, std::string xml, const SoapToken& markers, float pan,
+                         float tilt, float zoom) {
+  const std::array<std::string, NO_FIELD> text = {
+      markers.created,           markers.expires,            markers.nonce,
+      markers.digest,            ::soap_float2s(soap, pan),  ::soap_float2s(soap, tilt),
+      ::soap_float2s(soap, zoom)};
+  xml_ = std::move(xml);
+  segments_.clear();
+  for (size_t begin = 0;;) {
+    size_t at = std::string::npos;
+    Field field = NO_FIELD;
+    for (uint8_t f = 0; f < NO_FIELD; ++f) {
+      const size_t found = xml_.find(text[f], begin);
+      if (found == std::string::npos) continue;
+      if (found == at) return false;
+      if (found < at) {
+        at = found;
+        field = static_cast<Field>(f);
+      }
+    }
+    if (field == NO_FIELD) {
+      segments_.push_back({begin, xml_.size(), NO_FIELD});
+      return true;
+    }
+    segments_.push_back({begin, at, field});
+    begin = at + text[field].size();
+  }
+}
+
+void SoapEnvelope::render(struct soap* soap, const SoapToken& token, float pan, float tilt,
+                          float zoom, std::string& out) const {
+  out.clear();
+  for (const segment& s : segments_) {
+    out.append(xml_, s.begin, s.end - s.begin);
+    switch (s.field) {
+      case CREATED:
+        out.append(token.created);
+        break;
+      case EXPIRES:
+        out.append(token.expires);
+        break;
+      case NONCE:
+        out.append(token.nonce);
+        break;
+      case DIGEST:
+        out.append(token.digest);
+        break;
+      case PAN:
+        out.append(::soap_float2s(soap, pan));
+        break;
+      case TILT:
+        out.append(::soap_float2s(soap, tilt));
+        break;
+      case ZOOM:
+        out.append(::soap_float2s(soap, zoom));
+        break;
+      case NO_FIELD:
+        break;
+    }
+  }
+}
+
+/******************************************************************************\
+ *
+ *	SoapEnvelopes
+ *
+ \******************************************************************************/
+
+const char* SoapEnvelopes::action(Kind kind) {
+  switch (kind) {
+    case CONTINUOUS_MOVE:
+      return "http://www.onvif.org/ver20/ptz/wsdl/ContinuousMove";
+    case STOP:
+      return "http://www.onvif.org/ver20/ptz/wsdl/Stop";
+    case RELATIVE_MOVE:
+    case RELATIVE_MOVE_PAN_TILT:
+    case RELATIVE_MOVE_ZOOM:
+      return "http://www.onvif.org/ver20/ptz/wsdl/RelativeMove";
+    case GET_STATUS:
+    default:
+      return "http://www.onvif.org/ver20/ptz/wsdl/GetStatus";
+  }
+}
+
+bool SoapEnvelopes::build(struct soap* like, const std::string& profile_token,
+                          const SoapCredentials& credentials) {
+  ready_ = false;
+  credentials_ = &credentials;
+  profile_token_ = profile_token;
+
+  struct soap* soap = ::soap_new2(like->imode, like->omode);
+  ::soap_set_namespaces(soap, like->namespaces);
+  ::soap_register_plugin(soap, ::soap_wsse);
+  bool ok = true;
+  std::string rendered;
+  for (size_t k = 0; ok && k < KIND_COUNT; ++k) {
+    const auto kind = static_cast<Kind>(k);
+    std::ostringstream xml;
+    ok = !serialize(soap, kind, marker_token, marker_pan, marker_tilt, marker_zoom, xml) &&
+         envelopes_[k].parse(soap, xml.str(), marker_token, marker_pan, marker_tilt, marker_zoom);
+    for (const sample& s : samples) {
+      if (!ok) break;
+      std::ostringstream expected;
+      ok = !serialize(soap, kind, s.token, s.pan, s.tilt, s.zoom, expected);
+      envelopes_[k].render(soap, s.token, s.pan, s.tilt, s.zoom, rendered);
+      ok = ok && rendered == expected.str();
+    }
+    if (!ok) std::cerr << "SoapEnvelopes: envelope " << k << " differs from gSOAP's\n";
+    ::soap_destroy(soap);
+    ::soap_end(soap);
+  }
+  ::soap_free(soap);
+
+  clog.log("SoapEnvelopes: ", ok ? "pre-serialized PTZ requests ready" : "using the proxies");
+  return ready_ = ok;
+}
+
+int SoapEnvelopes::serialize(struct soap* soap, Kind kind, const SoapToken& token, float pan,
+                             float tilt, float zoom, std::ostream& out) const {
+  ::soap_begin(soap);
+  if (const int error = credentials_->put(soap, token)) return error;
+  switch (kind) {
+    case CONTINUOUS_MOVE: {
+      struct __tptz__ContinuousMove message;
+      message.tptz__ContinuousMove = ::soap_new_req__tptz__ContinuousMove(
+          soap, profile_token_,
+          ::soap_new_set_tt__PTZSpeed(soap, ::soap_new_set_tt__Vector2D(soap, pan, tilt, nullptr),
+                                      nullptr));
+      return write(soap, message, ::soap_serialize___tptz__ContinuousMove,
+                   ::soap_put___tptz__ContinuousMove, "-tptz:ContinuousMove", out);
+    }
+    case STOP: {
+      struct __tptz__Stop message;
+      message.tptz__Stop = ::soap_new_set__tptz__Stop(
+          soap, profile_token_, ::soap_new_bool(soap, true), ::soap_new_bool(soap, true));
+      return write(soap, message, ::soap_serialize___tptz__Stop, ::soap_put___tptz__Stop,
+                   "-tptz:Stop", out);
+    }
+    case RELATIVE_MOVE:
+    case RELATIVE_MOVE_PAN_TILT:
+    case RELATIVE_MOVE_ZOOM: {
+      struct __tptz__RelativeMove message;
+      message.tptz__RelativeMove = ::soap_new_set__tptz__RelativeMove(
+          soap, profile_token_,
+          ::soap_new_set_tt__PTZVector(
+              soap,
+              kind != RELATIVE_MOVE_ZOOM ? ::soap_new_set_tt__Vector2D(soap, pan, tilt, nullptr)
+                                         : nullptr,
+              kind != RELATIVE_MOVE_PAN_TILT ? ::soap_new_set_tt__Vector1D(soap, zoom, nullptr)
+                                             : nullptr),
+          nullptr);
+      return write(soap, message, ::soap_serialize___tptz__RelativeMove,
+                   ::soap_put___tptz__RelativeMove, "-tptz:RelativeMove", out);
+    }
+    case GET_STATUS:
+    default: {
+      struct __tptz__GetStatus message;
+      message.tptz__GetStatus = ::soap_new_set__tptz__GetStatus(soap, profile_token_);
+      return write(soap, message, ::soap_serialize___tptz__GetStatus,
+                   ::soap_put___tptz__GetStatus, "-tptz:GetStatus", out);
+    }
+  }
+}
+
+}  // namespace soap
+}  // namespace app
\ No newline at end of file
@@ -0,0 +1,101 @@
+#ifndef DEF_SOAP_ENVELOPE_H
+#define DEF_SOAP_ENVELOPE_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <stdsoap2.h>
+
+namespace app {
+
+namespace soap {
+
+class SoapCredentials;
+
+// The variable part of a WS-Security header (wsu:Timestamp and UsernameToken digest), as
+// serialized.
+struct SoapToken {
+  std::chrono::steady_clock::time_point computed;
+  char created[32];
+  char expires[32];
+  char nonce[32];
+  char digest[32];
+};
+
+// A request serialized once by gSOAP, cut around its variable fields: rendering it again copies the
+// literal parts and writes the fields in between, formatted by gSOAP itself, into a buffer whose
+// capacity is kept from one request to the next.
+class SoapEnvelope {
+ public:
+  enum Field : uint8_t { CREATED, EXPIRES, NONCE, DIGEST, PAN, TILT, ZOOM, NO_FIELD };
+
+ private:
+  struct segment {
+    size_t begin;  // literal text [begin, end) of xml_, followed by field
+    size_t end;
+    Field field;
+  };
+
+  std::string xml_;
+  std::vector<segment> segments_;
+
+ public:
+  // Cuts `xml`, serialized with `markers` (token) and `pan`, `tilt`, `zoom` (floats) in place of
+  // the fields. False when a marker cannot be told apart.
+  bool parse(struct soap* soap, std::string xml, const SoapToken& markers, float pan, float tilt,
+             float zoom);
+
+  bool empty() const { return segments_.empty(); }
+  size_t size() const { return xml_.size(); }
+
+  void render(struct soap* soap, const SoapToken& token, float pan, float tilt, float zoom,
+              std::string& out) const;
+};
+
+// The PTZ requests sent at a high rate, one envelope per shape of request: a RelativeMove without
+// zoom, for instance, has no Zoom element. Built, and checked byte for byte against gSOAP, once the
+// profile token is known; when any check fails, ready() stays false and the generated proxies are
+// used instead.
+class SoapEnvelopes {
+ public:
+  enum Kind : size_t {
+    CONTINUOUS_MOVE,
+    STOP,
+    RELATIVE_MOVE,  // pan, tilt and zoom
+    RELATIVE_MOVE_PAN_TILT,
+    RELATIVE_MOVE_ZOOM,
+    GET_STATUS,
+    KIND_COUNT
+  };
+
+  // SOAP action of the HTTP request, the same as the proxies'.
+  static const char* action(Kind kind);
+
+ private:
+  std::array<SoapEnvelope, KIND_COUNT> envelopes_;
+  const SoapCredentials* credentials_ = nullptr;
+  std::string profile_token_;
+  bool ready_ = false;
+
+ public:
+  // Serializes every kind on a context of its own, with the namespaces and modes of `like`.
+  bool build(struct soap* like, const std::string& profile_token,
+             const SoapCredentials& credentials);
+
+  bool ready() const { return ready_; }
+  const SoapEnvelope& operator[](Kind kind) const { return envelopes_[kind]; }
+
+  // What the proxy would send for the same request, written to `out`: the reference the envelopes
+  // are checked against. Returns a gSOAP error code.
+  int serialize(struct soap* soap, Kind kind, const SoapToken& token, float pan, float tilt,
+                float zoom, std::ostream& out) const;
+};
+
+}  // namespace soap
+}  // namespace app
+
+#endif
\ No newline at end of file
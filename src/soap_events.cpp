@@ -0,0 +1,315 @@
+#include "soap_events.h"
+
+#include <iostream>
+
+#include <stdsoap2.h>
+
+#include "soap/soapH.h"
+
+#include <plugin/wsaapi.h>
+
+#include "synchronized_ostream.h"
+#include "util.h"
+
+namespace app {
+namespace soap {
+
+namespace {
+
+constexpr auto create_action =
+    "http://www.onvif.org/ver10/events/wsdl/EventPortType/CreatePullPointSubscriptionRequest";
+constexpr auto pull_action =
+    "http://www.onvif.org/ver10/events/wsdl/PullPointSubscription/PullMessagesRequest";
+constexpr auto renew_action =
+    "http://docs.oasis-open.org/wsn/bw-2/SubscriptionManager/RenewRequest";
+constexpr auto unsubscribe_action =
+    "http://docs.oasis-open.org/wsn/bw-2/SubscriptionManager/UnsubscribeRequest";
+
+constexpr auto concrete_set = "http://www.onvif.org/ver10/tev/topicExpression/ConcreteSet";
+constexpr auto onvif_topics = "http://www.onvif.org/ver10/topics";
+
+const char plugin_id[] = "APP-EVENTS/1.0";
+
+// Gives ignored() the SoapEventThread of the context.
+int plugin(struct soap*, struct soap_plugin* p, void* events) {
+  p->id = plugin_id;
+  p->data = events;
+  p->fcopy = nullptr;
+  p->fdelete = [](struct soap*, struct soap_plugin*) {};
+  return SOAP_OK;
+}
+
+// The generated wsnt:FilterType has no content (xsd:any): writes the topic expression itself.
+class SoapTopicFilter : public wsnt__FilterType {
+  const std::string& topics_;
+
+ public:
+  explicit SoapTopicFilter(const std::string& topics) : topics_(topics) {}
+
+  int soap_out(struct soap* soap, const char* tag, int id, const char* type) const override {
+    if (::soap_element_begin_out(soap, tag,
+                                 ::soap_embedded_id(soap, id, this, SOAP_TYPE_wsnt__FilterType),
+                                 type) ||
+        ::soap_set_attr(soap, "Dialect", concrete_set, 1) ||
+        ::soap_set_attr(soap, "xmlns:tns1", onvif_topics, 1) ||
+        ::soap_element_begin_out(soap, "wsnt:TopicExpression", -1, nullptr) ||
+        ::soap_string_out(soap, topics_.c_str(), 0) ||
+        ::soap_element_end_out(soap, "wsnt:TopicExpression"))
+      return soap->error;
+    return ::soap_element_end_out(soap, tag);
+  }
+};
+
+std::string duration(std::chrono::seconds d) { return "PT" + std::to_string(d.count()) + "S"; }
+
+const char* name(tt__PropertyOperation operation) {
+  switch (operation) {
+    case tt__PropertyOperation::Initialized:
+      return "Initialized";
+    case tt__PropertyOperation::Deleted:
+      return "Deleted";
+    case tt__PropertyOperation::Changed:
+    default:
+      return "Changed";
+  }
+}
+
+void copy(const tt__ItemList* items, std::vector<std::pair<std::string, std::string>>& out) {
+  if (!items) return;
+  for (const auto& item : items->SimpleItem) out.emplace_back(item.Name, item.Value);
+}
+
+// The topic is the mixed content of wsnt:Topic, surrounded by the indentation, if any.
+std::string trim(const char* s) {
+  std::string text(s);
+  const auto first = text.find_first_not_of(" \t\r\n");
+  if (first == std::string::npos) return {};
+  return text.substr(first, text.find_last_not_of(" \t\r\n") - first + 1);
+}
+
+}  // namespace
+
+std::ostream& operator<<(std::ostream& out, const SoapEvent& event) {
+  out << event.topic;
+  if (!event.operation.empty()) out << " (" << event.operation << ')';
+  for (const auto* items : {&event.source, &event.key, &event.data})
+    for (const auto& item : *items) out << ' ' << item.first << '=' << item.second;
+  return out;
+}
+
+/******************************************************************************\
+ *
+ *	SoapEventThread
+ *
+ \******************************************************************************/
+
+SoapEventThread::SoapEventThread(SoapCredentials& credentials)
+    : connection_("events", credentials),
+      proxy_(connection_.soap()),
+      subscribed_(false),
+      exit_(false),
+      subscriptions_(0),
+      renewals_(0),
+      pulls_(0),
+      messages_(0),
+      cpu_(0) {
+  ::soap_register_plugin_arg(connection_.soap(), plugin, this);
+  connection_.soap()->fignore = ignored;
+}
+
+SoapEventThread::~SoapEventThread() {
+  must_exit();
+  if (thread_.joinable()) thread_.join();
+}
+
+// Called for the elements the generated code does not know. wsnt:Message being xsd:any there, the
+// tt:Message payload of each notification ends up here, its start tag already read: it is read
+// with the generated deserializer, up to its end tag, so that gSOAP has nothing left to skip.
+int SoapEventThread::ignored(struct soap* soap, const char* tag) {
+  if (::soap_match_tag(soap, tag, "tt:Message")) return SOAP_OK;
+  auto* events = static_cast<SoapEventThread*>(::soap_lookup_plugin(soap, plugin_id));
+  if (!events) return SOAP_OK;
+  _tt__Message* message = ::soap_new__tt__Message(soap);
+  soap->peeked = 1;
+  if (!message->soap_in(soap, tag, nullptr)) return soap->error;
+  soap->body = 0;
+  events->pulled_.push_back(message);
+  return SOAP_OK;
+}
+
+// WS-Addressing headers, which most devices require to route the requests to a subscription.
+void SoapEventThread::address(const char* to, const char* action) {
+  ::soap_wsa_request(connection_.soap(), ::soap_wsa_rand_uuid(connection_.soap()), to, action);
+}
+
+// From the difference of two device times, so that the device clock does not need to be in sync.
+void SoapEventThread::expire_in(std::time_t seconds) {
+  termination_ = std::chrono::steady_clock::now() +
+                 (seconds > 0 ? std::chrono::seconds(seconds) : termination_time);
+}
+
+bool SoapEventThread::subscribe() {
+  SoapRequestScope scope(connection_.soap());
+  SoapTopicFilter filter(topics_);
+  std::string termination = duration(termination_time);
+  _tev__CreatePullPointSubscription CreatePullPointSubscription;
+  CreatePullPointSubscription.Filter = topics_.empty() ? nullptr : &filter;
+  CreatePullPointSubscription.InitialTerminationTime = &termination;
+  _tev__CreatePullPointSubscriptionResponse CreatePullPointSubscriptionResponse;
+  if (connection_.call(metrics::operation::EVENTS_CREATE_PULL_POINT_SUBSCRIPTION, [&]() {
+        address(endpoint_.c_str(), create_action);
+        return proxy_.CreatePullPointSubscription(endpoint_.c_str(), create_action,
+                                                  &CreatePullPointSubscription,
+                                                  CreatePullPointSubscriptionResponse);
+      })) {
+    std::cerr << "Could not subscribe to the events:\n";
+    ::soap_stream_fault(connection_.soap(), std::cerr);
+    return false;
+  }
+  const auto& reference = CreatePullPointSubscriptionResponse.SubscriptionReference;
+  subscription_ = reference.Address ? reference.Address : endpoint_;
+  expire_in(CreatePullPointSubscriptionResponse.wsnt__TerminationTime -
+            CreatePullPointSubscriptionResponse.wsnt__CurrentTime);
+  subscribed_ = true;
+  ++subscriptions_;
+  clog.log("SoapEventThread: subscribed, pull point ", subscription_);
+  return true;
+}
+
+bool SoapEventThread::renew() {
+  SoapRequestScope scope(connection_.soap());
+  std::string termination = duration(termination_time);
+  _wsnt__Renew Renew;
+  Renew.TerminationTime = &termination;
+  _wsnt__RenewResponse RenewResponse;
+  if (connection_.call(metrics::operation::EVENTS_RENEW, [&]() {
+        address(subscription_.c_str(), renew_action);
+        return proxy_.Renew(subscription_.c_str(), renew_action, &Renew, RenewResponse);
+      })) {
+    std::cerr << "Could not renew the event subscription:\n";
+    ::soap_stream_fault(connection_.soap(), std::cerr);
+    return false;
+  }
+  expire_in(RenewResponse.CurrentTime ? RenewResponse.TerminationTime - *RenewResponse.CurrentTime
+                                      : 0);
+  ++renewals_;
+  return true;
+}
+
+bool SoapEventThread::pull() {
+  SoapRequestScope scope(connection_.soap());
+  _tev__PullMessages PullMessages;
+  PullMessages.Timeout = pull_timeout;
+  PullMessages.MessageLimit = message_limit;
+  _tev__PullMessagesResponse PullMessagesResponse;
+  if (connection_.call(metrics::operation::EVENTS_PULL_MESSAGES, [&]() {
+        pulled_.clear();
+        connection_.hold(pull_timeout);
+        address(subscription_.c_str(), pull_action);
+        return proxy_.PullMessages(subscription_.c_str(), pull_action, &PullMessages,
+                                   PullMessagesResponse);
+      })) {
+    std::cerr << "Could not pull the events:\n";
+    ::soap_stream_fault(connection_.soap(), std::cerr);
+    return false;
+  }
+  ++pulls_;
+  // Some devices push the termination back on every pull.
+  if (PullMessagesResponse.TerminationTime > PullMessagesResponse.CurrentTime)
+    expire_in(PullMessagesResponse.TerminationTime - PullMessagesResponse.CurrentTime);
+
+  // One tt:Message per notification: matched by position.
+  const auto& notifications = PullMessagesResponse.wsnt__NotificationMessage;
+  for (size_t i = 0; i < notifications.size(); ++i)
+    if (notifications[i])
+      publish(*notifications[i], i < pulled_.size() ? pulled_[i] : nullptr);
+  messages_ += notifications.size();
+  pulled_.clear();
+  return true;
+}
+
+// Best effort: a subscription left behind terminates on its own.
+void SoapEventThread::unsubscribe() {
+  SoapRequestScope scope(connection_.soap());
+  _wsnt__Unsubscribe Unsubscribe;
+  _wsnt__UnsubscribeResponse UnsubscribeResponse;
+  connection_.call(metrics::operation::EVENTS_UNSUBSCRIBE, [&]() {
+    address(subscription_.c_str(), unsubscribe_action);
+    return proxy_.Unsubscribe(subscription_.c_str(), unsubscribe_action, &Unsubscribe,
+                              UnsubscribeResponse);
+  });
+  subscribed_ = false;
+}
+
+void SoapEventThread::publish(const wsnt__NotificationMessageHolderType& holder,
+                              const _tt__Message* message) {
+  SoapEvent event;
+  event.received = std::chrono::steady_clock::now();
+  if (holder.Topic && holder.Topic->__mixed) event.topic = trim(holder.Topic->__mixed);
+  event.utc_time = 0;
+  if (message) {
+    event.utc_time = message->UtcTime;
+    if (message->PropertyOperation) event.operation = name(*message->PropertyOperation);
+    copy(message->Source, event.source);
+    copy(message->Key, event.key);
+    copy(message->Data, event.data);
+  }
+  clog.log("SoapEventThread: ", event);
+  if (bus_.push(event, OverflowPolicy::REJECT, event.received) != SubmitResult::ACCEPTED)
+    clog.log("SoapEventThread: event bus full, dropped ", event.topic);
+}
+
+// A lost subscription (failed pull or renewal) is created again, at once since the device is
+// answering, while a failed subscription is tried again after retry_interval.
+void SoapEventThread::loop() {
+  const auto cpu = thread_cpu_time();
+  while (!exit_) {
+    if (!subscribed_) {
+      if (!subscribe()) {
+        std::unique_lock<std::mutex> lock(exit_mx_);
+        exit_cv_.wait_for(lock, retry_interval, [this]() { return exit_.load(); });
+      }
+    } else if (std::chrono::steady_clock::now() + renew_margin >= termination_ && !renew()) {
+      subscribed_ = false;
+    } else if (!pull()) {
+      subscribed_ = false;
+    }
+    cpu_ = std::chrono::duration_cast<std::chrono::nanoseconds>(thread_cpu_time() - cpu).count();
+  }
+  if (subscribed_) unsubscribe();
+}
+
+void SoapEventThread::run(const std::string& endpoint, const std::string& topics,
+                          std::chrono::milliseconds rtt) {
+  endpoint_ = endpoint;
+  topics_ = topics;
+  connection_.rtt().seed(rtt);
+  started_ = std::chrono::steady_clock::now();
+  clog.log("SoapEventThread::run: events of ", endpoint_, ", topics ",
+           topics_.empty() ? "(all)" : topics_);
+  thread_ = std::thread([this]() { loop(); });
+}
+
+void SoapEventThread::must_exit() {
+  {
+    std::lock_guard<std::mutex> lock(exit_mx_);
+    exit_ = true;
+  }
+  exit_cv_.notify_all();
+  bus_.wake_up();
+}
+
+event_stats SoapEventThread::stats() const {
+  return {subscriptions_,
+          renewals_,
+          pulls_,
+          messages_,
+          bus_.stats().rejected,
+          started_ == std::chrono::steady_clock::time_point()
+              ? std::chrono::steady_clock::duration(0)
+              : std::chrono::steady_clock::now() - started_,
+          std::chrono::nanoseconds(cpu_.load())};
+}
+
+}  // namespace soap
+}  // namespace app
\ No newline at end of file
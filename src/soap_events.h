@@ -0,0 +1,128 @@
+#ifndef DEF_SOAP_EVENTS_H
+#define DEF_SOAP_EVENTS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "mpsc_ring.h"
+#include "soap.h"
+
+#include "soap/soapPullPointSubscriptionBindingProxy.h"
+
+namespace app {
+
+namespace soap {
+
+// One notification of the device, copied out of the gSOAP managed heap.
+struct SoapEvent {
+  std::string topic;      // e.g. tns1:RuleEngine/CellMotionDetector/Motion
+  std::string operation;  // Initialized, Changed or Deleted, for the events about a property
+  std::time_t utc_time;
+  std::vector<std::pair<std::string, std::string>> source;  // SimpleItem Name and Value
+  std::vector<std::pair<std::string, std::string>> key;
+  std::vector<std::pair<std::string, std::string>> data;
+  std::chrono::steady_clock::time_point received;
+};
+
+std::ostream& operator<<(std::ostream& out, const SoapEvent& event);
+
+struct event_stats {
+  unsigned long long subscriptions;
+  unsigned long long renewals;
+  unsigned long long pulls;
+  unsigned long long messages;
+  unsigned long long dropped;  // not published: the bus was full
+  std::chrono::steady_clock::duration elapsed;  // since run()
+  std::chrono::nanoseconds cpu;                 // used by the event thread
+};
+
+// The events of the device, pulled by a thread of its own (ONVIF real-time pull point). The
+// subscription is created with the topic filter, so that the device only queues the topics asked
+// for, then PullMessages is sent in a loop: the device holds each one until it has messages, up to
+// message_limit of them, or for pull_timeout. The subscription is renewed before it terminates, and
+// created again once lost. Events are published to a bounded bus, whose newest events are dropped
+// and counted when the consumer does not keep up.
+class SoapEventThread {
+ public:
+  static constexpr size_t bus_capacity = 256;
+  static constexpr int message_limit = 64;
+  static constexpr std::chrono::seconds pull_timeout{5};
+  static constexpr std::chrono::seconds termination_time{60};
+  // Renewed once less than this is left, so that a PullMessages held for pull_timeout never
+  // outlives the subscription.
+  static constexpr std::chrono::seconds renew_margin{20};
+  static constexpr std::chrono::seconds retry_interval{5};
+
+ private:
+  mpsc_ring<SoapEvent, bus_capacity> bus_;
+  SoapConnection connection_;
+  PullPointSubscriptionBindingProxy proxy_;
+  std::string endpoint_;
+  std::string topics_;
+  std::string subscription_;  // address of the pull point
+  std::atomic<bool> subscribed_;
+  std::chrono::steady_clock::time_point termination_;
+  std::vector<_tt__Message*> pulled_;  // payloads of the response being read, in document order
+  std::atomic<bool> exit_;
+  std::mutex exit_mx_;
+  std::condition_variable exit_cv_;
+  std::thread thread_;
+  std::chrono::steady_clock::time_point started_;
+
+  std::atomic<unsigned long long> subscriptions_;
+  std::atomic<unsigned long long> renewals_;
+  std::atomic<unsigned long long> pulls_;
+  std::atomic<unsigned long long> messages_;
+  std::atomic<long long> cpu_;  // in nanoseconds
+
+  static int ignored(struct soap* soap, const char* tag);
+  void address(const char* to, const char* action);
+  void expire_in(std::time_t seconds);
+  bool subscribe();
+  bool renew();
+  bool pull();
+  void unsubscribe();
+  void publish(const wsnt__NotificationMessageHolderType& holder, const _tt__Message* message);
+  void loop();
+
+ public:
+  explicit SoapEventThread(SoapCredentials& credentials);
+  SoapEventThread(const SoapEventThread&) = delete;
+  SoapEventThread& operator=(const SoapEventThread&) = delete;
+  ~SoapEventThread();
+
+  // Starts pulling the events of the service at `endpoint`, its timeouts first estimated from
+  // `rtt`. `topics` is a ConcreteSet topic expression pushed to the device, e.g.
+  // "tns1:RuleEngine//.|tns1:VideoSource//.", empty for every topic.
+  void run(const std::string& endpoint, const std::string& topics, std::chrono::milliseconds rtt);
+  // Returns at once: the thread ends after the PullMessages in flight, if any.
+  void must_exit();
+
+  std::thread& thread() { return thread_; }
+  const std::atomic<bool>& subscribed() const { return subscribed_; }
+
+  // Consumer side, from one thread only.
+  bool next(SoapEvent& event) { return bus_.pop(event); }
+  // Sleeps until an event is published, must_exit() is called or `deadline`: true when there is an
+  // event to read.
+  bool wait_until(std::chrono::steady_clock::time_point deadline) {
+    return bus_.wait_until(exit_, deadline);
+  }
+
+  // Thread safe.
+  event_stats stats() const;
+  const SoapConnection& connection() const { return connection_; }
+};
+
+}  // namespace soap
+}  // namespace app
+
+#endif
\ No newline at end of file
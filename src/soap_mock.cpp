@@ -0,0 +1,591 @@
+#include "soap_mock.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+
+#include "soap/soapH.h"
+#include "soap/soapPTZBindingProxy.h"
+
+#include "synchronized_ostream.h"
+
+namespace app {
+namespace soap {
+
+namespace {
+
+// Optional elements and attributes of the generated types are pointers.
+template <typename T>
+T* soap_value(struct soap* soap, T value) {
+  T* p = static_cast<T*>(::soap_malloc(soap, sizeof(T)));
+  if (p) *p = value;
+  return p;
+}
+
+// The axes of a vector, unset when the vector is absent.
+std::optional<float> pan(const tt__PTZVector* v) {
+  return v && v->PanTilt ? std::optional<float>(v->PanTilt->x) : std::nullopt;
+}
+std::optional<float> tilt(const tt__PTZVector* v) {
+  return v && v->PanTilt ? std::optional<float>(v->PanTilt->y) : std::nullopt;
+}
+std::optional<float> zoom(const tt__PTZVector* v) {
+  return v && v->Zoom ? std::optional<float>(v->Zoom->x) : std::nullopt;
+}
+std::optional<float> pan(const tt__PTZSpeed* v) {
+  return v && v->PanTilt ? std::optional<float>(v->PanTilt->x) : std::nullopt;
+}
+std::optional<float> tilt(const tt__PTZSpeed* v) {
+  return v && v->PanTilt ? std::optional<float>(v->PanTilt->y) : std::nullopt;
+}
+std::optional<float> zoom(const tt__PTZSpeed* v) {
+  return v && v->Zoom ? std::optional<float>(v->Zoom->x) : std::nullopt;
+}
+
+}  // namespace
+
+/******************************************************************************\
+ *
+ *	SoapMockPTZ
+ *
+ \******************************************************************************/
+
+void SoapMockPTZ::axis::advance(float seconds) {
+  if (target) {
+    const float step = full_speed * seconds;
+    if (std::abs(*target - position) <= step) {
+      position = *target;
+      target.reset();
+    } else {
+      position += *target > position ? step : -step;
+    }
+    return;
+  }
+  if (speed == 0.f) return;
+  position += speed * full_speed * seconds;
+  // The motors stop at the end of the range.
+  if (position <= min || position >= max) {
+    position = std::max(min, std::min(max, position));
+    speed = 0.f;
+  }
+}
+
+SoapMockPTZ::SoapMockPTZ()
+    : axes_{{{pan_tilt_min, pan_tilt_max, pan_tilt_full_speed, 0.f, 0.f, std::nullopt},
+             {pan_tilt_min, pan_tilt_max, pan_tilt_full_speed, 0.f, 0.f, std::nullopt},
+             {zoom_min, zoom_max, zoom_full_speed, 0.f, 0.f, std::nullopt}}},
+      updated_(std::chrono::steady_clock::now()) {}
+
+void SoapMockPTZ::advance(std::chrono::steady_clock::time_point now) {
+  if (until_ && *until_ < now) {
+    const float seconds = std::chrono::duration<float>(*until_ - updated_).count();
+    for (auto& a : axes_) {
+      a.advance(std::max(0.f, seconds));
+      a.speed = 0.f;
+    }
+    updated_ = std::max(updated_, *until_);
+    until_.reset();
+  }
+  const float seconds = std::chrono::duration<float>(now - updated_).count();
+  for (auto& a : axes_) a.advance(seconds);
+  updated_ = now;
+}
+
+void SoapMockPTZ::continuous(std::optional<float> pan, std::optional<float> tilt,
+                             std::optional<float> zoom,
+                             std::optional<std::chrono::nanoseconds> timeout) {
+  const auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(mx_);
+  advance(now);
+  const std::optional<float> speeds[] = {pan, tilt, zoom};
+  for (size_t i = 0; i < axes_.size(); ++i) {
+    if (!speeds[i]) continue;
+    axes_[i].speed = std::max(-1.f, std::min(1.f, *speeds[i]));
+    axes_[i].target.reset();
+  }
+  if (timeout)
+    until_ = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(*timeout);
+  else
+    until_.reset();
+}
+
+void SoapMockPTZ::stop(bool pan_tilt, bool zoom) {
+  std::lock_guard<std::mutex> lock(mx_);
+  advance(std::chrono::steady_clock::now());
+  for (size_t i = 0; i < axes_.size(); ++i) {
+    if (i < 2 ? !pan_tilt : !zoom) continue;
+    axes_[i].speed = 0.f;
+    axes_[i].target.reset();
+  }
+}
+
+void SoapMockPTZ::relative(std::optional<float> pan, std::optional<float> tilt,
+                           std::optional<float> zoom) {
+  std::lock_guard<std::mutex> lock(mx_);
+  advance(std::chrono::steady_clock::now());
+  const std::optional<float> translations[] = {pan, tilt, zoom};
+  for (size_t i = 0; i < axes_.size(); ++i) {
+    if (!translations[i]) continue;
+    axis& a = axes_[i];
+    // From the target of a move in progress, as the device adds them up.
+    const float from = a.target ? *a.target : a.position;
+    a.target = std::max(a.min, std::min(a.max, from + *translations[i]));
+    a.speed = 0.f;
+  }
+}
+
+void SoapMockPTZ::absolute(std::optional<float> pan, std::optional<float> tilt,
+                           std::optional<float> zoom) {
+  std::lock_guard<std::mutex> lock(mx_);
+  advance(std::chrono::steady_clock::now());
+  const std::optional<float> positions[] = {pan, tilt, zoom};
+  for (size_t i = 0; i < axes_.size(); ++i) {
+    if (!positions[i]) continue;
+    axes_[i].target = std::max(axes_[i].min, std::min(axes_[i].max, *positions[i]));
+    axes_[i].speed = 0.f;
+  }
+}
+
+SoapMockPTZ::position SoapMockPTZ::status(bool& pan_tilt_moving, bool& zoom_moving) {
+  std::lock_guard<std::mutex> lock(mx_);
+  advance(std::chrono::steady_clock::now());
+  pan_tilt_moving = axes_[0].moving() || axes_[1].moving();
+  zoom_moving = axes_[2].moving();
+  return {axes_[0].position, axes_[1].position, axes_[2].position};
+}
+
+/******************************************************************************\
+ *
+ *	SoapMockDevice
+ *
+ \******************************************************************************/
+
+SoapMockDevice::SoapMockDevice(unsigned seed)
+    : master_(nullptr),
+      port_(0),
+      profiles_{},
+      stats_{},
+      random_(seed),
+      ir_cut_filter_(static_cast<int>(tt__IrCutFilterMode::AUTO)),
+      accepted_(0),
+      exit_(false) {}
+
+SoapMockDevice::~SoapMockDevice() { stop(); }
+
+void SoapMockDevice::set(metrics::operation op, const mock_profile& profile) {
+  std::lock_guard<std::mutex> lock(mx_);
+  profiles_[static_cast<size_t>(op)] = profile;
+}
+
+void SoapMockDevice::set(const mock_profile& profile) {
+  std::lock_guard<std::mutex> lock(mx_);
+  profiles_.fill(profile);
+}
+
+mock_stats SoapMockDevice::stats(metrics::operation op) const {
+  std::lock_guard<std::mutex> lock(mx_);
+  return stats_[static_cast<size_t>(op)];
+}
+
+unsigned long long SoapMockDevice::connections() const {
+  std::lock_guard<std::mutex> lock(mx_);
+  return accepted_;
+}
+
+void SoapMockDevice::dump(std::ostream& out) const {
+  std::lock_guard<std::mutex> lock(mx_);
+  out << std::setw(36) << "" << std::setw(10) << "requests" << std::setw(10) << "faults"
+      << std::setw(10) << "drops" << '\n';
+  for (size_t i = 0; i < stats_.size(); ++i) {
+    if (!stats_[i].requests) continue;
+    out << std::setw(36) << metrics::name(static_cast<metrics::operation>(i)) << std::setw(10)
+        << stats_[i].requests << std::setw(10) << stats_[i].faults << std::setw(10)
+        << stats_[i].drops << '\n';
+  }
+  out << "Connections: " << accepted_ << '\n';
+}
+
+std::string SoapMockDevice::xaddr(const char* service) const {
+  return "http://" + host_ + ':' + std::to_string(port_) + "/onvif/" + service;
+}
+
+bool SoapMockDevice::start(const std::string& host, int port) {
+  master_ = ::soap_new1(SOAP_IO_KEEPALIVE | SOAP_XML_CANONICAL);
+  // The namespaces of the proxies, shared by every service.
+  PTZBindingProxy namespaces(master_);
+  master_->bind_flags = SO_REUSEADDR;
+  master_->accept_timeout =
+      -static_cast<int>(std::chrono::microseconds(poll_interval).count());
+  if (!soap_valid_socket(::soap_bind(master_, host.c_str(), port, 100))) {
+    std::cerr << "SoapMockDevice: could not listen on " << host << ':' << port << ": ";
+    ::soap_stream_fault(master_, std::cerr);
+    ::soap_free(master_);
+    master_ = nullptr;
+    return false;
+  }
+  sockaddr_in address{};
+  SOAP_SOCKLEN_T length = sizeof address;
+  if (::getsockname(master_->master, reinterpret_cast<sockaddr*>(&address), &length)) {
+    std::cerr << "SoapMockDevice: could not read the port listened on\n";
+    ::soap_free(master_);
+    master_ = nullptr;
+    return false;
+  }
+  host_ = host;
+  port_ = ntohs(address.sin_port);
+  exit_ = false;
+  listener_ = std::thread([this]() { listen(); });
+  clog.log("SoapMockDevice: listening on ", endpoint());
+  return true;
+}
+
+void SoapMockDevice::stop() {
+  if (!master_) return;
+  exit_ = true;
+  cv_.notify_all();
+  if (listener_.joinable()) listener_.join();
+  {
+    // Wakes up the threads waiting for a request.
+    std::lock_guard<std::mutex> lock(mx_);
+    for (auto& c : connections_)
+      if (c.soap && soap_valid_socket(c.soap->socket))
+        c.soap->fshutdownsocket(c.soap, c.soap->socket, SOAP_SHUT_RDWR);
+  }
+  for (auto& c : connections_) c.thread.join();
+  connections_.clear();
+  ::soap_free(master_);
+  master_ = nullptr;
+}
+
+void SoapMockDevice::listen() {
+  while (!exit_) {
+    if (!soap_valid_socket(::soap_accept(master_))) {
+      // No errnum: accept_timeout, only there for exit_ to be seen.
+      if (master_->errnum && !exit_) {
+        std::cerr << "SoapMockDevice: ";
+        ::soap_stream_fault(master_, std::cerr);
+      }
+      continue;
+    }
+    struct soap* soap = ::soap_copy(master_);
+    if (!soap) {
+      ::soap_force_closesock(master_);
+      continue;
+    }
+    soap->recv_timeout = soap->send_timeout = static_cast<int>(keep_alive_timeout.count());
+
+    std::lock_guard<std::mutex> lock(mx_);
+    // The threads of the connections closed since are done with.
+    for (auto c = connections_.begin(); c != connections_.end();) {
+      if (!c->done) {
+        ++c;
+        continue;
+      }
+      c->thread.join();
+      c = connections_.erase(c);
+    }
+    connections_.push_back({soap, std::thread(), false});
+    connection& c = connections_.back();
+    c.thread = std::thread([this, &c]() { serve(c); });
+    ++accepted_;
+  }
+}
+
+// The loop of soap_serve(): requests on the connection for as long as it is kept alive.
+void SoapMockDevice::serve(connection& c) {
+  struct soap* soap = c.soap;
+  soap->keep_alive = soap->max_keep_alive + 1;
+  do {
+    if (soap->keep_alive > 0 && soap->max_keep_alive > 0) soap->keep_alive--;
+    if (::soap_begin_serve(soap)) {
+      if (soap->error >= SOAP_STOP) continue;
+      break;
+    }
+    if (dispatch(soap) && soap->error && soap->error < SOAP_STOP) ::soap_send_fault(soap);
+    ::soap_destroy(soap);
+    ::soap_end(soap);
+  } while (soap->keep_alive && !exit_);
+
+  {
+    std::lock_guard<std::mutex> lock(mx_);
+    c.soap = nullptr;
+  }
+  ::soap_destroy(soap);
+  ::soap_end(soap);
+  ::soap_free(soap);
+  std::lock_guard<std::mutex> lock(mx_);
+  c.done = true;
+}
+
+bool SoapMockDevice::rest(std::chrono::steady_clock::duration duration) {
+  std::unique_lock<std::mutex> lock(mx_);
+  return !cv_.wait_for(lock, duration, [this]() { return exit_.load(); });
+}
+
+int SoapMockDevice::hang_up(struct soap* soap) {
+  soap->keep_alive = 0;
+  ::soap_force_closesock(soap);
+  return soap->error = SOAP_STOP;
+}
+
+int SoapMockDevice::behave(struct soap* soap, metrics::operation op) {
+  std::chrono::microseconds delay;
+  bool fault = false, drop = false;
+  {
+    std::lock_guard<std::mutex> lock(mx_);
+    const mock_profile& profile = profiles_[static_cast<size_t>(op)];
+    mock_stats& stats = stats_[static_cast<size_t>(op)];
+    ++stats.requests;
+    delay = profile.latency;
+    if (profile.jitter.count() > 0)
+      delay += std::chrono::microseconds(std::uniform_int_distribution<long long>(
+          0, std::chrono::microseconds(profile.jitter).count())(random_));
+    std::uniform_real_distribution<double> roll(0., 1.);
+    drop = profile.drop_rate > 0. && roll(random_) < profile.drop_rate;
+    fault = !drop && profile.fault_rate > 0. && roll(random_) < profile.fault_rate;
+    if (drop) ++stats.drops;
+    if (fault) ++stats.faults;
+  }
+  if (!rest(delay) || drop) return hang_up(soap);
+  if (fault) return ::soap_receiver_fault(soap, "Fault injected by the mock device", nullptr);
+  return SOAP_OK;
+}
+
+// As the skeletons of soapcpp2 do for one operation: the rest of the request, then a counting pass
+// for the HTTP length, and the response.
+template <typename Request, typename Response, typename Handler>
+int SoapMockDevice::serve(struct soap* soap, metrics::operation op, const char* request_tag,
+                          const char* response_tag, Handler&& handle) {
+  Request request;
+  request.soap_default(soap);
+  if (!request.soap_get(soap, request_tag, nullptr) || ::soap_body_end_in(soap) ||
+      ::soap_envelope_end_in(soap) || ::soap_end_recv(soap))
+    return soap->error;
+  // The header of the request (WS-Security, WS-Addressing) is not echoed back.
+  soap->header = nullptr;
+  if (const int error = behave(soap, op)) return error;
+  Response response;
+  response.soap_default(soap);
+  if (const int error = handle(soap, request, response)) return error;
+
+  const auto put = [soap, &response, response_tag]() {
+    return ::soap_envelope_begin_out(soap) || ::soap_putheader(soap) ||
+           ::soap_body_begin_out(soap) || response.soap_put(soap, response_tag, "") ||
+           ::soap_body_end_out(soap) || ::soap_envelope_end_out(soap);
+  };
+  soap->encodingStyle = nullptr;
+  ::soap_serializeheader(soap);
+  response.soap_serialize(soap);
+  if (::soap_begin_count(soap) || ((soap->mode & SOAP_IO_LENGTH) && put()) ||
+      ::soap_end_count(soap) || ::soap_response(soap, SOAP_OK) || put() || ::soap_end_send(soap))
+    return soap->error;
+  return ::soap_closesock(soap);
+}
+
+int SoapMockDevice::dispatch(struct soap* soap) {
+  using operation = metrics::operation;
+  ::soap_peek_element(soap);
+  const auto is = [soap](const char* tag) { return !::soap_match_tag(soap, soap->tag, tag); };
+
+  // Device
+  if (is("tds:GetDeviceInformation"))
+    return serve<_tds__GetDeviceInformation, _tds__GetDeviceInformationResponse>(
+        soap, operation::DEVICE_GET_DEVICE_INFORMATION, "tds:GetDeviceInformation",
+        "tds:GetDeviceInformationResponse",
+        [](struct soap*, const auto&, _tds__GetDeviceInformationResponse& response) {
+          response.Manufacturer = "Mock";
+          response.Model = model;
+          response.FirmwareVersion = "V1.0.0 build 000000";
+          response.SerialNumber = "MOCK00000000000000";
+          response.HardwareId = "0";
+          return SOAP_OK;
+        });
+  if (is("tds:GetCapabilities"))
+    return serve<_tds__GetCapabilities, _tds__GetCapabilitiesResponse>(
+        soap, operation::DEVICE_GET_CAPABILITIES, "tds:GetCapabilities",
+        "tds:GetCapabilitiesResponse",
+        [this](struct soap* soap, const auto&, _tds__GetCapabilitiesResponse& response) {
+          tt__Capabilities* capabilities = ::soap_new_tt__Capabilities(soap);
+          capabilities->Device = ::soap_new_tt__DeviceCapabilities(soap);
+          capabilities->Device->XAddr = xaddr("device_service");
+          capabilities->Media = ::soap_new_tt__MediaCapabilities(soap);
+          capabilities->Media->XAddr = xaddr("Media");
+          capabilities->PTZ = ::soap_new_tt__PTZCapabilities(soap);
+          capabilities->PTZ->XAddr = xaddr("PTZ");
+          capabilities->Imaging = ::soap_new_tt__ImagingCapabilities(soap);
+          capabilities->Imaging->XAddr = xaddr("Imaging");
+          capabilities->Events = ::soap_new_tt__EventCapabilities(soap);
+          capabilities->Events->XAddr = xaddr("Events");
+          capabilities->Events->WSPullPointSupport = true;
+          response.Capabilities = capabilities;
+          return SOAP_OK;
+        });
+
+  // Media
+  if (is("trt:GetProfiles"))
+    return serve<_trt__GetProfiles, _trt__GetProfilesResponse>(
+        soap, operation::MEDIA_GET_PROFILES, "trt:GetProfiles", "trt:GetProfilesResponse",
+        [](struct soap* soap, const auto&, _trt__GetProfilesResponse& response) {
+          tt__Profile* profile = ::soap_new_tt__Profile(soap);
+          profile->token = profile_token;
+          profile->Name = "mainStream";
+          profile->VideoSourceConfiguration = ::soap_new_tt__VideoSourceConfiguration(soap);
+          profile->VideoSourceConfiguration->token = "VideoSourceConfig_1";
+          profile->VideoSourceConfiguration->SourceToken = video_source_token;
+          profile->AudioSourceConfiguration = ::soap_new_tt__AudioSourceConfiguration(soap);
+          profile->AudioSourceConfiguration->token = "AudioSourceConfig_1";
+          profile->AudioSourceConfiguration->SourceToken = "AudioSource_1";
+          tt__PTZConfiguration* ptz = ::soap_new_tt__PTZConfiguration(soap);
+          ptz->token = "PTZConfig_1";
+          ptz->NodeToken = "PTZNode_1";
+          ptz->PanTiltLimits = ::soap_new_tt__PanTiltLimits(soap);
+          ptz->PanTiltLimits->Range = ::soap_new_set_tt__Space2DDescription(
+              soap, "http://www.onvif.org/ver10/tptz/PanTiltSpaces/PositionGenericSpace",
+              ::soap_new_set_tt__FloatRange(soap, SoapMockPTZ::pan_tilt_min,
+                                            SoapMockPTZ::pan_tilt_max),
+              ::soap_new_set_tt__FloatRange(soap, SoapMockPTZ::pan_tilt_min,
+                                            SoapMockPTZ::pan_tilt_max));
+          ptz->ZoomLimits = ::soap_new_tt__ZoomLimits(soap);
+          ptz->ZoomLimits->Range = ::soap_new_set_tt__Space1DDescription(
+              soap, "http://www.onvif.org/ver10/tptz/ZoomSpaces/PositionGenericSpace",
+              ::soap_new_set_tt__FloatRange(soap, SoapMockPTZ::zoom_min, SoapMockPTZ::zoom_max));
+          profile->PTZConfiguration = ptz;
+          response.Profiles.push_back(profile);
+          return SOAP_OK;
+        });
+  if (is("trt:GetAudioOutputs"))
+    return serve<_trt__GetAudioOutputs, _trt__GetAudioOutputsResponse>(
+        soap, operation::MEDIA_GET_AUDIO_OUTPUTS, "trt:GetAudioOutputs",
+        "trt:GetAudioOutputsResponse",
+        [](struct soap* soap, const auto&, _trt__GetAudioOutputsResponse& response) {
+          tt__AudioOutput* output = ::soap_new_tt__AudioOutput(soap);
+          output->token = "AudioOutput_1";
+          response.AudioOutputs.push_back(output);
+          return SOAP_OK;
+        });
+
+  // PTZ
+  if (is("tptz:ContinuousMove"))
+    return serve<_tptz__ContinuousMove, _tptz__ContinuousMoveResponse>(
+        soap, operation::PTZ_CONTINUOUS_MOVE, "tptz:ContinuousMove",
+        "tptz:ContinuousMoveResponse",
+        [this](struct soap*, const _tptz__ContinuousMove& request, auto&) {
+          const tt__PTZSpeed* speed = request.Velocity;
+          std::optional<std::chrono::nanoseconds> timeout;
+          if (request.Timeout) timeout = *request.Timeout;
+          ptz_.continuous(pan(speed), tilt(speed), zoom(speed), timeout);
+          return SOAP_OK;
+        });
+  if (is("tptz:Stop"))
+    return serve<_tptz__Stop, _tptz__StopResponse>(
+        soap, operation::PTZ_STOP, "tptz:Stop", "tptz:StopResponse",
+        [this](struct soap*, const _tptz__Stop& request, auto&) {
+          // Neither axis given: both are stopped.
+          const bool all = !request.PanTilt && !request.Zoom;
+          ptz_.stop(all || (request.PanTilt && *request.PanTilt),
+                    all || (request.Zoom && *request.Zoom));
+          return SOAP_OK;
+        });
+  if (is("tptz:RelativeMove"))
+    return serve<_tptz__RelativeMove, _tptz__RelativeMoveResponse>(
+        soap, operation::PTZ_RELATIVE_MOVE, "tptz:RelativeMove", "tptz:RelativeMoveResponse",
+        [this](struct soap*, const _tptz__RelativeMove& request, auto&) {
+          const tt__PTZVector* by = request.Translation;
+          ptz_.relative(pan(by), tilt(by), zoom(by));
+          return SOAP_OK;
+        });
+  if (is("tptz:AbsoluteMove"))
+    return serve<_tptz__AbsoluteMove, _tptz__AbsoluteMoveResponse>(
+        soap, operation::PTZ_ABSOLUTE_MOVE, "tptz:AbsoluteMove", "tptz:AbsoluteMoveResponse",
+        [this](struct soap*, const _tptz__AbsoluteMove& request, auto&) {
+          const tt__PTZVector* to = request.Position;
+          ptz_.absolute(pan(to), tilt(to), zoom(to));
+          return SOAP_OK;
+        });
+  if (is("tptz:GetStatus"))
+    return serve<_tptz__GetStatus, _tptz__GetStatusResponse>(
+        soap, operation::PTZ_GET_STATUS, "tptz:GetStatus", "tptz:GetStatusResponse",
+        [this](struct soap* soap, const auto&, _tptz__GetStatusResponse& response) {
+          bool pan_tilt_moving, zoom_moving;
+          const SoapMockPTZ::position p = ptz_.status(pan_tilt_moving, zoom_moving);
+          tt__PTZStatus* status = ::soap_new_tt__PTZStatus(soap);
+          status->Position = ::soap_new_set_tt__PTZVector(
+              soap, ::soap_new_set_tt__Vector2D(soap, p.pan, p.tilt, nullptr),
+              ::soap_new_set_tt__Vector1D(soap, p.zoom, nullptr));
+          status->MoveStatus = ::soap_new_set_tt__PTZMoveStatus(
+              soap,
+              soap_value(soap, pan_tilt_moving ? tt__MoveStatus::MOVING : tt__MoveStatus::IDLE),
+              soap_value(soap, zoom_moving ? tt__MoveStatus::MOVING : tt__MoveStatus::IDLE));
+          status->UtcTime = std::time(nullptr);
+          response.PTZStatus = status;
+          return SOAP_OK;
+        });
+
+  // Imaging
+  if (is("timg:GetImagingSettings"))
+    return serve<_timg__GetImagingSettings, _timg__GetImagingSettingsResponse>(
+        soap, operation::IMAGING_GET_IMAGING_SETTINGS, "timg:GetImagingSettings",
+        "timg:GetImagingSettingsResponse",
+        [this](struct soap* soap, const auto&, _timg__GetImagingSettingsResponse& response) {
+          response.ImagingSettings = ::soap_new_tt__ImagingSettings20(soap);
+          std::lock_guard<std::mutex> lock(mx_);
+          response.ImagingSettings->IrCutFilter =
+              soap_value(soap, static_cast<tt__IrCutFilterMode>(ir_cut_filter_));
+          return SOAP_OK;
+        });
+  if (is("timg:SetImagingSettings"))
+    return serve<_timg__SetImagingSettings, _timg__SetImagingSettingsResponse>(
+        soap, operation::IMAGING_SET_IMAGING_SETTINGS, "timg:SetImagingSettings",
+        "timg:SetImagingSettingsResponse",
+        [this](struct soap*, const _timg__SetImagingSettings& request, auto&) {
+          if (request.ImagingSettings && request.ImagingSettings->IrCutFilter) {
+            std::lock_guard<std::mutex> lock(mx_);
+            ir_cut_filter_ = static_cast<int>(*request.ImagingSettings->IrCutFilter);
+          }
+          return SOAP_OK;
+        });
+
+  // Events: a pull point without any event, whose pulls are held for their timeout.
+  if (is("tev:CreatePullPointSubscription"))
+    return serve<_tev__CreatePullPointSubscription, _tev__CreatePullPointSubscriptionResponse>(
+        soap, operation::EVENTS_CREATE_PULL_POINT_SUBSCRIPTION, "tev:CreatePullPointSubscription",
+        "tev:CreatePullPointSubscriptionResponse",
+        [this](struct soap* soap, const auto&, auto& response) {
+          response.SubscriptionReference.Address =
+              ::soap_strdup(soap, xaddr("Events/PullPoint").c_str());
+          response.wsnt__CurrentTime = std::time(nullptr);
+          response.wsnt__TerminationTime =
+              response.wsnt__CurrentTime + subscription_lifetime.count();
+          return SOAP_OK;
+        });
+  if (is("tev:PullMessages"))
+    return serve<_tev__PullMessages, _tev__PullMessagesResponse>(
+        soap, operation::EVENTS_PULL_MESSAGES, "tev:PullMessages", "tev:PullMessagesResponse",
+        [this](struct soap* soap, const _tev__PullMessages& request,
+               _tev__PullMessagesResponse& response) {
+          if (!rest(request.Timeout)) return hang_up(soap);
+          response.CurrentTime = std::time(nullptr);
+          response.TerminationTime = response.CurrentTime + subscription_lifetime.count();
+          return SOAP_OK;
+        });
+  if (is("wsnt:Renew"))
+    return serve<_wsnt__Renew, _wsnt__RenewResponse>(
+        soap, operation::EVENTS_RENEW, "wsnt:Renew", "wsnt:RenewResponse",
+        [](struct soap* soap, const auto&, _wsnt__RenewResponse& response) {
+          response.CurrentTime = soap_value(soap, std::time(nullptr));
+          response.TerminationTime = *response.CurrentTime + subscription_lifetime.count();
+          return SOAP_OK;
+        });
+  if (is("wsnt:Unsubscribe"))
+    return serve<_wsnt__Unsubscribe, _wsnt__UnsubscribeResponse>(
+        soap, operation::EVENTS_UNSUBSCRIBE, "wsnt:Unsubscribe", "wsnt:UnsubscribeResponse",
+        [](struct soap*, const auto&, auto&) { return SOAP_OK; });
+
+  clog.log("SoapMockDevice: no operation for ", soap->tag);
+  return soap->error = SOAP_NO_METHOD;
+}
+
+}  // namespace soap
+}  // namespace app
\ No newline at end of file
@@ -0,0 +1,169 @@
+#ifndef DEF_SOAP_MOCK_H
+#define DEF_SOAP_MOCK_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include <stdsoap2.h>
+
+#include "metrics.h"
+
+namespace app {
+
+namespace soap {
+
+// How a mock device answers one ONVIF operation.
+struct mock_profile {
+  std::chrono::milliseconds latency{0};  // before the answer, whatever it is
+  std::chrono::milliseconds jitter{0};   // added to the latency, uniform in [0, jitter]
+  double fault_rate = 0.;                // answered with a SOAP fault
+  double drop_rate = 0.;                 // the connection closed instead of answered
+};
+
+struct mock_stats {
+  unsigned long long requests;
+  unsigned long long faults;
+  unsigned long long drops;
+};
+
+// The pan/tilt/zoom head of a mock device, in the generic ONVIF spaces: pan and tilt in [-1, 1],
+// zoom in [0, 1]. A continuous move runs at its speed times full_speed until stopped, its timeout
+// or the end of the range, a relative or absolute move heads for its target at full speed.
+class SoapMockPTZ {
+ public:
+  struct position {
+    float pan;
+    float tilt;
+    float zoom;
+  };
+
+  static constexpr float pan_tilt_min = -1.f;
+  static constexpr float pan_tilt_max = 1.f;
+  static constexpr float zoom_min = 0.f;
+  static constexpr float zoom_max = 1.f;
+  static constexpr float pan_tilt_full_speed = 1.f;  // per second
+  static constexpr float zoom_full_speed = 0.5f;
+
+ private:
+  struct axis {
+    float min;
+    float max;
+    float full_speed;
+    float position;
+    float speed;  // of the continuous move, in [-1, 1]
+    std::optional<float> target;
+
+    void advance(float seconds);
+    bool moving() const { return speed != 0.f || target; }
+  };
+
+  mutable std::mutex mx_;
+  std::array<axis, 3> axes_;  // pan, tilt, zoom
+  std::chrono::steady_clock::time_point updated_;
+  std::optional<std::chrono::steady_clock::time_point> until_;  // of the continuous move
+
+  void advance(std::chrono::steady_clock::time_point now);
+
+ public:
+  SoapMockPTZ();
+
+  void continuous(std::optional<float> pan, std::optional<float> tilt, std::optional<float> zoom,
+                  std::optional<std::chrono::nanoseconds> timeout);
+  void stop(bool pan_tilt, bool zoom);
+  void relative(std::optional<float> pan, std::optional<float> tilt, std::optional<float> zoom);
+  void absolute(std::optional<float> pan, std::optional<float> tilt, std::optional<float> zoom);
+  position status(bool& pan_tilt_moving, bool& zoom_moving);
+};
+
+// A local stand-in for an ONVIF camera, so that the SoapThread can be measured without one: the
+// Device, Media, PTZ, Imaging and Events requests the application sends are answered on a single
+// port, whatever the path, by the generated serializers of the proxies. Every connection is served
+// by a thread of its own, kept alive as the device does. Each operation has its profile of latency
+// and failures, drawn from a seeded generator so that a run can be replayed. WS-Security headers
+// are read, not checked.
+class SoapMockDevice {
+ public:
+  static constexpr auto model = "ONVIF-MOCK-PTZ";
+  static constexpr auto profile_token = "Profile_1";
+  static constexpr auto video_source_token = "VideoSource_1";
+  // How often the threads blocked on the network look for stop().
+  static constexpr std::chrono::milliseconds poll_interval{200};
+  // An idle connection is closed after this, as a device does.
+  static constexpr std::chrono::seconds keep_alive_timeout{60};
+  static constexpr std::chrono::seconds subscription_lifetime{60};
+
+ private:
+  struct connection {
+    struct soap* soap;  // null once closing
+    std::thread thread;
+    bool done;
+  };
+
+  struct soap* master_;
+  std::string host_;
+  int port_;
+  SoapMockPTZ ptz_;
+
+  mutable std::mutex mx_;
+  std::condition_variable cv_;
+  std::array<mock_profile, static_cast<size_t>(metrics::operation::COUNT)> profiles_;
+  std::array<mock_stats, static_cast<size_t>(metrics::operation::COUNT)> stats_;
+  std::mt19937 random_;
+  int ir_cut_filter_;  // tt__IrCutFilterMode
+  std::list<connection> connections_;
+  unsigned long long accepted_;
+
+  std::atomic<bool> exit_;
+  std::thread listener_;
+
+  std::string xaddr(const char* service) const;
+  void listen();
+  void serve(connection& c);
+  int dispatch(struct soap* soap);
+  template <typename Request, typename Response, typename Handler>
+  int serve(struct soap* soap, metrics::operation op, const char* request_tag,
+            const char* response_tag, Handler&& handle);
+  // Waits for the profile of `op`, then rolls its failures.
+  int behave(struct soap* soap, metrics::operation op);
+  // Waits for `duration`, false when stopped meanwhile.
+  bool rest(std::chrono::steady_clock::duration duration);
+  // Closes the connection without an answer.
+  static int hang_up(struct soap* soap);
+
+ public:
+  explicit SoapMockDevice(unsigned seed = 1);
+  SoapMockDevice(const SoapMockDevice&) = delete;
+  SoapMockDevice& operator=(const SoapMockDevice&) = delete;
+  ~SoapMockDevice();
+
+  void set(metrics::operation op, const mock_profile& profile);
+  void set(const mock_profile& profile);  // of every operation
+
+  // Listens on `host`:`port`, any free port when 0.
+  bool start(const std::string& host = "127.0.0.1", int port = 0);
+  // Closes the connections, and waits for their threads.
+  void stop();
+
+  int port() const { return port_; }
+  // The device service, as given to the application.
+  std::string endpoint() const { return xaddr("device_service"); }
+  SoapMockPTZ& ptz() { return ptz_; }
+  mock_stats stats(metrics::operation op) const;
+  unsigned long long connections() const;
+  // One line per operation served: requests, faults and drops, then the connections accepted.
+  void dump(std::ostream& out) const;
+};
+
+}  // namespace soap
+}  // namespace app
+
+#endif
\ No newline at end of file
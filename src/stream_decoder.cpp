@@ -0,0 +1,235 @@
+#include "stream_decoder.h"
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include "synchronized_ostream.h"
+#include "util.h"
+
+namespace app {
+
+std::array<std::atomic<StreamDecoder*>, PLAYM4_MAX_SUPPORTS> StreamDecoder::decoders_;
+
+/******************************************************************************\
+ *
+ *	Frame
+ *
+ \******************************************************************************/
+
+void Frame::release() {
+  if (buffer_ && buffer_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    buffer_->pool->recycle(buffer_);
+  buffer_ = nullptr;
+}
+
+/******************************************************************************\
+ *
+ *	FramePool
+ *
+ \******************************************************************************/
+
+FramePool::FramePool() {
+  for (uint32_t i = 0; i < count; ++i) {
+    FrameBuffer& b = buffers_[i];
+    b.refs.store(0, std::memory_order_relaxed);
+    b.pool = this;
+    b.index = i;
+    b.capacity = 0;
+    uint32_t index = i;
+    free_.push(index, OverflowPolicy::REJECT, std::chrono::steady_clock::time_point::max());
+  }
+}
+
+FrameBuffer* FramePool::take(size_t size) {
+  uint32_t index;
+  if (!free_.pop(index)) return nullptr;
+  FrameBuffer* buffer = &buffers_[index];
+  if (buffer->capacity < size) {
+    buffer->memory.reset(new unsigned char[size]);
+    buffer->capacity = size;
+  }
+  buffer->refs.store(1, std::memory_order_relaxed);
+  return buffer;
+}
+
+void FramePool::recycle(FrameBuffer* buffer) {
+  uint32_t index = buffer->index;
+  free_.push(index, OverflowPolicy::REJECT, std::chrono::steady_clock::time_point::max());
+}
+
+// Read while the decoder runs, the capacities may be a frame late.
+size_t FramePool::footprint() const {
+  size_t bytes = 0;
+  for (const auto& b : buffers_) bytes += b.capacity;
+  return bytes;
+}
+
+/******************************************************************************\
+ *
+ *	StreamDecoder
+ *
+ \******************************************************************************/
+
+StreamDecoder::StreamDecoder(std::string name, frame_function on_frame)
+    : name_(std::move(name)),
+      on_frame_(std::move(on_frame)),
+      consumer_(name_ + " decoder", StreamBackpressure::SKIP_TO_KEYFRAME,
+                [this](const StreamPacket& packet) { input(packet); }),
+      tap_(nullptr),
+      port_(-1),
+      packets_(0),
+      rejected_(0),
+      frames_(0),
+      dropped_(0),
+      first_frame_(0),
+      last_frame_(0),
+      first_cpu_(0),
+      last_cpu_(0) {}
+
+StreamDecoder::~StreamDecoder() { stop(); }
+
+bool StreamDecoder::start(StreamTap& tap) {
+  consumer_.start();
+  if (!tap.attach(consumer_)) {
+    consumer_.stop();
+    return false;
+  }
+  tap_ = &tap;
+  return true;
+}
+
+void StreamDecoder::stop() {
+  if (tap_) {
+    tap_->detach(consumer_);
+    tap_ = nullptr;
+  }
+  consumer_.stop();
+  close();
+}
+
+// From the consumer thread, as are input() and close().
+bool StreamDecoder::open(const StreamPacket& header) {
+  if (!::PlayM4_GetPort(&port_)) {
+    std::cerr << name_ << ": no free PlayM4 port\n";
+    port_ = -1;
+    return false;
+  }
+  decoders_[port_].store(this, std::memory_order_release);
+  if (!::PlayM4_SetStreamOpenMode(port_, STREAME_REALTIME) ||
+      !::PlayM4_OpenStream(port_, const_cast<PBYTE>(header.data()),
+                           static_cast<DWORD>(header.size()), stream_buffer) ||
+      !::PlayM4_SetDecCallBackMend(port_, &StreamDecoder::decode_callback, port_) ||
+      !::PlayM4_Play(port_, nullptr)) {
+    std::cerr << name_ << ": could not open the decoder (PlayM4 error "
+              << ::PlayM4_GetLastError(port_) << ")\n";
+    close();
+    return false;
+  }
+  clog.log("StreamDecoder::open: ", name_, " on port ", port_);
+  return true;
+}
+
+void StreamDecoder::close() {
+  if (port_ < 0) return;
+  ::PlayM4_Stop(port_);
+  ::PlayM4_CloseStream(port_);
+  decoders_[port_].store(nullptr, std::memory_order_release);
+  ::PlayM4_FreePort(port_);
+  port_ = -1;
+}
+
+void StreamDecoder::input(const StreamPacket& packet) {
+  if (packet.type() == NET_DVR_SYSHEAD) {
+    // The stream started again: a new header, a new port.
+    close();
+    open(packet);
+    return;
+  }
+  if (port_ < 0 || packet.type() != NET_DVR_STREAMDATA) return;
+  packets_.fetch_add(1, std::memory_order_relaxed);
+  const auto deadline = std::chrono::steady_clock::now() + input_timeout;
+  while (!::PlayM4_InputData(port_, const_cast<PBYTE>(packet.data()),
+                             static_cast<DWORD>(packet.size()))) {
+    // Meanwhile the ring of the consumer fills up: the tap skips to the next keyframe.
+    if (::PlayM4_GetLastError(port_) != PLAYM4_BUF_OVER ||
+        std::chrono::steady_clock::now() >= deadline) {
+      rejected_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    std::this_thread::sleep_for(input_retry);
+  }
+}
+
+void CALLBACK StreamDecoder::decode_callback(long port, char* data, long size, FRAME_INFO* info,
+                                             long user, long reserved) {
+  if (port < 0 || port >= PLAYM4_MAX_SUPPORTS || !info) return;
+  if (StreamDecoder* d = decoders_[port].load(std::memory_order_acquire))
+    d->decoded(data, size, *info);
+}
+
+// From the decode thread of the port.
+void StreamDecoder::decoded(const char* data, long size, const FRAME_INFO& info) {
+  if (info.nType != T_YV12 || size <= 0) return;
+  const auto now = std::chrono::steady_clock::now();
+  const auto cpu = thread_cpu_time().count();
+  if (!frames_.load(std::memory_order_relaxed)) {
+    first_frame_.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+    first_cpu_.store(cpu, std::memory_order_relaxed);
+  }
+  frames_.fetch_add(1, std::memory_order_relaxed);
+
+  FrameBuffer* buffer = pool_.take(static_cast<size_t>(size));
+  if (!buffer) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    std::memcpy(buffer->memory.get(), data, static_cast<size_t>(size));
+    buffer->width = info.nWidth;
+    buffer->height = info.nHeight;
+    buffer->stamp = info.nStamp;
+    buffer->number = info.dwFrameNum;
+    buffer->decoded = now;
+    buffer->size = static_cast<size_t>(size);
+    const Frame frame(buffer);
+    if (on_frame_) on_frame_(frame);
+  }
+
+  // The frame function included.
+  last_cpu_.store(thread_cpu_time().count(), std::memory_order_relaxed);
+  last_frame_.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+decoder_stats StreamDecoder::stats() const {
+  decoder_stats s{packets_.load(std::memory_order_relaxed),
+                  rejected_.load(std::memory_order_relaxed),
+                  frames_.load(std::memory_order_relaxed),
+                  dropped_.load(std::memory_order_relaxed),
+                  0.,
+                  std::chrono::nanoseconds(0)};
+  if (s.frames > 1) {
+    const std::chrono::steady_clock::duration elapsed(last_frame_.load(std::memory_order_relaxed) -
+                                                      first_frame_.load(std::memory_order_relaxed));
+    if (elapsed.count() > 0)
+      s.fps = (s.frames - 1) / std::chrono::duration<double>(elapsed).count();
+    s.cpu_per_frame = std::chrono::nanoseconds(
+        (last_cpu_.load(std::memory_order_relaxed) - first_cpu_.load(std::memory_order_relaxed)) /
+        static_cast<long long>(s.frames - 1));
+  }
+  return s;
+}
+
+void StreamDecoder::dump(std::ostream& out) const {
+  const auto flags = out.flags();
+  const auto precision = out.precision();
+  const auto s = stats();
+  out << std::left << std::setw(12) << name_ << std::right << std::setw(8) << s.frames
+      << " frames" << std::setw(7) << std::fixed << std::setprecision(1) << s.fps << " fps"
+      << std::setw(8) << std::setprecision(2) << s.cpu_per_frame.count() / 1e6
+      << " ms CPU/frame" << std::setw(6) << s.dropped << " dropped" << std::setw(6) << s.rejected
+      << " refused packets, " << pool_.footprint() / 1024 << " KiB of frames\n";
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}  // namespace app
\ No newline at end of file
@@ -0,0 +1,177 @@
+#ifndef DEF_STREAM_DECODER_H
+#define DEF_STREAM_DECODER_H
+
+#include "winheaders.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include "plaympeg4.h"
+
+#include "mpsc_ring.h"
+#include "stream_tap.h"
+
+namespace app {
+
+class FramePool;
+
+// A decoded picture, YV12: the Y plane, then the V and U planes at half the width and height.
+struct FrameBuffer {
+  std::atomic<unsigned> refs;
+  FramePool* pool;
+  uint32_t index;
+  std::unique_ptr<unsigned char[]> memory;
+  size_t capacity;
+
+  int width;
+  int height;
+  long stamp;  // of the stream, in ms
+  unsigned long number;
+  std::chrono::steady_clock::time_point decoded;
+  size_t size;
+};
+
+// A reference to a FrameBuffer, copied without copying the picture.
+class Frame {
+  FrameBuffer* buffer_ = nullptr;
+
+  void release();
+
+ public:
+  Frame() = default;
+  // Takes the reference the pool gave `buffer` with.
+  explicit Frame(FrameBuffer* buffer) : buffer_(buffer) {}
+  Frame(const Frame& other) : buffer_(other.buffer_) {
+    if (buffer_) buffer_->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  Frame(Frame&& other) noexcept : buffer_(other.buffer_) { other.buffer_ = nullptr; }
+  Frame& operator=(const Frame& other) {
+    if (other.buffer_) other.buffer_->refs.fetch_add(1, std::memory_order_relaxed);
+    release();
+    buffer_ = other.buffer_;
+    return *this;
+  }
+  Frame& operator=(Frame&& other) noexcept {
+    if (this != &other) {
+      release();
+      buffer_ = other.buffer_;
+      other.buffer_ = nullptr;
+    }
+    return *this;
+  }
+  ~Frame() { release(); }
+
+  explicit operator bool() const { return buffer_ != nullptr; }
+  int width() const { return buffer_->width; }
+  int height() const { return buffer_->height; }
+  long stamp() const { return buffer_->stamp; }
+  unsigned long number() const { return buffer_->number; }
+  std::chrono::steady_clock::time_point decoded() const { return buffer_->decoded; }
+  const unsigned char* data() const { return buffer_->memory.get(); }
+  size_t size() const { return buffer_->size; }
+};
+
+// The pictures of a decoder, `count` buffers sized by the first frames: a buffer grows when a
+// larger picture comes, and is never shrunk. The buffers come back from any thread, and are taken
+// by the decode thread only.
+class FramePool {
+ public:
+  static constexpr size_t count = 8;
+
+ private:
+  std::array<FrameBuffer, count> buffers_;
+  mpsc_ring<uint32_t, count, 0> free_;
+
+ public:
+  FramePool();
+  FramePool(const FramePool&) = delete;
+  FramePool& operator=(const FramePool&) = delete;
+
+  // A buffer of at least `size` bytes, with one reference, nullptr when all are in use.
+  FrameBuffer* take(size_t size);
+  void recycle(FrameBuffer* buffer);
+  // The bytes allocated.
+  size_t footprint() const;
+};
+
+struct decoder_stats {
+  unsigned long long packets;  // given to the decoder
+  unsigned long long rejected;  // the decoder kept refusing them
+  unsigned long long frames;
+  unsigned long long dropped;  // no free buffer
+  double fps;  // since the first frame
+  std::chrono::nanoseconds cpu_per_frame;  // of the decode thread
+};
+
+// The stream of a StreamTap decoded without a window: the packets are fed to a PlayM4 port in
+// real-time stream mode, played without a window, and each decoded picture copied into a frame of
+// the pool, then given to the frame function on the decode thread of the port. Frames the function
+// keeps are frames the decoder cannot reuse: a frame finding the pool empty is dropped. The port
+// is opened with the system header, the first packet of the stream.
+class StreamDecoder {
+ public:
+  // Given to PlayM4_OpenStream: enough for a few seconds of a main stream.
+  static constexpr DWORD stream_buffer = 4 << 20;
+  // PlayM4_InputData refuses packets while its buffer is full: retried every input_retry, given up
+  // after input_timeout.
+  static constexpr std::chrono::milliseconds input_retry{5};
+  static constexpr std::chrono::milliseconds input_timeout{1000};
+
+  using frame_function = std::function<void(const Frame&)>;
+
+ private:
+  std::string name_;
+  frame_function on_frame_;
+  FramePool pool_;
+  StreamConsumer consumer_;
+  StreamTap* tap_;
+  LONG port_;
+
+  std::atomic<unsigned long long> packets_;
+  std::atomic<unsigned long long> rejected_;
+  std::atomic<unsigned long long> frames_;
+  std::atomic<unsigned long long> dropped_;
+  std::atomic<std::chrono::steady_clock::rep> first_frame_;  // time since epoch, 0 before
+  std::atomic<std::chrono::steady_clock::rep> last_frame_;
+  std::atomic<std::chrono::nanoseconds::rep> first_cpu_;  // of the decode thread at those frames
+  std::atomic<std::chrono::nanoseconds::rep> last_cpu_;
+
+  // The decoder of each port, for the decode callback: its user value is a long, too short for a
+  // pointer on 64 bits.
+  static std::array<std::atomic<StreamDecoder*>, PLAYM4_MAX_SUPPORTS> decoders_;
+
+  bool open(const StreamPacket& header);
+  void close();
+  void input(const StreamPacket& packet);
+  void decoded(const char* data, long size, const FRAME_INFO& info);
+  static void CALLBACK decode_callback(long port, char* data, long size, FRAME_INFO* info,
+                                       long user, long reserved);
+
+ public:
+  StreamDecoder(std::string name, frame_function on_frame);
+  StreamDecoder(const StreamDecoder&) = delete;
+  StreamDecoder& operator=(const StreamDecoder&) = delete;
+  ~StreamDecoder();
+
+  const std::string& name() const { return name_; }
+
+  // Attaches to `tap`, before or while it streams.
+  bool start(StreamTap& tap);
+  // Detaches, then closes the port.
+  void stop();
+
+  decoder_stats stats() const;
+  // Its name, frames, frames per second, CPU time per frame and losses.
+  void dump(std::ostream& out) const;
+};
+
+}  // namespace app
+
+#endif
\ No newline at end of file
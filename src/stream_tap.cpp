@@ -0,0 +1,288 @@
+#include "stream_tap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+#include "metrics.h"
+#include "synchronized_ostream.h"
+
+namespace app {
+
+StreamTap stream_tap;
+
+/******************************************************************************\
+ *
+ *	StreamPacket
+ *
+ \******************************************************************************/
+
+void StreamPacket::release() {
+  if (buffer_ && buffer_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    buffer_->pool->recycle(buffer_);
+  buffer_ = nullptr;
+}
+
+/******************************************************************************\
+ *
+ *	StreamPool
+ *
+ \******************************************************************************/
+
+static_assert(StreamPool::classes[0].count <= StreamPool::max_count &&
+                  StreamPool::classes[1].count <= StreamPool::max_count &&
+                  StreamPool::classes[2].count <= StreamPool::max_count,
+              "A class has more buffers than its free list holds");
+
+void StreamPool::open() {
+  if (open_) return;
+  for (size_t s = 0; s < classes.size(); ++s) {
+    slab& sl = slabs_[s];
+    sl.memory.reset(new unsigned char[classes[s].size * classes[s].count]);
+    sl.buffers.reset(new StreamBuffer[classes[s].count]);
+    for (uint32_t i = 0; i < classes[s].count; ++i) {
+      StreamBuffer& b = sl.buffers[i];
+      b.refs.store(0, std::memory_order_relaxed);
+      b.pool = this;
+      b.slab = static_cast<uint32_t>(s);
+      b.index = i;
+      b.memory = sl.memory.get() + i * classes[s].size;
+      uint32_t index = i;
+      sl.free.push(index, OverflowPolicy::REJECT, std::chrono::steady_clock::time_point::max());
+    }
+  }
+  open_ = true;
+}
+
+void StreamPool::close() {
+  if (!open_) return;
+  open_ = false;
+  for (size_t s = 0; s < classes.size(); ++s) {
+    size_t free = 0;
+    for (uint32_t index; slabs_[s].free.pop(index);) ++free;
+    if (free != classes[s].count)
+      std::cerr << "StreamPool::close: " << classes[s].count - free << " buffers of "
+                << classes[s].size << " bytes still in use\n";
+    slabs_[s].buffers.reset();
+    slabs_[s].memory.reset();
+  }
+}
+
+StreamBuffer* StreamPool::take(size_t size) {
+  if (!open_) return nullptr;
+  for (size_t s = 0; s < classes.size(); ++s) {
+    uint32_t index;
+    if (classes[s].size < size || !slabs_[s].free.pop(index)) continue;
+    StreamBuffer* buffer = &slabs_[s].buffers[index];
+    buffer->refs.store(1, std::memory_order_relaxed);
+    return buffer;
+  }
+  return nullptr;
+}
+
+void StreamPool::recycle(StreamBuffer* buffer) {
+  uint32_t index = buffer->index;
+  slabs_[buffer->slab].free.push(index, OverflowPolicy::REJECT,
+                                 std::chrono::steady_clock::time_point::max());
+}
+
+size_t StreamPool::footprint() {
+  size_t bytes = 0;
+  for (const auto& c : classes) bytes += c.count * (c.size + sizeof(StreamBuffer));
+  return bytes;
+}
+
+/******************************************************************************\
+ *
+ *	StreamConsumer
+ *
+ \******************************************************************************/
+
+StreamConsumer::StreamConsumer(std::string name, StreamBackpressure policy, handler handle)
+    : name_(std::move(name)),
+      policy_(policy),
+      handle_(std::move(handle)),
+      resync_(false),
+      delivered_(0),
+      dropped_(0),
+      skipped_(0),
+      exit_(false) {}
+
+StreamConsumer::~StreamConsumer() { stop(); }
+
+void StreamConsumer::start() {
+  exit_ = false;
+  thread_ = std::thread([this]() { loop(); });
+}
+
+void StreamConsumer::stop() {
+  if (!thread_.joinable()) return;
+  exit_ = true;
+  ring_.wake_up();
+  thread_.join();
+}
+
+void StreamConsumer::loop() {
+  StreamPacket packet;
+  while (true) {
+    while (ring_.pop(packet)) {
+      handle_(packet);
+      packet = StreamPacket();
+      delivered_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (exit_) return;
+    ring_.wait(exit_);
+  }
+}
+
+void StreamConsumer::offer(const StreamPacket& packet) {
+  if (resync_ && packet.type() == NET_DVR_STREAMDATA) {
+    if (!packet.keyframe()) {
+      skipped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    resync_ = false;
+  }
+  StreamPacket copy(packet);
+  switch (ring_.push(copy,
+                     policy_ == StreamBackpressure::KEEP_LATEST ? OverflowPolicy::REPLACE_LATEST
+                                                                : OverflowPolicy::REJECT,
+                     std::chrono::steady_clock::time_point::max())) {
+    case SubmitResult::ACCEPTED:
+      break;
+    case SubmitResult::REPLACED:
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      break;
+    default:
+      gap();
+      break;
+  }
+}
+
+void StreamConsumer::gap() {
+  dropped_.fetch_add(1, std::memory_order_relaxed);
+  if (policy_ == StreamBackpressure::SKIP_TO_KEYFRAME) resync_ = true;
+}
+
+void StreamConsumer::dump(std::ostream& out) const {
+  const auto s = stats();
+  out << std::left << std::setw(16) << name_ << std::right << std::setw(10) << s.delivered
+      << " handled" << std::setw(8) << s.dropped << " dropped" << std::setw(8) << s.skipped
+      << " skipped\n";
+}
+
+/******************************************************************************\
+ *
+ *	StreamTap
+ *
+ \******************************************************************************/
+
+StreamTap::StreamTap()
+    : epoch_(0), sequence_(0), packets_(0), bytes_(0), exhausted_(0), oversize_(0) {
+  for (auto& c : consumers_) c.store(nullptr, std::memory_order_relaxed);
+}
+
+void StreamTap::open() { pool_.open(); }
+
+void StreamTap::close() {
+  {
+    std::lock_guard<std::mutex> lock(mx_);
+    header_ = StreamPacket();
+  }
+  pool_.close();
+}
+
+void CALLBACK StreamTap::callback(LONG real_play_handle, DWORD type, BYTE* buffer, DWORD size,
+                                  void* user) {
+  static_cast<StreamTap*>(user)->tap(type, buffer, size);
+}
+
+void StreamTap::tap(DWORD type, const unsigned char* data, size_t size) {
+  const auto now = std::chrono::steady_clock::now();
+  // Seen by detach() before the consumers are read.
+  epoch_.fetch_add(1, std::memory_order_seq_cst);
+  packets_.fetch_add(1, std::memory_order_relaxed);
+  bytes_.fetch_add(size, std::memory_order_relaxed);
+
+  StreamBuffer* buffer = pool_.take(size);
+  if (!buffer) {
+    (size > StreamPool::classes.back().size ? oversize_ : exhausted_)
+        .fetch_add(1, std::memory_order_relaxed);
+    ++sequence_;
+    gap();
+  } else {
+    std::memcpy(buffer->memory, data, size);
+    buffer->type = type;
+    buffer->keyframe = type == NET_DVR_STREAMDATA && keyframe(data, size);
+    buffer->sequence = sequence_++;
+    buffer->received = now;
+    buffer->size = size;
+    const StreamPacket packet(buffer);
+    const auto give = [this, &packet]() {
+      for (auto& slot : consumers_)
+        if (StreamConsumer* c = slot.load(std::memory_order_seq_cst)) c->offer(packet);
+    };
+    if (type == NET_DVR_SYSHEAD) {
+      // A consumer attached meanwhile gets it once: from attach() or from here.
+      std::lock_guard<std::mutex> lock(mx_);
+      header_ = packet;
+      give();
+    } else {
+      give();
+    }
+  }
+
+  epoch_.fetch_add(1, std::memory_order_seq_cst);
+  metrics::record(metrics::operation::STREAM_TAP, std::chrono::steady_clock::now() - now);
+}
+
+void StreamTap::gap() {
+  for (auto& slot : consumers_)
+    if (StreamConsumer* c = slot.load(std::memory_order_seq_cst)) c->gap();
+}
+
+bool StreamTap::attach(StreamConsumer& consumer) {
+  std::lock_guard<std::mutex> lock(mx_);
+  for (auto& slot : consumers_) {
+    if (slot.load(std::memory_order_relaxed)) continue;
+    consumer.resync_ = consumer.policy() == StreamBackpressure::SKIP_TO_KEYFRAME;
+    if (header_) consumer.offer(header_);
+    slot.store(&consumer, std::memory_order_seq_cst);
+    clog.log("StreamTap::attach: ", consumer.name());
+    return true;
+  }
+  std::cerr << "Could not attach " << consumer.name() << " to the stream: " << max_consumers
+            << " consumers already\n";
+  return false;
+}
+
+void StreamTap::detach(StreamConsumer& consumer) {
+  {
+    std::lock_guard<std::mutex> lock(mx_);
+    for (auto& slot : consumers_)
+      if (slot.load(std::memory_order_relaxed) == &consumer)
+        slot.store(nullptr, std::memory_order_seq_cst);
+  }
+  // A packet given out while the slot was cleared may still be on its way to the consumer.
+  const auto epoch = epoch_.load(std::memory_order_seq_cst);
+  if (epoch % 2)
+    while (epoch_.load(std::memory_order_seq_cst) == epoch) std::this_thread::yield();
+  clog.log("StreamTap::detach: ", consumer.name());
+}
+
+bool StreamTap::keyframe(const unsigned char* data, size_t size) {
+  const size_t end = std::min(size, keyframe_window);
+  for (size_t i = 0; i + 4 <= end; ++i)
+    if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1 && data[i + 3] == 0xBB) return true;
+  return false;
+}
+
+void StreamTap::dump(std::ostream& out) const {
+  const auto s = stats();
+  out << "Stream: " << s.packets << " packets, " << s.bytes / 1024 << " KiB, " << s.exhausted
+      << " lost for want of a buffer, " << s.oversize << " larger than "
+      << StreamPool::classes.back().size / 1024 << " KiB\n";
+}
+
+}  // namespace app
\ No newline at end of file
@@ -0,0 +1,257 @@
+#ifndef DEF_STREAM_TAP_H
+#define DEF_STREAM_TAP_H
+
+#include "winheaders.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#include "HCNetSDK.h"
+
+#include "mpsc_ring.h"
+
+namespace app {
+
+class StreamPool;
+
+// A packet of the stream as the SDK gave it, copied once into a buffer of the pool. Shared by every
+// consumer it was given to: the buffer goes back to the pool with its last reference.
+struct StreamBuffer {
+  std::atomic<unsigned> refs;
+  StreamPool* pool;
+  uint32_t slab;
+  uint32_t index;
+  unsigned char* memory;
+
+  DWORD type;  // NET_DVR_SYSHEAD, NET_DVR_STREAMDATA...
+  bool keyframe;
+  uint64_t sequence;  // of the packets tapped, from 0
+  std::chrono::steady_clock::time_point received;
+  size_t size;
+};
+
+// A reference to a StreamBuffer, copied without copying the data.
+class StreamPacket {
+  StreamBuffer* buffer_ = nullptr;
+
+  void release();
+
+ public:
+  StreamPacket() = default;
+  // Takes the reference the pool gave `buffer` with.
+  explicit StreamPacket(StreamBuffer* buffer) : buffer_(buffer) {}
+  StreamPacket(const StreamPacket& other) : buffer_(other.buffer_) {
+    if (buffer_) buffer_->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  StreamPacket(StreamPacket&& other) noexcept : buffer_(other.buffer_) { other.buffer_ = nullptr; }
+  StreamPacket& operator=(const StreamPacket& other) {
+    if (other.buffer_) other.buffer_->refs.fetch_add(1, std::memory_order_relaxed);
+    release();
+    buffer_ = other.buffer_;
+    return *this;
+  }
+  StreamPacket& operator=(StreamPacket&& other) noexcept {
+    if (this != &other) {
+      release();
+      buffer_ = other.buffer_;
+      other.buffer_ = nullptr;
+    }
+    return *this;
+  }
+  ~StreamPacket() { release(); }
+
+  explicit operator bool() const { return buffer_ != nullptr; }
+  DWORD type() const { return buffer_->type; }
+  bool keyframe() const { return buffer_->keyframe; }
+  uint64_t sequence() const { return buffer_->sequence; }
+  std::chrono::steady_clock::time_point received() const { return buffer_->received; }
+  const unsigned char* data() const { return buffer_->memory; }
+  size_t size() const { return buffer_->size; }
+};
+
+// The buffers of the packets, allocated once: a slab per size class, a packet taking a buffer of
+// the smallest class it fits in, or of a larger one when those are all in use. The buffers come
+// back from any thread, and are taken by the tap thread only.
+class StreamPool {
+ public:
+  struct size_class {
+    size_t size;
+    size_t count;
+  };
+
+  // Most packets are P frames of a few KiB, an I frame of a 4 MP camera is a few hundred: 20 MiB.
+  // The consumers share the packets, but those falling behind each keep packets of their own in
+  // their ring: the buffers cover the full rings of four consumers, a keyframe in fifty packets.
+  static constexpr std::array<size_class, 3> classes = {
+      {{16 << 10, 512}, {256 << 10, 32}, {1 << 20, 4}}};
+  static constexpr size_t max_count = 512;  // of a class
+
+ private:
+  struct slab {
+    std::unique_ptr<unsigned char[]> memory;
+    std::unique_ptr<StreamBuffer[]> buffers;
+    mpsc_ring<uint32_t, max_count, 0> free;
+  };
+
+  std::array<slab, classes.size()> slabs_;
+  bool open_ = false;
+
+ public:
+  StreamPool() = default;
+  StreamPool(const StreamPool&) = delete;
+  StreamPool& operator=(const StreamPool&) = delete;
+
+  void open();
+  bool is_open() const { return open_; }
+  // Every packet must have been released.
+  void close();
+
+  // A buffer of at least `size` bytes, with one reference, nullptr when none is free.
+  StreamBuffer* take(size_t size);
+  void recycle(StreamBuffer* buffer);
+  // The bytes allocated.
+  static size_t footprint();
+};
+
+// What a consumer gets when it falls behind.
+enum class StreamBackpressure {
+  DROP_NEWEST,      // packets finding its ring full are dropped: analytics
+  KEEP_LATEST,      // the latest of those replaces the previous one: snapshots
+  SKIP_TO_KEYFRAME  // dropped, then nothing until the next keyframe: recording, restreaming
+};
+
+struct stream_consumer_stats {
+  unsigned long long delivered;
+  unsigned long long dropped;  // its ring full, or the packet lost before the tap
+  unsigned long long skipped;  // waiting for a keyframe
+};
+
+// A thread of its own given the packets of the tap in order, behind a ring: a slow consumer only
+// loses packets of its own, as its backpressure policy says. A SKIP_TO_KEYFRAME consumer starts at
+// a keyframe, after the system header of the stream.
+class StreamConsumer {
+ public:
+  static constexpr size_t capacity = 128;
+
+  using handler = std::function<void(const StreamPacket&)>;
+
+ private:
+  std::string name_;
+  StreamBackpressure policy_;
+  handler handle_;
+  mpsc_ring<StreamPacket, capacity> ring_;
+  bool resync_;  // tap thread only, once attached
+  std::atomic<unsigned long long> delivered_;
+  std::atomic<unsigned long long> dropped_;
+  std::atomic<unsigned long long> skipped_;
+  std::atomic<bool> exit_;
+  std::thread thread_;
+
+  void loop();
+
+  friend class StreamTap;
+  // From the tap thread.
+  void offer(const StreamPacket& packet);
+  // Packets were lost before the tap could give them.
+  void gap();
+
+ public:
+  StreamConsumer(std::string name, StreamBackpressure policy, handler handle);
+  StreamConsumer(const StreamConsumer&) = delete;
+  StreamConsumer& operator=(const StreamConsumer&) = delete;
+  ~StreamConsumer();
+
+  const std::string& name() const { return name_; }
+  StreamBackpressure policy() const { return policy_; }
+
+  void start();
+  // Once detached: handles what its ring holds, then joins its thread.
+  void stop();
+
+  stream_consumer_stats stats() const {
+    return {delivered_.load(std::memory_order_relaxed), dropped_.load(std::memory_order_relaxed),
+            skipped_.load(std::memory_order_relaxed)};
+  }
+  // Its name, the packets handled, dropped and skipped.
+  void dump(std::ostream& out) const;
+};
+
+struct stream_tap_stats {
+  unsigned long long packets;
+  unsigned long long bytes;
+  unsigned long long exhausted;  // dropped for want of a free buffer
+  unsigned long long oversize;   // larger than the largest buffer
+};
+
+// The encoded stream of NET_DVR_RealPlay_V40, given to its REALDATACALLBACK: each packet is copied
+// once into a buffer of the pool, then given to every consumer attached, a reference each. The
+// SDK thread never takes a lock nor waits for a consumer, except to keep the system header, once
+// per stream. Consumers are attached and detached from any thread, while the stream runs.
+class StreamTap {
+ public:
+  static constexpr size_t max_consumers = 8;
+  // A system header (0x000001BB) in this many first bytes of a packet of the PS stream marks an I
+  // frame: the camera sends it before each one.
+  static constexpr size_t keyframe_window = 64;
+
+ private:
+  StreamPool pool_;
+  std::array<std::atomic<StreamConsumer*>, max_consumers> consumers_;
+  std::atomic<unsigned long long> epoch_;  // odd while a packet is given out
+
+  std::mutex mx_;  // attaching, and the header
+  StreamPacket header_;
+
+  uint64_t sequence_;
+  std::atomic<unsigned long long> packets_;
+  std::atomic<unsigned long long> bytes_;
+  std::atomic<unsigned long long> exhausted_;
+  std::atomic<unsigned long long> oversize_;
+
+  // Every consumer is about to lose a packet.
+  void gap();
+
+ public:
+  StreamTap();
+  StreamTap(const StreamTap&) = delete;
+  StreamTap& operator=(const StreamTap&) = delete;
+
+  // Allocates the pool, before the stream starts.
+  void open();
+  // Once the stream stopped and the consumers are detached.
+  void close();
+
+  static void CALLBACK callback(LONG real_play_handle, DWORD type, BYTE* buffer, DWORD size,
+                                void* user);
+  // What callback() does, from a single thread.
+  void tap(DWORD type, const unsigned char* data, size_t size);
+
+  // False when max_consumers are attached already.
+  bool attach(StreamConsumer& consumer);
+  // Returns once the tap no longer gives the consumer any packet.
+  void detach(StreamConsumer& consumer);
+
+  static bool keyframe(const unsigned char* data, size_t size);
+
+  stream_tap_stats stats() const {
+    return {packets_.load(std::memory_order_relaxed), bytes_.load(std::memory_order_relaxed),
+            exhausted_.load(std::memory_order_relaxed), oversize_.load(std::memory_order_relaxed)};
+  }
+  // The packets tapped, and those lost.
+  void dump(std::ostream& out) const;
+};
+
+extern StreamTap stream_tap;
+
+}  // namespace app
+
+#endif
\ No newline at end of file
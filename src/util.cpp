@@ -34,15 +34,17 @@ std::string timeNow() {
   return ret.substr(0, ret.size() - 6) + ':' + pad;
 }
 
-// yyyy-MM-dd-hh_hh-MM-SS
+// yyyy-MM-dd_hh-mm-ss, zero-padded for the names to sort as the times
 std::string get_current_time() {
-  namespace po = boost::program_options;
   namespace pt = boost::posix_time;
-  namespace gr = boost::gregorian;
   const auto current_time = pt::ptime(pt::second_clock::local_time());
+  const auto date = current_time.date();
+  const auto time = current_time.time_of_day();
   std::stringstream ss;
-  ss << current_time.date().year() << '-' << current_time.date().month().as_number() << '-' << current_time.date().day() << '_'
-     << current_time.time_of_day().hours() << '-' << current_time.time_of_day().minutes() << '-' << current_time.time_of_day().seconds();
+  ss << std::setfill('0') << std::setw(4) << date.year() << '-' << std::setw(2)
+     << date.month().as_number() << '-' << std::setw(2) << date.day() << '_' << std::setw(2)
+     << time.hours() << '-' << std::setw(2) << time.minutes() << '-' << std::setw(2)
+     << time.seconds();
 
   return ss.str();
 }
@@ -151,6 +153,17 @@ bool ping(const char* src, int repeat) {
   return true;
 }
 
+std::chrono::nanoseconds thread_cpu_time() {
+  FILETIME creation, exit, kernel, user;
+  if (!::GetThreadTimes(::GetCurrentThread(), &creation, &exit, &kernel, &user))
+    return std::chrono::nanoseconds(0);
+  // In 100 ns units.
+  const auto ticks = [](const FILETIME& t) {
+    return (static_cast<uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime;
+  };
+  return std::chrono::nanoseconds((ticks(kernel) + ticks(user)) * 100);
+}
+
 float translate_interval(float val, float a1, float b1, float a2, float b2) {
   const auto x = (b2 - b1) / (a2 - a1);
   const auto y = b1 - x * a1;
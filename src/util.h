@@ -2,6 +2,7 @@
 #define DEF_UTIL_H
 
 
+#include <chrono>
 #include <string>
 #include <cstdint>
 
@@ -13,7 +14,7 @@ namespace app {
 
 std::string timeNow();
 
-std::string get_current_time(); // yyyy-MM-dd-hh_hh-MM-SS
+std::string get_current_time(); // yyyy-MM-dd_hh-mm-ss
 
 std::pair<int, int> getConfigResolution(BYTE resolution);
 std::pair<int, int> getConfigResolution(const NET_DVR_COMPRESSIONCFG_V30& config);
@@ -24,6 +25,8 @@ uint16_t int_to_hex(int n);
 std::string winErrorStr(DWORD errorMessageID);
 std::string message2str(UINT message);
 bool ping(const char* src, int repeat=1);
+// CPU time (user and kernel) used so far by the calling thread.
+std::chrono::nanoseconds thread_cpu_time();
 
 template<typename T>
 void SafeRelease(T **ppT)
@@ -36,23 +39,6 @@ void SafeRelease(T **ppT)
 }
 
 
-template<typename Function>
-constexpr std::string get_function_name(Function f)
-{
-    void* g = reinterpret_cast<void*>(f);
-
-    if (g == reinterpret_cast<void*>(ping)) return "ping";
-
-    if (g == reinterpret_cast<void*>(::NET_DVR_Login_V40)) return "Login";
-    if (g == reinterpret_cast<void*>(::NET_DVR_Logout)) return "Logout";
-    if (g == reinterpret_cast<void*>(::NET_DVR_GetDVRConfig)) return "GetDVRConfig";
-    if (g == reinterpret_cast<void*>(::NET_DVR_SetDVRConfig)) return "SetDVRConfig";
-    if (g == reinterpret_cast<void*>(::NET_DVR_GetDeviceConfig)) return "GetDeviceConfig";
-    
-    return "undefined";
-}
-
-
 float translate_interval(float val, float a1, float b1, float a2, float b2);
 
 }
@@ -13,6 +13,12 @@ namespace app {
 const BGWindow* MainWindow::BackgroundWindow() const { return this->m_bgwin; }
 BGWindow*& MainWindow::BackgroundWindow() { return this->m_bgwin; }
 
+void MainWindow::SetBox(const RECT& box)
+{
+    m_box = box;
+    ::InvalidateRect(this->Window(), nullptr, false);
+}
+
 void MainWindow::OnPaint()
 {
     PAINTSTRUCT ps;
@@ -41,6 +47,12 @@ void MainWindow::OnPaint()
                 ::SetPixel(memDC, x_start+j, y_start+i, RGB(r, g, b));
         }
     }
+    if (!::IsRectEmpty(&m_box))
+    {
+        HBRUSH box_brush = ::CreateSolidBrush(RGB(0, 0xff, 0));
+        ::FrameRect(memDC, &m_box, box_brush);
+        ::DeleteObject(box_brush);
+    }
     ::BitBlt(hdc, 0, 0, rc.right-rc.left, rc.bottom-rc.top, memDC, 0, 0, SRCCOPY);
     ::SelectObject(memDC, oldmap);
     ::DeleteObject(bmp);
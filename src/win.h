@@ -19,6 +19,7 @@ class BGWindow;
 class MainWindow : public BaseWindow<MainWindow>
 {
     BGWindow* m_bgwin;
+    RECT m_box = {};
     
     void OnPaint();
  
@@ -28,6 +29,9 @@ class MainWindow : public BaseWindow<MainWindow>
 
     const BGWindow* BackgroundWindow() const;
     BGWindow*& BackgroundWindow();
+
+    // Outlines `box` over the video, nothing when it is empty.
+    void SetBox(const RECT& box);
     
     const char* ClassName() const { return "Drawing Window"; }
 